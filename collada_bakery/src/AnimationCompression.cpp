@@ -0,0 +1,343 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "AnimationCompression.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace ColladaBakery;
+
+using rtr_format::Animation_Sampler;
+
+namespace {
+
+    //Number of samples taken from each original segment to measure the 
+    //error of a refitted segment
+    const int kSamplesPerSegment = 8;
+
+    //Copy of a time/data sampler pair, data is stored component by 
+    //component as in rtr_format
+    struct Curve {
+        int segment_count;
+        int components;
+        vector<float> time;
+        vector<float> data;
+
+        const float* time_segment(int segment) const {
+            return &time[segment * 3];
+        }
+
+        const float* data_segment(int component, int segment) const {
+            return &data[component * (segment_count * 3 + 1) + segment * 3];
+        }
+    };
+
+    float eval_bezier(const float* p, float t) {
+        float s = 1.0f - t;
+        return s*s*s*p[0] + 3.0f*s*s*t*p[1] + 3.0f*s*t*t*p[2] + t*t*t*p[3];
+    }
+
+    //Fits the original segments [first, last) with a single segment with
+    //evenly spaced time control points. The inner data control points are
+    //chosen by least squares, the end points are kept. Returns false if the
+    //error exceeds the tolerance of any component.
+    bool fit_span(const Curve& curve, int first, int last,
+                  const vector<float>& tolerances,
+                  float* time_cp, vector<float>& data_cp) {
+
+        float x0 = curve.time_segment(first)[0];
+        float x3 = curve.time_segment(last - 1)[3];
+        float duration = x3 - x0;
+
+        if (duration <= 0.0f)
+            return false;
+
+        int components = curve.components;
+
+        //sample the original curve, values are stored sample by sample
+        vector<float> u;
+        vector<float> values;
+
+        for (int s = first; s < last; ++s) {
+            int sample_count = (s == last - 1) ? kSamplesPerSegment + 1 : 
+                                                 kSamplesPerSegment;
+            for (int k = 0; k < sample_count; ++k) {
+                float t = float(k) / kSamplesPerSegment;
+                float x = eval_bezier(curve.time_segment(s), t);
+
+                u.push_back(glm::clamp((x - x0) / duration, 0.0f, 1.0f));
+
+                for (int c = 0; c < components; ++c) {
+                    values.push_back(eval_bezier(curve.data_segment(c, s), t));
+                }
+            }
+        }
+
+        size_t n = u.size();
+
+        double a11 = 0.0, a12 = 0.0, a22 = 0.0;
+        for (size_t k = 0; k < n; ++k) {
+            double s = 1.0 - u[k];
+            double b1 = 3.0 * s * s * u[k];
+            double b2 = 3.0 * s * u[k] * u[k];
+            a11 += b1 * b1;
+            a12 += b1 * b2;
+            a22 += b2 * b2;
+        }
+
+        double det = a11 * a22 - a12 * a12;
+
+        time_cp[0] = x0;
+        time_cp[1] = x0 + duration / 3.0f;
+        time_cp[2] = x0 + duration * 2.0f / 3.0f;
+        time_cp[3] = x3;
+
+        data_cp.resize(components * 4);
+
+        for (int c = 0; c < components; ++c) {
+            float* p = &data_cp[c * 4];
+
+            p[0] = values[c];
+            p[3] = values[(n - 1) * components + c];
+
+            if (std::fabs(det) < 1e-12) {
+                p[1] = p[0] + (p[3] - p[0]) / 3.0f;
+                p[2] = p[0] + (p[3] - p[0]) * 2.0f / 3.0f;
+            } else {
+                double r1 = 0.0, r2 = 0.0;
+                for (size_t k = 0; k < n; ++k) {
+                    double s = 1.0 - u[k];
+                    double b0 = s * s * s;
+                    double b1 = 3.0 * s * s * u[k];
+                    double b2 = 3.0 * s * u[k] * u[k];
+                    double b3 = u[k] * u[k] * u[k];
+                    double r = values[k * components + c] - b0 * p[0] - 
+                               b3 * p[3];
+                    r1 += b1 * r;
+                    r2 += b2 * r;
+                }
+
+                p[1] = float((a22 * r1 - a12 * r2) / det);
+                p[2] = float((a11 * r2 - a12 * r1) / det);
+            }
+
+            for (size_t k = 0; k < n; ++k) {
+                float error = eval_bezier(p, u[k]) - values[k * components + c];
+                if (std::fabs(error) > tolerances[c])
+                    return false;
+            }
+        }
+
+        return true;
+    }
+
+    void append_segment(const float* time_cp, const vector<float>& data_cp,
+                        vector<float>& out_time, 
+                        vector< vector<float> >& out_data) {
+
+        out_time.insert(out_time.end(), time_cp + 1, time_cp + 4);
+
+        for (size_t c = 0; c < out_data.size(); ++c) {
+            out_data[c].insert(out_data[c].end(), 
+                               data_cp.begin() + c * 4 + 1,
+                               data_cp.begin() + c * 4 + 4);
+        }
+    }
+}
+
+bool AnimationCompression::reduce_segments(Animation_Sampler& time_sampler,
+                                           Animation_Sampler& data_sampler,
+                                           float tolerance) {
+
+    if (time_sampler.encoding() != Animation_Sampler::FLOAT ||
+        data_sampler.encoding() != Animation_Sampler::FLOAT) {
+        cout << "Error: Cannot reduce quantized animation samplers." << endl;
+        return false;
+    }
+
+    int segment_count = data_sampler.segment_count();
+    int components = data_sampler.components();
+    int block = segment_count * 3 + 1;
+
+    if (time_sampler.components() != 1 || 
+        time_sampler.segment_count() != segment_count ||
+        time_sampler.control_point_size() != block ||
+        data_sampler.control_point_size() != block * components) {
+        cout << "Error: Time and data sampler do not match." << endl;
+        return false;
+    }
+
+    if (tolerance <= 0.0f || segment_count < 2)
+        return true;
+
+    Curve curve;
+    curve.segment_count = segment_count;
+    curve.components = components;
+    curve.time.assign(time_sampler.control_point().begin(),
+                      time_sampler.control_point().end());
+    curve.data.assign(data_sampler.control_point().begin(),
+                      data_sampler.control_point().end());
+
+    //tolerance is relative to the value range of each component, but never
+    //below float precision of the values
+    vector<float> tolerances(components);
+    for (int c = 0; c < components; ++c) {
+        const float* first = &curve.data[c * block];
+        float min_value = *std::min_element(first, first + block);
+        float max_value = *std::max_element(first, first + block);
+        float magnitude = std::max(std::fabs(min_value), std::fabs(max_value));
+
+        tolerances[c] = std::max(tolerance * (max_value - min_value),
+                                 std::max(magnitude * 1e-6f, 1e-6f));
+    }
+
+    vector<float> out_time(1, curve.time[0]);
+    vector< vector<float> > out_data(components);
+    for (int c = 0; c < components; ++c) {
+        out_data[c].push_back(curve.data[c * block]);
+    }
+
+    float time_cp[4];
+    vector<float> data_cp;
+
+    int first = 0;
+    while (first < segment_count) {
+
+        //hard cuts end a run of segments that can be merged
+        int run_end = first;
+        while (run_end < segment_count && 
+               curve.time_segment(run_end)[3] > curve.time_segment(run_end)[0])
+            ++run_end;
+
+        if (run_end == first || 
+            !fit_span(curve, first, first + 1, tolerances, time_cp, data_cp)) {
+            //keep the original segment
+            const float* t = curve.time_segment(first);
+            out_time.insert(out_time.end(), t + 1, t + 4);
+            for (int c = 0; c < components; ++c) {
+                const float* d = curve.data_segment(c, first);
+                out_data[c].insert(out_data[c].end(), d + 1, d + 4);
+            }
+            ++first;
+            continue;
+        }
+
+        //grow the span exponentially, then narrow down the last segment 
+        //count that still fits
+        int good = first + 1;
+        int bad = -1;
+        int step = 1;
+
+        while (good < run_end) {
+            int next = std::min(good + step, run_end);
+            if (fit_span(curve, first, next, tolerances, time_cp, data_cp)) {
+                good = next;
+                step *= 2;
+            } else {
+                bad = next;
+                break;
+            }
+        }
+
+        if (bad != -1) {
+            while (bad - good > 1) {
+                int mid = (good + bad) / 2;
+                if (fit_span(curve, first, mid, tolerances, time_cp, data_cp))
+                    good = mid;
+                else
+                    bad = mid;
+            }
+        }
+
+        fit_span(curve, first, good, tolerances, time_cp, data_cp);
+        append_segment(time_cp, data_cp, out_time, out_data);
+
+        first = good;
+    }
+
+    int out_segment_count = int(out_time.size() - 1) / 3;
+
+    if (out_segment_count >= segment_count)
+        return true;
+
+    time_sampler.clear_control_point();
+    for (size_t i = 0; i < out_time.size(); ++i) {
+        time_sampler.add_control_point(out_time[i]);
+    }
+
+    data_sampler.clear_control_point();
+    for (int c = 0; c < components; ++c) {
+        for (size_t i = 0; i < out_data[c].size(); ++i) {
+            data_sampler.add_control_point(out_data[c][i]);
+        }
+    }
+
+    time_sampler.set_segment_count(out_segment_count);
+    data_sampler.set_segment_count(out_segment_count);
+
+    return true;
+}
+
+void AnimationCompression::quantize(Animation_Sampler& sampler) {
+
+    if (sampler.encoding() == Animation_Sampler::QUANTIZED_16)
+        return;
+
+    int components = sampler.components();
+    int block = sampler.segment_count() * 3 + 1;
+
+    if (sampler.control_point_size() != block * components) {
+        cout << "Error: Cannot quantize sampler '" << sampler.id() 
+             << "' with unexpected control point count." << endl;
+        return;
+    }
+
+    const float* points = sampler.control_point().data();
+
+    string bytes(size_t(block) * components * 2, '\0');
+
+    for (int c = 0; c < components; ++c) {
+        const float* first = points + c * block;
+        float min_value = *std::min_element(first, first + block);
+        float max_value = *std::max_element(first, first + block);
+        float scale = (max_value - min_value) / 65535.0f;
+
+        sampler.add_quantization_min(min_value);
+        sampler.add_quantization_scale(scale);
+
+        for (int i = 0; i < block; ++i) {
+            int q = 0;
+            if (scale > 0.0f) {
+                q = int((first[i] - min_value) / scale + 0.5f);
+                q = glm::clamp(q, 0, 65535);
+            }
+
+            size_t idx = (size_t(c) * block + i) * 2;
+            bytes[idx] = char(q & 0xff);
+            bytes[idx + 1] = char(q >> 8);
+        }
+    }
+
+    sampler.clear_control_point();
+    sampler.set_quantized_control_point(bytes);
+    sampler.set_encoding(Animation_Sampler::QUANTIZED_16);
+}
@@ -0,0 +1,54 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef __CB_ANIMATION_COMPRESSION_H
+#define __CB_ANIMATION_COMPRESSION_H
+
+#include "cbcommon.h"
+
+#include "rtr_format.pb.h"
+
+/**
+ * Size reduction of baked animation curves.
+ *
+ * reduce_segments refits a pair of time/data samplers (as written by the
+ * AnimationProcessor) with as few Bezier segments as possible, such that the
+ * refitted curve deviates from the original by at most the given tolerance
+ * (relative to the value range of each data component). Zero-length segments
+ * (hard cuts inserted for STEP interpolation) are kept as they are.
+ *
+ * quantize converts the control points of a sampler to the QUANTIZED_16
+ * encoding with per-component value ranges.
+ */
+namespace ColladaBakery { namespace AnimationCompression {
+
+    //Refits the segments of time_sampler and data_sampler in-place. Returns
+    //false if the samplers do not match.
+    bool reduce_segments(rtr_format::Animation_Sampler& time_sampler,
+                         rtr_format::Animation_Sampler& data_sampler,
+                         float tolerance);
+
+    //Stores the control points of sampler as 16-bit values
+    void quantize(rtr_format::Animation_Sampler& sampler);
+
+} }
+
+#endif //__CB_ANIMATION_COMPRESSION_H
@@ -24,6 +24,7 @@
 #include "Baker.h"
 
 #include "Utils.h"
+#include "AnimationCompression.h"
 
 #include "common_const.h"
 
@@ -620,6 +621,8 @@ bool AnimationProcessor::post_process() {
         }
     }
 
+    compress_curves();
+
     //finally bake out the animation
     bool b = _baker->write_baked(_rtr_anim.id(), &_rtr_anim);
     if (!b)
@@ -666,6 +669,36 @@ void AnimationProcessor::transpose_mat_output() {
     _output_is_transposed = !_output_is_transposed;
 }
 
+void AnimationProcessor::compress_curves() {
+
+    int segments_before = _rtr_output_sampler->segment_count();
+    int size_before = _rtr_anim.ByteSize();
+
+    //Refit the curves with a minimal number of segments, this also removes
+    //the segments inserted for LINEAR and STEP interpolation and the dense
+    //per-frame keys of baked exports where possible
+    if (!AnimationCompression::reduce_segments(*_rtr_input_sampler, 
+                                               *_rtr_output_sampler,
+                                         bakery_config.animation_tolerance()))
+    {
+        cout << "Warning: Could not reduce segments of animation " 
+             << _rtr_anim.id() << "." << endl;
+    }
+
+    //Time control points are kept at full precision, the player inverts
+    //them to find the curve parameter
+    if (bakery_config.animation_quantization())
+        AnimationCompression::quantize(*_rtr_output_sampler);
+
+    int size_after = _rtr_anim.ByteSize();
+
+    cout << "Animation '" << _rtr_anim.id() << "': " 
+         << segments_before << " -> " << _rtr_output_sampler->segment_count()
+         << " segments, " << size_before << " -> " << size_after 
+         << " bytes (ratio " << float(size_before) / std::max(size_after, 1)
+         << ":1)." << endl;
+}
+
 void AnimationProcessor::insert_step_interpolation(const CF::AnimationCurve * c_anim_curve,
                                                    vector<CF::AnimationCurve::InterpolationType>& interpolation_types)
 {
@@ -53,6 +53,8 @@ namespace ColladaBakery {
 
         void transpose_mat_output();
 
+        void compress_curves();
+
         void insert_step_interpolation(const CF::AnimationCurve * c_anim_curve,
                                        vector<CF::AnimationCurve::InterpolationType>& interpolation_types);
 
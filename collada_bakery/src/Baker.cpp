@@ -35,6 +35,9 @@
 #include "MaterialProcessor.h"
 #include "EffectProcessor.h"
 #include "ImageProcessor.h"
+#include "SkinProcessor.h"
+#include "ControllerProcessor.h"
+#include "TextureBaker.h"
 
 #include "common_const.h"
 
@@ -165,34 +168,55 @@ bool Baker::copy_images() {
         }
     }
 
+    //The source images are always copied, the player falls back to them if
+    //baked textures are disabled or can't be used
     StringPair::const_iterator it;
     for (it = _images.begin(); it != _images.end(); ++it) {
-        string src = it->first;
-        string dst = _bake_file_dir + it->second;
+        if (!copy_image(it->first, _bake_file_dir + it->second))
+            return false;
+    }
 
-        //TODO: we might copy large files more efficiently by copying 
-        //subsequent blocks (or stream it)
-        int64_t src_size = 0;
-        char * src_data = kc::File::read_file(src, &src_size);
+    if (bakery_config.bake_textures()) {
+        //Transcode into GPU-ready containers next to the copies, images the
+        //texture baker could not handle are only available as copies
+        TextureBaker texture_baker(bakery_config.texture_bake_threads(),
+                                   bakery_config.texture_compression(),
+                                   bakery_config.texture_compression_compare());
 
-        if (src_data == NULL) {
-            cout << "Error: Could not read file " << src << endl;
-            return false;
+        for (it = _images.begin(); it != _images.end(); ++it) {
+            texture_baker.add(it->first, _bake_file_dir + it->second);
         }
 
-        bool b = kc::File::write_file(dst, src_data, src_size);
+        texture_baker.run();
+    }
+
+    return true;
+}
 
-        delete[] src_data;
+bool Baker::copy_image(const string& src, const string& dst) {
 
-        if (!b) {
-            cout << "Error: Could not write to file " << dst 
-                 << endl;
-            return false;
-        }
-        
-        cout << "Copy: '" << src << "' -> '" << dst << "'." << endl;
+    //TODO: we might copy large files more efficiently by copying 
+    //subsequent blocks (or stream it)
+    int64_t src_size = 0;
+    char * src_data = kc::File::read_file(src, &src_size);
+
+    if (src_data == NULL) {
+        cout << "Error: Could not read file " << src << endl;
+        return false;
     }
 
+    bool b = kc::File::write_file(dst, src_data, src_size);
+
+    delete[] src_data;
+
+    if (!b) {
+        cout << "Error: Could not write to file " << dst 
+             << endl;
+        return false;
+    }
+    
+    cout << "Copy: '" << src << "' -> '" << dst << "'." << endl;
+
     return true;
 }
 
@@ -230,12 +254,7 @@ void Baker::post_process() {
                  << " was not found." << endl;
             fail();
         } else {
-            bool b = _bake_db.set(rtr::kStartupSceneID(), it->second.id);
-            if (!b) {
-                cout << "Error: could not write key " << rtr::kStartupSceneID
-                     << "." << endl;
-                fail();
-            }
+            _records[rtr::kStartupSceneID()] = it->second.id;
         }
     } else {
         //just take the first scene in cache
@@ -245,12 +264,7 @@ void Baker::post_process() {
         } else {
             string scene_id = _cache.scenes.begin()->second.id;
 
-            bool b = _bake_db.set(rtr::kStartupSceneID(), scene_id);
-            if (!b) {
-                cout << "Error: could not write key " << rtr::kStartupSceneID
-                     << "." << endl;
-                fail();
-            }
+            _records[rtr::kStartupSceneID()] = scene_id;
         }
     }
 
@@ -325,50 +339,113 @@ bool Baker::open_db() {
         old_file = new_filename;
     }
 
-    //use compression
-    if (bakery_config.db_compression()) {
+    if (!_db_codec.parse(bakery_config.db_codec())) {
+        cerr << "Unknown DB codec '" << bakery_config.db_codec() << "'. "
+             << "Use none, lz4, zlib or zlib:<1-9>." << endl;
+        return false;
+    }
+
+    if (!bakery_config.db_compression()) {
+        _db_codec = rtr::DBCodec(rtr::DB_CODEC_NONE, 0);
+    }
+
+    //The DB file itself is created in close_db(), when we know how many
+    //records we have to write. We memorize it as a transaction already, so
+    //that we could roll-back all changes, if needed.
+    _bake_file_path = bake_file_path;
+    _records.clear();
+
+    FileTransaction t(bake_file_path, old_file);
+    _file_transactions.push_back(t);
+
+    return true;
+}
+
+bool Baker::close_db() {
+
+    double start_time = kc::time();
+
+    //A hash DB performs best with about twice as many buckets as records,
+    //we can size it exactly since all records are known at this point.
+    _bake_db.tune_buckets(std::max<int64_t>(int64_t(_records.size()) * 2, 
+                                            1024));
+
+    if (_db_codec.type() != rtr::DB_CODEC_NONE) {
         _bake_db.tune_options(kc::HashDB::TLINEAR | kc::HashDB::TCOMPRESS);
+        _bake_db.tune_compressor(&_db_codec);
     } else {
         _bake_db.tune_options(kc::HashDB::TLINEAR);
     }
-    if (!_bake_db.open( bake_file_path, 
+
+    if (!_bake_db.open( _bake_file_path, 
                        kc::HashDB::OWRITER | 
-                       kc::HashDB::OCREATE )) {
+                       kc::HashDB::OCREATE |
+                       kc::HashDB::OTRUNCATE )) {
         cerr << "Could not open HashDB: " << _bake_db.error().name() << endl;
         return false;
     }
 
-    //we have created the DB, let's memorize this as a transaction
-    //At a later point we could roll-back all changes, if needed
-    FileTransaction t(bake_file_path, old_file);
-    _file_transactions.push_back(t);
+    //let the player know how to decode our records
+    _db_codec.write_header(_bake_db.opaque());
+    bool success = _bake_db.synchronize_opaque();
 
-    return true;
-}
+    //write records in batches, each batch is one transaction
+    size_t batch_size = std::max(bakery_config.db_batch_size(), 1);
+    size_t raw_size = 0;
+
+    RecordMap::const_iterator it = _records.begin();
+    while (success && it != _records.end()) {
+
+        if (!_bake_db.begin_transaction()) {
+            success = false;
+            break;
+        }
+
+        for (size_t i = 0; i < batch_size && it != _records.end(); ++i, ++it) {
+            raw_size += it->first.size() + it->second.size();
+            if (!_bake_db.set(it->first, it->second)) {
+                success = false;
+                break;
+            }
+        }
+
+        if (!_bake_db.end_transaction(success))
+            success = false;
+    }
+
+    if (!success) {
+        cerr << "Could not write into DB: " << _bake_db.error().name() 
+             << "." << endl;
+        fail();
+    }
+
+    int64_t file_size = _bake_db.size();
 
-bool Baker::close_db() {
     //close database
     if (!_bake_db.close()) {
         cerr << "Could not close DB: " << _bake_db.error().name() << "." << endl;
         return false;
     }
 
+    if (success) {
+        cout << "DB: wrote " << _records.size() << " records (" 
+             << raw_size / 1024 << " KB) with codec '" << _db_codec.name()
+             << "' into " << file_size / 1024 << " KB in " 
+             << (kc::time() - start_time) * 1000.0 << " ms." << endl;
+    }
+
+    _records.clear();
+
     return true;
 }
 
 bool Baker::write_baked( const string& key, 
                          const google::protobuf::MessageLite * val ) {
 
-    if (!val->SerializeToString(&_protobuf_cache)) {
+    if (!val->SerializeToString(&_records[key])) {
         cerr << "Could not serialize protocol buffer of type " 
                 << val->GetTypeName() << endl;
-        return false;
-    }
-
-    //enter into DB
-    if (!_bake_db.set(key, _protobuf_cache)) {
-        cerr << "Could write into DB: " << _bake_db.error().name() 
-                << "." << endl;
+        _records.erase(key);
         return false;
     }
 
@@ -534,10 +611,22 @@ bool Baker::BakerWriter::writeAnimationList( const CF::AnimationList* animationL
 }
 
 bool Baker::BakerWriter::writeSkinControllerData( const CF::SkinControllerData* skinControllerData ) {
-return true; }
+    SkinProcessorRef ref(new SkinProcessor(_baker));
+    //process in place
+    bool success = ref->process(skinControllerData);
+    if (!success)
+        _baker->fail();
+    return success;
+}
 
 bool Baker::BakerWriter::writeController( const CF::Controller* controller ) {
-return true; }
+    ControllerProcessorRef ref(new ControllerProcessor(_baker));
+    //process in place
+    bool success = ref->process(controller);
+    if (!success)
+        _baker->fail();
+    return success;
+}
 
 bool Baker::BakerWriter::writeFormulas( const CF::Formulas* formulas ) {
 return true; }
@@ -36,6 +36,8 @@
 
 #include "Utils.h"
 
+#include "db_codec.h"
+
 #include <sstream>
 
 #ifdef _MSC_VER
@@ -80,6 +82,8 @@ namespace ColladaBakery {
         const BakerCache& cache() const;
         BakerCache& cache();
 
+        //Records are collected in memory and written in close_db(), see
+        //there.
         bool write_baked( const string& key, 
                           const google::protobuf::MessageLite * val );
 
@@ -111,7 +115,10 @@ namespace ColladaBakery {
         bool open_db();
         bool close_db();
 
+        //Copies all used images into the image destination folder, and
+        //transcodes them next to the copies if enabled, see TextureBaker
         bool copy_images();
+        bool copy_image(const string& src, const string& dst);
 
         /**
          * Nits things together, after having all elements processed. This is 
@@ -146,8 +153,12 @@ namespace ColladaBakery {
 
         BakerCache _cache;
 
-        //a cache for protobuf serialization
-        mutable string _protobuf_cache;
+        //serialized records which are written on close_db()
+        typedef std::map<string, string> RecordMap;
+        RecordMap _records;
+
+        string _bake_file_path;
+        rtr::DBCodec _db_codec;
 
         bool _baking_successful;
         SaxErrorHandler* _error_handler;
@@ -34,6 +34,8 @@
 #include "MaterialProcessor.h"
 #include "EffectProcessor.h"
 #include "ImageProcessor.h"
+#include "SkinProcessor.h"
+#include "ControllerProcessor.h"
 
 #include <boost/unordered_map.hpp>
 
@@ -73,6 +75,14 @@ namespace ColladaBakery {
                                       ImageProcessor::BakeCache >
                                                                ImageBakeCache;
 
+        typedef boost::unordered_map< CF::UniqueId, 
+                                      SkinProcessor::BakeCache >
+                                                               SkinBakeCache;
+
+        typedef boost::unordered_map< CF::UniqueId, 
+                                      ControllerProcessor::BakeCache >
+                                                           ControllerBakeCache;
+
         //This is the cache where we cache animation mappings that we actually
         //want to import.
         //AnimationListID -> rtr target string
@@ -108,6 +118,8 @@ namespace ColladaBakery {
         MaterialBakeCache materials;
         EffectBakeCache effects;
         ImageBakeCache images;
+        SkinBakeCache skins;
+        ControllerBakeCache controllers;
         
         AnimListToRTRTargetMap animation_binding_requests;
         AnimToRTRBindingMap animation_resolved_bindings;
@@ -116,6 +128,12 @@ namespace ColladaBakery {
         //TODO: maybe this list could be removed in future
         UniqueIdList animation_used_animlists;
 
+        //The rtr transform node of each COLLADA node of the visual scenes,
+        //used to resolve the joints of skin controllers
+        typedef boost::unordered_map< CF::UniqueId, string > NodeIdMap;
+
+        NodeIdMap rtr_nodes;
+
         //We will save the instantiated instance_visual_scene of the <scene>
         //element in here (if present)
         CF::UniqueId startup_scene;
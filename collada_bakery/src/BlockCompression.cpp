@@ -0,0 +1,678 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "BlockCompression.h"
+
+#include <algorithm>
+#include <limits>
+#include <cassert>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCK_COMPRESSION_USE_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace ColladaBakery;
+
+namespace {
+
+    typedef unsigned char ubyte;
+    typedef unsigned short ushort;
+
+    //----------------------------- BC1 color block --------------------------//
+
+    ushort pack_565(const vec3& c) {
+        int r = int(glm::clamp(c.x, 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+        int g = int(glm::clamp(c.y, 0.0f, 255.0f) * 63.0f / 255.0f + 0.5f);
+        int b = int(glm::clamp(c.z, 0.0f, 255.0f) * 31.0f / 255.0f + 0.5f);
+        return ushort((r << 11) | (g << 5) | b);
+    }
+
+    void unpack_565(ushort c, int* rgb) {
+        int r = (c >> 11) & 31;
+        int g = (c >> 5) & 63;
+        int b = c & 31;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    //Four-color palette, only valid for c0 > c1 (or c0 == c1)
+    void color_palette(ushort c0, ushort c1, int palette[4][3]) {
+        unpack_565(c0, palette[0]);
+        unpack_565(c1, palette[1]);
+        for (int i = 0; i < 3; ++i) {
+            palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+            palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+        }
+    }
+
+    //Picks the nearest palette entry for every pixel. Returns the packed
+    //2-bit indices, the total squared error is written to error.
+    unsigned int color_indices(const vec3* colors, const int palette[4][3],
+                               int& error) {
+        unsigned int indices = 0;
+        error = 0;
+
+        for (int i = 0; i < 16; ++i) {
+            int best = 0;
+            int best_dist = std::numeric_limits<int>::max();
+
+            for (int p = 0; p < 4; ++p) {
+                int dr = int(colors[i].x) - palette[p][0];
+                int dg = int(colors[i].y) - palette[p][1];
+                int db = int(colors[i].z) - palette[p][2];
+                int dist = dr * dr + dg * dg + db * db;
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = p;
+                }
+            }
+
+            indices |= unsigned(best) << (2 * i);
+            error += best_dist;
+        }
+
+        return indices;
+    }
+
+    //Range of the colors projected onto the axis through mean
+    void project_colors(const vec3* colors, const vec3& mean, 
+                        const vec3& axis, float& t_min, float& t_max) {
+        t_min = std::numeric_limits<float>::max();
+        t_max = -std::numeric_limits<float>::max();
+
+        for (int i = 0; i < 16; ++i) {
+            float t = dot(colors[i] - mean, axis);
+            t_min = std::min(t_min, t);
+            t_max = std::max(t_max, t);
+        }
+    }
+
+#ifdef BLOCK_COMPRESSION_USE_SSE
+
+    //The SSE2 versions work on the colors as three rows of 16 floats (red,
+    //green, blue) and four pixels at a time. They give the same results as
+    //the scalar versions.
+
+    void project_colors_sse(const float* rows, const vec3& mean, 
+                            const vec3& axis, float& t_min, float& t_max) {
+        const __m128 mx = _mm_set1_ps(mean.x);
+        const __m128 my = _mm_set1_ps(mean.y);
+        const __m128 mz = _mm_set1_ps(mean.z);
+        const __m128 ax = _mm_set1_ps(axis.x);
+        const __m128 ay = _mm_set1_ps(axis.y);
+        const __m128 az = _mm_set1_ps(axis.z);
+
+        __m128 lo = _mm_set1_ps(std::numeric_limits<float>::max());
+        __m128 hi = _mm_set1_ps(-std::numeric_limits<float>::max());
+
+        for (int i = 0; i < 16; i += 4) {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(rows + i), mx);
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(rows + 16 + i), my);
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(rows + 32 + i), mz);
+
+            __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, ax), 
+                                             _mm_mul_ps(dy, ay)),
+                                  _mm_mul_ps(dz, az));
+            lo = _mm_min_ps(lo, t);
+            hi = _mm_max_ps(hi, t);
+        }
+
+        lo = _mm_min_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(1, 0, 3, 2)));
+        lo = _mm_min_ps(lo, _mm_shuffle_ps(lo, lo, _MM_SHUFFLE(2, 3, 0, 1)));
+        hi = _mm_max_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(1, 0, 3, 2)));
+        hi = _mm_max_ps(hi, _mm_shuffle_ps(hi, hi, _MM_SHUFFLE(2, 3, 0, 1)));
+
+        t_min = _mm_cvtss_f32(lo);
+        t_max = _mm_cvtss_f32(hi);
+    }
+
+    //Distances are at most 3 * 255^2, which floats represent exactly
+    unsigned int color_indices_sse(const float* rows, 
+                                   const int palette[4][3], int& error) {
+        __m128 pr[4], pg[4], pb[4];
+        for (int p = 0; p < 4; ++p) {
+            pr[p] = _mm_set1_ps(float(palette[p][0]));
+            pg[p] = _mm_set1_ps(float(palette[p][1]));
+            pb[p] = _mm_set1_ps(float(palette[p][2]));
+        }
+
+        unsigned int indices = 0;
+        error = 0;
+
+        for (int i = 0; i < 16; i += 4) {
+            __m128 r = _mm_loadu_ps(rows + i);
+            __m128 g = _mm_loadu_ps(rows + 16 + i);
+            __m128 b = _mm_loadu_ps(rows + 32 + i);
+
+            __m128 best_dist = _mm_set1_ps(std::numeric_limits<float>::max());
+            __m128i best = _mm_setzero_si128();
+
+            for (int p = 0; p < 4; ++p) {
+                __m128 dr = _mm_sub_ps(r, pr[p]);
+                __m128 dg = _mm_sub_ps(g, pg[p]);
+                __m128 db = _mm_sub_ps(b, pb[p]);
+                __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), 
+                                                    _mm_mul_ps(dg, dg)),
+                                         _mm_mul_ps(db, db));
+
+                //strictly less keeps the first of equal entries
+                __m128i less = _mm_castps_si128(_mm_cmplt_ps(dist, 
+                                                             best_dist));
+                best = _mm_or_si128(_mm_andnot_si128(less, best),
+                                    _mm_and_si128(less, _mm_set1_epi32(p)));
+                best_dist = _mm_min_ps(dist, best_dist);
+            }
+
+            int lane_best[4];
+            _mm_storeu_si128((__m128i*)lane_best, best);
+            __m128i lane_dist = _mm_cvtps_epi32(best_dist);
+            int lane_error[4];
+            _mm_storeu_si128((__m128i*)lane_error, lane_dist);
+
+            for (int k = 0; k < 4; ++k) {
+                indices |= unsigned(lane_best[k]) << (2 * (i + k));
+                error += lane_error[k];
+            }
+        }
+
+        return indices;
+    }
+
+#endif
+
+    //Least-squares fit of both endpoints for a given index assignment
+    bool refine_endpoints(const vec3* colors, unsigned int indices,
+                          vec3& e0, vec3& e1) {
+        static const float weights[4] = {1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f};
+
+        float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+        vec3 ax(0.0f), bx(0.0f);
+
+        for (int i = 0; i < 16; ++i) {
+            float a = weights[(indices >> (2 * i)) & 3];
+            float b = 1.0f - a;
+            aa += a * a;
+            bb += b * b;
+            ab += a * b;
+            ax += a * colors[i];
+            bx += b * colors[i];
+        }
+
+        float det = aa * bb - ab * ab;
+        if (std::abs(det) < 1e-6f)
+            return false;
+
+        e0 = (ax * bb - bx * ab) / det;
+        e1 = (bx * aa - ax * ab) / det;
+
+        return true;
+    }
+
+    void write_color_block(ushort c0, ushort c1, unsigned int indices,
+                           ubyte* block) {
+        //c0 > c1 selects the four-color mode. Equal endpoints would switch
+        //to the three-color mode, where only index 0 is safe to use.
+        assert(c0 >= c1);
+        if (c0 == c1) {
+            indices = 0;
+        }
+
+        block[0] = ubyte(c0 & 0xff);
+        block[1] = ubyte(c0 >> 8);
+        block[2] = ubyte(c1 & 0xff);
+        block[3] = ubyte(c1 >> 8);
+        block[4] = ubyte(indices & 0xff);
+        block[5] = ubyte((indices >> 8) & 0xff);
+        block[6] = ubyte((indices >> 16) & 0xff);
+        block[7] = ubyte((indices >> 24) & 0xff);
+    }
+
+    //Endpoints along the principal axis, refined by least squares
+    void encode_color_block(const ubyte* pixels, int components, 
+                            ubyte* block, bool simd) {
+        vec3 colors[16];
+        vec3 mean(0.0f);
+
+        for (int i = 0; i < 16; ++i) {
+            const ubyte* p = pixels + i * components;
+            colors[i] = vec3(p[0], p[1], p[2]);
+            mean += colors[i];
+        }
+        mean /= 16.0f;
+
+#ifdef BLOCK_COMPRESSION_USE_SSE
+        float rows[48];
+        if (simd) {
+            for (int i = 0; i < 16; ++i) {
+                rows[i] = colors[i].x;
+                rows[16 + i] = colors[i].y;
+                rows[32 + i] = colors[i].z;
+            }
+        }
+#else
+        simd = false;
+#endif
+
+        //Principal axis of the color distribution by power iteration on
+        //the covariance matrix
+        mat3 cov(0.0f);
+        for (int i = 0; i < 16; ++i) {
+            vec3 d = colors[i] - mean;
+            cov += mat3(d * d.x, d * d.y, d * d.z);
+        }
+
+        vec3 axis(1.0f, 1.0f, 1.0f);
+        for (int i = 0; i < 8; ++i) {
+            axis = cov * axis;
+            float len = length(axis);
+            if (len < 1e-6f)
+                break;
+            axis /= len;
+        }
+
+        float t_min, t_max;
+#ifdef BLOCK_COMPRESSION_USE_SSE
+        if (simd) {
+            project_colors_sse(rows, mean, axis, t_min, t_max);
+        } else
+#endif
+        {
+            project_colors(colors, mean, axis, t_min, t_max);
+        }
+
+        //Inset the endpoints slightly, extremes are rarely worth their
+        //precision
+        float inset = (t_max - t_min) / 16.0f;
+        vec3 e0 = mean + axis * (t_max - inset);
+        vec3 e1 = mean + axis * (t_min + inset);
+
+        ushort c0 = pack_565(e0);
+        ushort c1 = pack_565(e1);
+        if (c0 < c1) 
+            std::swap(c0, c1);
+
+        int palette[4][3];
+        int error;
+        color_palette(c0, c1, palette);
+        unsigned int indices;
+#ifdef BLOCK_COMPRESSION_USE_SSE
+        if (simd) {
+            indices = color_indices_sse(rows, palette, error);
+        } else
+#endif
+        {
+            indices = color_indices(colors, palette, error);
+        }
+
+        //One least-squares refinement step, kept only if it helps
+        if (error > 0 && refine_endpoints(colors, indices, e0, e1)) {
+            ushort r0 = pack_565(e0);
+            ushort r1 = pack_565(e1);
+            if (r0 < r1) 
+                std::swap(r0, r1);
+
+            int refined_palette[4][3];
+            int refined_error;
+            color_palette(r0, r1, refined_palette);
+            unsigned int refined_indices;
+#ifdef BLOCK_COMPRESSION_USE_SSE
+            if (simd) {
+                refined_indices = color_indices_sse(rows, refined_palette, 
+                                                    refined_error);
+            } else
+#endif
+            {
+                refined_indices = color_indices(colors, refined_palette,
+                                                refined_error);
+            }
+
+            if (refined_error < error) {
+                c0 = r0;
+                c1 = r1;
+                indices = refined_indices;
+            }
+        }
+
+        write_color_block(c0, c1, indices, block);
+    }
+
+    void decode_color_block(const ubyte* block, ubyte* pixels, 
+                            int components) {
+        ushort c0 = ushort(block[0] | (block[1] << 8));
+        ushort c1 = ushort(block[2] | (block[3] << 8));
+        unsigned int indices = block[4] | (block[5] << 8) | 
+                               (block[6] << 16) | (unsigned(block[7]) << 24);
+
+        int palette[4][3];
+        color_palette(c0, c1, palette);
+
+        for (int i = 0; i < 16; ++i) {
+            const int* c = palette[(indices >> (2 * i)) & 3];
+            ubyte* p = pixels + i * components;
+            p[0] = ubyte(c[0]);
+            p[1] = ubyte(c[1]);
+            p[2] = ubyte(c[2]);
+        }
+    }
+
+    //--------------------- BC4 single channel block -------------------------//
+
+    void channel_palette(int a0, int a1, int palette[8]) {
+        palette[0] = a0;
+        palette[1] = a1;
+        for (int i = 1; i < 7; ++i) {
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+        }
+    }
+
+    //Nearest of the eight palette entries for every value
+    unsigned long long channel_indices(const int* values, 
+                                       const int palette[8]) {
+        unsigned long long indices = 0;
+
+        for (int i = 0; i < 16; ++i) {
+            int best = 0;
+            int best_dist = 256;
+
+            for (int p = 0; p < 8; ++p) {
+                int dist = std::abs(values[i] - palette[p]);
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = p;
+                }
+            }
+
+            indices |= (unsigned long long)(best) << (3 * i);
+        }
+
+        return indices;
+    }
+
+#ifdef BLOCK_COMPRESSION_USE_SSE
+
+    //All 16 values in two vectors of 16 bit lanes
+    void channel_range_sse(const __m128i* values, int& a_min, int& a_max) {
+        __m128i lo = _mm_min_epi16(values[0], values[1]);
+        __m128i hi = _mm_max_epi16(values[0], values[1]);
+
+        lo = _mm_min_epi16(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(1,0,3,2)));
+        lo = _mm_min_epi16(lo, _mm_shuffle_epi32(lo, _MM_SHUFFLE(2,3,0,1)));
+        lo = _mm_min_epi16(lo, _mm_srli_epi32(lo, 16));
+        hi = _mm_max_epi16(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(1,0,3,2)));
+        hi = _mm_max_epi16(hi, _mm_shuffle_epi32(hi, _MM_SHUFFLE(2,3,0,1)));
+        hi = _mm_max_epi16(hi, _mm_srli_epi32(hi, 16));
+
+        a_min = _mm_cvtsi128_si32(lo) & 0xffff;
+        a_max = _mm_cvtsi128_si32(hi) & 0xffff;
+    }
+
+    unsigned long long channel_indices_sse(const __m128i* values, 
+                                           const int palette[8]) {
+        unsigned long long indices = 0;
+
+        for (int half = 0; half < 2; ++half) {
+            __m128i v = values[half];
+            __m128i best_dist = _mm_set1_epi16(256);
+            __m128i best = _mm_setzero_si128();
+
+            for (int p = 0; p < 8; ++p) {
+                __m128i entry = _mm_set1_epi16(short(palette[p]));
+                __m128i dist = _mm_max_epi16(_mm_sub_epi16(v, entry),
+                                             _mm_sub_epi16(entry, v));
+
+                //strictly less keeps the first of equal entries
+                __m128i less = _mm_cmplt_epi16(dist, best_dist);
+                best = _mm_or_si128(_mm_andnot_si128(less, best),
+                                    _mm_and_si128(less, 
+                                                  _mm_set1_epi16(short(p))));
+                best_dist = _mm_min_epi16(dist, best_dist);
+            }
+
+            short lane_best[8];
+            _mm_storeu_si128((__m128i*)lane_best, best);
+
+            for (int k = 0; k < 8; ++k) {
+                indices |= (unsigned long long)(lane_best[k]) << 
+                           (3 * (half * 8 + k));
+            }
+        }
+
+        return indices;
+    }
+
+#endif
+
+    void encode_channel_block(const ubyte* pixels, int components, 
+                              int channel, ubyte* block, bool simd) {
+        int values[16];
+        for (int i = 0; i < 16; ++i) {
+            values[i] = pixels[i * components + channel];
+        }
+
+#ifdef BLOCK_COMPRESSION_USE_SSE
+        __m128i lanes[2];
+        if (simd) {
+            short v[16];
+            for (int i = 0; i < 16; ++i) {
+                v[i] = short(values[i]);
+            }
+            lanes[0] = _mm_loadu_si128((const __m128i*)v);
+            lanes[1] = _mm_loadu_si128((const __m128i*)(v + 8));
+        }
+#else
+        simd = false;
+#endif
+
+        int a_min = 255;
+        int a_max = 0;
+
+#ifdef BLOCK_COMPRESSION_USE_SSE
+        if (simd) {
+            channel_range_sse(lanes, a_min, a_max);
+        } else
+#endif
+        {
+            for (int i = 0; i < 16; ++i) {
+                a_min = std::min(a_min, values[i]);
+                a_max = std::max(a_max, values[i]);
+            }
+        }
+
+        block[0] = ubyte(a_max);
+        block[1] = ubyte(a_min);
+
+        unsigned long long indices = 0;
+
+        if (a_max > a_min) {
+            int palette[8];
+            channel_palette(a_max, a_min, palette);
+
+#ifdef BLOCK_COMPRESSION_USE_SSE
+            if (simd) {
+                indices = channel_indices_sse(lanes, palette);
+            } else
+#endif
+            {
+                indices = channel_indices(values, palette);
+            }
+        }
+
+        for (int i = 0; i < 6; ++i) {
+            block[2 + i] = ubyte((indices >> (8 * i)) & 0xff);
+        }
+    }
+
+    void decode_channel_block(const ubyte* block, ubyte* pixels, 
+                              int components, int channel) {
+        int palette[8];
+        int a0 = block[0];
+        int a1 = block[1];
+
+        if (a0 > a1) {
+            channel_palette(a0, a1, palette);
+        } else {
+            //six-value mode, we never write it but decode it for 
+            //completeness
+            palette[0] = a0;
+            palette[1] = a1;
+            for (int i = 1; i < 5; ++i) {
+                palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+
+        unsigned long long indices = 0;
+        for (int i = 0; i < 6; ++i) {
+            indices |= (unsigned long long)(block[2 + i]) << (8 * i);
+        }
+
+        for (int i = 0; i < 16; ++i) {
+            pixels[i * components + channel] = 
+                ubyte(palette[(indices >> (3 * i)) & 7]);
+        }
+    }
+
+    //Copies a 4x4 block out of an image, clamping at the borders
+    void fetch_block(const ubyte* pixels, int width, int height, 
+                     int components, int bx, int by, ubyte* dst) {
+        for (int y = 0; y < 4; ++y) {
+            int sy = std::min(by * 4 + y, height - 1);
+            for (int x = 0; x < 4; ++x) {
+                int sx = std::min(bx * 4 + x, width - 1);
+                const ubyte* src = pixels + (sy * width + sx) * components;
+                std::copy(src, src + components, 
+                          dst + (y * 4 + x) * components);
+            }
+        }
+    }
+
+}
+
+bool BlockCompression::has_simd() {
+#ifdef BLOCK_COMPRESSION_USE_SSE
+    return true;
+#else
+    return false;
+#endif
+}
+
+void BlockCompression::encode_block(Format format, const ubyte* pixels, 
+                                    int components, ubyte* block,
+                                    bool simd) {
+    switch (format) {
+    case BC1:
+        encode_color_block(pixels, components, block, simd);
+        break;
+    case BC3:
+        assert(components == 4);
+        encode_channel_block(pixels, components, 3, block, simd);
+        encode_color_block(pixels, components, block + 8, simd);
+        break;
+    case BC5:
+        encode_channel_block(pixels, components, 0, block, simd);
+        encode_channel_block(pixels, components, 1, block + 8, simd);
+        break;
+    }
+}
+
+void BlockCompression::decode_block(Format format, const ubyte* block, 
+                                    ubyte* pixels, int components) {
+    switch (format) {
+    case BC1:
+        decode_color_block(block, pixels, components);
+        break;
+    case BC3:
+        decode_channel_block(block, pixels, components, 3);
+        decode_color_block(block + 8, pixels, components);
+        break;
+    case BC5:
+        decode_channel_block(block, pixels, components, 0);
+        decode_channel_block(block + 8, pixels, components, 1);
+        break;
+    }
+}
+
+void BlockCompression::encode_image(Format format, const ubyte* pixels,
+                                    int width, int height, int components,
+                                    ubyte* dst, bool simd) {
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+    int size = block_size(format);
+
+    ubyte block_pixels[16 * 4];
+
+    for (int by = 0; by < blocks_y; ++by) {
+        for (int bx = 0; bx < blocks_x; ++bx) {
+            fetch_block(pixels, width, height, components, bx, by, 
+                        block_pixels);
+            encode_block(format, block_pixels, components, dst, simd);
+            dst += size;
+        }
+    }
+}
+
+double BlockCompression::squared_error(Format format, const ubyte* pixels,
+                                       int width, int height, 
+                                       int components,
+                                       const ubyte* compressed,
+                                       size_t& channel_count) {
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+    int size = block_size(format);
+
+    int channels = format == BC1 ? 3 : (format == BC3 ? 4 : 2);
+
+    ubyte original[16 * 4];
+    ubyte decoded[16 * 4];
+
+    double error = 0.0;
+    channel_count = 0;
+
+    for (int by = 0; by < blocks_y; ++by) {
+        for (int bx = 0; bx < blocks_x; ++bx) {
+            fetch_block(pixels, width, height, components, bx, by, original);
+            std::copy(original, original + 16 * components, decoded);
+            decode_block(format, compressed, decoded, components);
+            compressed += size;
+
+            for (int y = 0; y < 4; ++y) {
+                if (by * 4 + y >= height) 
+                    break;
+                for (int x = 0; x < 4; ++x) {
+                    if (bx * 4 + x >= width) 
+                        break;
+                    int i = (y * 4 + x) * components;
+                    for (int c = 0; c < channels; ++c) {
+                        double d = double(original[i + c]) - decoded[i + c];
+                        error += d * d;
+                    }
+                    channel_count += channels;
+                }
+            }
+        }
+    }
+
+    return error;
+}
@@ -0,0 +1,94 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef __CB_BLOCK_COMPRESSION_H
+#define __CB_BLOCK_COMPRESSION_H
+
+#include "cbcommon.h"
+
+/**
+ * CPU encoders (and reference decoders) for the block-compressed texture 
+ * formats we bake into texture containers:
+ *
+ *   BC1 (DXT1)  - RGB color maps, 8 bytes per 4x4 block
+ *   BC3 (DXT5)  - RGBA color maps, 16 bytes per 4x4 block
+ *   BC5 (RGTC2) - two-channel normal maps (x, y), 16 bytes per 4x4 block
+ *
+ * All functions operate on a single 4x4 block of 8-bit pixels stored 
+ * row by row with the given number of components per pixel. 
+ *
+ * Where SSE2 is available, the endpoint search and the index fitting run
+ * four (BC1) or eight (BC4/BC5 channels) pixels at a time. The scalar 
+ * encoder is kept as the fallback and as a reference, both produce the 
+ * same blocks.
+ */
+namespace ColladaBakery { namespace BlockCompression {
+
+    enum Format {
+        BC1,
+        BC3,
+        BC5
+    };
+
+    //Size of one compressed 4x4 block in bytes
+    inline int block_size(Format format) {
+        return format == BC1 ? 8 : 16;
+    }
+
+    //Size of a compressed image of the given size in bytes
+    inline size_t image_size(Format format, int width, int height) {
+        return size_t((width + 3) / 4) * ((height + 3) / 4) * 
+               block_size(format);
+    }
+
+    //Whether the encoder was built with the SSE2 path
+    bool has_simd();
+
+    //simd selects the SSE2 path if it was built, see has_simd()
+    void encode_block(Format format, const unsigned char* pixels, 
+                      int components, unsigned char* block, 
+                      bool simd = true);
+
+    void decode_block(Format format, const unsigned char* block, 
+                      unsigned char* pixels, int components);
+
+    /**
+     * Compresses a whole image. Blocks crossing the image border are padded
+     * by repeating the last row and column.
+     */
+    void encode_image(Format format, const unsigned char* pixels, 
+                      int width, int height, int components, 
+                      unsigned char* dst, bool simd = true);
+
+    /**
+     * Decompresses dst and returns the sum of squared errors against the 
+     * original pixels, taking only the channels covered by the format into
+     * account (RGB for BC1, RGBA for BC3, RG for BC5). channel_count 
+     * receives the number of compared channel values.
+     */
+    double squared_error(Format format, const unsigned char* pixels,
+                         int width, int height, int components, 
+                         const unsigned char* compressed, 
+                         size_t& channel_count);
+
+} }
+
+#endif //__CB_BLOCK_COMPRESSION_H
@@ -0,0 +1,92 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "ControllerProcessor.h"
+#include "COLLADAFWSkinController.h"
+#include "Baker.h"
+#include "BakerCache.h"
+
+using namespace ColladaBakery;
+
+ControllerProcessor::ControllerProcessor(Baker* baker) :
+    Processor(baker)
+{}
+
+bool ControllerProcessor::process(const CF::Object* cObject) {
+
+    const CF::Controller* c_ctrl = static_cast<const CF::Controller*>(cObject);
+
+    if (c_ctrl->getControllerType() != CF::Controller::CONTROLLER_TYPE_SKIN) {
+        cout << "Controller type: " << c_ctrl->getControllerType() 
+             << " not supported." << endl;
+        return true;
+    }
+
+    const CF::SkinController* c_skin = 
+        static_cast<const CF::SkinController*>(c_ctrl);
+
+    _c_id = c_skin->getUniqueId();
+    _c_source_geometry = c_skin->getSource();
+
+    BakeCache cache;
+    cache.source_geometry = _c_source_geometry;
+    cache.skin_data = c_skin->getSkinControllerData();
+
+    for (size_t i = 0; i < c_skin->getJoints().getCount(); ++i)
+        cache.joints.push_back(c_skin->getJoints()[i]);
+
+    BakerCache::ControllerBakeCache::value_type v(_c_id, cache);
+    if (!_baker->cache().controllers.insert(v).second) {
+        cout << "Error inserting into bake cache." << endl;
+        return false;
+    }
+
+    //Has to run before the GeometryProcessor's post process stage
+    _baker->register_for_postprocess(shared_from_this(), 3);
+
+    return true;
+}
+
+bool ControllerProcessor::post_process() {
+
+    BakerCache::SceneMaterialBindingMap& bindings = 
+        _baker->cache().scene_material_cache;
+
+    vector<BakerCache::SceneMaterialBindingMap::value_type> copies;
+
+    BakerCache::SceneMaterialBindingMap::const_iterator it;
+    for (it = bindings.begin(); it != bindings.end(); ++it) {
+        if (it->first.get<0>() == _c_id) {
+            BakerCache::GeomMatIdPair key(_c_source_geometry, 
+                                          it->first.get<1>());
+            copies.push_back(
+                BakerCache::SceneMaterialBindingMap::value_type(key, 
+                                                                it->second));
+        }
+    }
+
+    //If the geometry is instantiated on its own as well, its own bindings
+    //are kept
+    for (size_t i = 0; i < copies.size(); ++i)
+        bindings.insert(copies[i]);
+
+    return true;
+}
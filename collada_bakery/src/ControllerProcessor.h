@@ -0,0 +1,74 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef __CB_CONTROLLER_PROCESSOR_H
+#define __CB_CONTROLLER_PROCESSOR_H
+
+#include "cbcommon.h"
+#include "Processor.h"
+#include "COLLADAFWUniqueId.h"
+
+namespace ColladaBakery {
+
+    class Baker;
+
+    /**
+     * Resolves skin controllers to the geometry they deform, their skin
+     * data and their joint nodes. Morph controllers are not supported.
+     */
+    class ControllerProcessor : public Processor {
+
+    public:
+
+        struct BakeCache {
+            CF::UniqueId source_geometry;
+            CF::UniqueId skin_data;
+            vector<CF::UniqueId> joints;
+
+            //A sphere (center, radius) per joint in the joint's space 
+            //around the vertices it influences, written by the 
+            //GeometryProcessor of the source geometry.
+            vector<vec4> joint_bounds;
+        };
+
+        ControllerProcessor(Baker* baker);
+
+        virtual bool process(const CF::Object* cObject);
+
+        /**
+         * Materials are bound by the instance_controller of a visual scene,
+         * but resolved by the GeometryProcessor of the source geometry. The
+         * bindings are therefore copied to that geometry before the
+         * GeometryProcessor's post process stage runs.
+         */
+        virtual bool post_process();
+
+    private:
+
+        CF::UniqueId _c_id;
+        CF::UniqueId _c_source_geometry;
+
+    };
+
+    typedef boost::shared_ptr<ControllerProcessor> ControllerProcessorRef;
+}
+
+#endif //__CB_CONTROLLER_PROCESSOR_H
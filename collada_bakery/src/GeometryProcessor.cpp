@@ -27,6 +27,9 @@
 #include "COLLADAFWTristrips.h"
 #include "Baker.h"
 #include "Utils.h"
+#include "Meshlets.h"
+#include "SkinProcessor.h"
+#include "ColladaBakeryConfig.h"
 #include "rtr_format.pb.h"
 
 #include <limits>
@@ -38,7 +41,7 @@
 using namespace ColladaBakery;
 
 GeometryProcessor::GeometryProcessor(Baker* baker) :
-    Processor(baker), _idx_count(0)
+    Processor(baker), _idx_count(0), _is_skinned(false)
 {
 }
 
@@ -322,6 +325,9 @@ bool GeometryProcessor::process(const CF::Object* c_obj) {
 
                         } // assembly-loop
 
+                        _position_indices.push_back(
+                                             (*assembly[0].c_indices)[iVtx]);
+
                         //use the new index, and increment
                         rtr_mesh_info.rtr_mesh->add_index_data(_idx_count);
 
@@ -346,6 +352,11 @@ bool GeometryProcessor::process(const CF::Object* c_obj) {
                                                   c_prim->getMaterialId());
                 _bake_cache.rtr_meshes.insert(mmp);
 
+                //the visual scene needs the bounds for its spatial index
+                MeshToSphereMap::value_type msp(rtr_mesh_info.rtr_mesh->id(),
+                                  rtr_mesh_info.rtr_mesh->bounding_sphere());
+                _bake_cache.bounding_spheres.insert(msp);
+
                 //add the created to the list of processed meshes
                 _mesh_infos.push_back(rtr_mesh_info);
 
@@ -837,6 +848,9 @@ GeometryProcessor::setup_layer( const string& layer_name,
 
 bool GeometryProcessor::post_process() {
 
+    if (!setup_skin())
+        return false;
+
     MeshInfoList::iterator it;
     for (it = _mesh_infos.begin();
          it != _mesh_infos.end();
@@ -1023,6 +1037,23 @@ bool GeometryProcessor::post_process() {
         //use those.
         check_fallback_layers(*it->rtr_mesh);
 
+        if (_is_skinned)
+            add_joint_layers(*it->rtr_mesh);
+
+        //Large meshes are split into meshlets the player can cull 
+        //individually. Their bounds would not hold for skinned meshes.
+        if (bakery_config.meshlets() && !_is_skinned &&
+            it->rtr_mesh->primitive_type() == rtr_format::Mesh::TRIANGLES &&
+            it->rtr_mesh->index_data_size() / 3 >= 
+                bakery_config.meshlet_min_triangles() &&
+            _layer_sources.count(kPositionsLayerName()) > 0) {
+
+            Meshlets::build(_layer_sources[kPositionsLayerName()].float_data(),
+                            bakery_config.meshlet_triangles(),
+                            bakery_config.meshlet_cone_weight(),
+                            *it->rtr_mesh);
+        }
+
         //Write out this mesh
         bool b = _baker->write_baked(it->rtr_mesh->id(), it->rtr_mesh.get());
         if (!b) {
@@ -1044,4 +1075,152 @@ bool GeometryProcessor::post_process() {
     }
 
     return true;
-}
\ No newline at end of file
+}
+
+bool GeometryProcessor::setup_skin() {
+
+    const rtr_format::LayerSource* index_source = NULL;
+    const rtr_format::LayerSource* weight_source = NULL;
+    CF::UniqueId c_skin_id;
+
+    BakerCache::ControllerBakeCache::iterator it;
+    for (it = _baker->cache().controllers.begin();
+         it != _baker->cache().controllers.end();
+         ++it)
+    {
+        if (!(it->second.source_geometry == _c_id))
+            continue;
+
+        BakerCache::SkinBakeCache::const_iterator it_skin = 
+            _baker->cache().skins.find(it->second.skin_data);
+
+        //The skin might not have been supported
+        if (it_skin == _baker->cache().skins.end())
+            continue;
+
+        const SkinProcessor::BakeCache& skin = it_skin->second;
+
+        if (index_source != NULL) {
+            if (!(it->second.skin_data == c_skin_id)) {
+                cout << "Warning: Geometry '" << _c_mesh_id << "' is deformed"
+                     << " by more than one skin, only the first one is used."
+                     << endl;
+                continue;
+            }
+
+            calculate_joint_bounds(*index_source, *weight_source,
+                                   skin.joint_matrices,
+                                   it->second.joint_bounds);
+            continue;
+        }
+
+        rtr_format::LayerSource indices;
+        indices.set_id(_c_mesh_id + "_" + kJointIndexLayerName());
+        indices.set_type(rtr_format::LayerSource::INT32);
+
+        rtr_format::LayerSource weights;
+        weights.set_id(_c_mesh_id + "_" + kJointWeightLayerName());
+        weights.set_type(rtr_format::LayerSource::INT32);
+
+        bool valid = true;
+        for (size_t i = 0; i < _position_indices.size(); ++i) {
+            UInt c_idx = _position_indices[i];
+
+            if (c_idx >= skin.joint_indices.size()) {
+                valid = false;
+                break;
+            }
+
+            indices.add_int_data(skin.joint_indices[c_idx]);
+            weights.add_int_data(skin.joint_weights[c_idx]);
+        }
+
+        if (!valid) {
+            cout << "Warning: The skin of geometry '" << _c_mesh_id 
+                 << "' has less vertices than the geometry. It will not be"
+                 << " skinned." << endl;
+            continue;
+        }
+
+        c_skin_id = it->second.skin_data;
+
+        index_source = &(_layer_sources[kJointIndexLayerName()] = indices);
+        weight_source = &(_layer_sources[kJointWeightLayerName()] = weights);
+
+        calculate_joint_bounds(*index_source, *weight_source,
+                               skin.joint_matrices,
+                               it->second.joint_bounds);
+    }
+
+    _is_skinned = (index_source != NULL);
+
+    return true;
+}
+
+void GeometryProcessor::calculate_joint_bounds(
+                                    const rtr_format::LayerSource& indices,
+                                    const rtr_format::LayerSource& weights,
+                                    const vector<mat4>& joint_matrices,
+                                    vector<vec4>& joint_bounds)
+{
+    const google::protobuf::RepeatedField<float>& positions = 
+        _layer_sources[kPositionsLayerName()].float_data();
+
+    size_t joint_count = joint_matrices.size();
+
+    //The center of a joint's sphere is the center of the bounding box of
+    //its vertices in joint space
+    const float max = std::numeric_limits<float>::max();
+    vector<vec3> lower(joint_count, vec3(max));
+    vector<vec3> upper(joint_count, vec3(-max));
+
+    for (int pass = 0; pass < 2; ++pass) {
+
+        if (pass == 1) {
+            joint_bounds.assign(joint_count, vec4(0, 0, 0, -1));
+            for (size_t j = 0; j < joint_count; ++j) {
+                if (lower[j].x <= upper[j].x)
+                    joint_bounds[j] = vec4((lower[j] + upper[j]) * 0.5f, 0);
+            }
+        }
+
+        for (int v = 0; v < indices.int_data_size(); ++v) {
+            unsigned int packed_indices = indices.int_data(v);
+            unsigned int packed_weights = weights.int_data(v);
+
+            vec4 p = vec4(Utils::vec3_from_arr(positions, v), 1);
+
+            for (int i = 0; i < 4; ++i) {
+                if (((packed_weights >> (i * 8)) & 0xff) == 0)
+                    continue;
+
+                size_t j = (packed_indices >> (i * 8)) & 0xff;
+                vec3 q = vec3(joint_matrices[j] * p);
+
+                if (pass == 0) {
+                    lower[j] = glm::min(lower[j], q);
+                    upper[j] = glm::max(upper[j], q);
+                } else {
+                    vec4& b = joint_bounds[j];
+                    b.w = std::max(b.w, length(q - vec3(b)));
+                }
+            }
+        }
+    }
+}
+
+void GeometryProcessor::add_joint_layers(rtr_format::Mesh& rtr_mesh) {
+
+    rtr_format::Mesh_VertexAttributeLayer* index_layer = rtr_mesh.add_layer();
+    index_layer->set_name(kJointIndexLayerName());
+    index_layer->set_source(_layer_sources[kJointIndexLayerName()].id());
+    index_layer->set_num_components(4);
+    index_layer->set_source_index(0);
+
+    rtr_format::Mesh_VertexAttributeLayer* weight_layer = rtr_mesh.add_layer();
+    weight_layer->set_name(kJointWeightLayerName());
+    weight_layer->set_source(_layer_sources[kJointWeightLayerName()].id());
+    weight_layer->set_num_components(4);
+    weight_layer->set_source_index(0);
+    weight_layer->set_normalized(true);
+}
@@ -46,9 +46,12 @@ namespace ColladaBakery {
         GeometryProcessor(Baker* baker);
 
         typedef map<string, CF::MaterialId > MeshToMaterialMap;
+        typedef map<string, rtr_format::Mesh_BoundingSphere> MeshToSphereMap;
         //This cache includes holds a list of mesh_id -> material_id pairs
+        //and the object space bounding sphere of each mesh
         struct BakeCache {
              MeshToMaterialMap rtr_meshes;
+             MeshToSphereMap bounding_spheres;
         };
 
         static const string& kPositionsLayerName() {
@@ -80,6 +83,18 @@ namespace ColladaBakery {
             return s;
         }
 
+        //The four strongest joint influences of skinned meshes, see 
+        //rtr_format::Skin
+        static const string& kJointIndexLayerName() {
+            static const string s = "joint_index";
+            return s;
+        }
+
+        static const string& kJointWeightLayerName() {
+            static const string s = "joint_weight";
+            return s;
+        }
+
         //By convention our runtime uses a UV channel for each texture
         //and these are named as follows
         static const string& kUvDiffuseName() {
@@ -208,6 +223,15 @@ namespace ColladaBakery {
         //populates the bounding volume infor about a mesh
         void calculate_bounding_volumes(rtr_format::Mesh& rtr_mesh);
 
+        //Adds the joint layer sources if a skin controller deforms this 
+        //geometry, and the bounds of its joints to the controller's cache
+        bool setup_skin();
+        void calculate_joint_bounds(const rtr_format::LayerSource& indices,
+                                    const rtr_format::LayerSource& weights,
+                                    const vector<mat4>& joint_matrices,
+                                    vector<vec4>& joint_bounds);
+        void add_joint_layers(rtr_format::Mesh& rtr_mesh);
+
         //Adds fallback layers, if a required layer does not exist.
         void check_fallback_layers(rtr_format::Mesh& rtr_mesh);
         void add_padded_layer(rtr_format::Mesh& rtr_mesh, 
@@ -217,6 +241,11 @@ namespace ColladaBakery {
 
         IdxLookup _idx_cache;
         unsigned int _idx_count;
+
+        //The COLLADA position index of each of our vertices, to look up 
+        //skin influences
+        vector<UInt> _position_indices;
+        bool _is_skinned;
         string _c_mesh_id;
         LayerSourceCache _layer_sources;
         MeshList _meshes;
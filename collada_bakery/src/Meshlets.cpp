@@ -0,0 +1,333 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "Meshlets.h"
+#include "Utils.h"
+
+#include <algorithm>
+#include <limits>
+
+using namespace ColladaBakery;
+
+namespace {
+
+    struct Triangle {
+        vec3 centroid;
+        vec3 normal; //unit length, zero for degenerate triangles
+    };
+
+    struct PositionKey {
+        float x;
+        float y;
+        float z;
+
+        bool operator<(const PositionKey& o) const {
+            if (x != o.x) return x < o.x;
+            if (y != o.y) return y < o.y;
+            return z < o.z;
+        }
+    };
+
+    //Spreads the lower 10 bits of v to every third bit
+    unsigned int spread_bits(unsigned int v) {
+        v &= 0x3ff;
+        v = (v | (v << 16)) & 0x030000ff;
+        v = (v | (v <<  8)) & 0x0300f00f;
+        v = (v | (v <<  4)) & 0x030c30c3;
+        v = (v | (v <<  2)) & 0x09249249;
+        return v;
+    }
+
+    unsigned int morton_code(const vec3& p, 
+                             const vec3& box_min, 
+                             const vec3& box_size) {
+        unsigned int c[3];
+        for (int i = 0; i < 3; ++i) {
+            float f = (box_size[i] > 0) ? (p[i] - box_min[i]) / box_size[i] 
+                                        : 0.0f;
+            c[i] = (unsigned int)glm::clamp(f * 1023.0f, 0.0f, 1023.0f);
+        }
+        return spread_bits(c[0]) | 
+               (spread_bits(c[1]) << 1) | 
+               (spread_bits(c[2]) << 2);
+    }
+
+    //Bounding sphere and normal cone of the triangles in indices
+    void calculate_bounds(const google::protobuf::RepeatedField<float>& pos,
+                          const vector<unsigned int>& indices,
+                          const vector<Triangle>& triangles,
+                          const vector<int>& meshlet_triangles,
+                          rtr_format::Mesh_Meshlet& meshlet) {
+        size_t first = meshlet.first_index();
+        size_t last = first + meshlet.index_count();
+
+        //Same as GeometryProcessor::calculate_bounding_volumes
+        vec3 center(0);
+        for (size_t i = first; i < last; ++i) {
+            center += Utils::vec3_from_arr(pos, indices[i]);
+        }
+        center *= 1.0f / (float)(last - first);
+
+        float radius = 0;
+        for (size_t i = first; i < last; ++i) {
+            vec3 v = Utils::vec3_from_arr(pos, indices[i]);
+            radius = glm::max(radius, glm::distance(v, center));
+        }
+
+        rtr_format::Mesh_BoundingSphere* sphere = 
+                                            meshlet.mutable_bounding_sphere();
+        sphere->set_center_x(center.x);
+        sphere->set_center_y(center.y);
+        sphere->set_center_z(center.z);
+        sphere->set_radius(radius);
+
+        vec3 axis(0);
+        for (size_t i = 0; i < meshlet_triangles.size(); ++i) {
+            axis += triangles[meshlet_triangles[i]].normal;
+        }
+
+        float cutoff = -1.0f;
+        float axis_length = glm::length(axis);
+
+        if (axis_length > 0.0f) {
+            axis /= axis_length;
+            cutoff = 1.0f;
+            for (size_t i = 0; i < meshlet_triangles.size(); ++i) {
+                const Triangle& t = triangles[meshlet_triangles[i]];
+                //degenerate triangles are never rasterized
+                if (t.normal == vec3(0))
+                    continue;
+                cutoff = glm::min(cutoff, glm::dot(axis, t.normal));
+            }
+        }
+
+        meshlet.set_cone_axis_x(axis.x);
+        meshlet.set_cone_axis_y(axis.y);
+        meshlet.set_cone_axis_z(axis.z);
+        meshlet.set_cone_cutoff(cutoff);
+    }
+}
+
+bool Meshlets::build(const google::protobuf::RepeatedField<float>& positions,
+                     int max_triangles,
+                     float cone_weight,
+                     rtr_format::Mesh& mesh) {
+
+    if (mesh.primitive_type() != rtr_format::Mesh::TRIANGLES)
+        return false;
+
+    mesh.clear_meshlet();
+
+    int triangle_count = mesh.index_data_size() / 3;
+    if (triangle_count == 0 || max_triangles < 1)
+        return true;
+
+    vector<unsigned int> indices(mesh.index_data().begin(), 
+                                 mesh.index_data().begin() + 
+                                 triangle_count * 3);
+
+    //Baked vertices are split wherever any attribute differs (e.g. at hard
+    //edges), so adjacency is established over welded positions.
+    int vertex_count = positions.size() / 3;
+    vector<int> welded(vertex_count, -1);
+    map<PositionKey, int> weld_map;
+
+    for (size_t i = 0; i < indices.size(); ++i) {
+        unsigned int idx = indices[i];
+        if (welded[idx] >= 0)
+            continue;
+
+        vec3 p = Utils::vec3_from_arr(positions, idx);
+        PositionKey key = { p.x, p.y, p.z };
+
+        map<PositionKey, int>::value_type v(key, (int)weld_map.size());
+        welded[idx] = weld_map.insert(v).first->second;
+    }
+
+    vector<Triangle> triangles(triangle_count);
+
+    vec3 box_min(std::numeric_limits<float>::infinity());
+    vec3 box_max(-std::numeric_limits<float>::infinity());
+    float total_area = 0;
+
+    for (int t = 0; t < triangle_count; ++t) {
+        vec3 a = Utils::vec3_from_arr(positions, indices[t*3]);
+        vec3 b = Utils::vec3_from_arr(positions, indices[t*3 + 1]);
+        vec3 c = Utils::vec3_from_arr(positions, indices[t*3 + 2]);
+
+        //counter-clockwise triangles are front-facing
+        vec3 n = glm::cross(b - a, c - a);
+        float n_length = glm::length(n);
+
+        triangles[t].centroid = (a + b + c) * (1.0f / 3.0f);
+        triangles[t].normal = (n_length > 0.0f) ? n / n_length : vec3(0);
+
+        total_area += n_length * 0.5f;
+
+        box_min = glm::min(box_min, triangles[t].centroid);
+        box_max = glm::max(box_max, triangles[t].centroid);
+    }
+
+    //Triangles around every welded position
+    vector<int> adjacency_offsets(weld_map.size() + 1, 0);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        adjacency_offsets[welded[indices[i]] + 1]++;
+    }
+    for (size_t i = 1; i < adjacency_offsets.size(); ++i) {
+        adjacency_offsets[i] += adjacency_offsets[i - 1];
+    }
+
+    vector<int> adjacency(indices.size());
+    vector<int> fill(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        adjacency[fill[welded[indices[i]]]++] = i / 3;
+    }
+
+    //Seeds are taken in Morton order, such that meshlets started after a 
+    //seed ran out of neighbours stay close to each other.
+    vector<std::pair<unsigned int, int> > order(triangle_count);
+    for (int t = 0; t < triangle_count; ++t) {
+        order[t].first = morton_code(triangles[t].centroid, 
+                                     box_min, box_max - box_min);
+        order[t].second = t;
+    }
+    std::sort(order.begin(), order.end());
+
+    //The radius a meshlet of max_triangles average triangles would have,
+    //used to make distances comparable to normal deviations.
+    float expected_radius = glm::sqrt(total_area / triangle_count * 
+                                      max_triangles) * 0.5f;
+    if (expected_radius <= 0.0f)
+        expected_radius = 1.0f;
+
+    vector<int> meshlet_of(triangle_count, -1);
+    vector<int> candidate_of(triangle_count, -1);
+
+    vector<unsigned int> new_indices;
+    new_indices.reserve(indices.size());
+
+    vector<int> meshlet_triangles;
+    vector<int> candidates;
+    size_t next_seed = 0;
+    int meshlet_count = 0;
+
+    while (new_indices.size() < indices.size()) {
+
+        while (meshlet_of[order[next_seed].second] >= 0) 
+            ++next_seed;
+
+        int current = order[next_seed].second;
+
+        meshlet_triangles.clear();
+        candidates.clear();
+        vec3 centroid_sum(0);
+        vec3 normal_sum(0);
+
+        while (true) {
+            meshlet_of[current] = meshlet_count;
+            meshlet_triangles.push_back(current);
+            centroid_sum += triangles[current].centroid;
+            normal_sum += triangles[current].normal;
+
+            for (int i = 0; i < 3; ++i) {
+                int w = welded[indices[current*3 + i]];
+                for (int j = adjacency_offsets[w]; 
+                     j < adjacency_offsets[w + 1]; ++j) {
+                    int t = adjacency[j];
+                    if (meshlet_of[t] < 0 && 
+                        candidate_of[t] != meshlet_count) {
+                        candidate_of[t] = meshlet_count;
+                        candidates.push_back(t);
+                    }
+                }
+            }
+
+            if ((int)meshlet_triangles.size() == max_triangles)
+                break;
+
+            vec3 center = centroid_sum * (1.0f / meshlet_triangles.size());
+            float normal_length = glm::length(normal_sum);
+            vec3 axis = (normal_length > 0.0f) ? normal_sum / normal_length
+                                               : vec3(0);
+
+            //Pick the closest, most similarly oriented neighbour and drop
+            //candidates that were taken in the meantime
+            int best = -1;
+            float best_score = std::numeric_limits<float>::max();
+            size_t kept = 0;
+
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                int t = candidates[i];
+                if (meshlet_of[t] >= 0)
+                    continue;
+                candidates[kept++] = t;
+
+                float score = glm::distance(triangles[t].centroid, center) / 
+                              expected_radius + 
+                              cone_weight * 
+                              (1.0f - glm::dot(triangles[t].normal, axis));
+
+                if (score < best_score) {
+                    best_score = score;
+                    best = t;
+                }
+            }
+            candidates.resize(kept);
+
+            //Disconnected parts (e.g. separate leaves) continue with the 
+            //next free triangle in Morton order
+            if (best < 0) {
+                while (next_seed < order.size() && 
+                       meshlet_of[order[next_seed].second] >= 0) 
+                    ++next_seed;
+
+                if (next_seed == order.size())
+                    break;
+
+                best = order[next_seed].second;
+            }
+
+            current = best;
+        }
+
+        rtr_format::Mesh_Meshlet* meshlet = mesh.add_meshlet();
+        meshlet->set_first_index(new_indices.size());
+        meshlet->set_index_count(meshlet_triangles.size() * 3);
+
+        for (size_t i = 0; i < meshlet_triangles.size(); ++i) {
+            int t = meshlet_triangles[i];
+            new_indices.push_back(indices[t*3]);
+            new_indices.push_back(indices[t*3 + 1]);
+            new_indices.push_back(indices[t*3 + 2]);
+        }
+
+        calculate_bounds(positions, new_indices, triangles, 
+                         meshlet_triangles, *meshlet);
+
+        ++meshlet_count;
+    }
+
+    for (size_t i = 0; i < new_indices.size(); ++i) {
+        mesh.set_index_data(i, new_indices[i]);
+    }
+
+    return true;
+}
@@ -0,0 +1,51 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef __CB_MESHLETS_H
+#define __CB_MESHLETS_H
+
+#include "cbcommon.h"
+
+#include "rtr_format.pb.h"
+
+/**
+ * Bake-time clustering of triangle meshes into meshlets.
+ *
+ * build groups the triangles of a mesh into clusters of spatially close and
+ * similarly oriented triangles, grown greedily over shared vertex positions.
+ * index_data is reordered such that every meshlet is a contiguous index 
+ * range, and each meshlet gets a bounding sphere and a normal cone, which 
+ * allow the player to frustum and backface cull parts of large meshes.
+ */
+namespace ColladaBakery { namespace Meshlets {
+
+    //Splits mesh into meshlets of at most max_triangles triangles. 
+    //positions holds three floats per vertex, as referenced by index_data.
+    //cone_weight trades meshlet compactness for tighter normal cones.
+    //Returns false if mesh is not a triangle list.
+    bool build(const google::protobuf::RepeatedField<float>& positions,
+               int max_triangles,
+               float cone_weight,
+               rtr_format::Mesh& mesh);
+
+} }
+
+#endif //__CB_MESHLETS_H
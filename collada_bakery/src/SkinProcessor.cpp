@@ -0,0 +1,188 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "SkinProcessor.h"
+#include "COLLADAFWSkinControllerData.h"
+#include "Baker.h"
+#include "BakerCache.h"
+#include "Utils.h"
+
+#include <algorithm>
+
+using namespace ColladaBakery;
+
+namespace {
+
+    typedef std::pair<float, int> Influence;
+
+    bool heavier(const Influence& a, const Influence& b) {
+        return a.first > b.first;
+    }
+
+    float get_weight(const CF::FloatOrDoubleArray& weights, size_t idx) {
+        if (weights.getType() == CF::FloatOrDoubleArray::DATA_TYPE_DOUBLE)
+            return static_cast<float>((*weights.getDoubleValues())[idx]);
+        
+        return (*weights.getFloatValues())[idx];
+    }
+
+}
+
+SkinProcessor::SkinProcessor(Baker* baker) :
+    Processor(baker)
+{}
+
+bool SkinProcessor::process(const CF::Object* cObject) {
+
+    const CF::SkinControllerData* c_skin = 
+        static_cast<const CF::SkinControllerData*>(cObject);
+
+    size_t joint_count = c_skin->getJointsCount();
+
+    if (joint_count > size_t(kMaxJoints())) {
+        cout << "Warning: Skin '" << c_skin->getOriginalId() << "' has " 
+             << joint_count << " joints, only " << kMaxJoints() << " are "
+             << "supported. Its geometry will not be skinned." << endl;
+        return true;
+    }
+
+    const CF::Matrix4Array& c_inverse_binds = 
+        c_skin->getInverseBindMatrices();
+
+    if (c_inverse_binds.getCount() != joint_count) {
+        cout << "Warning: Skin '" << c_skin->getOriginalId() << "' has " 
+             << c_inverse_binds.getCount() << " inverse bind matrices for "
+             << joint_count << " joints. Its geometry will not be skinned." 
+             << endl;
+        return true;
+    }
+
+    BakeCache cache;
+
+    mat4 bind_shape = Utils::mat4_from_matrix(c_skin->getBindShapeMatrix());
+
+    for (size_t i = 0; i < joint_count; ++i) {
+        cache.joint_matrices.push_back(
+            Utils::mat4_from_matrix(c_inverse_binds[i]) * bind_shape );
+    }
+
+    const CF::UIntValuesArray& c_counts = c_skin->getJointsPerVertex();
+    const CF::UIntValuesArray& c_weight_indices = c_skin->getWeightIndices();
+    const CF::IntValuesArray& c_joint_indices = c_skin->getJointIndices();
+    const CF::FloatOrDoubleArray& c_weights = c_skin->getWeights();
+
+    size_t weight_count = c_weights.getValuesCount();
+    size_t influence_count = std::min(c_weight_indices.getCount(), 
+                                      c_joint_indices.getCount());
+
+    //Influences on the bind shape itself (joint -1) are dropped, vertices
+    //without any other influence are bound to the first joint.
+    int dropped = 0;
+    int unbound = 0;
+
+    size_t offset = 0;
+    vector<Influence> influences;
+
+    for (size_t v = 0; v < c_counts.getCount(); ++v) {
+
+        influences.clear();
+
+        for (size_t i = offset; i < offset + c_counts[v]; ++i) {
+
+            if (i >= influence_count || 
+                c_weight_indices[i] >= weight_count) {
+                cout << "Error: Skin '" << c_skin->getOriginalId() 
+                     << "' has an invalid influence." << endl;
+                return false;
+            }
+
+            int joint = c_joint_indices[i];
+            float weight = get_weight(c_weights, c_weight_indices[i]);
+
+            if (joint < 0 || size_t(joint) >= joint_count) {
+                ++dropped;
+                continue;
+            }
+
+            if (weight > 0.0f)
+                influences.push_back(Influence(weight, joint));
+        }
+
+        offset += c_counts[v];
+
+        std::sort(influences.begin(), influences.end(), heavier);
+
+        if (influences.size() > 4)
+            influences.resize(4);
+
+        float sum = 0;
+        for (size_t i = 0; i < influences.size(); ++i)
+            sum += influences[i].first;
+
+        if (influences.empty()) {
+            ++unbound;
+            influences.push_back(Influence(1.0f, 0));
+            sum = 1.0f;
+        }
+
+        //Weights are quantized to bytes summing up to 255, the rounding 
+        //error is added to the strongest influence
+        unsigned int indices = 0;
+        int quantized[4] = { 0, 0, 0, 0 };
+        int quantized_sum = 0;
+
+        for (size_t i = 0; i < influences.size(); ++i) {
+            quantized[i] = int(influences[i].first / sum * 255.0f + 0.5f);
+            quantized_sum += quantized[i];
+            indices |= unsigned(influences[i].second) << (i * 8);
+        }
+
+        quantized[0] += 255 - quantized_sum;
+
+        unsigned int weights = 0;
+        for (int i = 0; i < 4; ++i)
+            weights |= unsigned(std::max(0, std::min(255, quantized[i]))) 
+                           << (i * 8);
+
+        cache.joint_indices.push_back(static_cast<int>(indices));
+        cache.joint_weights.push_back(static_cast<int>(weights));
+    }
+
+    if (dropped > 0) {
+        cout << "Warning: Skin '" << c_skin->getOriginalId() << "' has " 
+             << dropped << " influences on the bind shape or on invalid "
+             << "joints, which are ignored." << endl;
+    }
+
+    if (unbound > 0) {
+        cout << "Warning: Skin '" << c_skin->getOriginalId() << "' has " 
+             << unbound << " vertices without influences, they are bound to"
+             << " the first joint." << endl;
+    }
+
+    BakerCache::SkinBakeCache::value_type v(c_skin->getUniqueId(), cache);
+    if (!_baker->cache().skins.insert(v).second) {
+        cout << "Error inserting into bake cache." << endl;
+        return false;
+    }
+
+    return true;
+}
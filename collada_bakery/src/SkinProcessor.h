@@ -0,0 +1,68 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef __CB_SKIN_PROCESSOR_H
+#define __CB_SKIN_PROCESSOR_H
+
+#include "cbcommon.h"
+#include "Processor.h"
+#include "COLLADAFWTypes.h"
+
+namespace ColladaBakery {
+
+    class Baker;
+
+    /**
+     * Converts the joint influences and bind matrices of a skin controller.
+     * Only the four strongest influences of a vertex are kept, they are 
+     * stored per COLLADA vertex (i.e. position index) and are turned into
+     * vertex layers by the GeometryProcessor of the skinned mesh.
+     */
+    class SkinProcessor : public Processor {
+
+    public:
+
+        /**
+         * Joint indices and weights are packed into one int per vertex with
+         * a byte per influence, which limits a skin to 256 joints.
+         */
+        static int kMaxJoints() { return 256; }
+
+        struct BakeCache {
+            //The influences of each COLLADA vertex, as stored in the 
+            //joint_index and joint_weight layers
+            vector<int> joint_indices;
+            vector<int> joint_weights;
+
+            //Inverse bind matrix times bind shape matrix, per joint
+            vector<mat4> joint_matrices;
+        };
+
+        SkinProcessor(Baker* baker);
+
+        virtual bool process(const CF::Object* cObject);
+
+    };
+
+    typedef boost::shared_ptr<SkinProcessor> SkinProcessorRef;
+}
+
+#endif //__CB_SKIN_PROCESSOR_H
@@ -0,0 +1,299 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "SpatialIndex.h"
+
+#include <glm/gtx/transform2.hpp>
+
+#include <algorithm>
+
+using namespace ColladaBakery;
+
+using glm::mat4;
+
+namespace {
+
+    struct Sphere {
+        vec3 center;
+        float radius;
+    };
+
+    struct CellKey {
+        int depth;
+        int x;
+        int y;
+        int z;
+
+        bool operator<(const CellKey& o) const {
+            if (depth != o.depth) return depth < o.depth;
+            if (x != o.x) return x < o.x;
+            if (y != o.y) return y < o.y;
+            return z < o.z;
+        }
+    };
+
+    //Evaluates one transform with its static values. This has to match
+    //the player's Transform implementations (which ignore SKEW as well).
+    mat4 rest_matrix(const rtr_format::Transform& t) {
+
+        if (t.type() == rtr_format::Transform::TRANSLATE) {
+            const rtr_format::Vec3f& v = t.translate().value();
+            return glm::translate(v.x(), v.y(), v.z());
+        } else if (t.type() == rtr_format::Transform::ROTATE) {
+            const rtr_format::Vec3f& a = t.rotate().axis();
+            return glm::rotate(t.rotate().angle(), a.x(), a.y(), a.z());
+        } else if (t.type() == rtr_format::Transform::SCALE) {
+            const rtr_format::Vec3f& v = t.scale().value();
+            return glm::scale(v.x(), v.y(), v.z());
+        } else if (t.type() == rtr_format::Transform::MATRIX) {
+            const rtr_format::Mat4f& v = t.matrix();
+            return mat4(v.m00(),v.m10(), v.m20(), v.m30(),
+                        v.m01(),v.m11(), v.m21(), v.m31(),
+                        v.m02(),v.m12(), v.m22(), v.m32(),
+                        v.m03(),v.m13(), v.m23(), v.m33());
+        } else if (t.type() == rtr_format::Transform::LOOKAT) {
+            const rtr_format::Transform_LookAt& v = t.lookat();
+            vec3 position(v.position().x(), v.position().y(), v.position().z());
+            vec3 focus(v.point_of_interest().x(), 
+                       v.point_of_interest().y(),
+                       v.point_of_interest().z());
+            vec3 up(v.up().x(), v.up().y(), v.up().z());
+            return glm::inverse(glm::lookAt(position, focus, up));
+        }
+
+        return mat4(1.0f);
+    }
+
+    //Same as Geometry::update_bounding_volume of the player (which assumes
+    //uniform scale)
+    Sphere to_world(const rtr_format::Mesh_BoundingSphere& s, const mat4& m) {
+        vec4 center(s.center_x(), s.center_y(), s.center_z(), 1);
+        vec4 p = center;
+        p.z += s.radius();
+
+        vec4 ctr_m = m * center;
+
+        Sphere result;
+        result.center = vec3(ctr_m);
+        result.radius = glm::length(m * p - ctr_m);
+        return result;
+    }
+
+    //Same as Sphere::unite of the player
+    Sphere unite(const Sphere& a, const Sphere& b) {
+        const Sphere& bigger = (a.radius > b.radius) ? a : b;
+        const Sphere& smaller = (a.radius > b.radius) ? b : a;
+
+        vec3 center_diff = smaller.center - bigger.center;
+        float center_diff_length = glm::length(center_diff);
+
+        if ( (center_diff_length + smaller.radius) <= bigger.radius)
+            return bigger;
+
+        Sphere merged;
+        merged.radius = 0.5f * ( center_diff_length + 
+                                 smaller.radius + 
+                                 bigger.radius );
+        float factor = 0.5f * ( smaller.radius + 
+                                center_diff_length - 
+                                bigger.radius ) / center_diff_length;
+        merged.center = bigger.center + factor * center_diff;
+        return merged;
+    }
+
+    //Mirrors LooseOctree::get_node_coords and LooseOctree::is_valid
+    class Layout {
+
+    public:
+
+        Layout(float world_size, const vec3& center, int max_depth) :
+            _world_size(world_size), _center(center), _max_depth(max_depth) {}
+
+        bool cell_of(const Sphere& s, CellKey& key) const {
+
+            if (s.radius <= 0) {
+                key.depth = _max_depth;
+            } else {
+                key.depth = glm::min( _max_depth, 
+                      (int)glm::floor(glm::log2(_world_size/s.radius)-1) );
+            }
+
+            if (key.depth < 0)
+                return false;
+
+            vec3 idx = indices(s.center, spacing(key.depth));
+            key.x = (int)idx.x;
+            key.y = (int)idx.y;
+            key.z = (int)idx.z;
+
+            //try the closest child, as the player does
+            if (key.depth != _max_depth) {
+                vec3 c_idx = indices(s.center, spacing(key.depth+1));
+                CellKey child = { key.depth+1, 
+                                  (int)c_idx.x, (int)c_idx.y, (int)c_idx.z };
+                if (fits_inside(s, child))
+                    key = child;
+            }
+
+            int max_index = 1 << key.depth;
+            return ( key.x >= 0 && key.x < max_index &&
+                     key.y >= 0 && key.y < max_index &&
+                     key.z >= 0 && key.z < max_index );
+        }
+
+    private:
+
+        float spacing(int depth) const {
+            return ( _world_size / glm::pow(2.0f, (float)depth) );
+        }
+
+        vec3 indices(const vec3& c, float s) const {
+            float inv_s = 1/s;
+            return glm::floor((c-_center+vec3(_world_size*0.5f)) * inv_s );
+        }
+
+        bool fits_inside(const Sphere& b, const CellKey& n) const {
+            float s = spacing(n.depth);
+            vec3 idx(n.x + 0.5f, n.y + 0.5f, n.z + 0.5f);
+            vec3 node_center = s * idx - vec3(_world_size*0.5f) + _center;
+            vec3 min_extends = node_center - vec3(s);
+            vec3 max_extends = node_center + vec3(s);
+
+            return ( ((b.center.x + b.radius) <= max_extends.x) &&
+                     ((b.center.y + b.radius) <= max_extends.y) &&
+                     ((b.center.z + b.radius) <= max_extends.z) &&
+                     ((b.center.x - b.radius) >= min_extends.x) &&
+                     ((b.center.y - b.radius) >= min_extends.y) &&
+                     ((b.center.z - b.radius) >= min_extends.z) );
+        }
+
+        float _world_size;
+        vec3 _center;
+        int _max_depth;
+    };
+
+}
+
+bool SpatialIndex::build( const rtr_format::Scene& scene,
+                          const MeshSphereMap& mesh_spheres,
+                          const std::set<string>& animated_trafos,
+                          int max_depth,
+                          rtr_format::SpatialIndex& index_out )
+{
+    //Nodes are ordered by dependency, therefore parents are always evaluated
+    //before their children
+    map<string, mat4> world;
+    std::set<string> animated_nodes;
+
+    for (int i = 0; i < scene.node_size(); ++i) {
+        const rtr_format::TransformNode& node = scene.node(i);
+
+        mat4 m(1.0f);
+        bool is_animated = false;
+
+        if (node.has_dependency()) {
+            map<string, mat4>::const_iterator it = world.find(node.dependency());
+            if (it != world.end())
+                m = it->second;
+            is_animated = (animated_nodes.count(node.dependency()) > 0);
+        }
+
+        for (int j = 0; j < node.transform_size(); ++j) {
+            m = m * rest_matrix(node.transform(j));
+            is_animated |= (animated_trafos.count(node.transform(j).id()) > 0);
+        }
+
+        world[node.id()] = m;
+        if (is_animated)
+            animated_nodes.insert(node.id());
+    }
+
+    //world space bounds of all geometries, in scene order
+    vector<Sphere> spheres;
+    vector<bool> is_static;
+    spheres.reserve(scene.geometry_size());
+    is_static.reserve(scene.geometry_size());
+
+    Sphere world_sphere;
+    bool has_world_sphere = false;
+
+    for (int i = 0; i < scene.geometry_size(); ++i) {
+        const rtr_format::Geometry& geo = scene.geometry(i);
+
+        MeshSphereMap::const_iterator it_s = mesh_spheres.find(geo.mesh_id());
+        map<string, mat4>::const_iterator it_m = world.find(geo.transform_node());
+
+        Sphere s;
+        s.radius = 0;
+        bool is_known = ( it_s != mesh_spheres.end() && it_m != world.end() );
+
+        if (is_known) {
+            s = to_world(it_s->second, it_m->second);
+            world_sphere = has_world_sphere ? unite(world_sphere, s) : s;
+            has_world_sphere = true;
+        }
+
+        spheres.push_back(s);
+        //skinned geometries move with their joints
+        is_static.push_back( is_known && !geo.has_skin() &&
+                     (animated_nodes.count(geo.transform_node()) == 0) );
+    }
+
+    if (!has_world_sphere)
+        return false;
+
+    //A little headroom, such that animated geometries in their rest pose
+    //still fit into the tree despite rounding differences in the player.
+    float world_size = world_sphere.radius * 2 * 1.01f;
+
+    index_out.Clear();
+    index_out.set_world_size(world_size);
+    index_out.mutable_center()->set_x(world_sphere.center.x);
+    index_out.mutable_center()->set_y(world_sphere.center.y);
+    index_out.mutable_center()->set_z(world_sphere.center.z);
+    index_out.set_max_depth(max_depth);
+
+    Layout layout(world_size, world_sphere.center, max_depth);
+
+    typedef map<CellKey, vector<unsigned int> > CellMap;
+    CellMap cells;
+
+    for (size_t i = 0; i < spheres.size(); ++i) {
+        CellKey key;
+        if (is_static[i] && layout.cell_of(spheres[i], key))
+            cells[key].push_back(static_cast<unsigned int>(i));
+    }
+
+    for (CellMap::const_iterator it = cells.begin(); it != cells.end(); ++it) {
+        rtr_format::SpatialIndex_Cell* cell = index_out.add_cell();
+        cell->set_depth(it->first.depth);
+        cell->set_x(it->first.x);
+        cell->set_y(it->first.y);
+        cell->set_z(it->first.z);
+        cell->set_first(index_out.geometry_index_size());
+        cell->set_count(static_cast<unsigned int>(it->second.size()));
+
+        for (size_t j = 0; j < it->second.size(); ++j)
+            index_out.add_geometry_index(it->second[j]);
+    }
+
+    return true;
+}
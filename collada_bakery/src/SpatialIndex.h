@@ -0,0 +1,56 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef __CB_SPATIAL_INDEX_H
+#define __CB_SPATIAL_INDEX_H
+
+#include "cbcommon.h"
+
+#include "rtr_format.pb.h"
+
+#include <set>
+
+/**
+ * Bake-time construction of the player's spatial index.
+ *
+ * build evaluates all transform nodes of a scene in their rest pose, places 
+ * the world space bounding sphere of every static geometry into a loose 
+ * octree cell (using the same addressing as the player's LooseOctree) and 
+ * stores the populated cells in a SpatialIndex. A geometry is static if none 
+ * of the transforms it depends on is animated. Animated geometries only 
+ * contribute to the world size and are left for the player to insert.
+ */
+namespace ColladaBakery { namespace SpatialIndex {
+
+    typedef map<string, rtr_format::Mesh_BoundingSphere> MeshSphereMap;
+
+    //Builds index_out for scene. mesh_spheres holds the object space bounds
+    //of all meshes, animated_trafos the IDs of all animated transforms.
+    //Returns false if the scene contains no geometry that could be placed.
+    bool build(const rtr_format::Scene& scene,
+               const MeshSphereMap& mesh_spheres,
+               const std::set<string>& animated_trafos,
+               int max_depth,
+               rtr_format::SpatialIndex& index_out);
+
+} }
+
+#endif //__CB_SPATIAL_INDEX_H
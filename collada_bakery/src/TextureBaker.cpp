@@ -0,0 +1,485 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "TextureBaker.h"
+#include "BlockCompression.h"
+
+#include "common_const.h"
+#include "baked_texture.h"
+
+#include <IL/il.h>
+
+#include <cmath>
+#include <algorithm>
+
+using namespace ColladaBakery;
+
+namespace {
+
+    //DevIL keeps a global image state, all calls into it have to be serialized
+    kc::Mutex devil_mutex;
+    bool devil_initialized = false;
+
+    //sRGB -> linear lookup, filled during DevIL initialization
+    float srgb_table[256];
+
+    //Linear float representation of one mip level
+    struct Level {
+        int width;
+        int height;
+        int components;
+        vector<float> data;
+    };
+
+    float srgb_to_linear(float c) {
+        if (c <= 0.04045f)
+            return c / 12.92f;
+        return std::pow((c + 0.055f) / 1.055f, 2.4f);
+    }
+
+    float linear_to_srgb(float l) {
+        if (l <= 0.0031308f)
+            return l * 12.92f;
+        return 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+    }
+
+    unsigned char to_byte(float v) {
+        int i = int(v * 255.0f + 0.5f);
+        return (unsigned char)(i < 0 ? 0 : (i > 255 ? 255 : i));
+    }
+
+    //Decodes an image file into 8 bit RGB(A). Returns false on failure.
+    bool load_image(const string& path, int& width, int& height, 
+                    int& components, vector<unsigned char>& pixels) {
+
+        kc::ScopedMutex lock(&devil_mutex);
+
+        if (!devil_initialized) {
+            ilInit();
+            //Same origin as the player's Image class
+            ilEnable(IL_ORIGIN_SET);
+            ilOriginFunc(IL_ORIGIN_LOWER_LEFT);
+
+            for (int i = 0; i < 256; ++i)
+                srgb_table[i] = srgb_to_linear(i / 255.0f);
+
+            devil_initialized = true;
+        }
+
+        ILuint il_image;
+        ilGenImages(1, &il_image);
+        ilBindImage(il_image);
+
+        if (!ilLoadImage(path.c_str())) {
+            ilDeleteImages(1, &il_image);
+            return false;
+        }
+
+        ILint format = ilGetInteger(IL_IMAGE_FORMAT);
+        bool has_alpha = (format == IL_RGBA || 
+                          format == IL_BGRA || 
+                          format == IL_LUMINANCE_ALPHA);
+
+        components = has_alpha ? 4 : 3;
+
+        if (!ilConvertImage(has_alpha ? IL_RGBA : IL_RGB, IL_UNSIGNED_BYTE)) {
+            ilDeleteImages(1, &il_image);
+            return false;
+        }
+
+        width = ilGetInteger(IL_IMAGE_WIDTH);
+        height = ilGetInteger(IL_IMAGE_HEIGHT);
+
+        pixels.resize(width * height * components);
+        ilCopyPixels(0, 0, 0, width, height, 1, 
+                     has_alpha ? IL_RGBA : IL_RGB, IL_UNSIGNED_BYTE, 
+                     &pixels[0]);
+
+        ilBindImage(0);
+        ilDeleteImages(1, &il_image);
+
+        return true;
+    }
+
+    void decode_level(const vector<unsigned char>& pixels, bool normal_map,
+                      Level& level) {
+
+        level.data.resize(pixels.size());
+
+        for (size_t i = 0; i < pixels.size(); ++i) {
+            int c = int(i % level.components);
+
+            if (normal_map && c < 3) {
+                level.data[i] = pixels[i] / 255.0f * 2.0f - 1.0f;
+            } else if (!normal_map && c < 3) {
+                level.data[i] = srgb_table[pixels[i]];
+            } else {
+                level.data[i] = pixels[i] / 255.0f;
+            }
+        }
+    }
+
+    void encode_level(const Level& level, bool normal_map, 
+                      unsigned char* dst) {
+
+        for (size_t i = 0; i < level.data.size(); ++i) {
+            int c = int(i % level.components);
+            float v = level.data[i];
+
+            if (normal_map && c < 3) {
+                dst[i] = to_byte(v * 0.5f + 0.5f);
+            } else if (!normal_map && c < 3) {
+                dst[i] = to_byte(linear_to_srgb(v));
+            } else {
+                dst[i] = to_byte(v);
+            }
+        }
+    }
+
+    //2x2 box filter. Odd sizes are handled by clamping to the last row or
+    //column of the source level.
+    void downsample(const Level& src, bool normal_map, Level& dst) {
+
+        dst.width = std::max(1, src.width / 2);
+        dst.height = std::max(1, src.height / 2);
+        dst.components = src.components;
+        dst.data.resize(dst.width * dst.height * dst.components);
+
+        const int n = src.components;
+
+        for (int y = 0; y < dst.height; ++y) {
+            int y0 = std::min(2 * y, src.height - 1);
+            int y1 = std::min(2 * y + 1, src.height - 1);
+
+            for (int x = 0; x < dst.width; ++x) {
+                int x0 = std::min(2 * x, src.width - 1);
+                int x1 = std::min(2 * x + 1, src.width - 1);
+
+                const float* s00 = &src.data[(y0 * src.width + x0) * n];
+                const float* s01 = &src.data[(y0 * src.width + x1) * n];
+                const float* s10 = &src.data[(y1 * src.width + x0) * n];
+                const float* s11 = &src.data[(y1 * src.width + x1) * n];
+
+                float* d = &dst.data[(y * dst.width + x) * n];
+
+                for (int c = 0; c < n; ++c) {
+                    d[c] = 0.25f * (s00[c] + s01[c] + s10[c] + s11[c]);
+                }
+
+                if (normal_map) {
+                    float len = std::sqrt(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+                    if (len > 1e-6f) {
+                        d[0] /= len; 
+                        d[1] /= len; 
+                        d[2] /= len;
+                    } else {
+                        //Opposing normals cancelled out, use the flat normal
+                        d[0] = 0.0f; 
+                        d[1] = 0.0f; 
+                        d[2] = 1.0f;
+                    }
+                }
+            }
+        }
+    }
+
+}
+
+class TextureBaker::Worker : public kc::Thread {
+
+public:
+
+    Worker() : _baker(NULL) {}
+
+    void set_baker(TextureBaker* baker) { _baker = baker; }
+
+    void run() {
+        Job* job;
+        while ((job = _baker->next_job()) != NULL) {
+            job->success = TextureBaker::transcode(*job);
+        }
+    }
+
+private:
+
+    TextureBaker* _baker;
+};
+
+TextureBaker::TextureBaker(int thread_count, bool compress, bool compare) :
+    _next_job(0),
+    _thread_count(std::max(1, thread_count)),
+    _compress(compress),
+    _compare(compress && compare)
+{
+}
+
+void TextureBaker::add(const string& src_path, const string& dst_path) {
+    Job job;
+    job.src_path = src_path;
+    job.dst_path = dst_path;
+    job.compress = _compress;
+    job.compare = _compare;
+    job.success = false;
+    job.level_count = 0;
+    job.size = 0;
+    job.psnr = 0.0;
+    job.encode_time = 0.0;
+    job.reference_psnr = 0.0;
+    job.reference_time = 0.0;
+    _jobs.push_back(job);
+}
+
+TextureBaker::Job* TextureBaker::next_job() {
+    kc::ScopedMutex lock(&_job_mutex);
+
+    if (_next_job >= _jobs.size())
+        return NULL;
+
+    return &_jobs[_next_job++];
+}
+
+bool TextureBaker::run() {
+
+    _failed.clear();
+    _next_job = 0;
+
+    int thread_count = std::min(_thread_count, int(_jobs.size()));
+
+    Worker* workers = new Worker[thread_count];
+
+    for (int i = 0; i < thread_count; ++i) {
+        workers[i].set_baker(this);
+        workers[i].start();
+    }
+
+    for (int i = 0; i < thread_count; ++i) {
+        workers[i].join();
+    }
+
+    delete[] workers;
+
+    vector<Job>::const_iterator it;
+    for (it = _jobs.begin(); it != _jobs.end(); ++it) {
+        if (it->success) {
+            cout << "Bake: '" << it->src_path << "' -> '" << it->dst_path
+                 << rtr::kBakedTextureExtension() << "' (" 
+                 << it->level_count << " levels, " 
+                 << it->size / 1024 << " KB";
+            if (it->compress) {
+                cout << ", PSNR " << it->psnr << " dB";
+            }
+            if (it->compare) {
+                cout << ", " << (BlockCompression::has_simd() ? "SSE2" : 
+                                                                "scalar")
+                     << " encoder " << it->encode_time * 1000.0 << " ms"
+                     << ", scalar encoder " << it->reference_time * 1000.0 
+                     << " ms at PSNR " << it->reference_psnr << " dB";
+            }
+            cout << ")." << endl;
+        } else {
+            cout << "Error: Could not transcode image '" << it->src_path 
+                 << "'." << endl;
+            _failed.push_back(std::make_pair(it->src_path, it->dst_path));
+        }
+    }
+
+    _jobs.clear();
+
+    return _failed.empty();
+}
+
+bool TextureBaker::transcode(Job& job) {
+
+    const boost::regex normalmap_pattern(rtr::kNormalMapFormat());
+    bool normal_map = boost::regex_match(job.dst_path, normalmap_pattern);
+
+    vector<unsigned char> pixels;
+    Level level;
+
+    if (!load_image(job.src_path, level.width, level.height, 
+                    level.components, pixels))
+        return false;
+
+    decode_level(pixels, normal_map, level);
+
+    //count levels down to 1x1
+    int level_count = 1;
+    for (int w = level.width, h = level.height; w > 1 || h > 1; ++level_count) {
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+
+    if (level_count > int(rtr::kBakedTextureMaxLevels))
+        return false;
+
+    typedef BlockCompression::Format BCFormat;
+
+    //Normal maps only keep x and y (BC5), z is reconstructed in the shader
+    BCFormat bc_format = normal_map ? BlockCompression::BC5 : 
+                         (level.components == 4 ? BlockCompression::BC3 : 
+                                                  BlockCompression::BC1);
+
+    rtr::BakedTextureHeader header;
+    std::memcpy(header.magic, rtr::kBakedTextureMagic, 4);
+    header.version = rtr::kBakedTextureVersion;
+    header.width = level.width;
+    header.height = level.height;
+    header.level_count = level_count;
+    header.type = rtr::BakedTextureFormat::UNSIGNED_BYTE;
+    header.flags = normal_map ? rtr::BAKED_TEXTURE_NORMAL_MAP : 0;
+
+    if (job.compress) {
+        header.flags |= rtr::BAKED_TEXTURE_COMPRESSED;
+        header.type = 0;
+
+        switch (bc_format) {
+        case BlockCompression::BC1:
+            header.internal_format = 
+                rtr::BakedTextureFormat::COMPRESSED_SRGB_S3TC_DXT1;
+            break;
+        case BlockCompression::BC3:
+            header.internal_format = 
+                rtr::BakedTextureFormat::COMPRESSED_SRGB_ALPHA_S3TC_DXT5;
+            break;
+        case BlockCompression::BC5:
+            header.internal_format = 
+                rtr::BakedTextureFormat::COMPRESSED_RG_RGTC2;
+            break;
+        }
+
+        header.format = header.internal_format;
+    } else if (level.components == 4) {
+        header.format = rtr::BakedTextureFormat::RGBA;
+        header.internal_format = normal_map ? 
+                                 rtr::BakedTextureFormat::RGBA8 : 
+                                 rtr::BakedTextureFormat::SRGB8_ALPHA8;
+    } else {
+        header.format = rtr::BakedTextureFormat::RGB;
+        header.internal_format = normal_map ? 
+                                 rtr::BakedTextureFormat::RGB8 : 
+                                 rtr::BakedTextureFormat::SRGB8;
+    }
+
+    vector<rtr::BakedTextureLevel> levels(level_count);
+
+    uint64_t offset = sizeof(rtr::BakedTextureHeader) + 
+                      level_count * sizeof(rtr::BakedTextureLevel);
+
+    int w = level.width;
+    int h = level.height;
+    for (int i = 0; i < level_count; ++i) {
+        levels[i].width = w;
+        levels[i].height = h;
+        levels[i].offset = offset;
+
+        if (job.compress) {
+            levels[i].size = BlockCompression::image_size(bc_format, w, h);
+        } else {
+            levels[i].size = uint64_t(w) * h * level.components;
+        }
+
+        offset += levels[i].size;
+
+        w = std::max(1, w / 2);
+        h = std::max(1, h / 2);
+    }
+
+    vector<char> buffer((size_t)offset);
+
+    std::memcpy(&buffer[0], &header, sizeof(header));
+    std::memcpy(&buffer[sizeof(header)], &levels[0], 
+                level_count * sizeof(rtr::BakedTextureLevel));
+
+    double squared_error = 0.0;
+    double reference_error = 0.0;
+    size_t channel_count = 0;
+    vector<unsigned char> reference;
+
+    for (int i = 0; i < level_count; ++i) {
+        if (i > 0) {
+            Level next;
+            downsample(level, normal_map, next);
+            std::swap(level, next);
+        }
+
+        unsigned char* dst = (unsigned char*)&buffer[size_t(levels[i].offset)];
+
+        if (!job.compress) {
+            encode_level(level, normal_map, dst);
+            continue;
+        }
+
+        pixels.resize(level.data.size());
+        encode_level(level, normal_map, &pixels[0]);
+
+        double start = kc::time();
+        BlockCompression::encode_image(bc_format, &pixels[0], 
+                                       level.width, level.height, 
+                                       level.components, dst);
+        job.encode_time += kc::time() - start;
+
+        size_t level_channels = 0;
+        squared_error += BlockCompression::squared_error(bc_format, 
+                                                         &pixels[0],
+                                                         level.width, 
+                                                         level.height,
+                                                         level.components,
+                                                         dst, level_channels);
+        channel_count += level_channels;
+
+        if (job.compare) {
+            reference.resize(size_t(levels[i].size));
+
+            start = kc::time();
+            BlockCompression::encode_image(bc_format, &pixels[0], 
+                                           level.width, level.height, 
+                                           level.components, &reference[0],
+                                           false);
+            job.reference_time += kc::time() - start;
+
+            reference_error += 
+                BlockCompression::squared_error(bc_format, &pixels[0],
+                                                level.width, level.height,
+                                                level.components,
+                                                &reference[0], 
+                                                level_channels);
+        }
+    }
+
+    string dst = job.dst_path + rtr::kBakedTextureExtension();
+
+    if (!kc::File::write_file(dst, &buffer[0], int64_t(buffer.size())))
+        return false;
+
+    job.level_count = level_count;
+    job.size = buffer.size();
+
+    if (job.compress && channel_count > 0) {
+        double mse = squared_error / channel_count;
+        job.psnr = mse > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+
+        mse = reference_error / channel_count;
+        job.reference_psnr = mse > 0.0 ? 
+                             10.0 * std::log10(255.0 * 255.0 / mse) : 99.0;
+    }
+
+    return true;
+}
@@ -0,0 +1,112 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef __CB_TEXTURE_BAKER_H
+#define __CB_TEXTURE_BAKER_H
+
+#include "cbcommon.h"
+
+#include <kcthread.h>
+
+namespace ColladaBakery {
+
+    /**
+     * Transcodes the source images of a COLLADA document (JPEG, PNG, ...) 
+     * into the baked texture container defined in baked_texture.h. 
+     *
+     * Every container holds a complete mip chain in the final pixel format,
+     * so the player neither has to decode the image nor to generate mipmaps
+     * on startup. Color textures are filtered in linear space and stored as
+     * sRGB. Normal maps (see rtr::kNormalMapFormat) are filtered as vectors
+     * and renormalized on each level.
+     *
+     * With compression enabled, color maps are stored as BC1 (RGB) or BC3
+     * (RGBA) and normal maps as BC5 (x and y only). The PSNR of every 
+     * compressed texture (over all levels) is reported. If compare is set,
+     * the textures are encoded with the scalar encoder as well, and the 
+     * PSNR and encoding time of both encoders are reported.
+     *
+     * Images are transcoded in parallel. DevIL itself is not thread-safe, 
+     * only decoding is serialized, filtering and writing is not.
+     */
+    class TextureBaker : noncopyable {
+
+    public:
+
+        TextureBaker(int thread_count, bool compress, bool compare = false);
+
+        /**
+         * Queues an image for transcoding.
+         * @param src_path The complete path of the source image.
+         * @param dst_path The complete path of the image in the destination
+         *                 folder. The container will be written to 
+         *                 dst_path + rtr::kBakedTextureExtension().
+         */
+        void add(const string& src_path, const string& dst_path);
+
+        /**
+         * Transcodes all queued images. Returns false if at least one image
+         * could not be transcoded, see failed().
+         */
+        bool run();
+
+        typedef list<std::pair<string, string> > ImageList;
+
+        //<src_path, dst_path> of all images which could not be transcoded.
+        //The caller might want to fall back to a plain copy for those.
+        const ImageList& failed() const { return _failed; }
+
+    private:
+
+        class Worker;
+
+        struct Job {
+            string src_path;
+            string dst_path;
+            bool compress;
+            bool compare;
+            bool success;
+            int level_count;
+            size_t size;
+            double psnr;
+            double encode_time;
+            double reference_psnr; /**< Of the scalar encoder */
+            double reference_time;
+        };
+
+        //thread-safe, returns NULL if all jobs have been handed out
+        Job* next_job();
+
+        static bool transcode(Job& job);
+
+        vector<Job> _jobs;
+        size_t _next_job;
+        kc::Mutex _job_mutex;
+        int _thread_count;
+        bool _compress;
+        bool _compare;
+
+        ImageList _failed;
+    };
+
+}
+
+#endif //__CB_TEXTURE_BAKER_H
@@ -34,6 +34,7 @@
 #include "COLLADAFWEffect.h"
 #include "COLLADAFWEffectCommon.h"
 #include "COLLADAFWTextureCoordinateBinding.h"
+#include "Math/COLLADABUMathMatrix4.h"
 
 #include <sstream>
 
@@ -172,6 +173,16 @@ namespace ColladaBakery { namespace Utils {
                     a.Get(idx*stride+1) );
     }
 
+    //Converts a row-major COLLADA matrix to glm's column-major matrix
+    inline mat4 mat4_from_matrix(const CB::Math::Matrix4& m)
+    {
+        mat4 result;
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 4; ++r)
+                result[c][r] = static_cast<float>(m[r][c]);
+        return result;
+    }
+
 } } //namespace Utils namespace ColladaBakery
 
  inline bool epsilon_compare(float a, float b) {
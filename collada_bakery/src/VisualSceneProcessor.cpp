@@ -24,6 +24,8 @@
 #include "BakerCache.h"
 
 #include "Utils.h"
+#include "SpatialIndex.h"
+#include "ColladaBakeryConfig.h"
 
 #include "COLLADAFWVisualScene.h"
 
@@ -111,6 +113,9 @@ void VisualSceneProcessor::process_node( const CF::Node* c_node,
         return;
     }
 
+    //skin controllers refer to their joints by the COLLADA node
+    _baker->cache().rtr_nodes[c_node->getUniqueId()] = c_node_id;
+
     //Process transforms
     for ( size_t iTrafo = 0; 
           iTrafo < c_node->getTransformations().getCount(); 
@@ -157,74 +162,25 @@ void VisualSceneProcessor::process_node( const CF::Node* c_node,
                                          c_node->getInstanceGeometries()[iGeo];
 
         //memorize this, we will resolve this during post-processing
+        _geometry_instances.push_back(
+            resolve_geometry_instance(c_node_id,
+                                      c_inst->getInstanciatedObjectId(),
+                                      c_inst->getMaterialBindings()) );
+    }
 
-        ResolveData instantiation;
-        instantiation.c_node_id = c_node_id;
-        instantiation.referenced_id = c_inst->getInstanciatedObjectId();
-        instantiation.rtr_node = c_node_id;
-        GeometryResolveData geo_instantiation;
-        geo_instantiation.resolve_data = instantiation;
-
-        //We add the material binding information to the resolve data
-        //we will need this later to connect the processed material
-        //with the correct mesh
-        //We will also add the COLLADAFW::UniqueId of the instantiated material
-        //to our cache in order to process only those material in their respective
-        //processor which are actually referenced.
-        for (size_t iMat = 0;
-             iMat < c_inst->getMaterialBindings().getCount();
-             ++iMat)
-        {
-            const CF::MaterialBinding& c_mb = 
-                c_inst->getMaterialBindings()[iMat];
-
-            BakerCache::TexCoordBindingList tex_coord_bdg_cache;
-            for (size_t iT = 0; 
-                 iT < c_mb.getTextureCoordinateBindingArray().getCount(); 
-                 ++iT)
-            {
-                tex_coord_bdg_cache.push_back(c_mb.getTextureCoordinateBindingArray()[iT]);
-            }
-
-            BakerCache::GeomMatIdPair key(c_inst->getInstanciatedObjectId(), 
-                                          c_mb.getMaterialId());
-
-            BakerCache::VisualSceneMaterialBinding binding_cache;
-            binding_cache.tex_coord_binding_list = tex_coord_bdg_cache;
-            binding_cache.referenced_material = c_mb.getReferencedMaterial();
-
-            BakerCache::SceneMaterialBindingMap::value_type val(key, 
-                                                                binding_cache);
-
-            std::pair<BakerCache::SceneMaterialBindingMap::iterator, bool>
-                insertion = _baker->cache().scene_material_cache.insert(val);
-            if (!insertion.second) {
-
-                bool are_equal = std::equal(tex_coord_bdg_cache.begin(), 
-                                            tex_coord_bdg_cache.end(), 
-                                            insertion.first->second.tex_coord_binding_list.begin(),
-                                            c_tex_coord_bgd_predicate);
-
-                are_equal &= ( insertion.first->second.referenced_material == 
-                               binding_cache.referenced_material );
-
-                if (!are_equal) {
-                    cout << "Warning: multiple UV set bindings for the same "
-                         << "material/mesh combination." << endl;
-                }
-            }
-
-            MatBindingMap::value_type v(c_mb.getMaterialId(), c_mb);
-            if (!geo_instantiation.material_bindings.insert(v).second) {
-                cout << "Could not insert material binding " << c_mb.getName()
-                     << ". This might be the result of a duplicate "
-                     << "instance_material binding." << endl;
-            }
-
-            _baker->cache().used_materials.insert(c_mb.getReferencedMaterial());
-        }
+    //Skinned geometries, their materials are bound to the controller, see
+    //ControllerProcessor::post_process
+    for ( size_t iCtrl = 0; 
+          iCtrl < c_node->getInstanceControllers().getCount(); 
+          ++iCtrl )
+    {
+        const CF::InstanceController* c_inst = 
+                                      c_node->getInstanceControllers()[iCtrl];
 
-        _geometry_instances.push_back(geo_instantiation);
+        _controller_instances.push_back(
+            resolve_geometry_instance(c_node_id,
+                                      c_inst->getInstanciatedObjectId(),
+                                      c_inst->getMaterialBindings()) );
     }
 
     for ( size_t iNodeInst = 0; 
@@ -262,6 +218,80 @@ void VisualSceneProcessor::process_node( const CF::Node* c_node,
 
 }
 
+VisualSceneProcessor::GeometryResolveData 
+VisualSceneProcessor::resolve_geometry_instance( 
+                                    const string& c_node_id,
+                                    const CF::UniqueId& c_instanced_id,
+                                    const CF::MaterialBindingArray& c_bindings )
+{
+    ResolveData instantiation;
+    instantiation.c_node_id = c_node_id;
+    instantiation.referenced_id = c_instanced_id;
+    instantiation.rtr_node = c_node_id;
+    GeometryResolveData geo_instantiation;
+    geo_instantiation.resolve_data = instantiation;
+
+    //We add the material binding information to the resolve data
+    //we will need this later to connect the processed material
+    //with the correct mesh
+    //We will also add the COLLADAFW::UniqueId of the instantiated material
+    //to our cache in order to process only those material in their respective
+    //processor which are actually referenced.
+    for (size_t iMat = 0;
+         iMat < c_bindings.getCount();
+         ++iMat)
+    {
+        const CF::MaterialBinding& c_mb = c_bindings[iMat];
+
+        BakerCache::TexCoordBindingList tex_coord_bdg_cache;
+        for (size_t iT = 0; 
+             iT < c_mb.getTextureCoordinateBindingArray().getCount(); 
+             ++iT)
+        {
+            tex_coord_bdg_cache.push_back(c_mb.getTextureCoordinateBindingArray()[iT]);
+        }
+
+        BakerCache::GeomMatIdPair key(c_instanced_id, 
+                                      c_mb.getMaterialId());
+
+        BakerCache::VisualSceneMaterialBinding binding_cache;
+        binding_cache.tex_coord_binding_list = tex_coord_bdg_cache;
+        binding_cache.referenced_material = c_mb.getReferencedMaterial();
+
+        BakerCache::SceneMaterialBindingMap::value_type val(key, 
+                                                            binding_cache);
+
+        std::pair<BakerCache::SceneMaterialBindingMap::iterator, bool>
+            insertion = _baker->cache().scene_material_cache.insert(val);
+        if (!insertion.second) {
+
+            bool are_equal = std::equal(tex_coord_bdg_cache.begin(), 
+                                        tex_coord_bdg_cache.end(), 
+                                        insertion.first->second.tex_coord_binding_list.begin(),
+                                        c_tex_coord_bgd_predicate);
+
+            are_equal &= ( insertion.first->second.referenced_material == 
+                           binding_cache.referenced_material );
+
+            if (!are_equal) {
+                cout << "Warning: multiple UV set bindings for the same "
+                     << "material/mesh combination." << endl;
+            }
+        }
+
+        MatBindingMap::value_type v(c_mb.getMaterialId(), c_mb);
+        if (!geo_instantiation.material_bindings.insert(v).second) {
+            cout << "Could not insert material binding " << c_mb.getName()
+                 << ". This might be the result of a duplicate "
+                 << "instance_material binding." << endl;
+        }
+
+        _baker->cache().used_materials.insert(c_mb.getReferencedMaterial());
+    }
+
+    return geo_instantiation;
+}
+
 void VisualSceneProcessor::process_trafo(
                                     const CF::Transformation* c_trafo, 
                                     rtr_format::TransformNode* t_node )
@@ -468,6 +498,7 @@ void VisualSceneProcessor::process_trafo(
         _baker->cache().animation_binding_requests.insert(v);
         _baker->cache().animation_used_animlists.push_back(
             c_trafo->getAnimationList());
+        _animated_trafos.insert(id);
     }
 
 }
@@ -506,56 +537,51 @@ bool VisualSceneProcessor::post_process() {
             continue;
         }
 
-        //add a rtr-geometry in the rtr-scene with the appropriate 
-        //transform node
-        GeometryProcessor::MeshToMaterialMap::const_iterator it_mmp;
-        for ( it_mmp = it_conv->second.rtr_meshes.begin();
-              it_mmp != it_conv->second.rtr_meshes.end();
-              ++it_mmp )
-        {
-            rtr_format::Geometry* rtr_geo = _rtr_scene.add_geometry();
-            rtr_geo->set_transform_node(geo_resolve.rtr_node);
-            string rtr_id = it_geo->resolve_data.c_node_id + "_" 
-                            + it_mmp->first + "_instance";
-            rtr_geo->set_id( rtr_id );
-            cout << "RTR Geo with: " << rtr_id << std::endl;
-            rtr_geo->set_mesh_id(it_mmp->first);
-
-            //MaterialId (of mesh) -> ColladaUniqueId -> rtr_material string
-            MatBindingMap::const_iterator it_mat = 
-                                it_geo->material_bindings.find(it_mmp->second);
-            if (it_mat != it_geo->material_bindings.end()) {
-                
-                CF::UniqueId c_mat_id = it_mat->second.getReferencedMaterial();
-
-                //TODO: we should deal with the texture coordinate binding
-                //more carefully in here. At the moment we just make a few
-                //assumptions about which texture channels should be used
-                //for which types of textures.
-
-                BakerCache::MaterialBakeCache::const_iterator it_baked_mat = 
-                                      _baker->cache().materials.find(c_mat_id);
-
-                if (it_baked_mat == _baker->cache().materials.end()) {
-                    cout << "Error: Could not resolve material " << 
-                        c_mat_id.toAscii() << "." << endl;
-                    cout << "Using 'error material' instead." << endl;
-                    rtr_geo->set_material_id(rtr::ERROR_MATERIAL_NAME());
-                } else {
-                    //Found the baked material, set its cached rtr-ID
-                    string rtr_mat_id = it_baked_mat->second.rtr_material_id;
-                    rtr_geo->set_material_id(rtr_mat_id);
-                }
+        add_geometries(*it_geo, it_conv->second, NULL);
+    }
 
-            } else {
-                cout << "Warning: Could not resolve material binding '"
-                     << it_mmp->second << "' of mesh " << rtr_id << endl;
-                cout << "         Setting 'error material' instead." << endl;
-                rtr_geo->set_material_id(rtr::ERROR_MATERIAL_NAME());
-            }
+    //skinned geometries
+    list<GeometryResolveData>::const_iterator it_ctrl;
+    for ( it_ctrl = _controller_instances.begin();
+          it_ctrl != _controller_instances.end();
+          ++it_ctrl )
+    {
+        const ResolveData& ctrl_resolve = it_ctrl->resolve_data;
+
+        BakerCache::ControllerBakeCache::const_iterator it_c = 
+                 _baker->cache().controllers.find(ctrl_resolve.referenced_id);
+
+        if (it_c == _baker->cache().controllers.end()) {
+            cout << "Instance to controller " 
+                 << ctrl_resolve.referenced_id.toAscii()
+                 << " could not be resolved." << endl;
+            cout << endl;
+            continue;
+        }
+
+        const ControllerProcessor::BakeCache& ctrl = it_c->second;
 
+        BakerCache::GeometryBakeCache::const_iterator it_conv = 
+                     _baker->cache().geometries.find(ctrl.source_geometry);
+
+        if (it_conv == _baker->cache().geometries.end()) {
+            cout << "Source geometry of controller " 
+                 << ctrl_resolve.referenced_id.toAscii()
+                 << " could not be resolved." << endl;
+            cout << endl;
+            continue;
         }
 
+        rtr_format::Skin skin;
+        if (!setup_skin(ctrl, skin)) {
+            cout << "Warning: Controller " 
+                 << ctrl_resolve.referenced_id.toAscii() << " instantiated "
+                 << "by node '" << ctrl_resolve.c_node_id << "' is drawn "
+                 << "without skinning." << endl;
+            add_geometries(*it_ctrl, it_conv->second, NULL);
+        } else {
+            add_geometries(*it_ctrl, it_conv->second, &skin);
+        }
     }
 
     //get cameras
@@ -650,6 +676,30 @@ bool VisualSceneProcessor::post_process() {
 
     }
 
+    //prebuild the player's octree for all static geometries
+    if (bakery_config.spatial_index()) {
+        SpatialIndex::MeshSphereMap mesh_spheres;
+        BakerCache::GeometryBakeCache::const_iterator it_bc;
+        for ( it_bc = _baker->cache().geometries.begin();
+              it_bc != _baker->cache().geometries.end();
+              ++it_bc )
+        {
+            mesh_spheres.insert(it_bc->second.bounding_spheres.begin(),
+                                it_bc->second.bounding_spheres.end());
+        }
+
+        rtr_format::SpatialIndex* index = _rtr_scene.mutable_spatial_index();
+        if (SpatialIndex::build(_rtr_scene, mesh_spheres, _animated_trafos,
+                                bakery_config.spatial_index_depth(), *index))
+        {
+            cout << "Spatial index: " << index->geometry_index_size() << " of "
+                 << _rtr_scene.geometry_size() << " geometries static in "
+                 << index->cell_size() << " cells." << endl;
+        } else {
+            _rtr_scene.clear_spatial_index();
+        }
+    }
+
     //TODO: if you are not careful, a similar named scene (which is not required
     //to be unique, could overwrite another one by accident)
     bool b = _baker->write_baked(_rtr_scene.name(), 
@@ -671,3 +721,110 @@ bool VisualSceneProcessor::post_process() {
 
     return true;
 }
+
+void VisualSceneProcessor::add_geometries(
+                                    const GeometryResolveData& geo,
+                                    const GeometryProcessor::BakeCache& conv,
+                                    const rtr_format::Skin* skin)
+{
+    //add a rtr-geometry in the rtr-scene with the appropriate 
+    //transform node
+    GeometryProcessor::MeshToMaterialMap::const_iterator it_mmp;
+    for ( it_mmp = conv.rtr_meshes.begin();
+          it_mmp != conv.rtr_meshes.end();
+          ++it_mmp )
+    {
+        rtr_format::Geometry* rtr_geo = _rtr_scene.add_geometry();
+        rtr_geo->set_transform_node(geo.resolve_data.rtr_node);
+        string rtr_id = geo.resolve_data.c_node_id + "_" 
+                        + it_mmp->first + "_instance";
+        rtr_geo->set_id( rtr_id );
+        cout << "RTR Geo with: " << rtr_id << std::endl;
+        rtr_geo->set_mesh_id(it_mmp->first);
+
+        if (skin != NULL)
+            rtr_geo->mutable_skin()->CopyFrom(*skin);
+
+        //MaterialId (of mesh) -> ColladaUniqueId -> rtr_material string
+        MatBindingMap::const_iterator it_mat = 
+                            geo.material_bindings.find(it_mmp->second);
+        if (it_mat != geo.material_bindings.end()) {
+            
+            CF::UniqueId c_mat_id = it_mat->second.getReferencedMaterial();
+
+            //TODO: we should deal with the texture coordinate binding
+            //more carefully in here. At the moment we just make a few
+            //assumptions about which texture channels should be used
+            //for which types of textures.
+
+            BakerCache::MaterialBakeCache::const_iterator it_baked_mat = 
+                                  _baker->cache().materials.find(c_mat_id);
+
+            if (it_baked_mat == _baker->cache().materials.end()) {
+                cout << "Error: Could not resolve material " << 
+                    c_mat_id.toAscii() << "." << endl;
+                cout << "Using 'error material' instead." << endl;
+                rtr_geo->set_material_id(rtr::ERROR_MATERIAL_NAME());
+            } else {
+                //Found the baked material, set its cached rtr-ID
+                string rtr_mat_id = it_baked_mat->second.rtr_material_id;
+                rtr_geo->set_material_id(rtr_mat_id);
+            }
+
+        } else {
+            cout << "Warning: Could not resolve material binding '"
+                 << it_mmp->second << "' of mesh " << rtr_id << endl;
+            cout << "         Setting 'error material' instead." << endl;
+            rtr_geo->set_material_id(rtr::ERROR_MATERIAL_NAME());
+        }
+
+    }
+}
+
+bool VisualSceneProcessor::setup_skin(
+                                  const ControllerProcessor::BakeCache& ctrl,
+                                  rtr_format::Skin& skin)
+{
+    BakerCache::SkinBakeCache::const_iterator it_skin = 
+                                   _baker->cache().skins.find(ctrl.skin_data);
+
+    //The bounds are only calculated if the geometry could be skinned
+    if ( it_skin == _baker->cache().skins.end() || 
+         ctrl.joint_bounds.empty() )
+        return false;
+
+    const vector<mat4>& joint_matrices = it_skin->second.joint_matrices;
+
+    if (ctrl.joints.size() != joint_matrices.size()) {
+        cout << "Error: Controller has " << ctrl.joints.size() 
+             << " joints, but its skin has " << joint_matrices.size() 
+             << "." << endl;
+        return false;
+    }
+
+    for (size_t j = 0; j < ctrl.joints.size(); ++j) {
+
+        BakerCache::NodeIdMap::const_iterator it_node = 
+                               _baker->cache().rtr_nodes.find(ctrl.joints[j]);
+
+        if (it_node == _baker->cache().rtr_nodes.end()) {
+            cout << "Error: Could not resolve joint node " 
+                 << ctrl.joints[j].toAscii() << "." << endl;
+            return false;
+        }
+
+        skin.add_joint_node(it_node->second);
+
+        for (int c = 0; c < 4; ++c)
+            for (int r = 0; r < 4; ++r)
+                skin.add_inverse_bind_matrix(joint_matrices[j][c][r]);
+
+        const vec4& bounds = ctrl.joint_bounds[j];
+        skin.add_joint_bounds(bounds.x);
+        skin.add_joint_bounds(bounds.y);
+        skin.add_joint_bounds(bounds.z);
+        skin.add_joint_bounds(bounds.w);
+    }
+
+    return true;
+}
\ No newline at end of file
@@ -26,11 +26,14 @@
 #include "Types.h"
 
 #include "Processor.h"
+#include "GeometryProcessor.h"
+#include "ControllerProcessor.h"
 
 #include "rtr_format.pb.h"
 
 #include "COLLADAFWNode.h"
 #include "COLLADAFWUniqueId.h"
+#include "COLLADAFWMaterialBinding.h"
 
 #include <set>
 
@@ -100,11 +103,30 @@ namespace ColladaBakery {
 
         list<ResolveData> _camera_instances;
         list<GeometryResolveData> _geometry_instances;
+        list<GeometryResolveData> _controller_instances;
         list<ResolveData> _light_instances;
         list<NodeResolveData> _node_instances;
 
+        //also registers the material bindings with the BakerCache
+        GeometryResolveData resolve_geometry_instance( 
+                                  const string& c_node_id,
+                                  const CF::UniqueId& c_instanced_id,
+                                  const CF::MaterialBindingArray& c_bindings );
+
+        //adds a rtr geometry for each mesh of a converted geometry
+        void add_geometries(const GeometryResolveData& geo,
+                            const GeometryProcessor::BakeCache& conv,
+                            const rtr_format::Skin* skin);
+
+        //returns false if the controller's skin could not be resolved
+        bool setup_skin(const ControllerProcessor::BakeCache& ctrl,
+                        rtr_format::Skin& skin);
+
         std::set<string> _nodes_name_cache;
 
+        //IDs of all transforms that are targeted by an animation
+        std::set<string> _animated_trafos;
+
     };
 
     typedef boost::shared_ptr<VisualSceneProcessor> VisualSceneProcessorRef;
@@ -0,0 +1,96 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef BAKED_TEXTURE_H
+#define BAKED_TEXTURE_H
+
+#include <stdint.h>
+#include <string>
+
+/**
+ * Layout of the texture container that is written by the bakery and
+ * memory-mapped by the player. A file starts with a BakedTextureHeader,
+ * followed by header.level_count BakedTextureLevel entries and the tightly
+ * packed pixel data of all mip levels (largest level first). The entries
+ * start right after the 36 byte header, so their 64 bit fields are not 
+ * aligned and have to be copied out instead of being read in place.
+ *
+ * Levels are either raw pixels or, if BAKED_TEXTURE_COMPRESSED is set, 
+ * 4x4 blocks in the compressed internal format (BC1, BC3 or BC5).
+ *
+ * Formats are stored as plain OpenGL enum values, so the player can hand them
+ * directly to glTexImage2D. The bakery does not include any GL headers, this
+ * is why the few enums we need are repeated here.
+ */
+
+namespace rtr {
+
+    inline const std::string& kBakedTextureExtension() {
+        static const std::string s = ".rtex";
+        return s;
+    }
+
+    static const char kBakedTextureMagic[4] = {'R', 'T', 'E', 'X'};
+    static const uint32_t kBakedTextureVersion = 2;
+    static const uint32_t kBakedTextureMaxLevels = 32;
+
+    namespace BakedTextureFormat {
+        static const uint32_t RGB = 0x1907;
+        static const uint32_t RGBA = 0x1908;
+        static const uint32_t UNSIGNED_BYTE = 0x1401;
+        static const uint32_t RGB8 = 0x8051;
+        static const uint32_t RGBA8 = 0x8058;
+        static const uint32_t SRGB8 = 0x8C41;
+        static const uint32_t SRGB8_ALPHA8 = 0x8C43;
+        static const uint32_t COMPRESSED_SRGB_S3TC_DXT1 = 0x8C4C;
+        static const uint32_t COMPRESSED_SRGB_ALPHA_S3TC_DXT5 = 0x8C4F;
+        static const uint32_t COMPRESSED_RG_RGTC2 = 0x8DBD;
+    }
+
+    enum BakedTextureFlags {
+        BAKED_TEXTURE_NORMAL_MAP = 1, /**< Mips were filtered as normals. */
+        BAKED_TEXTURE_COMPRESSED = 2  /**< Levels are block-compressed. */
+    };
+
+    struct BakedTextureHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t width;
+        uint32_t height;
+        uint32_t level_count;
+        uint32_t format;          /**< GL pixel format, e.g. GL_RGBA. Equals
+                                       internal_format if compressed. */
+        uint32_t type;            /**< GL pixel type, e.g. GL_UNSIGNED_BYTE.
+                                       0 if compressed. */
+        uint32_t internal_format; /**< GL internal format of the texture */
+        uint32_t flags;           /**< Combination of BakedTextureFlags */
+    };
+
+    struct BakedTextureLevel {
+        uint32_t width;
+        uint32_t height;
+        uint64_t offset;          /**< Byte offset from the start of the file */
+        uint64_t size;            /**< Byte size of this level */
+    };
+
+}
+
+#endif //BAKED_TEXTURE_H
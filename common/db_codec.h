@@ -0,0 +1,400 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef DB_CODEC_H
+#define DB_CODEC_H
+
+#include <stdint.h>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sstream>
+
+#include <kccompress.h>
+#include <zlib.h>
+
+/**
+ * Record codecs for the baked scene database. 
+ *
+ * The bakery compresses every record with the selected codec (via Kyoto's
+ * TCOMPRESS option) and records the codec in the opaque region of the 
+ * database header. The player reads this header and installs the matching 
+ * decoder before reading any record. Databases without a codec header were
+ * written with Kyoto's default ZLIB compressor.
+ *
+ * Every compressed record starts with its uncompressed size (uint32, 
+ * little-endian), followed by the codec payload:
+ *
+ *   DB_CODEC_ZLIB - zlib stream, level 1 (fast) to 9 (small)
+ *   DB_CODEC_LZ4  - LZ4 block format, trades size for decoding speed
+ */
+
+namespace rtr {
+
+    enum DBCodecType {
+        DB_CODEC_NONE = 0,
+        DB_CODEC_ZLIB = 1,
+        DB_CODEC_LZ4  = 2
+    };
+
+    static const char kDBCodecMagic[4] = {'R', 'T', 'R', 'C'};
+
+    namespace LZ4 {
+
+        static const size_t kMinMatch = 4;
+        static const size_t kLastLiterals = 5;
+        static const size_t kMatchLimit = 12;
+        static const int kHashBits = 16;
+
+        inline uint32_t read32(const unsigned char* p) {
+            uint32_t v;
+            std::memcpy(&v, p, 4);
+            return v;
+        }
+
+        inline void write_length(unsigned char*& op, size_t length) {
+            while (length >= 255) {
+                *op++ = 255;
+                length -= 255;
+            }
+            *op++ = (unsigned char)length;
+        }
+
+        inline bool read_length(const unsigned char* src, size_t size,
+                                size_t& ip, size_t& length) {
+            unsigned char b;
+            do {
+                if (ip >= size)
+                    return false;
+                b = src[ip++];
+                length += b;
+            } while (b == 255);
+            return true;
+        }
+
+        /** Worst case size of compressing size bytes. */
+        inline size_t bound(size_t size) {
+            return size + size / 255 + 16;
+        }
+
+        /** 
+         * Greedy single-pass compression into the LZ4 block format. dst must
+         * hold at least bound(size) bytes. Returns the compressed size.
+         */
+        inline size_t compress(const unsigned char* src, size_t size, 
+                               unsigned char* dst) {
+            unsigned char* op = dst;
+            size_t anchor = 0;
+
+            if (size > kMatchLimit) {
+                std::vector<uint32_t> table(size_t(1) << kHashBits, 0);
+
+                size_t ip = 0;
+                size_t misses = 0;
+                size_t match_start_limit = size - kMatchLimit;
+                size_t match_end_limit = size - kLastLiterals;
+
+                while (ip < match_start_limit) {
+                    uint32_t sequence = read32(src + ip);
+                    uint32_t h = (sequence * 2654435761U) >> (32 - kHashBits);
+                    size_t candidate = table[h];
+                    table[h] = uint32_t(ip);
+
+                    if (candidate >= ip || ip - candidate > 65535 ||
+                        read32(src + candidate) != sequence) {
+                        //skip faster through data that does not compress
+                        ip += 1 + (misses++ >> 6);
+                        continue;
+                    }
+
+                    misses = 0;
+
+                    size_t length = kMinMatch;
+                    while (ip + length < match_end_limit && 
+                           src[candidate + length] == src[ip + length])
+                        ++length;
+
+                    size_t literals = ip - anchor;
+                    size_t match = length - kMinMatch;
+
+                    *op++ = (unsigned char)(
+                        ((literals < 15 ? literals : 15) << 4) | 
+                        (match < 15 ? match : 15));
+
+                    if (literals >= 15)
+                        write_length(op, literals - 15);
+
+                    std::memcpy(op, src + anchor, literals);
+                    op += literals;
+
+                    size_t offset = ip - candidate;
+                    *op++ = (unsigned char)(offset & 0xff);
+                    *op++ = (unsigned char)(offset >> 8);
+
+                    if (match >= 15)
+                        write_length(op, match - 15);
+
+                    ip += length;
+                    anchor = ip;
+                }
+            }
+
+            //the last sequence holds only literals
+            size_t literals = size - anchor;
+            *op++ = (unsigned char)((literals < 15 ? literals : 15) << 4);
+            if (literals >= 15)
+                write_length(op, literals - 15);
+
+            std::memcpy(op, src + anchor, literals);
+            op += literals;
+
+            return op - dst;
+        }
+
+        /**
+         * Decompresses an LZ4 block, which must decode to exactly dst_size
+         * bytes. Returns false for malformed input.
+         */
+        inline bool decompress(const unsigned char* src, size_t size,
+                               unsigned char* dst, size_t dst_size) {
+            size_t ip = 0;
+            size_t op = 0;
+
+            while (true) {
+                if (ip >= size)
+                    return false;
+
+                unsigned char token = src[ip++];
+
+                size_t literals = token >> 4;
+                if (literals == 15 && !read_length(src, size, ip, literals))
+                    return false;
+
+                if (literals > size - ip || literals > dst_size - op)
+                    return false;
+
+                std::memcpy(dst + op, src + ip, literals);
+                ip += literals;
+                op += literals;
+
+                if (ip == size)
+                    return op == dst_size;
+
+                if (size - ip < 2)
+                    return false;
+
+                size_t offset = src[ip] | (src[ip + 1] << 8);
+                ip += 2;
+
+                if (offset == 0 || offset > op)
+                    return false;
+
+                size_t length = token & 15;
+                if (length == 15 && !read_length(src, size, ip, length))
+                    return false;
+                length += kMinMatch;
+
+                if (length > dst_size - op)
+                    return false;
+
+                //matches may overlap the output, copy byte by byte
+                const unsigned char* match = dst + op - offset;
+                for (size_t i = 0; i < length; ++i) {
+                    dst[op + i] = match[i];
+                }
+                op += length;
+            }
+        }
+    }
+
+    /**
+     * Kyoto compressor implementing the codecs above. An instance has to 
+     * outlive the database it is installed into (see 
+     * kc::HashDB::tune_compressor).
+     */
+    class DBCodec : public kyotocabinet::Compressor 
+    {
+    public:
+
+        DBCodec(DBCodecType type = DB_CODEC_ZLIB, int level = 6) :
+            _type(type), _level(level) {}
+
+        DBCodecType type() const { return _type; }
+        int level() const { return _level; }
+
+        /** Human readable name, the inverse of parse(). */
+        std::string name() const {
+            switch (_type) {
+            case DB_CODEC_NONE: return "none";
+            case DB_CODEC_LZ4: return "lz4";
+            case DB_CODEC_ZLIB: break;
+            }
+            std::ostringstream os;
+            os << "zlib:" << _level;
+            return os.str();
+        }
+
+        /**
+         * Parses a codec name: "none", "lz4", "zlib" or "zlib:<level>" with
+         * a level from 1 to 9. Returns false for unknown names.
+         */
+        bool parse(const std::string& name) {
+            if (name == "none") {
+                _type = DB_CODEC_NONE;
+                _level = 0;
+            } else if (name == "lz4") {
+                _type = DB_CODEC_LZ4;
+                _level = 0;
+            } else if (name == "zlib") {
+                _type = DB_CODEC_ZLIB;
+                _level = 6;
+            } else if (name.size() == 6 && name.compare(0, 5, "zlib:") == 0 &&
+                       name[5] >= '1' && name[5] <= '9') {
+                _type = DB_CODEC_ZLIB;
+                _level = name[5] - '0';
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        /** Writes the codec into the 16 byte opaque region of a DB. */
+        void write_header(char* opaque) const {
+            std::memset(opaque, 0, 16);
+            std::memcpy(opaque, kDBCodecMagic, 4);
+            opaque[4] = char(_type);
+            opaque[5] = char(_level);
+        }
+
+        /** 
+         * Reads the codec from the opaque region of a DB. Returns false if 
+         * the DB has no (or an unknown) codec header.
+         */
+        bool read_header(const char* opaque) {
+            if (std::memcmp(opaque, kDBCodecMagic, 4) != 0)
+                return false;
+
+            if (opaque[4] != DB_CODEC_NONE && opaque[4] != DB_CODEC_ZLIB &&
+                opaque[4] != DB_CODEC_LZ4)
+                return false;
+
+            _type = DBCodecType(opaque[4]);
+            _level = opaque[5];
+            return true;
+        }
+
+        char* compress(const void* buf, size_t size, size_t* sp) {
+            const unsigned char* src = (const unsigned char*)buf;
+
+            size_t bound = size;
+            if (_type == DB_CODEC_ZLIB) {
+                bound = compressBound(uLong(size));
+            } else if (_type == DB_CODEC_LZ4) {
+                bound = LZ4::bound(size);
+            }
+
+            char* out = new char[bound + 4];
+            unsigned char* dst = (unsigned char*)out + 4;
+
+            out[0] = char(size & 0xff);
+            out[1] = char((size >> 8) & 0xff);
+            out[2] = char((size >> 16) & 0xff);
+            out[3] = char((size >> 24) & 0xff);
+
+            size_t out_size = 0;
+
+            switch (_type) {
+            case DB_CODEC_NONE:
+                std::memcpy(dst, src, size);
+                out_size = size;
+                break;
+            case DB_CODEC_ZLIB: {
+                uLongf dst_size = uLongf(bound);
+                if (compress2(dst, &dst_size, src, uLong(size), _level) != 
+                    Z_OK) {
+                    delete[] out;
+                    return NULL;
+                }
+                out_size = dst_size;
+                break;
+            }
+            case DB_CODEC_LZ4:
+                out_size = LZ4::compress(src, size, dst);
+                break;
+            }
+
+            *sp = out_size + 4;
+            return out;
+        }
+
+        char* decompress(const void* buf, size_t size, size_t* sp) {
+            const unsigned char* src = (const unsigned char*)buf;
+
+            if (size < 4)
+                return NULL;
+
+            size_t raw_size = size_t(src[0]) | (size_t(src[1]) << 8) |
+                              (size_t(src[2]) << 16) | (size_t(src[3]) << 24);
+
+            src += 4;
+            size -= 4;
+
+            //Kyoto expects a terminating zero after the data
+            char* out = new char[raw_size + 1];
+            unsigned char* dst = (unsigned char*)out;
+            out[raw_size] = '\0';
+
+            bool success = false;
+
+            switch (_type) {
+            case DB_CODEC_NONE:
+                success = (size == raw_size);
+                if (success)
+                    std::memcpy(dst, src, size);
+                break;
+            case DB_CODEC_ZLIB: {
+                uLongf dst_size = uLongf(raw_size);
+                success = uncompress(dst, &dst_size, src, uLong(size)) == 
+                          Z_OK && dst_size == raw_size;
+                break;
+            }
+            case DB_CODEC_LZ4:
+                success = LZ4::decompress(src, size, dst, raw_size);
+                break;
+            }
+
+            if (!success) {
+                delete[] out;
+                return NULL;
+            }
+
+            *sp = raw_size;
+            return out;
+        }
+
+    private:
+
+        DBCodecType _type;
+        int _level;
+    };
+}
+
+#endif //DB_CODEC_H
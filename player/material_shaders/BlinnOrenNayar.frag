@@ -32,9 +32,10 @@ uniform Material
     float shininess;
     vec3 specular;
     vec4 color;
+    float tex_layer;
 };
 
-uniform sampler2D tex;
+uniform material_sampler tex;
 
 vec3 calc_illumination(vec3 albedo, float shininess)
 {
@@ -51,7 +52,9 @@ vec3 calc_illumination(vec3 albedo, float shininess)
     float eta_o = acos(dot(normal,view));
     vec3 Vp = normalize(view - dot(normal,view) * normal);
 
-    for (int i = 0; i < light_count; ++i) {
+    uvec2 cluster = find_light_cluster(mvaryings.position);
+    for (int n = 0; n < cluster_light_count(cluster); ++n) {
+        int i = cluster_light(cluster, n);
         vec3 light;
         vec3 intensity;
 
@@ -79,7 +82,7 @@ vec3 calc_illumination(vec3 albedo, float shininess)
 
 vec4 eval_material(void)
 {
-    float v = texture(tex, mvaryings.tex_coord).x;
+    float v = material_texture(tex, tex_layer, mvaryings.tex_coord).x;
     vec3 albedo = color.xyz;
     return vec4(calc_illumination(albedo, 10+v*50),1);
 }
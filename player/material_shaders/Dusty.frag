@@ -38,13 +38,18 @@ uniform Material
     float dust_min_angle;
     float dust_exponent;
     vec3 dust_color;
+    float diffuse_tex_layer;
+    float specular_tex_layer;
+    float ambient_occ_tex_layer;
+    float normal_tex_layer;
+    float dust_noise_tex_layer;
 };
 
-uniform sampler2D diffuse_tex;
-uniform sampler2D specular_tex;
-uniform sampler2D ambient_occ_tex;
-uniform sampler2D normal_tex;
-uniform sampler2D dust_noise_tex;
+uniform material_sampler diffuse_tex;
+uniform material_sampler specular_tex;
+uniform material_sampler ambient_occ_tex;
+uniform material_sampler normal_tex;
+uniform material_sampler dust_noise_tex;
 
 vec3 calc_illumination(vec3 albedo, vec3 specular_color, float ambient_occlusion)
 {
@@ -52,7 +57,8 @@ vec3 calc_illumination(vec3 albedo, vec3 specular_color, float ambient_occlusion
     vec3 tangent = normalize(mvaryings.tangent);
     vec3 bitangent = normalize(mvaryings.bitangent);
     
-    vec3 normal_ts = normalize(texture(normal_tex, mvaryings.uv_normalmap).xyz  - 0.5f);
+    vec3 normal_ts = decode_normal(material_texture(normal_tex, normal_tex_layer,
+                                                    mvaryings.uv_normalmap));
 
     // Transform normalmap normal from tangent space to world space
     vec3 normal_ws = normalize(mat3( tangent, bitangent, normal) * normal_ts);
@@ -66,7 +72,9 @@ vec3 calc_illumination(vec3 albedo, vec3 specular_color, float ambient_occlusion
     vec3 dust_intensity = vec3(0.0);
     vec3 total_intensity = vec3(0.0);
 
-    for (int i = 0; i < light_count; ++i) {
+    uvec2 cluster = find_light_cluster(mvaryings.position);
+    for (int n = 0; n < cluster_light_count(cluster); ++n) {
+        int i = cluster_light(cluster, n);
         vec3 light_ws;
         vec3 intensity;
 
@@ -95,7 +103,8 @@ vec3 calc_illumination(vec3 albedo, vec3 specular_color, float ambient_occlusion
     float thickness = smoothstep(dust_min_angle, 1, max(0,normal_ws.z));
 
     vec2 dust_tex_coord = mvaryings.position.xy * 0.015;
-    float noise_tex_factor = texture(dust_noise_tex, dust_tex_coord).r * 1.5;
+    float noise_tex_factor = material_texture(dust_noise_tex, dust_noise_tex_layer,
+                                              dust_tex_coord).r * 1.5;
 
     vec3 mixed_dust = mix(total_intensity, dust_intensity,
                           thickness * dust_thickness * noise_tex_factor) * ambient_occlusion;
@@ -105,9 +114,12 @@ vec3 calc_illumination(vec3 albedo, vec3 specular_color, float ambient_occlusion
 
 vec4 eval_material(void)
 {
-    vec3 albedo = texture(diffuse_tex, mvaryings.uv_diffuse).xyz;
-    vec3 specular = texture(specular_tex, mvaryings.uv_specular).xyz;
-    float ambient_occlusion = texture(ambient_occ_tex, mvaryings.uv_ambientmap).r;
+    vec3 albedo = material_texture(diffuse_tex, diffuse_tex_layer,
+                                   mvaryings.uv_diffuse).xyz;
+    vec3 specular = material_texture(specular_tex, specular_tex_layer,
+                                     mvaryings.uv_specular).xyz;
+    float ambient_occlusion = material_texture(ambient_occ_tex, ambient_occ_tex_layer,
+                                               mvaryings.uv_ambientmap).r;
 
     vec3 ill = calc_illumination(albedo, specular, ambient_occlusion);
 
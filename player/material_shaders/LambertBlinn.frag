@@ -31,10 +31,12 @@ uniform Material
 {
     float shininess;
     vec3 specular_color;
+    float light_map_layer;
+    float albedo_tex_layer;
 };
 
-uniform sampler2D light_map;
-uniform sampler2D albedo_tex;
+uniform material_sampler light_map;
+uniform material_sampler albedo_tex;
 
 vec3 calc_illumination(vec3 albedo)
 {
@@ -43,7 +45,9 @@ vec3 calc_illumination(vec3 albedo)
 
     vec3 total_intensity = vec3(0);
 
-    for (int i = 0; i < light_count; ++i) {
+    uvec2 cluster = find_light_cluster(mvaryings.position);
+    for (int n = 0; n < cluster_light_count(cluster); ++n) {
+        int i = cluster_light(cluster, n);
         vec3 light;
         vec3 intensity;
 
@@ -62,8 +66,10 @@ vec3 calc_illumination(vec3 albedo)
 
 vec4 eval_material(void)
 {
-    vec3 albedo = texture(albedo_tex, mvaryings.tex_coord).xyz;
-    vec3 ambient = texture(light_map, mvaryings.tex_coord2).xyz;
+    vec3 albedo = material_texture(albedo_tex, albedo_tex_layer,
+                                   mvaryings.tex_coord).xyz;
+    vec3 ambient = material_texture(light_map, light_map_layer,
+                                    mvaryings.tex_coord2).xyz;
 
     return vec4((calc_illumination(albedo) + ambient*albedo, 1);
 }
@@ -35,12 +35,16 @@ uniform Material
 {
     float shininess;
     float silk_factor;
+    float diffuse_tex_layer;
+    float specular_tex_layer;
+    float lightmap_tex_layer;
+    float normal_tex_layer;
 };
 
-uniform sampler2D diffuse_tex;
-uniform sampler2D specular_tex;
-uniform sampler2D lightmap_tex;
-uniform sampler2D normal_tex;
+uniform material_sampler diffuse_tex;
+uniform material_sampler specular_tex;
+uniform material_sampler lightmap_tex;
+uniform material_sampler normal_tex;
 
 float silk_lobe(vec3 V, vec3 N)
 {
@@ -56,7 +60,8 @@ vec3 calc_illumination(vec3 albedo, vec3 specular_color, vec3 indirect_ill)
     vec3 tangent = normalize(mvaryings.tangent);
     vec3 bitangent = normalize(mvaryings.bitangent);
     
-    vec3 normal_ts = normalize(texture(normal_tex, mvaryings.uv_normalmap).xyz  - 0.5f);
+    vec3 normal_ts = decode_normal(material_texture(normal_tex, normal_tex_layer,
+                                                    mvaryings.uv_normalmap));
 
     // Transform normalmap normal from tangent space to world space
     vec3 normal_ws = normalize(mat3( tangent, bitangent, normal) * normal_ts);
@@ -69,7 +74,9 @@ vec3 calc_illumination(vec3 albedo, vec3 specular_color, vec3 indirect_ill)
 
     vec3 total_intensity = vec3(0);
 
-    for (int i = 0; i < light_count; ++i) {
+    uvec2 cluster = find_light_cluster(mvaryings.position);
+    for (int n = 0; n < cluster_light_count(cluster); ++n) {
+        int i = cluster_light(cluster, n);
         vec3 light_ws;
         vec3 intensity;
 
@@ -91,9 +98,12 @@ vec3 calc_illumination(vec3 albedo, vec3 specular_color, vec3 indirect_ill)
 
 vec4 eval_material(void)
 {
-    vec3 albedo = texture(diffuse_tex, mvaryings.uv_diffuse).xyz;
-    vec3 specular = texture(specular_tex, mvaryings.uv_specular).xyz;
-    vec3 indirect_ill = texture(lightmap_tex, mvaryings.uv_lightmap).xyz;
+    vec3 albedo = material_texture(diffuse_tex, diffuse_tex_layer,
+                                   mvaryings.uv_diffuse).xyz;
+    vec3 specular = material_texture(specular_tex, specular_tex_layer,
+                                     mvaryings.uv_specular).xyz;
+    vec3 indirect_ill = material_texture(lightmap_tex, lightmap_tex_layer,
+                                         mvaryings.uv_lightmap).xyz;
 
     vec3 ill = calc_illumination(albedo, specular, indirect_ill);
 
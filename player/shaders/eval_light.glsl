@@ -23,6 +23,52 @@
 uniform sampler2DArray shadowmaps;
 uniform float min_variance;
 
+// Five texels per light: position and type, direction and shadow id,
+// intensity, attenuation, spot attenuation
+uniform samplerBuffer light_data;
+
+// Offset into light_indices and number of lights for each cluster
+uniform usamplerBuffer light_ranges;
+uniform usamplerBuffer light_indices;
+
+vec4 light_texel(int index, int texel)
+{
+    return texelFetch(light_data, index * 5 + texel);
+}
+
+// Returns the range of clustered lights for a world space position
+uvec2 find_light_cluster(vec3 position)
+{
+    vec4 clip = cluster_view_projection * vec4(position, 1);
+
+    if (clip.w <= 0) return uvec2(0);
+
+    vec2 tile = clamp((clip.xy / clip.w * 0.5 + 0.5) * cluster_grid.xy,
+                      vec2(0), vec2(cluster_grid.xy - 1));
+    float slice = clamp(log(clip.w / cluster_depth.x) * cluster_depth.y,
+                        0, cluster_grid.z - 1);
+
+    int cluster = (int(slice) * cluster_grid.y + int(tile.y)) * 
+                  cluster_grid.x + int(tile.x);
+
+    return texelFetch(light_ranges, cluster).xy;
+}
+
+// Number of lights that have to be evaluated within a cluster
+int cluster_light_count(uvec2 cluster)
+{
+    return global_light_count + int(cluster.y);
+}
+
+// Index of the nth light of a cluster, to be passed to eval_light()
+int cluster_light(uvec2 cluster, int n)
+{
+    if (n < global_light_count) return n;
+
+    int offset = int(cluster.x) + n - global_light_count;
+    return global_light_count + int(texelFetch(light_indices, offset).x);
+}
+
 float linstep(float minv, float maxv, float v)
 {
     return maxv == minv ? 1.0 : clamp((v - minv) / (maxv - minv), 0.0, 1.0);
@@ -58,48 +104,49 @@ float attenuate(vec4 attenuation, float d)
 void eval_spotlight(in int index, in vec3 position,
                     out vec3 intensity, out vec3 direction)
 {
-    vec3 light_pos = light_positions[index];
+    vec3 light_pos = light_texel(index, 0).xyz;
 
     direction = light_pos - position;
     float d = length(direction);
     direction = normalize(direction);
 
-    float cos_angle = dot(-direction, light_directions[index]);
+    float cos_angle = dot(-direction, light_texel(index, 1).xyz);
 
-    float cos_min_angle = light_spot_attenuations[index].x;
-    float cos_max_angle = light_spot_attenuations[index].y;
+    vec2 spot_attenuation = light_texel(index, 4).xy;
+    float cos_min_angle = spot_attenuation.x;
+    float cos_max_angle = spot_attenuation.y;
 
-    float att = attenuate(light_attenuations[index], d);
+    float att = attenuate(light_texel(index, 3), d);
     att *= linstep(cos_max_angle, cos_min_angle, cos_angle);
 
-    intensity = light_intensities[index] * att;        
+    intensity = light_texel(index, 2).xyz * att;        
 }
 
 void eval_light(in int index, in vec3 position, 
                 out vec3 light_vector, out vec3 intensity)
 {
-    int type = light_types[index];
+    int type = int(light_texel(index, 0).w);
 
     if (type == POINT_LIGHT) {
-        vec3 light_pos = light_positions[index];
+        vec3 light_pos = light_texel(index, 0).xyz;
 
         light_vector = light_pos - position;
         
         float d = length(light_vector);
         light_vector = normalize(light_vector);
 
-        float att = attenuate(light_attenuations[index], d);
+        float att = attenuate(light_texel(index, 3), d);
 
-        intensity = light_intensities[index] * att;
+        intensity = light_texel(index, 2).xyz * att;
     } else if (type == DIRECTIONAL_LIGHT) {
-        light_vector = -light_directions[index];
-        intensity = light_intensities[index];
+        light_vector = -light_texel(index, 1).xyz;
+        intensity = light_texel(index, 2).xyz;
     } else if (type == SPOT_LIGHT) {
         eval_spotlight(index, position, intensity, light_vector);
     }  else /* if (type == SHADOWED_SPOT_LIGHT) */ {
         eval_spotlight(index, position, intensity, light_vector);
 
-        int shadow_id = light_shadow_ids[index];
+        int shadow_id = int(light_texel(index, 1).w);
 
         //This is a workaround for Catalyst 11.1, where uploading mat4
         //arrays had a bug. Therefeore, until this bug is fixed, we use
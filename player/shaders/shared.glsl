@@ -20,29 +20,50 @@
 //THE SOFTWARE.
 
 
-#define MAX_LIGHT_COUNT 12
+#define MAX_SHADOWMAP_COUNT 12
 
 #define POINT_LIGHT 0
 #define DIRECTIONAL_LIGHT 1
 #define SPOT_LIGHT 2
 #define SHADOWED_SPOT_LIGHT 3
 
+// With texture arrays, material textures are layers of shared arrays and
+// each texture has a member <name>_layer in the Material block.
+#ifdef TEXTURE_ARRAYS
+#define material_sampler sampler2DArray
+#define material_texture(tex, layer, uv) texture(tex, vec3(uv, layer))
+#else
+#define material_sampler sampler2D
+#define material_texture(tex, layer, uv) texture(tex, uv)
+#endif
+
 uniform Shared
 {
     vec3 ambient;
-    int  light_types[MAX_LIGHT_COUNT];
-    int light_shadow_ids[MAX_LIGHT_COUNT];
-    vec3 light_positions[MAX_LIGHT_COUNT];
-    vec3 light_directions[MAX_LIGHT_COUNT];
-    vec3 light_intensities[MAX_LIGHT_COUNT];
-    vec4 light_attenuations[MAX_LIGHT_COUNT];
-    vec2 light_spot_attenuations[MAX_LIGHT_COUNT];
     
-    vec4 shadow_matrices[MAX_LIGHT_COUNT*4];
+    vec4 shadow_matrices[MAX_SHADOWMAP_COUNT*4];
     float shadowmap_min_variance;
     float shadow_bleed_bias;
     
+    // Lights are stored in light_data, the first global_light_count of 
+    // them light everything, the others are assigned to clusters.
     int light_count;
+    int global_light_count;
+
+    // Clusters are tiles on screen, cut into slices that are spaced
+    // exponentially between the near (x of cluster_depth) and the far plane
+    mat4 cluster_view_projection;
+    ivec3 cluster_grid;
+    vec2 cluster_depth;
+
     vec3 camera_world_position;
 };
 
+
+// Decode a tangent space normal from a normal map texel. Only x and y are
+// used, since block-compressed normal maps (BC5) do not store z.
+vec3 decode_normal(vec4 texel)
+{
+    vec2 xy = texel.xy * 2.0f - 1.0f;
+    return vec3(xy, sqrt(max(0.0f, 1.0f - dot(xy, xy))));
+}
@@ -0,0 +1,68 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#version 150
+
+//Skins the bind pose of a mesh into the buffers of a skinned geometry with
+//transform feedback, one point per vertex. Nothing is rasterized.
+
+in vec4 vertex;
+in vec3 normal;
+in vec4 tangent;
+in vec4 joint_index;
+in vec4 joint_weight;
+
+out vec3 skinned_vertex;
+out vec3 skinned_normal;
+out vec4 skinned_tangent;
+
+//The palettes of all skins drawn in a frame, a matrix is stored as four 
+//columns
+uniform samplerBuffer palettes;
+uniform int palette_offset;
+
+mat4 joint_matrix(float joint)
+{
+    int texel = (palette_offset + int(joint)) * 4;
+
+    return mat4(texelFetch(palettes, texel),
+                texelFetch(palettes, texel + 1),
+                texelFetch(palettes, texel + 2),
+                texelFetch(palettes, texel + 3));
+}
+
+void main (void)
+{
+    mat4 m = joint_matrix(joint_index.x) * joint_weight.x +
+             joint_matrix(joint_index.y) * joint_weight.y +
+             joint_matrix(joint_index.z) * joint_weight.z +
+             joint_matrix(joint_index.w) * joint_weight.w;
+
+    //Not the inverse transpose, see Skinning.h. The material shaders 
+    //normalize.
+    mat3 m3 = mat3(m);
+
+    skinned_vertex = (m * vertex).xyz;
+    skinned_normal = m3 * normal;
+    skinned_tangent = vec4(m3 * tangent.xyz, tangent.w);
+
+    gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+}
@@ -32,11 +32,13 @@ void AnimEvaluator::add_animation(const Animation& animation, float time_offset)
 
     AnimEntry entry = AnimEntry(animation, time_offset, this);
     _animations[animation.id()] = entry;
+    _groups_changed = true;
 }
 
 void AnimEvaluator::remove_animation(const string& animation_id)
 {
     _animations.erase(animation_id);
+    _groups_changed = true;
 }
 
 void AnimEvaluator::free_listener(const string& name)
@@ -69,6 +71,129 @@ void AnimEvaluator::update_absolute(float time)
     }
 }
 
+void AnimEvaluator::update_ungrouped(float time)
+{
+    if (_listener_groups.empty()) {
+        update_absolute(time);
+        return;
+    }
+
+    if (_groups_changed)
+        resolve_groups();
+
+    _time = time;
+
+    for (size_t i = 0; i < _ungrouped.size(); ++i) {
+        _ungrouped[i].channel->update(time + _ungrouped[i].time_offset);
+    }
+}
+
+void AnimEvaluator::update_group(int group)
+{
+    if (_groups_changed)
+        resolve_groups();
+
+    if (group < 0 || group >= (int)_groups.size())
+        return;
+
+    const vector<GroupChannel>& channels = _groups[group];
+
+    for (size_t i = 0; i < channels.size(); ++i) {
+        channels[i].channel->update(_time + channels[i].time_offset);
+    }
+}
+
+void AnimEvaluator::set_listener_group(const string& name, int group)
+{
+    if (group < 0) {
+        _listener_groups.erase(name);
+    } else {
+        _listener_groups[name] = group;
+    }
+
+    _groups_changed = true;
+}
+
+void AnimEvaluator::animated_listeners(std::set<string>& names) const
+{
+    for (map<string, AnimEntry>::const_iterator i = _animations.begin();
+         i != _animations.end(); ++i) {
+        const AnimEntry& entry = i->second;
+        for (list<AnimEntry::ChannelEntry>::const_iterator c = 
+                 entry._channels.begin(); c != entry._channels.end(); ++c) {
+            names.insert(c->_listener_name);
+        }
+    }
+}
+
+void AnimEvaluator::key_times(const std::set<string>& listeners,
+                              vector<float>& times) const
+{
+    for (map<string, AnimEntry>::const_iterator i = _animations.begin();
+         i != _animations.end(); ++i) {
+        const AnimEntry& entry = i->second;
+        for (list<AnimEntry::ChannelEntry>::const_iterator c = 
+                 entry._channels.begin(); c != entry._channels.end(); ++c) {
+            if (listeners.count(c->_listener_name) == 0)
+                continue;
+
+            //Keys are every third control point, see end_time()
+            int segments = c->_time_sampler->segment_count();
+            for (int k = 0; k <= segments; ++k) {
+                times.push_back(c->_time_points[k * 3] - entry._time_offset);
+            }
+        }
+    }
+}
+
+void AnimEvaluator::resolve_groups()
+{
+    _ungrouped.clear();
+    _groups.clear();
+
+    for (map<string, AnimEntry>::iterator i = _animations.begin();
+         i != _animations.end(); ++i) {
+        AnimEntry& entry = i->second;
+        for (list<AnimEntry::ChannelEntry>::iterator c = 
+                 entry._channels.begin(); c != entry._channels.end(); ++c) {
+            GroupChannel channel = {&(*c), entry._time_offset};
+
+            map<string, int>::const_iterator group = 
+                _listener_groups.find(c->_listener_name);
+
+            if (group == _listener_groups.end()) {
+                _ungrouped.push_back(channel);
+                continue;
+            }
+
+            if ((int)_groups.size() <= group->second) {
+                _groups.resize(group->second + 1);
+            }
+
+            _groups[group->second].push_back(channel);
+        }
+    }
+
+    _groups_changed = false;
+}
+
+float AnimEvaluator::end_time() const
+{
+    float end = 0;
+
+    for (map<string, AnimEntry>::const_iterator i = _animations.begin();
+         i != _animations.end(); ++i) {
+        const AnimEntry& entry = i->second;
+        for (list<AnimEntry::ChannelEntry>::const_iterator c = 
+                 entry._channels.begin(); c != entry._channels.end(); ++c) {
+            //channels are evaluated at time + offset
+            end = glm::max(end, c->_end_time - entry._time_offset);
+        }
+    }
+
+    return end;
+}
+
 shared_array<float> AnimEvaluator::get_listener_ref(const string& name,
                                                     int components)
 {
@@ -148,9 +273,11 @@ AnimEvaluator::AnimEntry::AnimEntry(const Animation& animation,
     _animation(&animation), _channels(), _time_offset(time_offset), _parent(parent)
 {
     for (int i = 0; i < animation.channel_size(); ++i) {
-        _channels.push_back(ChannelEntry(animation, 
-                                         animation.channel(i), 
-                                         parent));
+        ChannelEntry channel(animation, animation.channel(i), parent);
+
+        //Channels with unusable samplers hold no listener, skip them
+        if (channel.is_valid())
+            _channels.push_back(channel);
     }
 }
 
@@ -193,7 +320,11 @@ AnimEvaluator::AnimEntry::ChannelEntry::ChannelEntry
      const Animation_Channel& channel,
      AnimEvaluator* parent) :
     _time_sampler(NULL), _data_sampler(NULL),
+    _time_points(NULL), _data_points(NULL),
+    _components(0), _target_offset(0),
     _target_name(channel.target()),
+    _listener_name(_target_name.substr(0, _target_name.find('.'))),
+    _start_time(0.0f), _end_time(0.0f),
     _current_segment(0)
 {
     for (int i = 0; i < animation.sampler_size(); ++i) {
@@ -227,18 +358,55 @@ AnimEvaluator::AnimEntry::ChannelEntry::ChannelEntry
              << endl;
     }
 
+    assert(_data_sampler->segment_count() == _time_sampler->segment_count());
+
+    if (_time_sampler->encoding() != Animation_Sampler::FLOAT) {
+        cerr << "Error ChannelEntry constructor: "
+             << "Time sampler \"" << _time_sampler->id() 
+             << "\" has to be stored as floats"
+             << endl;
+        return;
+    }
+
     assert(_time_sampler->control_point_size() == 
            (_time_sampler->segment_count()*3+1) * _time_sampler->components());
-    assert(_data_sampler->control_point_size() == 
-           (_data_sampler->segment_count()*3+1) * _data_sampler->components());
-    assert(_data_sampler->segment_count() == _time_sampler->segment_count());
+
+    _time_points = _time_sampler->control_point().data();
+
+    if (_data_sampler->encoding() == Animation_Sampler::QUANTIZED_16) {
+        int count = (_data_sampler->segment_count()*3+1) * 
+                    _data_sampler->components();
+
+        assert(_data_sampler->quantized_control_point().size() == 
+               size_t(count) * 2);
+
+        const unsigned char* bytes = (const unsigned char*)
+                                 _data_sampler->quantized_control_point().data();
+
+        _decoded_points.reset(new float[count]);
+
+        for (int i = 0; i < count; ++i) {
+            int component = i / (_data_sampler->segment_count()*3+1);
+            int q = bytes[i*2] | (bytes[i*2+1] << 8);
+            _decoded_points[i] = _data_sampler->quantization_min(component) +
+                                 q * _data_sampler->quantization_scale(component);
+        }
+
+        _data_points = _decoded_points.get();
+    } else {
+        assert(_data_sampler->control_point_size() == 
+               (_data_sampler->segment_count()*3+1) * 
+               _data_sampler->components());
+
+        _data_points = _data_sampler->control_point().data();
+    }
 
     _components = _data_sampler->components();
     
     _target_ref = parent->get_listener_ref(_target_name, _target_offset, 
                                            _components);    
-    _start_time = _time_sampler->control_point(0);
-    _end_time = _time_sampler->control_point(_time_sampler->segment_count()*3);
+    _start_time = _time_points[0];
+    _end_time = _time_points[_time_sampler->segment_count()*3];
 }
 
 void AnimEvaluator::AnimEntry::ChannelEntry::free_listeners(AnimEvaluator* parent)
@@ -298,7 +466,7 @@ void AnimEvaluator::AnimEntry::ChannelEntry::update(float time)
         for (int i = 0; i < _components; ++i) {
             // Offset of first point in curve for component i
             int offset = (_data_sampler->segment_count()*3+1)*i;
-            _target_ref[i+_target_offset] = _data_sampler->control_point(offset);
+            _target_ref[i+_target_offset] = _data_points[offset];
         }
         return;
     }
@@ -308,7 +476,7 @@ void AnimEvaluator::AnimEntry::ChannelEntry::update(float time)
             // Offset of last point in curve for component i
             int offset = (_data_sampler->segment_count()*3+1)*i;
             offset += _data_sampler->segment_count() * 3;
-            _target_ref[i+_target_offset] = _data_sampler->control_point(offset);
+            _target_ref[i+_target_offset] = _data_points[offset];
         }
         return;
     }
@@ -316,20 +484,20 @@ void AnimEvaluator::AnimEntry::ChannelEntry::update(float time)
     // Find current segment
 
     while (_current_segment < _time_sampler->segment_count() - 1 && 
-           local_time >= _time_sampler->control_point(_current_segment*3 + 3)) {
+           local_time >= _time_points[_current_segment*3 + 3]) {
         ++_current_segment;
     }
 
     while (_current_segment > 0 &&
-           local_time <= _time_sampler->control_point(_current_segment*3)) {
+           local_time <= _time_points[_current_segment*3]) {
         --_current_segment;
     }
 
     // Find t for our current time
-    float X1 = _time_sampler->control_point(_current_segment * 3 + 0);
-    float X2 = _time_sampler->control_point(_current_segment * 3 + 1);
-    float X3 = _time_sampler->control_point(_current_segment * 3 + 2);
-    float X4 = _time_sampler->control_point(_current_segment * 3 + 3);
+    float X1 = _time_points[_current_segment * 3 + 0];
+    float X2 = _time_points[_current_segment * 3 + 1];
+    float X3 = _time_points[_current_segment * 3 + 2];
+    float X4 = _time_points[_current_segment * 3 + 3];
 
     float t;
     bool success = find_zero(X1, X2, X3, X4, local_time, t);
@@ -349,10 +517,10 @@ void AnimEvaluator::AnimEntry::ChannelEntry::update(float time)
     for (int i = 0; i < _components; ++i) {
         int offset = (_data_sampler->segment_count()*3+1)*i;
         offset += _current_segment * 3;
-        float Y1 = _data_sampler->control_point(offset + 0);
-        float Y2 = _data_sampler->control_point(offset + 1);
-        float Y3 = _data_sampler->control_point(offset + 2);
-        float Y4 = _data_sampler->control_point(offset + 3);
+        float Y1 = _data_points[offset + 0];
+        float Y2 = _data_points[offset + 1];
+        float Y3 = _data_points[offset + 2];
+        float Y4 = _data_points[offset + 3];
         
         _target_ref[i + _target_offset] = eval_bezier(Y1, Y2, Y3, Y4, t);
     }
@@ -24,6 +24,8 @@
 
 #include "common.h"
 
+#include <set>
+
 #include "type_info.h"
 
 namespace rtr_format {
@@ -48,7 +50,7 @@ class AnimEvaluator
 
     public:
  
-    AnimEvaluator() : _time(0.0) {};
+    AnimEvaluator() : _time(0.0), _groups_changed(false) {};
 
     /**
      * Add rtr_format::Animation object to evaluator.
@@ -75,6 +77,46 @@ class AnimEvaluator
      */
     void update_absolute(float time);
 
+    /**
+     * Set timer and evaluate the channels of listeners without a group, 
+     * grouped channels are left at their last value until update_group().
+     * @param time Time.
+     */
+    void update_ungrouped(float time);
+
+    /**
+     * Evaluate the channels of the listeners in a group at the time of the 
+     * last update. Channels are evaluated statelessly, so a group that was
+     * skipped for a while snaps to the current values.
+     * @param group Group as passed to set_listener_group().
+     */
+    void update_group(int group);
+
+    /**
+     * Put a listener into a group, its channels are then evaluated by
+     * update_group() instead of update_ungrouped().
+     * @param name Listener name.
+     * @param group Group, -1 for none.
+     */
+    void set_listener_group(const string& name, int group);
+
+    /**
+     * Names of all listeners targeted by a channel.
+     */
+    void animated_listeners(std::set<string>& names) const;
+
+    /**
+     * Appends the times of all keys of the channels targeting the given
+     * listeners, with the time offsets of their animations applied.
+     */
+    void key_times(const std::set<string>& listeners, 
+                   vector<float>& times) const;
+
+    /**
+     * Time at which the last of the animations ends, 0 without animations.
+     */
+    float end_time() const;
+
     private:
 
     shared_array<float> get_listener_ref(const string& name,
@@ -100,13 +142,26 @@ class AnimEvaluator
             void free_listeners(AnimEvaluator* parent);
             void update(float time);
 
+            /**
+             * False if the samplers could not be used, the channel has 
+             * no listener then.
+             */
+            bool is_valid() const { return _target_ref.get() != NULL; }
+
             const Animation_Sampler* _time_sampler;
             const Animation_Sampler* _data_sampler;
 
+            // Control points of the samplers as floats. Quantized samplers 
+            // are decoded once into _decoded_points.
+            const float* _time_points;
+            const float* _data_points;
+            shared_array<float> _decoded_points;
+
             int _components;
             int _target_offset;
 
             string _target_name;
+            string _listener_name; /**< _target_name without subscript */
             shared_array<float> _target_ref;
 
             float _start_time, _end_time;
@@ -134,9 +189,27 @@ class AnimEvaluator
         int use_count;
     };
 
+    /**
+     * A grouped channel with the time offset of its animation.
+     */
+    struct GroupChannel {
+        AnimEntry::ChannelEntry* channel;
+        float time_offset;
+    };
+
+    /**
+     * Sorts the channels into _ungrouped and _groups.
+     */
+    void resolve_groups();
+
     map<string, ListenerEntry> _listeners;
     map<string, AnimEntry> _animations;
     float _time;
+
+    map<string, int> _listener_groups;
+    vector<GroupChannel> _ungrouped;
+    vector<vector<GroupChannel> > _groups;
+    bool _groups_changed;
 };
 
 /**
@@ -173,6 +246,8 @@ class AnimListener
         _name(init._name) {}
     ~AnimListener();
 
+    const string& name() const { return _name; }
+
     /**
      * Statically typed setter function.
      */
@@ -80,8 +80,7 @@ const T* ArrayAdapter::access_elements() const {
 		return glm::value_ptr(glm_vec4_access_ref[0]);
 	} catch (const boost::bad_any_cast&) {}
 
-	std::cerr << "Could not access elements. Don't know how to read." << std::endl;
-
+	//not readable as T, e.g. when testing for float on int data
 	return NULL;
 }
 
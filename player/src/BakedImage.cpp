@@ -0,0 +1,207 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "BakedImage.h"
+
+#include <algorithm>
+
+BakedImage::BakedImage(const string& filename) :
+    _mapping(NULL),
+    _size(0),
+    _header(NULL)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              NULL, OPEN_EXISTING, 
+                              FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        cerr << "BakedImage: Could not open " << filename << endl;
+        return;
+    }
+
+    LARGE_INTEGER file_size;
+    GetFileSizeEx(file, &file_size);
+    _size = size_t(file_size.QuadPart);
+
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+
+    if (mapping == NULL) {
+        cerr << "BakedImage: Could not map " << filename << endl;
+        return;
+    }
+
+    // The view keeps the mapping object alive
+    _mapping = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        cerr << "BakedImage: Could not open " << filename << endl;
+        return;
+    }
+
+    struct stat s;
+    if (fstat(fd, &s) != 0) {
+        close(fd);
+        return;
+    }
+
+    _size = size_t(s.st_size);
+
+    void* p = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (p == MAP_FAILED) {
+        cerr << "BakedImage: Could not map " << filename << endl;
+        return;
+    }
+
+    _mapping = (const char*)p;
+#endif
+
+    if (_mapping == NULL)
+        return;
+
+    _header = (const rtr::BakedTextureHeader*)_mapping;
+
+    if (!validate()) {
+        cerr << "BakedImage: " << filename 
+             << " is not a valid texture container." << endl;
+        unmap();
+        return;
+    }
+
+    // The 64 bit fields of the table are not aligned in the file
+    _levels.resize(_header->level_count);
+    memcpy(&_levels[0], _mapping + sizeof(rtr::BakedTextureHeader),
+           _levels.size() * sizeof(rtr::BakedTextureLevel));
+}
+
+BakedImage::~BakedImage()
+{
+    unmap();
+}
+
+bool BakedImage::validate() const
+{
+    if (_size < sizeof(rtr::BakedTextureHeader))
+        return false;
+
+    if (memcmp(_header->magic, rtr::kBakedTextureMagic, 4) != 0 ||
+        _header->version < 1 ||
+        _header->version > rtr::kBakedTextureVersion)
+        return false;
+
+    if (_header->level_count < 1 || 
+        _header->level_count > rtr::kBakedTextureMaxLevels)
+        return false;
+
+    if (_header->width < 1 || _header->height < 1)
+        return false;
+
+    // Bytes per pixel, or per 4x4 block if compressed
+    uint64_t unit_size = 0;
+    if (_header->flags & rtr::BAKED_TEXTURE_COMPRESSED) {
+        switch (_header->internal_format) {
+        case rtr::BakedTextureFormat::COMPRESSED_SRGB_S3TC_DXT1:
+            unit_size = 8;
+            break;
+        case rtr::BakedTextureFormat::COMPRESSED_SRGB_ALPHA_S3TC_DXT5:
+        case rtr::BakedTextureFormat::COMPRESSED_RG_RGTC2:
+            unit_size = 16;
+            break;
+        }
+    } else if (_header->type == rtr::BakedTextureFormat::UNSIGNED_BYTE) {
+        if (_header->format == rtr::BakedTextureFormat::RGB)
+            unit_size = 3;
+        else if (_header->format == rtr::BakedTextureFormat::RGBA)
+            unit_size = 4;
+    }
+
+    if (unit_size == 0)
+        return false;
+
+    size_t table_end = sizeof(rtr::BakedTextureHeader) + 
+                       _header->level_count * sizeof(rtr::BakedTextureLevel);
+
+    if (_size < table_end)
+        return false;
+
+    const char* table = _mapping + sizeof(rtr::BakedTextureHeader);
+
+    for (uint32_t i = 0; i < _header->level_count; ++i) {
+        rtr::BakedTextureLevel level;
+        memcpy(&level, table + i * sizeof(level), sizeof(level));
+
+        if (level.offset < table_end || level.offset > _size ||
+            level.size > _size - level.offset)
+            return false;
+
+        // Levels are uploaded with their dimensions, which must follow the
+        // mip chain and match the stored size
+        uint32_t width = std::max(_header->width >> i, 1u);
+        uint32_t height = std::max(_header->height >> i, 1u);
+
+        if (level.width != width || level.height != height)
+            return false;
+
+        uint64_t expected_size = uint64_t(width) * height * unit_size;
+        if (_header->flags & rtr::BAKED_TEXTURE_COMPRESSED) {
+            expected_size = uint64_t((width + 3) / 4) * ((height + 3) / 4) * 
+                            unit_size;
+        }
+
+        if (level.size != expected_size)
+            return false;
+    }
+
+    return true;
+}
+
+void BakedImage::unmap()
+{
+    if (_mapping == NULL)
+        return;
+
+#ifdef _WIN32
+    UnmapViewOfFile(_mapping);
+#else
+    munmap((void*)_mapping, _size);
+#endif
+
+    _mapping = NULL;
+    _header = NULL;
+    _levels.clear();
+}
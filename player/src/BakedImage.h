@@ -0,0 +1,84 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef BAKEDIMAGE_H
+#define BAKEDIMAGE_H
+
+#include "common.h"
+#include "baked_texture.h"
+
+/**
+ * Read-only view of a texture container written by the bakery (see 
+ * baked_texture.h). The file is memory-mapped, mip levels are handed to GL
+ * straight from the mapping without decoding or copying.
+ */
+class BakedImage : boost::noncopyable
+{
+    const char* _mapping; /**< Start of the mapped file, NULL if invalid */
+    size_t _size; /**< Size of the mapping in bytes */
+
+    const rtr::BakedTextureHeader* _header; /**< Container header */
+    vector<rtr::BakedTextureLevel> _levels; /**< Copy of the level table */
+
+    public:
+
+    /**
+     * Map a texture container.
+     * @param filename Path to the container file.
+     */
+    BakedImage(const string& filename);
+
+    ~BakedImage();
+
+    /** Returns true if the file could be mapped and passed validation. */
+    bool is_valid() const { return _mapping != NULL; }
+
+    int width() const { return _header->width; } /**< Get width of level 0 */
+    int height() const { return _header->height; } /**< Get height of level 0 */
+    int level_count() const { return _header->level_count; } /**< Get level count */
+
+    int level_width(int i) const { return _levels[i].width; } /**< Get level width */
+    int level_height(int i) const { return _levels[i].height; } /**< Get level height */
+
+    /** Get size of mip level i in bytes */
+    size_t level_size(int i) const { return size_t(_levels[i].size); }
+
+    /** Get pixel data of mip level i */
+    const void* level_data(int i) const { return _mapping + _levels[i].offset; }
+
+    GLenum format() const { return _header->format; } /**< Get pixel format */
+    GLenum type() const { return _header->type; } /**< Get pixel type */
+    /** Get internal format */
+    GLenum internal_format() const { return _header->internal_format; }
+
+    /** Returns true if the levels hold block-compressed data. */
+    bool is_compressed() const 
+    { 
+        return (_header->flags & rtr::BAKED_TEXTURE_COMPRESSED) != 0;
+    }
+
+    private:
+
+    bool validate() const;
+    void unmap();
+};
+
+#endif
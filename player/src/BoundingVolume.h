@@ -69,6 +69,35 @@ private:
 
 };
 
+/**
+ * A ray with an origin and a normalized direction. The inverse of the 
+ * direction is kept for the slab test against boxes.
+ */
+class Ray {
+
+public:
+
+    Ray(const vec3& origin, const vec3& direction) :
+        _origin(origin),
+        _direction(glm::normalize(direction)),
+        _inv_direction(1.0f / _direction.x, 
+                       1.0f / _direction.y, 
+                       1.0f / _direction.z) {}
+
+    const vec3& origin() const { return _origin; }
+    const vec3& direction() const { return _direction; }
+    const vec3& inv_direction() const { return _inv_direction; }
+
+    vec3 point_at(float distance) const { 
+        return _origin + _direction * distance; 
+    }
+
+private:
+    vec3 _origin;
+    vec3 _direction;
+    vec3 _inv_direction;
+};
+
 /** 
  * A bounding volume holds different BV representations, atm Sphere and AABB.
  */
@@ -135,4 +164,116 @@ inline TestResult intersect_aabb_frustum(const AABB& box, const Frustum& f) {
 
 }
 
+/**
+ * Test the intersection between a sphere and a frustum. Like the AABB test,
+ * spheres close to the frustum's corners may be reported as intersecting.
+ */
+inline TestResult intersect_sphere_frustum(const Sphere& sphere, 
+                                           const Frustum& f) {
+
+    vec4 c(sphere.center(), 1);
+
+    bool intersecting = false;
+    for ( int i = 0; i < 6; ++i ) {
+        float s = glm::dot(c, f.get_plane(i));
+        if (s > sphere.radius())
+            return OUTSIDE;
+        else if (s > -sphere.radius())
+            intersecting = true;
+    }
+
+    if (intersecting)
+        return INTERSECTING;
+    else
+        return INSIDE;
+
+}
+
+/**
+ * Test a ray against a sphere. Code based on Realtime rendering, Ed. 3, 
+ * pg. 741.
+ * @param[out] distance Where the ray enters the sphere, 0 if it starts 
+ * inside.
+ */
+inline bool intersect_ray_sphere(const Ray& ray, const Sphere& sphere, 
+                                 float& distance) {
+
+    vec3 m = ray.origin() - sphere.center();
+    float b = glm::dot(m, ray.direction());
+    float c = glm::dot(m, m) - sphere.radius() * sphere.radius();
+
+    //starts outside and points away
+    if (c > 0 && b > 0)
+        return false;
+
+    float discriminant = b*b - c;
+    if (discriminant < 0)
+        return false;
+
+    distance = glm::max(-b - glm::sqrt(discriminant), 0.0f);
+    return true;
+}
+
+/**
+ * Slab test of a ray against an AABB, considering the ray up to 
+ * max_distance only. Code based on Realtime rendering, Ed. 3, pg. 743.
+ * @param[out] distance Where the ray enters the box, 0 if it starts inside.
+ */
+inline bool intersect_ray_aabb(const Ray& ray, const AABB& box, 
+                               float max_distance, float& distance) {
+
+    //for rays parallel to a slab, the inverse direction is infinite and so
+    //are the slab distances: the slab is either ignored or missed entirely
+    vec3 t1 = (box.center() - box.half_diagonal() - ray.origin()) * 
+              ray.inv_direction();
+    vec3 t2 = (box.center() + box.half_diagonal() - ray.origin()) * 
+              ray.inv_direction();
+
+    float t_min = 0;
+    float t_max = max_distance;
+
+    for (int i = 0; i < 3; ++i) {
+        //a ray parallel to the slab, starting on one of its planes
+        if (t1[i] != t1[i] || t2[i] != t2[i])
+            continue;
+
+        float t_near = glm::min(t1[i], t2[i]);
+        float t_far = glm::max(t1[i], t2[i]);
+
+        t_min = glm::max(t_min, t_near);
+        t_max = glm::min(t_max, t_far);
+        if (t_min > t_max)
+            return false;
+    }
+
+    distance = t_min;
+    return true;
+}
+
+/**
+ * Squared distance between a point and an AABB, 0 if it is inside.
+ */
+inline float distance_sq_point_aabb(const vec3& point, const AABB& box) {
+    vec3 d = glm::max(glm::abs(point - box.center()) - box.half_diagonal(), 
+                      vec3(0));
+    return glm::dot(d, d);
+}
+
+inline bool overlap_sphere_aabb(const Sphere& sphere, const AABB& box) {
+    return ( distance_sq_point_aabb(sphere.center(), box) <= 
+             sphere.radius() * sphere.radius() );
+}
+
+inline bool overlap_sphere_sphere(const Sphere& a, const Sphere& b) {
+    vec3 d = a.center() - b.center();
+    float r = a.radius() + b.radius();
+    return glm::dot(d, d) <= r * r;
+}
+
+inline bool overlap_aabb_aabb(const AABB& a, const AABB& b) {
+    vec3 d = glm::abs(a.center() - b.center());
+    vec3 e = a.half_diagonal() + b.half_diagonal();
+    return d.x <= e.x && d.y <= e.y && d.z <= e.z;
+}
+
 #endif //__BOUNDING_VOLUME_H
\ No newline at end of file
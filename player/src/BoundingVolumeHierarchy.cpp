@@ -0,0 +1,692 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "BoundingVolumeHierarchy.h"
+#include "BoundingVolume.h"
+#include "Profiler.h"
+
+#include <algorithm>
+#include <limits>
+
+//see DBLoader.h
+#undef ERROR
+#undef SYNCHRONIZE
+
+#include <kcthread.h>
+
+namespace kc = kyotocabinet;
+
+namespace {
+
+    //number of bins per axis used to evaluate split candidates
+    const int kBinCount = 16;
+
+    //nodes with up to this many geometries may become leaves
+    const int kMaxLeafSize = 4;
+
+    //cost of visiting a node relative to testing one geometry
+    const float kTraversalCost = 1.0f;
+
+    float surface_area(const vec3& min, const vec3& max) {
+        vec3 d = glm::max(max - min, vec3(0));
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    void grow(vec3& min, vec3& max, const vec3& p_min, const vec3& p_max) {
+        min = glm::min(min, p_min);
+        max = glm::max(max, p_max);
+    }
+
+    void reset(vec3& min, vec3& max) {
+        min = vec3(std::numeric_limits<float>::max());
+        max = vec3(-std::numeric_limits<float>::max());
+    }
+
+    template <class ItemT>
+    float centroid(const ItemT& item, int axis) {
+        return (item.min[axis] + item.max[axis]) * 0.5f;
+    }
+
+    template <class ItemT>
+    struct IsLeftOfBin {
+        int axis;
+        float c_min;
+        float scale;
+        int split_bin;
+
+        bool operator()(const ItemT& item) const {
+            int bin = std::min( kBinCount - 1,
+                       int((centroid(item, axis) - c_min) * scale) );
+            return bin < split_bin;
+        }
+    };
+
+    template <class ItemT>
+    struct IsLessAlongAxis {
+        int axis;
+
+        bool operator()(const ItemT& a, const ItemT& b) const {
+            return centroid(a, axis) < centroid(b, axis);
+        }
+    };
+
+}
+
+/**
+ * Builds a tree on a separate thread. The builder only works on its own copy
+ * of the items.
+ */
+class BoundingVolumeHierarchy::Builder : public kc::Thread {
+
+public:
+
+    Builder() : _is_done(false) {}
+
+    void run() {
+        Profiler::set_thread_name("BVH builder");
+
+        {
+            ProfileZone zone("BVH rebuild");
+            BoundingVolumeHierarchy::build(tree);
+        }
+
+        kc::ScopedMutex lock(&_mutex);
+        _is_done = true;
+    }
+
+    bool is_done() {
+        kc::ScopedMutex lock(&_mutex);
+        return _is_done;
+    }
+
+    Tree tree;
+
+private:
+
+    kc::Mutex _mutex;
+    bool _is_done;
+};
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy(float rebuild_threshold,
+                                                 bool do_background_rebuild,
+                                                 bool do_collect_statistics,
+                                                 bool do_collect_debug_info) :
+    _built_cost(0),
+    _removed_count(0),
+    _builder(NULL),
+    _pending_in_build(0),
+    _build_invalidated(false),
+    _rebuild_threshold(rebuild_threshold),
+    _do_background_rebuild(do_background_rebuild),
+    _do_collect_statistics(do_collect_statistics),
+    _do_collect_debug_info(do_collect_debug_info),
+    _build_count(0),
+    _world_size(0),
+    _center(0)
+{
+    reset_statistics();
+}
+
+BoundingVolumeHierarchy::~BoundingVolumeHierarchy() {
+    if (_builder != NULL) {
+        _builder->join();
+        delete _builder;
+    }
+}
+
+void BoundingVolumeHierarchy::reset_statistics() {
+    _statistics.nodes_queried = 0;
+    _statistics.nodes_reinserted = 0;
+    _statistics.objects_visible = 0;
+    _statistics.objects_tested = 0;
+    _statistics.objects_contribution_culled = 0;
+    _statistics.nodes_contribution_culled = 0;
+    _statistics.storage_size = 0;
+}
+
+void BoundingVolumeHierarchy::set_collect_statistics(bool enabled) {
+    _do_collect_statistics = enabled;
+    reset_statistics();
+}
+
+BoundingVolumeHierarchy::Item 
+BoundingVolumeHierarchy::make_item(const Geometry * geo) {
+    const Sphere& sphere = geo->bounding_volume().sphere();
+    const vec3 radius_vec(sphere.radius());
+
+    Item item;
+    item.geo = geo;
+    item.min = sphere.center() - radius_vec;
+    item.max = sphere.center() + radius_vec;
+    return item;
+}
+
+//Top-down build with binned SAH. Nodes are processed from a work list, 
+//children are appended when their parent is split, therefore parents 
+//always precede their children.
+void BoundingVolumeHierarchy::build(Tree& tree) {
+
+    vector<Node>& nodes = tree.nodes;
+    vector<Item>& items = tree.items;
+
+    nodes.clear();
+    tree.cost = 0;
+
+    if (items.empty())
+        return;
+
+    nodes.reserve(2 * items.size() / kMaxLeafSize + 1);
+
+    Node root;
+    root.left = -1;
+    root.parent = -1;
+    root.first = 0;
+    root.count = static_cast<int>(items.size());
+    nodes.push_back(root);
+
+    vector<int> work;
+    work.push_back(0);
+
+    while (!work.empty()) {
+        int n_idx = work.back();
+        work.pop_back();
+
+        int first = nodes[n_idx].first;
+        int count = nodes[n_idx].count;
+        int end = first + count;
+
+        vec3 b_min, b_max, c_min, c_max;
+        reset(b_min, b_max);
+        reset(c_min, c_max);
+        for (int i = first; i < end; ++i) {
+            grow(b_min, b_max, items[i].min, items[i].max);
+            vec3 c = (items[i].min + items[i].max) * 0.5f;
+            grow(c_min, c_max, c, c);
+        }
+
+        nodes[n_idx].min = b_min;
+        nodes[n_idx].max = b_max;
+
+        if (count <= 2)
+            continue;
+
+        vec3 extent = c_max - c_min;
+        int axis = 0;
+        if (extent.y > extent[axis]) axis = 1;
+        if (extent.z > extent[axis]) axis = 2;
+
+        int mid = first;
+
+        if (extent[axis] > 0) {
+
+            IsLeftOfBin<Item> left_of;
+            left_of.axis = axis;
+            left_of.c_min = c_min[axis];
+            left_of.scale = kBinCount / extent[axis];
+
+            int bin_count[kBinCount];
+            vec3 bin_min[kBinCount];
+            vec3 bin_max[kBinCount];
+            for (int b = 0; b < kBinCount; ++b) {
+                bin_count[b] = 0;
+                reset(bin_min[b], bin_max[b]);
+            }
+
+            for (int i = first; i < end; ++i) {
+                int b = std::min( kBinCount - 1, 
+                  int((centroid(items[i], axis) - left_of.c_min) * left_of.scale) );
+                bin_count[b]++;
+                grow(bin_min[b], bin_max[b], items[i].min, items[i].max);
+            }
+
+            //sweep from the right to get the cost of all right halves
+            float right_cost[kBinCount];
+            vec3 r_min, r_max;
+            reset(r_min, r_max);
+            int r_count = 0;
+            for (int b = kBinCount - 1; b > 0; --b) {
+                grow(r_min, r_max, bin_min[b], bin_max[b]);
+                r_count += bin_count[b];
+                right_cost[b] = r_count ? r_count * surface_area(r_min, r_max)
+                                        : 0;
+            }
+
+            float best_cost = std::numeric_limits<float>::max();
+            int best_bin = -1;
+            vec3 l_min, l_max;
+            reset(l_min, l_max);
+            int l_count = 0;
+            for (int b = 1; b < kBinCount; ++b) {
+                grow(l_min, l_max, bin_min[b-1], bin_max[b-1]);
+                l_count += bin_count[b-1];
+                if (l_count == 0 || l_count == count)
+                    continue;
+                float c = l_count * surface_area(l_min, l_max) + right_cost[b];
+                if (c < best_cost) {
+                    best_cost = c;
+                    best_bin = b;
+                }
+            }
+
+            float node_area = surface_area(b_min, b_max);
+            float split_cost = (node_area > 0) ? 
+                       kTraversalCost + best_cost / node_area : kTraversalCost;
+
+            if (best_bin < 0 || 
+                (split_cost >= count && count <= kMaxLeafSize))
+            {
+                if (count <= kMaxLeafSize)
+                    continue;
+            } else {
+                left_of.split_bin = best_bin;
+                mid = static_cast<int>( std::partition(items.begin() + first,
+                                                       items.begin() + end,
+                                                       left_of) 
+                                        - items.begin() );
+            }
+
+        } else if (count <= kMaxLeafSize) {
+            continue;
+        }
+
+        //all centroids in one bin (or at one spot), fall back to a median 
+        //split
+        if (mid == first || mid == end) {
+            IsLessAlongAxis<Item> less;
+            less.axis = axis;
+            mid = first + count / 2;
+            std::nth_element(items.begin() + first, items.begin() + mid, 
+                             items.begin() + end, less);
+        }
+
+        int left = static_cast<int>(nodes.size());
+        nodes[n_idx].left = left;
+
+        Node child;
+        child.left = -1;
+        child.parent = n_idx;
+
+        child.first = first;
+        child.count = mid - first;
+        nodes.push_back(child);
+
+        child.first = mid;
+        child.count = end - mid;
+        nodes.push_back(child);
+
+        work.push_back(left + 1);
+        work.push_back(left);
+    }
+
+    tree.cost = compute_cost(nodes);
+}
+
+float BoundingVolumeHierarchy::compute_cost(const vector<Node>& nodes) {
+    if (nodes.empty())
+        return 0;
+
+    float root_area = surface_area(nodes[0].min, nodes[0].max);
+    if (root_area <= 0)
+        return static_cast<float>(nodes[0].count);
+
+    float cost = 0;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        float a = surface_area(nodes[i].min, nodes[i].max) / root_area;
+        if (nodes[i].left < 0)
+            cost += a * nodes[i].count;
+        else
+            cost += a * kTraversalCost;
+    }
+    return cost;
+}
+
+float BoundingVolumeHierarchy::cost() const {
+    return compute_cost(_nodes);
+}
+
+void BoundingVolumeHierarchy::adopt(Tree& tree) {
+    _nodes.swap(tree.nodes);
+    _items.swap(tree.items);
+    _removed_count = 0;
+
+    _item_leaf.assign(_items.size(), -1);
+    for (size_t n = 0; n < _nodes.size(); ++n) {
+        if (_nodes[n].left >= 0)
+            continue;
+        for (int i = _nodes[n].first; i < _nodes[n].first+_nodes[n].count; ++i)
+            _item_leaf[i] = static_cast<int>(n);
+    }
+
+    //Geometries might have moved while the tree was built, take their 
+    //current bounds and refit all nodes.
+    for (size_t i = 0; i < _items.size(); ++i) {
+        _items[i] = make_item(_items[i].geo);
+    }
+
+    for (int n = static_cast<int>(_nodes.size()) - 1; n >= 0; --n) {
+        Node& node = _nodes[n];
+        if (node.left < 0) {
+            reset(node.min, node.max);
+            for (int i = node.first; i < node.first + node.count; ++i)
+                grow(node.min, node.max, _items[i].min, _items[i].max);
+        } else {
+            node.min = glm::min(_nodes[node.left].min,_nodes[node.left+1].min);
+            node.max = glm::max(_nodes[node.left].max,_nodes[node.left+1].max);
+        }
+    }
+
+    _item_lookup.clear();
+    _item_lookup.rehash(static_cast<std::size_t>( 
+      (_items.size() + _pending.size()) / _item_lookup.max_load_factor()) + 1);
+    for (size_t i = 0; i < _items.size(); ++i) {
+        _item_lookup[_items[i].geo] = static_cast<int>(i);
+    }
+    for (size_t i = 0; i < _pending.size(); ++i) {
+        _item_lookup[_pending[i]] = -1;
+    }
+
+    if (!_nodes.empty()) {
+        _center = (_nodes[0].min + _nodes[0].max) * 0.5f;
+        _world_size = glm::length(_nodes[0].max - _nodes[0].min);
+    }
+
+    _built_cost = compute_cost(_nodes);
+    _build_count++;
+}
+
+void BoundingVolumeHierarchy::start_rebuild() {
+
+    Tree tree;
+    tree.items.reserve(_items.size() - _removed_count + _pending.size());
+    for (size_t i = 0; i < _items.size(); ++i) {
+        if (_items[i].geo != NULL)
+            tree.items.push_back(_items[i]);
+    }
+    for (size_t i = 0; i < _pending.size(); ++i) {
+        tree.items.push_back(make_item(_pending[i]));
+    }
+
+    _pending_in_build = _pending.size();
+    _build_invalidated = false;
+
+    //The very first build has to be in place, there is nothing to query 
+    //in the meantime.
+    if (!_do_background_rebuild || _nodes.empty()) {
+        build(tree);
+        _pending.clear();
+        adopt(tree);
+        return;
+    }
+
+    _builder = new Builder();
+    _builder->tree.items.swap(tree.items);
+    _builder->start();
+}
+
+void BoundingVolumeHierarchy::finish_rebuild() {
+    if (_builder == NULL || !_builder->is_done())
+        return;
+
+    _builder->join();
+
+    //Removals during the build would leave dangling geometries in the new
+    //tree. They are rare, in this case we simply build again.
+    if (!_build_invalidated) {
+        _pending.erase(_pending.begin(), _pending.begin() + _pending_in_build);
+        adopt(_builder->tree);
+    }
+
+    delete _builder;
+    _builder = NULL;
+}
+
+void BoundingVolumeHierarchy::refit() {
+
+    vector<int> dirty_leaves;
+
+    for (size_t i = 0; i < _items.size(); ++i) {
+        const Geometry * geo = _items[i].geo;
+        if (geo == NULL || !geo->has_changed())
+            continue;
+
+        _items[i] = make_item(geo);
+        dirty_leaves.push_back(_item_leaf[i]);
+    }
+
+    if (dirty_leaves.empty())
+        return;
+
+    if (_do_collect_statistics)
+        _statistics.nodes_reinserted += static_cast<int>(dirty_leaves.size());
+
+    //Refit bottom-up. Children are stored after their parents, walking the
+    //dirty nodes from the highest index handles children first.
+    std::sort(dirty_leaves.begin(), dirty_leaves.end());
+    dirty_leaves.erase(std::unique(dirty_leaves.begin(), dirty_leaves.end()),
+                       dirty_leaves.end());
+
+    vector<char> is_dirty(_nodes.size(), 0);
+    for (size_t i = 0; i < dirty_leaves.size(); ++i) {
+        for (int n = dirty_leaves[i]; n >= 0 && !is_dirty[n]; 
+             n = _nodes[n].parent)
+        {
+            is_dirty[n] = 1;
+        }
+    }
+
+    for (int n = static_cast<int>(_nodes.size()) - 1; n >= 0; --n) {
+        if (!is_dirty[n])
+            continue;
+
+        Node& node = _nodes[n];
+        if (node.left < 0) {
+            vec3 b_min, b_max;
+            reset(b_min, b_max);
+            bool has_items = false;
+            for (int i = node.first; i < node.first + node.count; ++i) {
+                if (_items[i].geo == NULL)
+                    continue;
+                grow(b_min, b_max, _items[i].min, _items[i].max);
+                has_items = true;
+            }
+            //leaves without geometries just keep their old bounds
+            if (has_items) {
+                node.min = b_min;
+                node.max = b_max;
+            }
+        } else {
+            node.min = glm::min(_nodes[node.left].min,_nodes[node.left+1].min);
+            node.max = glm::max(_nodes[node.left].max,_nodes[node.left+1].max);
+        }
+    }
+
+    //only worth checking if something moved
+    if ( _builder == NULL && 
+         compute_cost(_nodes) > _built_cost * _rebuild_threshold )
+    {
+        start_rebuild();
+    }
+}
+
+bool BoundingVolumeHierarchy::update() {
+
+    finish_rebuild();
+
+    bool needs_rebuild = ( !_pending.empty() || 
+                           _removed_count * 4 > static_cast<int>(_items.size()) );
+
+    if (_builder == NULL && needs_rebuild)
+        start_rebuild();
+
+    refit();
+
+    return true;
+}
+
+void BoundingVolumeHierarchy::insert(const Geometry * geo) {
+    if (!_item_lookup.insert(ItemLookup::value_type(geo, -1)).second) {
+        cerr << "Warning: Geometry " << geo->get_id() 
+             << " is already contained in the hierarchy." << endl;
+        return;
+    }
+    _pending.push_back(geo);
+}
+
+bool BoundingVolumeHierarchy::remove(const Geometry * geo) {
+    ItemLookup::iterator it = _item_lookup.find(geo);
+    if (it == _item_lookup.end())
+        return false;
+
+    if (it->second < 0) {
+        _pending.erase(std::find(_pending.begin(), _pending.end(), geo));
+    } else {
+        _items[it->second].geo = NULL;
+        _removed_count++;
+    }
+
+    _item_lookup.erase(it);
+
+    if (_builder != NULL)
+        _build_invalidated = true;
+
+    return true;
+}
+
+void BoundingVolumeHierarchy::clear() {
+    if (_builder != NULL) {
+        _builder->join();
+        delete _builder;
+        _builder = NULL;
+    }
+
+    _nodes.clear();
+    _items.clear();
+    _item_leaf.clear();
+    _pending.clear();
+    _item_lookup.clear();
+    _removed_count = 0;
+    _built_cost = 0;
+}
+
+bool BoundingVolumeHierarchy::is_too_small(const Item& item, 
+                                           const ContributionCulling& c) const
+{
+    if (!c.is_enabled())
+        return false;
+
+    const Sphere& sphere = item.geo->bounding_volume().sphere();
+    if (!c.rejects(sphere.radius(), glm::length(sphere.center() - c.eye)))
+        return false;
+
+    if (_do_collect_statistics)
+        _statistics.objects_contribution_culled++;
+
+    return true;
+}
+
+void BoundingVolumeHierarchy::query(const Frustum& f, 
+                                    QueryResult& query_out,
+                                    const ContributionCulling& c) const {
+
+    if (_do_collect_statistics) {
+        _statistics.nodes_queried = 0;
+        _statistics.objects_visible = 0;
+        _statistics.objects_tested = 0;
+        _statistics.objects_contribution_culled = 0;
+        _statistics.storage_size = 
+            static_cast<unsigned long>( _nodes.size() * sizeof(Node) + 
+                                        _items.size() * sizeof(Item) );
+    }
+
+    if (_do_collect_debug_info) {
+        _debug_query.clear();
+    }
+
+    //(node index, is fully visible)
+    vector<std::pair<int, bool> > stack;
+    stack.reserve(64);
+
+    if (!_nodes.empty())
+        stack.push_back(std::make_pair(0, false));
+
+    while (!stack.empty()) {
+        const Node& node = _nodes[stack.back().first];
+        bool is_inside = stack.back().second;
+        stack.pop_back();
+
+        if (_do_collect_statistics)
+            _statistics.nodes_queried++;
+
+        if (!is_inside) {
+            TestResult r = intersect_aabb_frustum(AABB(node.min, node.max), f);
+            if (r == OUTSIDE)
+                continue;
+            is_inside = (r == INSIDE);
+        }
+
+        //visible leaves and fully visible subtrees are collected directly,
+        //the items of a subtree are contiguous.
+        if (node.left >= 0 && !is_inside) {
+            stack.push_back(std::make_pair(node.left + 1, false));
+            stack.push_back(std::make_pair(node.left, false));
+            continue;
+        }
+
+        bool has_visible_geo = false;
+        for (int i = node.first; i < node.first + node.count; ++i) {
+            const Item& item = _items[i];
+            if (item.geo == NULL)
+                continue;
+
+            if (is_too_small(item, c))
+                continue;
+
+            if (_do_collect_statistics && !is_inside)
+                _statistics.objects_tested++;
+
+            if ( is_inside || 
+                 intersect_aabb_frustum(AABB(item.min, item.max), f) != OUTSIDE)
+            {
+                query_out[item.geo->material_id()].push_back(item.geo);
+                has_visible_geo = true;
+                if (_do_collect_statistics)
+                    _statistics.objects_visible++;
+            }
+        }
+
+        if (_do_collect_debug_info && has_visible_geo)
+            _debug_query.push_back(AABB(node.min, node.max));
+    }
+
+    //geometries which are not part of the tree yet
+    for (size_t i = 0; i < _pending.size(); ++i) {
+        Item item = make_item(_pending[i]);
+        if (is_too_small(item, c))
+            continue;
+        if (_do_collect_statistics)
+            _statistics.objects_tested++;
+        if (intersect_aabb_frustum(AABB(item.min, item.max), f) != OUTSIDE) {
+            query_out[item.geo->material_id()].push_back(item.geo);
+            if (_do_collect_statistics)
+                _statistics.objects_visible++;
+        }
+    }
+}
@@ -0,0 +1,174 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef __BOUNDING_VOLUME_HIERARCHY_H
+#define __BOUNDING_VOLUME_HIERARCHY_H
+
+#include "common.h"
+#include "CullingStructure.h"
+
+/**
+ * A bounding volume hierarchy over the AABBs of the geometries' bounding 
+ * spheres, built top-down with the binned surface area heuristic (SAH).
+ *
+ * Unlike the LooseOctree, the hierarchy adapts to the distribution and the
+ * sizes of the objects. Moving geometries do not change the topology, the
+ * bounds of their leaves and all parent nodes are refitted during update().
+ * As refitting degrades the tree, its SAH cost is tracked and the tree is
+ * rebuilt once the cost exceeds the cost right after the last build by a
+ * given factor. Rebuilds can run on a background thread, the current tree is
+ * used (and refitted) until the new one is ready.
+ *
+ * Geometries inserted after a build are kept in a list that is tested 
+ * linearly until the next update() rebuilds the tree.
+ */
+class BoundingVolumeHierarchy : public CullingStructure {
+
+public:
+
+    /**
+     * Creates an empty hierarchy.
+     * @param rebuild_threshold The tree is rebuilt once its SAH cost exceeds
+     * the cost after the last build by this factor.
+     * @param do_background_rebuild If enabled, rebuilds (except the first one)
+     * run on a separate thread.
+     * @param do_collect_statistics See LooseOctree.
+     * @param do_collect_debug_info See LooseOctree. The debug info contains
+     * the leaves with visible geometries.
+     */
+    BoundingVolumeHierarchy(float rebuild_threshold = 1.5f,
+                            bool do_background_rebuild = true,
+                            bool do_collect_statistics = false,
+                            bool do_collect_debug_info = false);
+
+    virtual ~BoundingVolumeHierarchy();
+
+    /**
+     * Queries the hierarchy, see CullingStructure. Geometries which are too
+     * small on screen are rejected one by one, nodes are not.
+     */
+    virtual void query(const Frustum& frustum, QueryResult& query_out,
+                       const ContributionCulling& contribution = 
+                           ContributionCulling()) const;
+    virtual void insert(const Geometry * geo);
+    virtual bool remove(const Geometry * geo);
+
+    /**
+     * Builds the tree if geometries have been inserted, refits moving 
+     * geometries and triggers rebuilds. A hierarchy is never too small,
+     * therefore this always returns TRUE.
+     */
+    virtual bool update();
+    virtual void clear();
+
+    virtual const Statistics& statistics() const { return _statistics; }
+    virtual void reset_statistics();
+    virtual void set_collect_statistics(bool enabled);
+    virtual const DebugQueryResult& debug_info() const { return _debug_query; }
+    virtual bool has_debug_info() const { return _do_collect_debug_info; }
+
+    virtual float world_size() const { return _world_size; }
+    virtual const vec3& center() const { return _center; }
+
+    /**
+     * Current SAH cost of the tree, relative to the cost of testing 
+     * every geometry.
+     */
+    float cost() const;
+
+    /**
+     * Number of builds so far, including background rebuilds.
+     */
+    int build_count() const { return _build_count; }
+
+private:
+
+    /**
+     * A node covers the contiguous range [first, first+count) of _items. 
+     * Inner nodes have their two children at left and left+1, leaves have
+     * left set to -1. Children are always stored after their parent.
+     */
+    struct Node {
+        vec3 min;
+        vec3 max;
+        int left;
+        int parent;
+        int first;
+        int count;
+    };
+
+    struct Item {
+        const Geometry * geo; //NULL if removed
+        vec3 min;
+        vec3 max;
+    };
+
+    //A complete tree, as produced by a build
+    struct Tree {
+        vector<Node> nodes;
+        vector<Item> items;
+        float cost;
+    };
+
+    class Builder;
+
+    static void build(Tree& tree);
+    static float compute_cost(const vector<Node>& nodes);
+    static Item make_item(const Geometry * geo);
+
+    bool is_too_small(const Item& item, const ContributionCulling& c) const;
+
+    void adopt(Tree& tree);
+    void start_rebuild();
+    void finish_rebuild();
+    void refit();
+
+    //the current tree
+    vector<Node> _nodes;
+    vector<Item> _items;
+    vector<int> _item_leaf;
+    float _built_cost;
+    int _removed_count;
+
+    //geometries inserted since the last build
+    vector<const Geometry *> _pending;
+
+    typedef boost::unordered_map<const Geometry*, int> ItemLookup;
+    ItemLookup _item_lookup;
+
+    Builder* _builder;
+    size_t _pending_in_build;
+    bool _build_invalidated;
+
+    const float _rebuild_threshold;
+    const bool _do_background_rebuild;
+    bool _do_collect_statistics;
+    const bool _do_collect_debug_info;
+    int _build_count;
+
+    float _world_size;
+    vec3 _center;
+
+    mutable Statistics _statistics;
+    mutable DebugQueryResult _debug_query;
+};
+
+#endif //__BOUNDING_VOLUME_HIERARCHY_H
@@ -0,0 +1,76 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "BufferTexture.h"
+#include "Texture.h"
+#include "Profiler.h"
+
+BufferTexture::BufferTexture(GLenum internal_format) :
+    _bound_unit(0),
+    _internal_format(internal_format),
+    _size(0)
+{
+    glGenBuffers(1, &_buffer);
+    glGenTextures(1, &_texture_name);
+
+    bind();
+    glTexBuffer(GL_TEXTURE_BUFFER, _internal_format, _buffer);
+    unbind();
+}
+
+BufferTexture::~BufferTexture()
+{
+    assert(_bound_unit == 0);
+
+    glDeleteTextures(1, &_texture_name);
+    glDeleteBuffers(1, &_buffer);
+}
+
+void BufferTexture::set_data(const void* data, size_t size)
+{
+    glBindBuffer(GL_TEXTURE_BUFFER, _buffer);
+    glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    _size = size;
+}
+
+void BufferTexture::bind()
+{
+    assert (_bound_unit == 0);
+
+    _bound_unit = Texture::unit_manager().get_unit();
+    glActiveTexture(_bound_unit);
+    glBindTexture(GL_TEXTURE_BUFFER, _texture_name);
+    Profiler::count(Profiler::STATE_BINDS);
+}
+
+void BufferTexture::unbind()
+{
+    assert(_bound_unit != 0);
+
+    glActiveTexture(_bound_unit);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    Texture::unit_manager().return_unit(_bound_unit);
+
+    _bound_unit = 0;
+}
@@ -0,0 +1,60 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef BUFFERTEXTURE_H
+#define BUFFERTEXTURE_H
+
+#include "common.h"
+
+/**
+ * A buffer object that shaders read as a texture (samplerBuffer).
+ */
+class BufferTexture : boost::noncopyable
+{
+    GLenum _bound_unit;
+    GLuint _buffer;
+    GLuint _texture_name;
+    GLenum _internal_format;
+    size_t _size;
+
+    public:
+
+    /**
+     * @param internal_format Format of one texel, e.g. GL_RGBA32F.
+     */
+    BufferTexture(GLenum internal_format);
+    ~BufferTexture();
+
+    /**
+     * Replaces the contents. The previous storage is orphaned, so this 
+     * doesn't wait for draw calls still reading it.
+     */
+    void set_data(const void* data, size_t size);
+
+    void bind();
+    void unbind();
+
+    GLint get_unit_number() const { return _bound_unit - GL_TEXTURE0; }
+    bool is_bound() const { return _bound_unit != 0; }
+    size_t size() const { return _size; }
+};
+
+#endif
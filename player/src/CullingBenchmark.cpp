@@ -0,0 +1,403 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "CullingBenchmark.h"
+#include "RtrPlayerConfig.h"
+#include "LooseOctree.h"
+#include "BoundingVolumeHierarchy.h"
+#include "BoundingVolume.h"
+#include "utility.h"
+#include "Profiler.h"
+
+#include <glm/gtc/matrix_projection.hpp>
+#include <glm/gtx/transform2.hpp>
+
+#include <cstdlib>
+#include <cmath>
+#include <sstream>
+
+namespace {
+
+    //number of frusta each structure is queried with
+    const int kFrustumCount = 64;
+
+    //number of frames during which geometries are moved
+    const int kUpdateFrames = 32;
+
+    //synthetic clustered scenes consist of this many clusters
+    const int kClusterCount = 16;
+
+    //number of queries per type of spatial query, which are taken from a
+    //smaller pool of random queries
+    const int kSpatialQueryCount = 1000000;
+    const int kSpatialQueryPoolSize = 4096;
+
+    //number of geometries a k-nearest query looks for
+    const size_t kNearestCount = 8;
+
+    float random_float() {
+        return std::rand() / float(RAND_MAX);
+    }
+
+    vec3 random_vec3() {
+        return vec3(random_float(), random_float(), random_float()) * 2.0f 
+               - vec3(1.0f);
+    }
+
+    //Half of the frusta look at the scene from the outside, the other half
+    //is placed inside, looking in random directions (with a shorter range).
+    vector<Frustum> make_frusta(const Sphere& world) {
+        vector<Frustum> frusta;
+        float r = glm::max(world.radius(), 0.001f);
+
+        for (int i = 0; i < kFrustumCount; ++i) {
+            vec3 eye, focus;
+            float far_plane;
+
+            if (i % 2 == 0) {
+                eye = world.center() + glm::normalize(random_vec3()+vec3(0.01f))
+                                        * r * 1.5f;
+                focus = world.center() + random_vec3() * r * 0.3f;
+                far_plane = r * 4.0f;
+            } else {
+                eye = world.center() + random_vec3() * r * 0.5f;
+                focus = eye + random_vec3() + vec3(0.01f);
+                far_plane = r * 0.5f;
+            }
+
+            mat4 proj = glm::perspective(60.0f, 4.0f/3.0f, 
+                                         far_plane * 0.001f, far_plane);
+            mat4 view = glm::lookAt(eye, focus, vec3(0, 1, 0));
+            frusta.push_back(Frustum(proj * view));
+        }
+
+        return frusta;
+    }
+
+    double to_ms(double seconds) {
+        return seconds * 1000.0;
+    }
+
+}
+
+CullingBenchmark::CullingBenchmark(int material_count) :
+    _material_count(material_count)
+{
+}
+
+void CullingBenchmark::move(float t) {
+    for (size_t i = 0; i < _movers.size(); ++i) {
+        vec3 offset = _mover_directions[i] * t;
+        _movers[i]->override_transform(glm::translate(offset.x, 
+                                                      offset.y, 
+                                                      offset.z));
+        _moving_nodes[i]->update();
+    }
+}
+
+void CullingBenchmark::run_structure(const string& name, 
+                                     CullingStructure* structure,
+                                     const vector<const Geometry*>& geometries,
+                                     const vector<Frustum>& frusta)
+{
+    double start = Profiler::now();
+    for (size_t i = 0; i < geometries.size(); ++i) {
+        structure->insert(geometries[i]);
+    }
+    structure->update();
+    double build_time = Profiler::now() - start;
+
+    CullingStructure::QueryResult result(_material_count);
+    size_t visible_count = 0;
+
+    start = Profiler::now();
+    for (size_t f = 0; f < frusta.size(); ++f) {
+        for (size_t i = 0; i < result.size(); ++i) {
+            result[i].clear();
+        }
+        structure->query(frusta[f], result);
+        for (size_t i = 0; i < result.size(); ++i) {
+            visible_count += result[i].size();
+        }
+    }
+    double query_time = Profiler::now() - start;
+
+    double update_time = 0;
+    double max_update_time = 0;
+    int overflow_count = 0;
+    if (!_movers.empty()) {
+        for (int frame = 1; frame <= kUpdateFrames; ++frame) {
+            move(float(frame) / kUpdateFrames);
+            start = Profiler::now();
+            if (!structure->update())
+                overflow_count++;
+            double frame_time = Profiler::now() - start;
+            update_time += frame_time;
+            if (frame_time > max_update_time)
+                max_update_time = frame_time;
+        }
+    }
+
+    //query again, after updates the structure might have degraded
+    start = Profiler::now();
+    for (size_t f = 0; f < frusta.size(); ++f) {
+        for (size_t i = 0; i < result.size(); ++i) {
+            result[i].clear();
+        }
+        structure->query(frusta[f], result);
+    }
+    double moved_query_time = Profiler::now() - start;
+
+    move(0);
+
+    cout << "  " << name << ": build " << to_ms(build_time) << " ms, "
+         << "query " << to_ms(query_time) / frusta.size() << " ms, "
+         << "visible " << visible_count / frusta.size();
+    if (!_movers.empty()) {
+        cout << ", update " << to_ms(update_time) / kUpdateFrames << " ms "
+             << "(max " << to_ms(max_update_time) << " ms), "
+             << "query after updates " 
+             << to_ms(moved_query_time) / frusta.size() << " ms";
+        if (overflow_count > 0)
+            cout << ", " << overflow_count << " updates out of bounds";
+    }
+    cout << endl;
+}
+
+void CullingBenchmark::run(const string& label, 
+                           const vector<const Geometry*>& geometries)
+{
+    if (geometries.empty()) {
+        cout << "Culling benchmark '" << label << "': no geometries." << endl;
+        return;
+    }
+
+    Sphere world = geometries[0]->bounding_volume().sphere();
+    for (size_t i = 1; i < geometries.size(); ++i) {
+        world = Sphere::unite(world, geometries[i]->bounding_volume().sphere());
+    }
+
+    vector<Frustum> frusta = make_frusta(world);
+
+    cout << "Culling benchmark '" << label << "', " << geometries.size() 
+         << " geometries, " << _movers.size() << " moving "
+         << "(times per query/update):" << endl;
+
+    int depth = config.octree_max_depth();
+
+    {
+        LooseOctree octree(world.radius() * 2, world.center(), depth, 
+                           LooseOctree::SPARSE_MAP);
+        octree.set_purge_budget(config.octree_purge_budget() / 1000.0);
+        run_structure("LooseOctree SPARSE_MAP", &octree, geometries, frusta);
+        print_growth(octree);
+        run_spatial_queries(octree, world);
+    }
+
+    //the full array does not scale to deeper trees, see LooseOctree
+    if (depth <= 7) {
+        LooseOctree octree(world.radius() * 2, world.center(), depth, 
+                           LooseOctree::FULL_ARRAY);
+        octree.set_purge_budget(config.octree_purge_budget() / 1000.0);
+        run_structure("LooseOctree FULL_ARRAY", &octree, geometries, frusta);
+        print_growth(octree);
+    }
+
+    {
+        BoundingVolumeHierarchy bvh(config.bvh_rebuild_threshold(),
+                                    config.bvh_background_rebuild());
+        run_structure("BVH", &bvh, geometries, frusta);
+        cout << "    SAH cost " << bvh.cost() << ", " 
+             << bvh.build_count() << " builds" << endl;
+    }
+}
+
+void CullingBenchmark::print_growth(const LooseOctree& octree)
+{
+    if (octree.grow_count() > 0 || octree.overflow_count() > 0) {
+        cout << "    grew " << octree.grow_count() << " times, " 
+             << octree.overflow_count() << " geometries in overflow" << endl;
+    }
+}
+
+void CullingBenchmark::run_spatial_queries(const LooseOctree& octree,
+                                           const Sphere& world)
+{
+    float r = glm::max(world.radius(), 0.001f);
+
+    //rays start anywhere in the world, spheres and boxes are about the 
+    //size of a probe around the camera
+    vector<Ray> rays;
+    vector<vec3> points;
+    for (int i = 0; i < kSpatialQueryPoolSize; ++i) {
+        rays.push_back(Ray(world.center() + random_vec3() * r, 
+                           random_vec3() + vec3(0.01f)));
+        points.push_back(world.center() + random_vec3() * r);
+    }
+
+    float probe_size = r * 0.02f;
+    float ray_length = r * 2.0f;
+
+    vector<LooseOctree::Hit> hits;
+    vector<const Geometry*> result;
+    LooseOctree::Hit hit;
+    size_t found_count[5] = { 0, 0, 0, 0, 0 };
+    double rates[5];
+
+    double start = Profiler::now();
+    for (int i = 0; i < kSpatialQueryCount; ++i) {
+        if (octree.query_ray_first(rays[i % kSpatialQueryPoolSize], 
+                                   ray_length, hit))
+            found_count[0]++;
+    }
+    rates[0] = kSpatialQueryCount / (Profiler::now() - start);
+
+    start = Profiler::now();
+    for (int i = 0; i < kSpatialQueryCount; ++i) {
+        octree.query_ray_all(rays[i % kSpatialQueryPoolSize], ray_length, 
+                             hits);
+        found_count[1] += hits.size();
+    }
+    rates[1] = kSpatialQueryCount / (Profiler::now() - start);
+
+    start = Profiler::now();
+    for (int i = 0; i < kSpatialQueryCount; ++i) {
+        octree.query_sphere(Sphere(probe_size, 
+                                   points[i % kSpatialQueryPoolSize]), 
+                            result);
+        found_count[2] += result.size();
+    }
+    rates[2] = kSpatialQueryCount / (Profiler::now() - start);
+
+    start = Profiler::now();
+    for (int i = 0; i < kSpatialQueryCount; ++i) {
+        const vec3& p = points[i % kSpatialQueryPoolSize];
+        octree.query_aabb(AABB(p - vec3(probe_size), p + vec3(probe_size)), 
+                          result);
+        found_count[3] += result.size();
+    }
+    rates[3] = kSpatialQueryCount / (Profiler::now() - start);
+
+    start = Profiler::now();
+    for (int i = 0; i < kSpatialQueryCount; ++i) {
+        octree.query_nearest(points[i % kSpatialQueryPoolSize], 
+                             kNearestCount, hits);
+        found_count[4] += hits.size();
+    }
+    rates[4] = kSpatialQueryCount / (Profiler::now() - start);
+
+    const char* labels[] = { "ray first hit", "ray all hits", "sphere", "box",
+                             "k-nearest" };
+
+    cout << "    spatial queries per second (average results):" << endl;
+    for (int i = 0; i < 5; ++i) {
+        cout << "      " << labels[i] << ": " << (int)rates[i] << " (" 
+             << double(found_count[i]) / kSpatialQueryCount << ")" << endl;
+    }
+}
+
+void CullingBenchmark::run_synthetic(const Geometry& proxy, int count)
+{
+    const char* labels[] = { "uniform", "clustered", "uneven sizes", 
+                             "fly-away" };
+    Distribution distributions[] = { UNIFORM, CLUSTERED, UNEVEN, FLY_AWAY };
+
+    float radius = proxy.mesh()->bounding_volume().sphere().radius();
+    if (radius <= 0)
+        radius = 1.0f;
+
+    //roughly a few object sizes between neighbours
+    float extent = radius * 4.0f * std::pow(float(count), 1.0f/3.0f);
+
+    std::srand(1);
+
+    for (int d = 0; d < 4; ++d) {
+
+        vector<vec3> cluster_centers;
+        for (int i = 0; i < kClusterCount; ++i) {
+            cluster_centers.push_back(random_vec3() * extent);
+        }
+
+        vector<GeometryRef> geometry_refs;
+        vector<const Geometry*> geometries;
+        geometry_refs.reserve(count);
+        geometries.reserve(count);
+
+        for (int i = 0; i < count; ++i) {
+
+            vec3 position;
+            float scale = 1.0f;
+
+            if (distributions[d] == CLUSTERED) {
+                position = cluster_centers[i % kClusterCount] 
+                           + random_vec3() * extent * 0.05f;
+            } else {
+                position = random_vec3() * extent;
+            }
+
+            //sizes between 0.1 and 100 times the proxy
+            if (distributions[d] == UNEVEN)
+                scale = std::pow(10.0f, random_float() * 3.0f - 1.0f);
+
+            std::ostringstream oss;
+            oss << "__culling_benchmark_" << d << "_" << i;
+            string id = oss.str();
+
+            //every tenth geometry moves
+            TransformNodeRef mover;
+            if (i % 10 == 0) {
+                mover.reset(new TransformNode(id + "_mover", NULL));
+                _movers.push_back(mover);
+                //fly-away movers end up far outside of the initial scene
+                float range = (distributions[d] == FLY_AWAY) ? 20.0f : 0.1f;
+                _mover_directions.push_back(random_vec3() * extent * range);
+            }
+
+            TransformNodeRef node(new TransformNode(id, mover.get()));
+            mat4 m = glm::translate(position.x, position.y, position.z) * 
+                     glm::scale(scale, scale, scale);
+            node->add_matrix_transform(id + "/Matrix", m, _evaluator);
+            node->update();
+
+            if (mover)
+                _moving_nodes.push_back(node);
+
+            GeometryRef geo(new Geometry(id, proxy.mesh(), node, 
+                                         proxy.material_instance(),
+                                         proxy.material_string_id()));
+            geometry_refs.push_back(geo);
+            geometries.push_back(geo.get());
+        }
+
+        //a second update resets the change flags of all static nodes
+        for (int i = 0; i < count; ++i) {
+            geometry_refs[i]->transform_node()->update();
+        }
+
+        run(labels[d], geometries);
+
+        geometries.clear();
+        geometry_refs.clear();
+        _moving_nodes.clear();
+        _movers.clear();
+        _mover_directions.clear();
+    }
+}
@@ -0,0 +1,101 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef __CULLING_BENCHMARK_H
+#define __CULLING_BENCHMARK_H
+
+#include "common.h"
+#include "Geometry.h"
+#include "Transform.h"
+#include "AnimEvaluator.h"
+#include "CullingStructure.h"
+
+class LooseOctree;
+
+/**
+ * Side-by-side comparison of the culling structures (LooseOctree with its 
+ * storages and BoundingVolumeHierarchy).
+ *
+ * Every structure is built over the same geometries, queried with a set of 
+ * frusta looking into and across the scene, and updated while a part of the
+ * geometries moves. Build, query and update times are written to cout.
+ * The spatial queries of the LooseOctree are measured in queries per second.
+ *
+ * Besides the loaded scene, synthetic scenes with a uniform, a clustered and
+ * an uneven size distribution can be generated from the mesh and material of
+ * an existing geometry. A fourth scene lets its moving geometries fly far 
+ * outside of the initial bounds, which makes the octree grow.
+ */
+class CullingBenchmark : noncopyable {
+
+public:
+
+    /**
+     * @param material_count Number of materials, i.e. the size of the query
+     * results.
+     */
+    CullingBenchmark(int material_count);
+
+    /**
+     * Benchmarks the given geometries. None of them is moved.
+     */
+    void run(const string& label, const vector<const Geometry*>& geometries);
+
+    /**
+     * Benchmarks synthetic scenes with count copies of proxy each, a tenth of 
+     * them is moving.
+     */
+    void run_synthetic(const Geometry& proxy, int count);
+
+private:
+
+    typedef enum {
+        UNIFORM,
+        CLUSTERED,
+        UNEVEN,
+        FLY_AWAY
+    } Distribution;
+
+    void run_structure(const string& name, CullingStructure* structure,
+                       const vector<const Geometry*>& geometries,
+                       const vector<Frustum>& frusta);
+
+    void move(float t);
+
+    void print_growth(const LooseOctree& octree);
+
+    /**
+     * Measures the spatial queries of the octree (rays, spheres, boxes and
+     * k-nearest) with random queries inside the world.
+     */
+    void run_spatial_queries(const LooseOctree& octree, const Sphere& world);
+
+    int _material_count;
+
+    AnimEvaluator _evaluator;
+
+    //parents of moving geometries and the (animated) node they depend on
+    vector<TransformNodeRef> _movers;
+    vector<TransformNodeRef> _moving_nodes;
+    vector<vec3> _mover_directions;
+};
+
+#endif //__CULLING_BENCHMARK_H
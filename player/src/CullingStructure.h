@@ -0,0 +1,182 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef __CULLING_STRUCTURE_H
+#define __CULLING_STRUCTURE_H
+
+#include "common.h"
+#include "Geometry.h"
+#include "Camera.h"
+
+/**
+ * Common interface of the spatial acceleration structures used for 
+ * View-Frustum culling. Implementations are LooseOctree and 
+ * BoundingVolumeHierarchy, the runtime selects one via octree_storage_type.
+ *
+ * Geometries are inserted once, and implementations track changes of their
+ * transforms during update().
+ */
+class CullingStructure : public noncopyable {
+
+public:
+
+    /**
+     * The vector is indexed by some prioritization that
+     * we formulate. For example, we might use this as the material id.
+     * The list of each vector element is roughly sorted along viewers direction 
+     * with the earlier entries being closer to the viewer. Note that 
+     * this is not strict sorting, however.
+     */
+    typedef vector<list<const Geometry * > > QueryResult;
+
+    //A list of axis aligned bounding boxes used for debug rendering
+    typedef list<AABB > DebugQueryResult;
+
+    //Some statistics which can be collected optionally.
+    struct Statistics {
+        //The number of visible objects that were identified 
+        //during a traversal
+        int objects_visible;
+        //The number of objects whose bounds were tested against the frustum
+        int objects_tested;
+        //The number of objects and nodes rejected for being too small on 
+        //screen, see ContributionCulling
+        int objects_contribution_culled;
+        int nodes_contribution_culled;
+        //The number of nodes that had to be traversed
+        //in order to determine visibility
+        int nodes_queried;
+        //The number of nodes that had to be re-inserted (or refitted)
+        //due to animation updates
+        int nodes_reinserted;
+        //The current amount of memory (in bytes) that the structure's 
+        //storage occupies
+        unsigned long storage_size;
+    };
+
+    /**
+     * Rejects geometries whose bounding sphere projects to less than 
+     * min_size pixels. A sphere of radius r at distance d from the eye
+     * projects to a diameter of 2 * r * pixel_scale / d pixels. The default
+     * constructed parameters reject nothing.
+     */
+    struct ContributionCulling {
+        vec3 eye;
+        float pixel_scale;
+        float min_size;
+
+        ContributionCulling() : eye(0), pixel_scale(0), min_size(0) {}
+
+        /**
+         * @param projection A perspective projection matrix.
+         * @param viewport_height Height of the viewport in pixels.
+         */
+        ContributionCulling(const vec3& eye, const mat4& projection, 
+                            int viewport_height, float min_size) :
+            eye(eye),
+            pixel_scale(projection[1][1] * viewport_height * 0.5f),
+            min_size(min_size) {}
+
+        bool is_enabled() const { return min_size > 0 && pixel_scale > 0; }
+
+        /**
+         * TRUE if a sphere with the given radius is too small at this 
+         * distance.
+         */
+        bool rejects(float radius, float distance) const {
+            return 2 * radius * pixel_scale < min_size * distance;
+        }
+    };
+
+    virtual ~CullingStructure() {}
+
+    /**
+     * Queries the structure with a particular frustum. The results of the 
+     * query will be written into query_out.
+     * @param frustum The frustum used to query the structure.
+     * @param[out] An out parameter where the results of the query will be 
+     * written to. Note that the vector's size of QueryResult must have the 
+     * correct size.
+     * @param contribution Geometries which are too small on screen are not
+     * written to query_out.
+     */
+    virtual void query(const Frustum& frustum, 
+                       QueryResult& query_out,
+                       const ContributionCulling& contribution = 
+                           ContributionCulling()) const = 0;
+
+    /**
+     * Inserts a geometry object based on its bounding sphere.
+     */
+    virtual void insert(const Geometry * geo) = 0;
+
+    /**
+     * Removes a geometry.
+     * @return TRUE if the geometry was contained and could be removed, 
+     * FALSE otherwise.
+     */
+    virtual bool remove(const Geometry * geo) = 0;
+
+    /**
+     * Checks all contained geometries, if they need to be updated, e.g. when
+     * their positions or orientations changed during animation.
+     * @return FALSE if the structure can not hold the updated geometries 
+     * anymore and should be recreated by the caller.
+     */
+    virtual bool update() = 0;
+
+    /**
+     * Removes all elements.
+     */
+    virtual void clear() = 0;
+
+    /**
+     * Returns statistical information which is collected during traversal,
+     * if enabled on construction.
+     */
+    virtual const Statistics& statistics() const = 0;
+
+    /**
+     * Reset statistical data that is not automatically reset on each traversal.
+     */
+    virtual void reset_statistics() = 0;
+
+    /**
+     * Starts or stops collecting statistics, e.g. after tuning.
+     */
+    virtual void set_collect_statistics(bool enabled) = 0;
+
+    /**
+     * Return a list of axis aligned bounding boxes which represent the 
+     * non-empty nodes of the last query, if enabled on construction.
+     */
+    virtual const DebugQueryResult& debug_info() const = 0;
+
+    virtual bool has_debug_info() const = 0;
+
+    /**
+     * Diameter and center of the space covered by this structure.
+     */
+    virtual float world_size() const = 0;
+    virtual const vec3& center() const = 0;
+};
+
+#endif //__CULLING_STRUCTURE_H
@@ -0,0 +1,391 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "CullingTuner.h"
+#include "RtrPlayerConfig.h"
+#include "BoundingVolumeHierarchy.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+
+    //limits the number of candidates for scenes with tiny objects
+    const int kMaxDepth = 16;
+
+    //the full array does not scale to deeper trees, see LooseOctree
+    const int kMaxArrayDepth = 7;
+
+    //geometries tested against the frusta for the visible fraction
+    const size_t kVisibleFractionSamples = 4096;
+
+    //cell indices packed into one key, enough for kMaxDepth
+    const int kAxisBits = 21;
+    const uint64_t kAxisMask = (uint64_t(1) << kAxisBits) - 1;
+
+    uint64_t cell_key(const vec3& idx)
+    {
+        return  uint64_t(idx.x) | 
+               (uint64_t(idx.y) << kAxisBits) | 
+               (uint64_t(idx.z) << (2*kAxisBits));
+    }
+
+    uint64_t parent_key(uint64_t key)
+    {
+        uint64_t x = (key & kAxisMask) >> 1;
+        uint64_t y = ((key >> kAxisBits) & kAxisMask) >> 1;
+        uint64_t z = ((key >> (2*kAxisBits)) & kAxisMask) >> 1;
+        return x | (y << kAxisBits) | (z << (2*kAxisBits));
+    }
+
+    void make_unique(vector<uint64_t>& keys)
+    {
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    }
+
+    /**
+     * Chance that a loose node at the given depth overlaps a visible region
+     * with side a, both relative to the world.
+     */
+    float overlap_chance(float a, int depth)
+    {
+        float side = a + 2.0f / glm::pow(2.0f, (float)depth);
+        return glm::min(side * side * side, 1.0f);
+    }
+
+}
+
+CullingTuner::CullingTuner(const vector<const Geometry*>& geometries, 
+                           const Sphere& world, 
+                           int material_count) :
+    _geometries(geometries),
+    _world(world),
+    _material_count(material_count),
+    _object_counts(kMaxDepth+1, 0),
+    _cell_counts(kMaxDepth+1, 0),
+    _node_counts(kMaxDepth+1, 0),
+    _max_useful_depth(0),
+    _best(0)
+{
+    float world_size = glm::max(_world.radius() * 2, 0.001f);
+    vec3 world_min = _world.center() - vec3(world_size * 0.5f);
+
+    vector<vector<uint64_t> > cells(kMaxDepth+1);
+
+    for (size_t i = 0; i < _geometries.size(); ++i) {
+        const Sphere& sphere = _geometries[i]->bounding_volume().sphere();
+
+        //same as LooseOctree::calc_depth(), without the depth limit
+        int depth = kMaxDepth;
+        if (sphere.radius() > 0) {
+            float d = glm::floor(glm::log2(world_size/sphere.radius()) - 1);
+            depth = (int)glm::clamp(d, 0.0f, (float)kMaxDepth);
+        }
+
+        float divisions = glm::pow(2.0f, (float)depth);
+        vec3 idx = glm::clamp( glm::floor( (sphere.center() - world_min) * 
+                                           divisions / world_size ),
+                               vec3(0), vec3(divisions - 1) );
+
+        _object_counts[depth]++;
+        cells[depth].push_back(cell_key(idx));
+
+        _max_useful_depth = glm::max(_max_useful_depth, depth);
+    }
+
+    //a node exists at depth d for the cells of the geometries at d and the
+    //parents of the nodes at d+1, regardless of how deep the tree may grow
+    vector<uint64_t> nodes;
+    for (int d = kMaxDepth; d >= 0; --d) {
+        make_unique(cells[d]);
+        _cell_counts[d] = (int)cells[d].size();
+
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            nodes[i] = parent_key(nodes[i]);
+        }
+        nodes.insert(nodes.end(), cells[d].begin(), cells[d].end());
+        make_unique(nodes);
+        _node_counts[d] = (int)nodes.size();
+    }
+
+    //the root always exists
+    _node_counts[0] = 1;
+}
+
+void CullingTuner::print_histogram() const
+{
+    cout << "Culling tuner: " << _geometries.size() << " geometries, "
+         << "world size " << _world.radius() * 2 << endl;
+    cout << "  depth  geometries  cells  nodes" << endl;
+
+    for (int d = 0; d <= _max_useful_depth; ++d) {
+        printf("  %5d  %10d  %5d  %5d\n", d, _object_counts[d], 
+               _cell_counts[d], _node_counts[d]);
+    }
+}
+
+float CullingTuner::visible_fraction(const vector<Frustum>& frusta) const
+{
+    //a subset of the geometries suffices for the estimate
+    size_t step = glm::max(_geometries.size() / kVisibleFractionSamples, 
+                           (size_t)1);
+
+    int tested = 0;
+    int visible = 0;
+
+    for (size_t f = 0; f < frusta.size(); ++f) {
+        for (size_t i = 0; i < _geometries.size(); i += step) {
+            const Sphere& sphere = _geometries[i]->bounding_volume().sphere();
+            if (intersect_sphere_frustum(sphere, frusta[f]) != OUTSIDE)
+                ++visible;
+            ++tested;
+        }
+    }
+
+    if (tested == 0)
+        return 1;
+
+    return glm::max((float)visible / tested, 1e-6f);
+}
+
+float CullingTuner::estimate_cost(int max_depth, float visible_fraction) const
+{
+    //the visible part of the world as a cube
+    float a = glm::pow(glm::clamp(visible_fraction, 0.0f, 1.0f), 1.0f/3.0f);
+
+    //geometries below the maximum depth are kept at the deepest node
+    int deeper_objects = 0;
+    for (int d = max_depth; d <= kMaxDepth; ++d) {
+        deeper_objects += _object_counts[d];
+    }
+
+    float cost = 0;
+    for (int d = 0; d <= max_depth; ++d) {
+        //a node is tested when its parent was visible, the root always
+        float parent_chance = (d == 0) ? 1 : overlap_chance(a, d - 1);
+        cost += _node_counts[d] * parent_chance;
+
+        int objects = (d < max_depth) ? _object_counts[d] : deeper_objects;
+        cost += objects * overlap_chance(a, d);
+    }
+
+    return cost;
+}
+
+const CullingTuner::Candidate& 
+CullingTuner::estimate(float visible_fraction)
+{
+    _candidates.clear();
+    _best = 0;
+
+    Candidate c;
+    c.is_bvh = false;
+    c.storage_type = LooseOctree::SPARSE_MAP;
+
+    unsigned long node_count = _node_counts[0];
+    for (int d = 1; d <= glm::max(_max_useful_depth, 1); ++d) {
+        node_count += _node_counts[d];
+
+        c.max_depth = d;
+        c.cost = estimate_cost(d, visible_fraction);
+        c.storage_size = LooseOctree::estimate_storage_size(c.storage_type, 
+                                                            d, node_count);
+        _candidates.push_back(c);
+        if (c.cost < _candidates[_best].cost)
+            _best = _candidates.size() - 1;
+    }
+
+    add_array_candidate();
+
+    cout << "Culling tuner: estimated costs for a visible fraction of "
+         << visible_fraction << " (bounding box tests per query)" << endl;
+    print_candidates();
+
+    return _candidates[_best];
+}
+
+const CullingTuner::Candidate& 
+CullingTuner::tune(const vector<Frustum>& frusta)
+{
+    //only the depths around the estimated best one are built
+    int estimated_depth = estimate(visible_fraction(frusta)).max_depth;
+
+    _candidates.clear();
+    _best = 0;
+
+    Candidate c;
+    c.is_bvh = false;
+    c.storage_type = LooseOctree::SPARSE_MAP;
+
+    int max_depth = glm::min(estimated_depth + 1, 
+                             glm::max(_max_useful_depth, 1));
+    for (int d = glm::max(estimated_depth - 1, 1); d <= max_depth; ++d) {
+        c.max_depth = d;
+        evaluate(c, frusta);
+        _candidates.push_back(c);
+        if (c.cost < _candidates[_best].cost)
+            _best = _candidates.size() - 1;
+    }
+
+    add_array_candidate();
+
+    c.is_bvh = true;
+    c.storage_type = LooseOctree::SPARSE_MAP;
+    c.max_depth = 0;
+    evaluate(c, frusta);
+    _candidates.push_back(c);
+    if (c.cost < _candidates[_best].cost)
+        _best = _candidates.size() - 1;
+
+    cout << "Culling tuner: measured costs for " << frusta.size() 
+         << " frusta (bounding box tests per query)" << endl;
+    print_candidates();
+
+    return _candidates[_best];
+}
+
+void CullingTuner::add_array_candidate()
+{
+    //both storages yield the same tree at the same cost, the array is only
+    //chosen if it doesn't take more memory
+    Candidate c = _candidates[_best];
+    if (c.is_bvh || c.max_depth > kMaxArrayDepth)
+        return;
+
+    unsigned long node_count = 0;
+    for (int d = 0; d <= c.max_depth; ++d) {
+        node_count += _node_counts[d];
+    }
+
+    c.storage_type = LooseOctree::FULL_ARRAY;
+    c.storage_size = LooseOctree::estimate_storage_size(c.storage_type,
+                                                        c.max_depth,
+                                                        node_count);
+    _candidates.push_back(c);
+
+    unsigned long map_size = 
+        LooseOctree::estimate_storage_size(LooseOctree::SPARSE_MAP,
+                                           c.max_depth, node_count);
+    if (c.storage_size <= map_size)
+        _best = _candidates.size() - 1;
+}
+
+void CullingTuner::print_candidates() const
+{
+    for (size_t i = 0; i < _candidates.size(); ++i) {
+        cout << "  ";
+        print(cout, _candidates[i]);
+        cout << ": " << _candidates[i].cost << ", " 
+             << _candidates[i].storage_size << " bytes";
+        if (i == _best)
+            cout << " (best)";
+        cout << endl;
+    }
+}
+
+const CullingTuner::Candidate* 
+CullingTuner::find_octree(LooseOctree::StorageType storage_type,
+                          int max_depth) const
+{
+    for (size_t i = 0; i < _candidates.size(); ++i) {
+        const Candidate& c = _candidates[i];
+        if ( !c.is_bvh && c.storage_type == storage_type && 
+             c.max_depth == max_depth )
+            return &c;
+    }
+
+    return NULL;
+}
+
+const CullingTuner::Candidate* CullingTuner::find_bvh() const
+{
+    for (size_t i = 0; i < _candidates.size(); ++i) {
+        if (_candidates[i].is_bvh)
+            return &_candidates[i];
+    }
+
+    return NULL;
+}
+
+void CullingTuner::print(std::ostream& out, const Candidate& candidate)
+{
+    if (candidate.is_bvh) {
+        out << "BVH";
+        return;
+    }
+
+    if (candidate.storage_type == LooseOctree::FULL_ARRAY)
+        out << "FULL_ARRAY";
+    else
+        out << "SPARSE_MAP";
+
+    out << " depth " << candidate.max_depth;
+}
+
+float CullingTuner::query_cost(const CullingStructure::Statistics& statistics,
+                               int query_count)
+{
+    if (query_count <= 0)
+        return 0;
+
+    return float(statistics.nodes_queried + statistics.objects_tested) / 
+           query_count;
+}
+
+void CullingTuner::evaluate(Candidate& candidate, 
+                            const vector<Frustum>& frusta) const
+{
+    CullingStructure* structure;
+
+    if (candidate.is_bvh) {
+        structure = new BoundingVolumeHierarchy(config.bvh_rebuild_threshold(),
+                                                false, true);
+    } else {
+        structure = new LooseOctree(_world.radius() * 2, _world.center(),
+                                    candidate.max_depth, 
+                                    candidate.storage_type, true);
+    }
+
+    for (size_t i = 0; i < _geometries.size(); ++i) {
+        structure->insert(_geometries[i]);
+    }
+    structure->update();
+
+    CullingStructure::QueryResult result(_material_count);
+    CullingStructure::Statistics total = CullingStructure::Statistics();
+
+    for (size_t f = 0; f < frusta.size(); ++f) {
+        for (size_t i = 0; i < result.size(); ++i) {
+            result[i].clear();
+        }
+        structure->query(frusta[f], result);
+
+        const CullingStructure::Statistics& s = structure->statistics();
+        total.nodes_queried += s.nodes_queried;
+        total.objects_tested += s.objects_tested;
+    }
+
+    candidate.cost = query_cost(total, (int)frusta.size());
+    candidate.storage_size = structure->statistics().storage_size;
+
+    delete structure;
+}
@@ -0,0 +1,164 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef __CULLING_TUNER_H
+#define __CULLING_TUNER_H
+
+#include "common.h"
+#include "Geometry.h"
+#include "BoundingVolume.h"
+#include "CullingStructure.h"
+#include "LooseOctree.h"
+
+/**
+ * Picks the culling structure and octree depth for a scene.
+ *
+ * At construction, a histogram of the geometries is built: for every depth
+ * of a LooseOctree spanning the world, the number of geometries whose radius
+ * places them at this depth, the number of distinct cells they occupy and 
+ * the number of nodes an octree has at this depth. Depths below the deepest 
+ * populated one only add empty levels and are not considered.
+ *
+ * The cost of a query is the number of bounding box tests it needs, i.e. the
+ * visited nodes plus the tested geometries. estimate() derives it for each
+ * octree depth from the histogram and the fraction of the geometries that is
+ * visible, without building anything, and is cheap enough for load time. 
+ * tune() builds the octrees around the estimated depth and a BVH, and 
+ * queries them with a set of frusta, e.g. those of the frames rendered so 
+ * far. A FULL_ARRAY octree has the same cost as a SPARSE_MAP one of the same
+ * depth and is preferred if it does not take more memory.
+ */
+class CullingTuner : noncopyable {
+
+public:
+
+    struct Candidate {
+        //a BoundingVolumeHierarchy instead of a LooseOctree
+        bool is_bvh;
+        //octrees only
+        LooseOctree::StorageType storage_type;
+        int max_depth;
+        //average number of bounding box tests per query
+        float cost;
+        unsigned long storage_size;
+    };
+
+    /**
+     * @param material_count Number of materials, i.e. the size of the query
+     * results.
+     */
+    CullingTuner(const vector<const Geometry*>& geometries, 
+                 const Sphere& world, 
+                 int material_count);
+
+    /**
+     * Writes the histogram to cout.
+     */
+    void print_histogram() const;
+
+    /**
+     * Average fraction of the geometries inside the given frusta, tested on
+     * a subset of the geometries.
+     */
+    float visible_fraction(const vector<Frustum>& frusta) const;
+
+    /**
+     * Estimates the cost of the octree candidates from the histogram and
+     * returns the cheapest one. BVHs are not estimated.
+     */
+    const Candidate& estimate(float visible_fraction);
+
+    /**
+     * Builds the octrees around the estimated depth and a BVH, queries them
+     * with the given frusta and returns the cheapest one.
+     */
+    const Candidate& tune(const vector<Frustum>& frusta);
+
+    /**
+     * The candidates evaluated by the last estimate() or tune().
+     */
+    const vector<Candidate>& candidates() const { return _candidates; }
+
+    /**
+     * Returns the evaluated octree of the given storage and depth, NULL if
+     * it has not been evaluated.
+     */
+    const Candidate* find_octree(LooseOctree::StorageType storage_type,
+                                 int max_depth) const;
+
+    /**
+     * Returns the evaluated BVH, NULL if tune() has not been called.
+     */
+    const Candidate* find_bvh() const;
+
+    /**
+     * Writes a short description of the candidate to out.
+     */
+    static void print(std::ostream& out, const Candidate& candidate);
+
+    /**
+     * Average cost per query, given the statistics summed over query_count
+     * queries.
+     */
+    static float query_cost(const CullingStructure::Statistics& statistics,
+                            int query_count);
+
+    /**
+     * The deepest octree worth evaluating.
+     */
+    int max_useful_depth() const { return _max_useful_depth; }
+
+private:
+
+    /**
+     * Estimated cost of an octree of the given depth.
+     */
+    float estimate_cost(int max_depth, float visible_fraction) const;
+
+    /**
+     * Builds the structure described by candidate, and sets its cost and
+     * storage size.
+     */
+    void evaluate(Candidate& candidate, const vector<Frustum>& frusta) const;
+
+    /**
+     * Adds the FULL_ARRAY variant of the best octree, and makes it the best
+     * candidate if it does not take more memory.
+     */
+    void add_array_candidate();
+
+    void print_candidates() const;
+
+    vector<const Geometry*> _geometries;
+    Sphere _world;
+    int _material_count;
+
+    //per depth
+    vector<int> _object_counts;
+    vector<int> _cell_counts;
+    vector<int> _node_counts;
+    int _max_useful_depth;
+
+    vector<Candidate> _candidates;
+    size_t _best;
+};
+
+#endif //__CULLING_TUNER_H
@@ -62,6 +62,25 @@ bool DBLoader::initialize() {
         return false;
     }
 
+    //Files written by newer bakeries record their codec in the header. We
+    //have to re-open the DB with the matching compressor installed, files 
+    //without a codec header use Kyoto's default ZLIB compressor.
+    if (_codec.read_header(_db.opaque()) && 
+        _codec.type() != rtr::DB_CODEC_NONE) {
+
+        _db.close();
+        _db.tune_compressor(&_codec);
+
+        b = _db.open(_db_path, kc::HashDB::OREADER | kc::HashDB::ONOLOCK);
+        if (!b) {
+            cout << "Error: Failed to open db: " << _db.error().name() << endl;
+            return false;
+        }
+
+        cout << "Database " << _db_path << " uses codec '" << _codec.name() 
+             << "'." << endl;
+    }
+
     _is_initialized = true;
 
     return true;
@@ -91,3 +110,46 @@ string DBLoader::startup_scene_id() {
         return cpy;
     }
 }
+
+bool DBLoader::benchmark() {
+
+    if (!_is_initialized) {
+        cerr << "Error: Database is not initialized." << endl;
+        return false;
+    }
+
+    double start_time = kc::time();
+
+    int64_t record_count = 0;
+    int64_t raw_size = 0;
+
+    kc::HashDB::Cursor* cursor = _db.cursor();
+    cursor->jump();
+
+    size_t key_size = 0;
+    size_t value_size = 0;
+    const char* value = NULL;
+
+    //the value is stored in the same allocation as the key
+    char* key;
+    while ((key = cursor->get(&key_size, &value, &value_size, true)) != NULL) {
+        raw_size += key_size + value_size;
+        ++record_count;
+        delete[] key;
+    }
+
+    bool success = _db.error().code() == kc::BasicDB::Error::NOREC;
+
+    delete cursor;
+
+    if (!success) {
+        cout << "Error: Failed to read db: " << _db.error().name() << endl;
+        return false;
+    }
+
+    cout << "Read " << record_count << " records (" << raw_size / 1024
+         << " KB) from " << _db.size() / 1024 << " KB in " 
+         << (kc::time() - start_time) * 1000.0 << " ms." << endl;
+
+    return true;
+}
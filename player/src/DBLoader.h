@@ -37,6 +37,8 @@
 
 #include <kchashdb.h>
 
+#include "db_codec.h"
+
 #include <boost/scoped_array.hpp>
 
 namespace kc = kyotocabinet;
@@ -73,12 +75,21 @@ public:
 
     string startup_scene_id(); 
 
+    /**
+     * Reads and decodes every record of the database once and prints the
+     * time this took. This is used to compare the record codecs (see 
+     * db_codec.h) without loading a scene into GL.
+     */
+    bool benchmark();
+
     template <typename T>
     void read(const string& key, boost::shared_ptr<T>& value_out);
 
 private:
     bool _is_initialized;
     string _db_path;
+    //Members are destroyed in reverse order, _db is closed first
+    rtr::DBCodec _codec; /**< Record decoder, must outlive _db */
     kc::HashDB _db;
 
 };
@@ -26,25 +26,32 @@
 #include "UniformBuffer.h"
 #include "TextureArray.h"
 #include "FBO.h"
+#include "Profiler.h"
 
 #include "RtrPlayerConfig.h"
 #include "Image.h"
 
-#include <glm/gtx/random.hpp>
-
 DustParticles::DustParticles(vec3 center, vec3 size, ivec2 framebuffer_size) :
     _center(center),
     _half_size(size * 0.5f),
-    _shader("dust")
+    _shader("dust"),
+    _simulation(config.dust_particle_count(), config.dust_thread_count(),
+                config.dust_min_life(), config.dust_max_life()),
+    _mapped(NULL),
+    _region(0),
+    _draw_first(0),
+    _draw_count(0)
 {
+    for (int i = 0; i < kRegionCount; ++i) {
+        _fences[i] = 0;
+    }
+
     FBOFormat format;
     format.add_texture(GL_RGBA16F, GL_COLOR_ATTACHMENT0, 
                        GL_LINEAR, GL_LINEAR);
 
     _fbo = new FBO(framebuffer_size, 0, format);
 
-    _particles.resize(config.dust_particle_count(), vec4(0));
-
     prepare_vbo();
 
     Image image(config.texture_dir()+"/dust_particle_nm.png");
@@ -53,51 +60,78 @@ DustParticles::DustParticles(vec3 center, vec3 size, ivec2 framebuffer_size) :
 
 DustParticles::~DustParticles()
 {
+    for (int i = 0; i < kRegionCount; ++i) {
+        if (_fences[i] != 0) {
+            glDeleteSync(_fences[i]);
+        }
+    }
+
+    if (_mapped != NULL) {
+        glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    glDeleteVertexArrays(1, &_vao);
+    glDeleteBuffers(1, &_vbo);
+
     delete _particle_texture;
     delete _fbo;
 }
 
-void DustParticles::update(float time_diff, CameraRef& render_cam)
+void DustParticles::update(float time_diff, const vec3& camera_position)
 {
-    float life_range = config.dust_max_life() - config.dust_min_life();
-    
-    float top = _center.z + _half_size.z;
-    float bottom = _center.z - _half_size.z;
-
-    for (size_t i = 0; i < _particles.size(); ++i) {
-        vec4& particle = _particles[i];
-
-        if (particle.w <= 0.0f) {
-            // generate new particle
+    _simulation.set_volume(_center, _half_size);
+    _simulation.set_speed(config.dust_particle_speed());
+    _simulation.set_radius(config.dust_simulation_radius());
+
+    size_t capacity = _simulation.particle_count();
+
+    if (_mapped != NULL) {
+        _region = (_region + 1) % kRegionCount;
+
+        // Wait until the GPU has drawn from this region
+        if (_fences[_region] != 0) {
+            while (glClientWaitSync(_fences[_region], 
+                                    GL_SYNC_FLUSH_COMMANDS_BIT,
+                                    1000000000) == GL_TIMEOUT_EXPIRED);
+            glDeleteSync(_fences[_region]);
+            _fences[_region] = 0;
+        }
 
-            vec3 pos = glm::compRand3(-1.0f, 1.0f) * _half_size + _center;
-            float life = glm::compRand1(0.0f, 1.0f) * life_range + config.dust_min_life();
+        _draw_first = _region * capacity;
+        _draw_count = _simulation.update(time_diff, camera_position, 
+                                         _mapped + _draw_first);
+        return;
+    }
 
-            particle = vec4(pos, life);            
-        } else {
-            // Update particle position
-            
-            vec3 pos(particle.x, particle.y, particle.z);
+    // Orphan the buffer, the driver hands out fresh memory instead of 
+    // waiting for the previous frame
+    glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+    glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(vec4), 
+                 NULL, GL_STREAM_DRAW);
 
-            pos += vec3(0,0,-1.0f) * time_diff * config.dust_particle_speed();
-            if (pos.z < bottom) pos.z = top;
+    vec4* data = (vec4*)glMapBufferRange(GL_ARRAY_BUFFER, 0, 
+                                         capacity * sizeof(vec4),
+                                         GL_MAP_WRITE_BIT | 
+                                         GL_MAP_INVALIDATE_BUFFER_BIT |
+                                         GL_MAP_UNSYNCHRONIZED_BIT);
 
-            particle = vec4(pos, particle.w);
+    _draw_first = 0;
+    _draw_count = 0;
 
-            //particle.w -= time_diff;
-        }
+    if (data != NULL) {
+        _draw_count = _simulation.update(time_diff, camera_position, data);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
     }
 
-    // Send to VBO
-    glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-    glBufferData(GL_ARRAY_BUFFER, _particles.size() * sizeof(vec4),
-                 _particles.data(), GL_STREAM_DRAW);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 void DustParticles::render(Texture& rgbz_buffer,
                            UniformBuffer& shared_UBO,
                            TextureArray& shadowmaps,
+                           const LightTextures& lights,
                            const mat4& view_projection)
 {
     _fbo->bind();
@@ -113,6 +147,7 @@ void DustParticles::render(Texture& rgbz_buffer,
 
     rgbz_buffer.bind();
     shadowmaps.bind();
+    lights.bind();
     _particle_texture->bind();
     
     shared_UBO.bind();
@@ -121,6 +156,7 @@ void DustParticles::render(Texture& rgbz_buffer,
 
     _shader.set_uniform_block("Shared", shared_UBO);
     _shader.set_uniform("shadowmaps", shadowmaps);
+    lights.set_uniforms(_shader);
     _shader.set_uniform("view_projection", view_projection);
     _shader.set_uniform("pixel_size", vec2(1.0/rgbz_buffer.width(),
                                            1.0/rgbz_buffer.height()));
@@ -134,15 +170,23 @@ void DustParticles::render(Texture& rgbz_buffer,
 
     glBindVertexArray(_vao);
 
-    glDrawArrays(GL_POINTS, 0, _particles.size());
+    glDrawArrays(GL_POINTS, _draw_first, _draw_count);
+
+    Profiler::count(Profiler::DRAW_CALLS);
+    Profiler::count(Profiler::STATE_BINDS);
 
     glBindVertexArray(0);
 
+    if (_mapped != NULL) {
+        _fences[_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
     _shader.unbind();
 
     shared_UBO.unbind();
 
     _particle_texture->unbind();
+    lights.unbind();
     shadowmaps.unbind();
     rgbz_buffer.unbind();
 
@@ -166,8 +210,32 @@ void DustParticles::prepare_vbo()
     
     glGenBuffers(1, &_vbo);
     glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-    glBufferData(GL_ARRAY_BUFFER, _particles.size() * sizeof(vec4), 
-                 NULL, GL_STREAM_DRAW);
+
+    size_t capacity = _simulation.particle_count();
+
+    if (EXTGL_ARB_buffer_storage && capacity > 0) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | 
+                           GL_MAP_COHERENT_BIT;
+        GLsizeiptr size = kRegionCount * capacity * sizeof(vec4);
+
+        glBufferStorage(GL_ARRAY_BUFFER, size, NULL, flags);
+        _mapped = (vec4*)glMapBufferRange(GL_ARRAY_BUFFER, 0, size, flags);
+
+        if (_mapped == NULL) {
+            cerr << "Could not map dust particle buffer persistently, "
+                 << "falling back to mapping it per frame." << endl;
+
+            // Storage of the buffer is immutable now, start over
+            glDeleteBuffers(1, &_vbo);
+            glGenBuffers(1, &_vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+        }
+    }
+
+    if (_mapped == NULL) {
+        glBufferData(GL_ARRAY_BUFFER, capacity * sizeof(vec4), 
+                     NULL, GL_STREAM_DRAW);
+    }
 
     glEnableVertexAttribArray(vertex_attrib_location);
     glVertexAttribPointer(vertex_attrib_location, 4, 
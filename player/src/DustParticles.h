@@ -26,12 +26,21 @@
 
 #include "Camera.h"
 #include "Shader.h"
+#include "DustSimulation.h"
+#include "LightClusters.h"
 
 class Texture;
 class UniformBuffer;
 class TextureArray;
 class FBO;
 
+/**
+ * Dust particles, simulated by DustSimulation and drawn as points. 
+ * Particles are written straight into a mapped vertex buffer. With 
+ * ARB_buffer_storage the buffer is mapped persistently and split into 
+ * regions that are used round robin, guarded by fences. Otherwise the 
+ * buffer is orphaned and mapped every frame.
+ */
 class DustParticles : boost::noncopyable
 {
     public:
@@ -39,10 +48,11 @@ class DustParticles : boost::noncopyable
     DustParticles(vec3 center, vec3 size, ivec2 framebuffer_size);
     ~DustParticles();
 
-    void update(float time_diff, CameraRef& render_cam);
+    void update(float time_diff, const vec3& camera_position);
     void render(Texture& rgbz_buffer, 
                 UniformBuffer& shared_UBO,
                 TextureArray& shadowmaps,
+                const LightTextures& lights,
                 const mat4& view_projection);
     Texture& get_particle_layer();
 
@@ -55,6 +65,8 @@ class DustParticles : boost::noncopyable
 
     private:
 
+    static const int kRegionCount = 3;
+
     void prepare_vbo();
 
     vec3 _center;
@@ -67,12 +79,18 @@ class DustParticles : boost::noncopyable
     GLuint _vbo;
     GLuint _vao;
 
+    DustSimulation _simulation;
+
     /**
-     * Vector of particles. 
-     * xyz components contain particle position
-     * w component contains particle life
+     * Persistently mapped buffer, NULL if the buffer is mapped per frame.
+     * Particles are stored as xyz position and life in w.
      */
-    vector<vec4> _particles;
+    vec4* _mapped;
+    int _region;
+    GLsync _fences[kRegionCount];
+
+    GLint _draw_first;
+    GLsizei _draw_count;
 };
 
 #endif
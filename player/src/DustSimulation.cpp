@@ -0,0 +1,258 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "DustSimulation.h"
+
+#include "RtrPlayerConfig.h"
+#include "Profiler.h"
+
+#include <cmath>
+
+//see DBLoader.h
+#undef ERROR
+#undef SYNCHRONIZE
+
+#include <kcutil.h>
+
+namespace kc = kyotocabinet;
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DUST_USE_SSE
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+    //number of columns along x and y
+    const int kColumnCount = 16;
+
+    /**
+     * Counter based random numbers: a hash of the particle index, so 
+     * particles can be spawned in any order and on any thread.
+     */
+    uint32_t hash(uint32_t x)
+    {
+        x ^= x >> 16;
+        x *= 0x7feb352dU;
+        x ^= x >> 15;
+        x *= 0x846ca68bU;
+        x ^= x >> 16;
+        return x;
+    }
+
+    /**
+     * Random number in [0,1) for a particle and one of its attributes.
+     */
+    float random(uint32_t particle, uint32_t attribute)
+    {
+        return (hash(particle * 4 + attribute) >> 8) * (1.0f / 16777216.0f);
+    }
+
+    /**
+     * Distance of a point to a box, 0 if it is inside.
+     */
+    float distance(const vec3& p, const vec3& min, const vec3& max)
+    {
+        return glm::length(glm::max(glm::max(min - p, p - max), vec3(0)));
+    }
+
+}
+
+DustSimulation::DustSimulation(int particle_count, int thread_count,
+                               float min_life, float max_life) :
+    _center(0),
+    _half_size(1),
+    _speed(0),
+    _radius(0),
+    _x(std::max(particle_count, 0)),
+    _y(_x.size()),
+    _z(_x.size()),
+    _life(_x.size()),
+    _columns(kColumnCount * kColumnCount),
+    _out(NULL),
+    _pool(thread_count)
+{
+    spawn(min_life, max_life);
+}
+
+DustSimulation::~DustSimulation()
+{
+}
+
+void DustSimulation::spawn(float min_life, float max_life)
+{
+    //Particles are distributed uniformly, so every column gets the same
+    //share and the positions are generated within the column right away.
+    size_t count = _x.size();
+    size_t column_count = _columns.size();
+    size_t i = 0;
+
+    for (size_t c = 0; c < column_count; ++c) {
+        Column& column = _columns[c];
+        column.begin = i;
+        column.end = i + count / column_count + (c < count % column_count);
+        column.pending_time = 0;
+
+        float cell = 2.0f / kColumnCount;
+        float x0 = -1.0f + (c % kColumnCount) * cell;
+        float y0 = -1.0f + (c / kColumnCount) * cell;
+
+        for (; i < column.end; ++i) {
+            _x[i] = x0 + random(i, 0) * cell;
+            _y[i] = y0 + random(i, 1) * cell;
+            _z[i] = random(i, 2) * 2.0f - 1.0f;
+            _life[i] = min_life + random(i, 3) * (max_life - min_life);
+        }
+    }
+}
+
+size_t DustSimulation::update(float time_diff, const vec3& camera_position,
+                              vec4* out)
+{
+    ProfileZone zone("dust simulation");
+
+    _jobs.clear();
+    _out = out;
+
+    size_t out_offset = 0;
+
+    for (size_t c = 0; c < _columns.size(); ++c) {
+        Column& column = _columns[c];
+        column.pending_time += time_diff;
+
+        if (_radius > 0) {
+            float cell = 2.0f / kColumnCount;
+            vec3 min(-1.0f + (c % kColumnCount) * cell,
+                     -1.0f + (c / kColumnCount) * cell,
+                     -1.0f);
+            vec3 max = min + vec3(cell, cell, 2.0f);
+
+            if (distance(camera_position, 
+                         min * _half_size + _center,
+                         max * _half_size + _center) > _radius) {
+                continue;
+            }
+        }
+
+        Job job = { int(c), column.pending_time, out_offset };
+        _jobs.push_back(job);
+
+        column.pending_time = 0;
+        out_offset += column.end - column.begin;
+    }
+
+    _pool.run(*this, _jobs.size());
+
+    return out_offset;
+}
+
+void DustSimulation::run_job(int job_index)
+{
+    ProfileZone zone("dust column");
+
+    const Job& job = _jobs[job_index];
+    const Column& column = _columns[job.column];
+
+    //Particles wrap around at the bottom, so only the fall distance modulo
+    //the height matters. This keeps long pending times in range.
+    float fall = std::fmod(job.time_diff * _speed / _half_size.z, 2.0f);
+
+    vec4* out = _out + job.out_offset;
+    size_t i = column.begin;
+
+#ifdef DUST_USE_SSE
+    __m128 fall4 = _mm_set1_ps(fall);
+    __m128 bottom4 = _mm_set1_ps(-1.0f);
+    __m128 height4 = _mm_set1_ps(2.0f);
+
+    __m128 center_x = _mm_set1_ps(_center.x);
+    __m128 center_y = _mm_set1_ps(_center.y);
+    __m128 center_z = _mm_set1_ps(_center.z);
+    __m128 half_x = _mm_set1_ps(_half_size.x);
+    __m128 half_y = _mm_set1_ps(_half_size.y);
+    __m128 half_z = _mm_set1_ps(_half_size.z);
+
+    for (; i + 4 <= column.end; i += 4, out += 4) {
+        __m128 z = _mm_sub_ps(_mm_loadu_ps(&_z[i]), fall4);
+        z = _mm_add_ps(z, _mm_and_ps(_mm_cmplt_ps(z, bottom4), height4));
+        _mm_storeu_ps(&_z[i], z);
+
+        __m128 x = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&_x[i]), half_x), 
+                              center_x);
+        __m128 y = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&_y[i]), half_y), 
+                              center_y);
+        z = _mm_add_ps(_mm_mul_ps(z, half_z), center_z);
+        __m128 life = _mm_loadu_ps(&_life[i]);
+
+        _MM_TRANSPOSE4_PS(x, y, z, life);
+
+        _mm_storeu_ps((float*)(out + 0), x);
+        _mm_storeu_ps((float*)(out + 1), y);
+        _mm_storeu_ps((float*)(out + 2), z);
+        _mm_storeu_ps((float*)(out + 3), life);
+    }
+#endif
+
+    for (; i < column.end; ++i, ++out) {
+        float z = _z[i] - fall;
+        if (z < -1.0f) z += 2.0f;
+        _z[i] = z;
+
+        *out = vec4(vec3(_x[i], _y[i], z) * _half_size + _center, _life[i]);
+    }
+}
+
+void DustSimulation::benchmark(int particle_count, int thread_count, 
+                               int frames)
+{
+    vector<vec4> out(std::max(particle_count, 0));
+
+    cout << "Dust simulation, " << particle_count << " particles, " 
+         << frames << " frames" << endl;
+
+    //single threaded for reference, then with the configured threads
+    int counts[] = { 1, thread_count };
+
+    for (int t = 0; t < (thread_count > 1 ? 2 : 1); ++t) {
+        DustSimulation simulation(particle_count, counts[t],
+                                  config.dust_min_life(), 
+                                  config.dust_max_life());
+        simulation.set_volume(config.dust_center(), config.dust_size() * 0.5f);
+        simulation.set_speed(config.dust_particle_speed());
+        simulation.set_radius(config.dust_simulation_radius());
+
+        size_t written = 0;
+        double start = kc::time();
+
+        for (int i = 0; i < frames; ++i) {
+            written += simulation.update(1.0f / 60.0f, config.dust_center(),
+                                         out.empty() ? NULL : &out[0]);
+        }
+
+        double ms = (kc::time() - start) * 1000.0 / std::max(frames, 1);
+
+        cout << counts[t] << " thread(s): " << ms << " ms per frame, "
+             << written / std::max(frames, 1) << " particles written, "
+             << (particle_count / 1.0e6) / (ms / 1000.0) 
+             << " M particles/s" << endl;
+    }
+}
@@ -0,0 +1,117 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef DUSTSIMULATION_H
+#define DUSTSIMULATION_H
+
+#include "common.h"
+#include "WorkerPool.h"
+
+/**
+ * CPU side of the dust particles, it doesn't use OpenGL.
+ *
+ * Particles are stored as a structure of arrays in volume coordinates
+ * ([-1,1] on each axis), so the volume can be moved and resized. They only
+ * fall along z, which is why they are sorted into columns over the xy 
+ * plane once and never change their column. Only columns close to the 
+ * camera are simulated and written out, the others catch up once they 
+ * get close again. Columns are handed out to worker threads, the kernel 
+ * uses SSE2 where available.
+ */
+class DustSimulation : boost::noncopyable, WorkerPool::Task
+{
+    public:
+
+    /**
+     * @param thread_count Number of threads used by update(), including the
+     * calling one.
+     */
+    DustSimulation(int particle_count, int thread_count,
+                   float min_life, float max_life);
+    ~DustSimulation();
+
+    void set_volume(const vec3& center, const vec3& half_size)
+    {
+        _center = center;
+        _half_size = half_size;
+    }
+
+    void set_speed(float speed) { _speed = speed; }
+
+    /**
+     * Only columns within radius of the camera are simulated, 0 simulates
+     * all of them.
+     */
+    void set_radius(float radius) { _radius = radius; }
+
+    /**
+     * Advances the active columns and writes their particles to out, as 
+     * world space position and life. 
+     * @param out Room for particle_count() particles, need not be aligned.
+     * @return Number of particles written.
+     */
+    size_t update(float time_diff, const vec3& camera_position, vec4* out);
+
+    size_t particle_count() const { return _x.size(); }
+
+    /**
+     * Runs the kernel for a number of frames with the dust settings of the
+     * config and prints the timings.
+     */
+    static void benchmark(int particle_count, int thread_count, int frames);
+
+    private:
+
+    struct Column {
+        size_t begin;
+        size_t end;
+        float pending_time; /**< Time the column has not been simulated */
+    };
+
+    struct Job {
+        int column;
+        float time_diff;
+        size_t out_offset;
+    };
+
+    void spawn(float min_life, float max_life);
+    void run_job(int job);
+
+    vec3 _center;
+    vec3 _half_size;
+    float _speed;
+    float _radius;
+
+    vector<float> _x;
+    vector<float> _y;
+    vector<float> _z;
+    vector<float> _life;
+
+    vector<Column> _columns;
+
+    //Jobs of the current frame
+    vector<Job> _jobs;
+    vec4* _out;
+
+    WorkerPool _pool;
+};
+
+#endif
@@ -25,6 +25,7 @@
 #include "format_map.h"
 
 GLuint FBO::_blit_fbo = 0;
+GLuint FBO::_output_fbo = 0;
 
 int FBOFormat::add_renderbuffer(GLenum format, GLenum attachment)
 {
@@ -142,7 +143,7 @@ FBO::FBO(ivec2 size, int samples, const FBOFormat& format) :
         _complete = false;
     }
 
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _output_fbo);
 
     if (_blit_fbo == 0) {
         glGenFramebuffers(1, &_blit_fbo);
@@ -256,10 +257,28 @@ void FBO::bind()
 
 void FBO::unbind()
 {
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
-    glDrawBuffer(GL_BACK);
-    glReadBuffer(GL_BACK);
+    bind_output();
+}
+
+void FBO::set_output(FBO* output)
+{
+    _output_fbo = (output != NULL) ? output->_fbo : 0;
+    bind_output();
+}
+
+void FBO::bind_output()
+{
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _output_fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _output_fbo);
+
+    if (_output_fbo == 0) {
+        glDrawBuffer(GL_BACK);
+        glReadBuffer(GL_BACK);
+    } else {
+        GLenum buffer = GL_COLOR_ATTACHMENT0;
+        glDrawBuffers(1, &buffer);
+        glReadBuffer(buffer);
+    }
 }
 
 bool FBO::is_complete() const
@@ -307,8 +326,8 @@ void FBO::blit(int id, Texture& tex,
     glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, destination,
                            GL_TEXTURE_2D, 0, 0);    
 
-    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _output_fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, _output_fbo);
 }
 
 ivec2 FBO::get_size()
@@ -43,8 +43,18 @@ class FBO : boost::noncopyable
     ~FBO();
 
     void bind();
+
+    /**
+     * Binds the output framebuffer again, see set_output().
+     */
     void unbind();
 
+    /**
+     * Makes unbind() return to output instead of the window, e.g. to render
+     * offscreen. NULL selects the window again.
+     */
+    static void set_output(FBO* output);
+
     void set_array_index(int id, int index);
 
     bool is_complete() const;
@@ -90,6 +100,9 @@ class FBO : boost::noncopyable
     bool _complete;
 
     static GLuint _blit_fbo;
+    static GLuint _output_fbo;
+
+    static void bind_output();
 };
 
 class FBOFormat
@@ -0,0 +1,722 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "FrameWriter.h"
+#include "Profiler.h"
+
+#include <fstream>
+#include <deque>
+#include <cstdio>
+#include <zlib.h>
+
+//see DBLoader.h
+#undef ERROR
+#undef SYNCHRONIZE
+
+#include <kcthread.h>
+
+namespace kc = kyotocabinet;
+
+/**
+ * Pixels of one frame, as read from OpenGL: RGBA rows from bottom to top,
+ * with 8 bit or half float channels.
+ */
+struct FrameWriter::Image {
+    ivec2 size;
+    Format format;
+    string filename;
+    vector<byte> pixels;
+};
+
+struct FrameWriter::State {
+    vector<Encoder*> encoders;
+
+    std::deque<Image*> queue;
+    size_t capacity;
+    vector<Image*> free_images;
+
+    kc::Mutex mutex;
+    kc::CondVar queued_cond;
+    kc::CondVar done_cond;
+    int busy;
+    int failed;
+    bool quit;
+};
+
+/**
+ * Writes queued images until the writer is destroyed.
+ */
+class FrameWriter::Encoder : public kc::Thread {
+
+public:
+
+    Encoder(FrameWriter* writer) : _writer(writer) {}
+
+    void run() {
+        Profiler::set_thread_name("Encoder");
+        _writer->encode();
+    }
+
+private:
+
+    FrameWriter* _writer;
+};
+
+FrameWriter::FrameWriter(const ivec2& size, Format format,
+                         int frames_in_flight, int thread_count) :
+    _size(size),
+    _format(format),
+    _image_size(size.x * size.y * 4 * (format == EXR ? 2 : 1)),
+    _next(0),
+    _state(new State())
+{
+    _ring.resize(std::max(frames_in_flight, 1));
+
+    for (size_t i = 0; i < _ring.size(); ++i) {
+        glGenBuffers(1, &_ring[i].buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, _ring[i].buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, _image_size, NULL, GL_STREAM_READ);
+        _ring[i].fence = 0;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    thread_count = std::max(thread_count, 1);
+
+    //Enough to keep every encoder busy while the next frames are read
+    _state->capacity = thread_count;
+    _state->busy = 0;
+    _state->failed = 0;
+    _state->quit = false;
+
+    for (int i = 0; i < thread_count; ++i) {
+        _state->encoders.push_back(new Encoder(this));
+        _state->encoders.back()->start();
+    }
+}
+
+FrameWriter::~FrameWriter()
+{
+    finish();
+
+    _state->mutex.lock();
+    _state->quit = true;
+    _state->queued_cond.broadcast();
+    _state->mutex.unlock();
+
+    for (size_t i = 0; i < _state->encoders.size(); ++i) {
+        _state->encoders[i]->join();
+        delete _state->encoders[i];
+    }
+
+    for (size_t i = 0; i < _state->free_images.size(); ++i) {
+        delete _state->free_images[i];
+    }
+
+    for (size_t i = 0; i < _ring.size(); ++i) {
+        glDeleteBuffers(1, &_ring[i].buffer);
+    }
+
+    delete _state;
+}
+
+string FrameWriter::extension(Format format)
+{
+    switch (format) {
+    case PNG: return ".png";
+    case EXR: return ".exr";
+    default: return ".tiff";
+    }
+}
+
+int FrameWriter::failed_count() const
+{
+    kc::ScopedMutex lock(&_state->mutex);
+    return _state->failed;
+}
+
+void FrameWriter::capture(const ivec2& offset, const string& filename)
+{
+    Readback& readback = _ring[_next];
+    _next = (_next + 1) % _ring.size();
+
+    if (readback.fence != 0) {
+        retire(readback);
+    }
+
+    GLenum type = (_format == EXR) ? GL_HALF_FLOAT : GL_UNSIGNED_BYTE;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glReadPixels(offset.x, offset.y, _size.x, _size.y, GL_RGBA, type, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.filename = filename + extension(_format);
+}
+
+void FrameWriter::finish()
+{
+    //Oldest first
+    for (size_t i = 0; i < _ring.size(); ++i) {
+        Readback& readback = _ring[(_next + i) % _ring.size()];
+
+        if (readback.fence != 0) {
+            retire(readback);
+        }
+    }
+
+    kc::ScopedMutex lock(&_state->mutex);
+    while (!_state->queue.empty() || _state->busy > 0) {
+        _state->done_cond.wait(&_state->mutex);
+    }
+}
+
+void FrameWriter::retire(Readback& readback)
+{
+    ProfileZone zone("read back frame");
+
+    while (glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                            1000000000) == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(readback.fence);
+    readback.fence = 0;
+
+    Image* image = NULL;
+
+    {
+        kc::ScopedMutex lock(&_state->mutex);
+        if (!_state->free_images.empty()) {
+            image = _state->free_images.back();
+            _state->free_images.pop_back();
+        }
+    }
+
+    if (image == NULL) {
+        image = new Image();
+    }
+
+    image->size = _size;
+    image->format = _format;
+    image->filename = readback.filename;
+    image->pixels.resize(_image_size);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+
+    const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 
+                                        _image_size, GL_MAP_READ_BIT);
+
+    if (data != NULL) {
+        memcpy(&image->pixels[0], data, _image_size);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        cerr << "Could not read back '" << image->filename << "'." << endl;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    kc::ScopedMutex lock(&_state->mutex);
+
+    while (_state->queue.size() >= _state->capacity) {
+        _state->done_cond.wait(&_state->mutex);
+    }
+
+    _state->queue.push_back(image);
+    _state->queued_cond.signal();
+}
+
+void FrameWriter::encode()
+{
+    while (true) {
+        Image* image;
+
+        {
+            kc::ScopedMutex lock(&_state->mutex);
+
+            while (_state->queue.empty() && !_state->quit) {
+                _state->queued_cond.wait(&_state->mutex);
+            }
+
+            if (_state->queue.empty())
+                return;
+
+            image = _state->queue.front();
+            _state->queue.pop_front();
+            ++_state->busy;
+
+            //There is room in the queue again
+            _state->done_cond.broadcast();
+        }
+
+        bool success = false;
+
+        {
+            ProfileZone zone("encode frame");
+
+            switch (image->format) {
+            case TIFF: success = write_tiff(*image, image->filename); break;
+            case PNG: success = write_png(*image, image->filename); break;
+            case EXR: success = write_exr(*image, image->filename); break;
+            }
+        }
+
+        if (!success) {
+            cerr << "Could not save image to '" << image->filename << "'." 
+                 << endl;
+        }
+
+        kc::ScopedMutex lock(&_state->mutex);
+        --_state->busy;
+        if (!success) {
+            ++_state->failed;
+        }
+        _state->free_images.push_back(image);
+        _state->done_cond.broadcast();
+    }
+}
+
+//All formats below store numbers in little endian, independent of the host
+static void put_u16(vector<byte>& out, unsigned value)
+{
+    out.push_back(byte(value));
+    out.push_back(byte(value >> 8));
+}
+
+static void put_u32(vector<byte>& out, unsigned value)
+{
+    put_u16(out, value & 0xffff);
+    put_u16(out, value >> 16);
+}
+
+static void put_u32_be(vector<byte>& out, unsigned value)
+{
+    out.push_back(byte(value >> 24));
+    out.push_back(byte(value >> 16));
+    out.push_back(byte(value >> 8));
+    out.push_back(byte(value));
+}
+
+static void put_string(vector<byte>& out, const char* s)
+{
+    out.insert(out.end(), s, s + strlen(s) + 1);
+}
+
+static unsigned get_u32(const vector<byte>& in, size_t offset)
+{
+    return in[offset] | (in[offset+1] << 8) | 
+        (in[offset+2] << 16) | (unsigned(in[offset+3]) << 24);
+}
+
+static unsigned get_u32_be(const vector<byte>& in, size_t offset)
+{
+    return (unsigned(in[offset]) << 24) | (in[offset+1] << 16) | 
+        (in[offset+2] << 8) | in[offset+3];
+}
+
+/**
+ * Files are written under a temporary name and renamed when complete, so
+ * an interrupted render never leaves a partial file behind.
+ */
+static bool write_file(const string& filename, 
+                       const vector<byte>& header,
+                       const vector<byte>& data)
+{
+    string part_filename = filename + ".part";
+
+    {
+        std::ofstream file(part_filename.c_str(), 
+                           std::ios::out | std::ios::binary);
+
+        file.write((const char*)&header[0], header.size());
+        file.write((const char*)&data[0], data.size());
+        file.close();
+
+        if (!file.good()) {
+            std::remove(part_filename.c_str());
+            return false;
+        }
+    }
+
+    //rename does not replace existing files on Windows
+    std::remove(filename.c_str());
+
+    return std::rename(part_filename.c_str(), filename.c_str()) == 0;
+}
+
+/**
+ * Top to bottom RGB rows of an 8 bit image.
+ */
+static void get_rgb_rows(const vector<byte>& pixels, const ivec2& size, 
+                         vector<byte>& rgb)
+{
+    rgb.resize(size.x * size.y * 3);
+
+    byte* out = &rgb[0];
+
+    for (int y = size.y - 1; y >= 0; --y) {
+        const byte* row = &pixels[y * size.x * 4];
+
+        for (int x = 0; x < size.x; ++x) {
+            *out++ = row[x*4];
+            *out++ = row[x*4+1];
+            *out++ = row[x*4+2];
+        }
+    }
+}
+
+static void put_tiff_entry(vector<byte>& out, unsigned tag, unsigned type,
+                           unsigned count, unsigned value)
+{
+    const unsigned SHORT = 3;
+
+    put_u16(out, tag);
+    put_u16(out, type);
+    put_u32(out, count);
+
+    if (type == SHORT && count == 1) {
+        put_u16(out, value);
+        put_u16(out, 0);
+    } else {
+        put_u32(out, value);
+    }
+}
+
+bool FrameWriter::write_tiff(const Image& image, const string& filename)
+{
+    const unsigned SHORT = 3;
+    const unsigned LONG = 4;
+    const unsigned entry_count = 10;
+
+    //Header, directory and the bits per sample, followed by the pixels
+    const unsigned bits_offset = 8 + 2 + entry_count*12 + 4;
+    const unsigned pixel_offset = bits_offset + 6;
+
+    vector<byte> header;
+    header.push_back('I');
+    header.push_back('I');
+    put_u16(header, 42);
+    put_u32(header, 8);
+
+    put_u16(header, entry_count);
+    put_tiff_entry(header, 256, LONG, 1, image.size.x);  // ImageWidth
+    put_tiff_entry(header, 257, LONG, 1, image.size.y);  // ImageLength
+    put_tiff_entry(header, 258, SHORT, 3, bits_offset);  // BitsPerSample
+    put_tiff_entry(header, 259, SHORT, 1, 1);            // No compression
+    put_tiff_entry(header, 262, SHORT, 1, 2);            // RGB
+    put_tiff_entry(header, 273, LONG, 1, pixel_offset);  // StripOffsets
+    put_tiff_entry(header, 277, SHORT, 1, 3);            // SamplesPerPixel
+    put_tiff_entry(header, 278, LONG, 1, image.size.y);  // RowsPerStrip
+    put_tiff_entry(header, 279, LONG, 1,                 // StripByteCounts
+                   image.size.x * image.size.y * 3);
+    put_tiff_entry(header, 284, SHORT, 1, 1);            // Interleaved
+    put_u32(header, 0);
+
+    put_u16(header, 8);
+    put_u16(header, 8);
+    put_u16(header, 8);
+
+    vector<byte> rgb;
+    get_rgb_rows(image.pixels, image.size, rgb);
+
+    return write_file(filename, header, rgb);
+}
+
+static void put_png_chunk(vector<byte>& out, const char* type, 
+                          const byte* data, size_t size)
+{
+    put_u32_be(out, size);
+
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + size);
+
+    uLong crc = crc32(0L, Z_NULL, 0);
+    crc = crc32(crc, &out[start], out.size() - start);
+
+    put_u32_be(out, crc);
+}
+
+bool FrameWriter::write_png(const Image& image, const string& filename)
+{
+    int width = image.size.x;
+    int height = image.size.y;
+    size_t row_size = width * 3 + 1;
+
+    vector<byte> rgb;
+    get_rgb_rows(image.pixels, image.size, rgb);
+
+    //Every row uses the Sub filter, which stores the difference to the 
+    //pixel on the left
+    vector<byte> filtered(row_size * height);
+
+    for (int y = 0; y < height; ++y) {
+        const byte* in = &rgb[y * width * 3];
+        byte* out = &filtered[y * row_size];
+
+        *out++ = 1;
+        for (int i = 0; i < width * 3; ++i) {
+            out[i] = (i < 3) ? in[i] : byte(in[i] - in[i-3]);
+        }
+    }
+
+    uLongf compressed_size = compressBound(filtered.size());
+    vector<byte> compressed(compressed_size);
+
+    if (compress2(&compressed[0], &compressed_size, 
+                  &filtered[0], filtered.size(), 
+                  Z_DEFAULT_COMPRESSION) != Z_OK) {
+        return false;
+    }
+
+    static const byte signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+    vector<byte> header(signature, signature + 8);
+
+    vector<byte> ihdr;
+    put_u32_be(ihdr, width);
+    put_u32_be(ihdr, height);
+    ihdr.push_back(8);  // bit depth
+    ihdr.push_back(2);  // RGB
+    ihdr.push_back(0);  // deflate
+    ihdr.push_back(0);  // adaptive filtering
+    ihdr.push_back(0);  // no interlace
+
+    put_png_chunk(header, "IHDR", &ihdr[0], ihdr.size());
+
+    vector<byte> chunks;
+    put_png_chunk(chunks, "IDAT", &compressed[0], compressed_size);
+    put_png_chunk(chunks, "IEND", NULL, 0);
+
+    return write_file(filename, header, chunks);
+}
+
+static void put_exr_attribute(vector<byte>& out, const char* name, 
+                              const char* type, unsigned size)
+{
+    put_string(out, name);
+    put_string(out, type);
+    put_u32(out, size);
+}
+
+bool FrameWriter::write_exr(const Image& image, const string& filename)
+{
+    int width = image.size.x;
+    int height = image.size.y;
+
+    vector<byte> header;
+    put_u32(header, 20000630);
+    put_u32(header, 2);  // single part scanline file
+
+    //Channels are sorted by name
+    const char* channels[] = {"B", "G", "R"};
+    const int channel_offsets[] = {2, 1, 0};
+
+    put_exr_attribute(header, "channels", "chlist", 3 * 18 + 1);
+    for (int c = 0; c < 3; ++c) {
+        put_string(header, channels[c]);
+        put_u32(header, 1);  // HALF
+        put_u32(header, 0);  // pLinear and reserved
+        put_u32(header, 1);  // x sampling
+        put_u32(header, 1);  // y sampling
+    }
+    header.push_back(0);
+
+    put_exr_attribute(header, "compression", "compression", 1);
+    header.push_back(0);
+
+    const char* windows[] = {"dataWindow", "displayWindow"};
+    for (int i = 0; i < 2; ++i) {
+        put_exr_attribute(header, windows[i], "box2i", 16);
+        put_u32(header, 0);
+        put_u32(header, 0);
+        put_u32(header, width - 1);
+        put_u32(header, height - 1);
+    }
+
+    put_exr_attribute(header, "lineOrder", "lineOrder", 1);
+    header.push_back(0);  // increasing y
+
+    float one = 1.0f;
+    unsigned one_bits;
+    memcpy(&one_bits, &one, 4);
+
+    put_exr_attribute(header, "pixelAspectRatio", "float", 4);
+    put_u32(header, one_bits);
+
+    put_exr_attribute(header, "screenWindowCenter", "v2f", 8);
+    put_u32(header, 0);
+    put_u32(header, 0);
+
+    put_exr_attribute(header, "screenWindowWidth", "float", 4);
+    put_u32(header, one_bits);
+
+    header.push_back(0);
+
+    //One scanline per block, preceded by the table of their offsets
+    unsigned line_size = width * 3 * 2;
+    size_t block_size = 8 + line_size;
+    size_t first_block = header.size() + height * 8;
+
+    for (int y = 0; y < height; ++y) {
+        uint64_t offset = first_block + y * block_size;
+        put_u32(header, unsigned(offset & 0xffffffff));
+        put_u32(header, unsigned(offset >> 32));
+    }
+
+    vector<byte> blocks;
+    blocks.reserve(height * block_size);
+
+    for (int y = 0; y < height; ++y) {
+        put_u32(blocks, y);
+        put_u32(blocks, line_size);
+
+        //Rows are stored from the top
+        const byte* row = &image.pixels[(height - 1 - y) * width * 8];
+
+        for (int c = 0; c < 3; ++c) {
+            for (int x = 0; x < width; ++x) {
+                unsigned short half;
+                memcpy(&half, row + x*8 + channel_offsets[c]*2, 2);
+                put_u16(blocks, half);
+            }
+        }
+    }
+
+    return write_file(filename, header, blocks);
+}
+
+bool FrameWriter::is_complete(const string& filename, Format format,
+                              const ivec2& size)
+{
+    std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+
+    if (!in)
+        return false;
+
+    in.seekg(0, std::ios::end);
+    std::streamoff length = in.tellg();
+    in.seekg(0, std::ios::beg);
+
+    if (length <= 0)
+        return false;
+
+    vector<byte> file(length);
+    in.read((char*)&file[0], length);
+
+    if (!in.good())
+        return false;
+
+    switch (format) {
+    case TIFF: return is_complete_tiff(file, size);
+    case PNG: return is_complete_png(file, size);
+    case EXR: return is_complete_exr(file, size);
+    }
+
+    return false;
+}
+
+bool FrameWriter::is_complete_tiff(const vector<byte>& file, 
+                                   const ivec2& size)
+{
+    //Same layout as write_tiff: a fixed header followed by the pixels
+    const size_t pixel_offset = 8 + 2 + 10*12 + 4 + 6;
+
+    if (file.size() != pixel_offset + size.x * size.y * 3)
+        return false;
+
+    if (file[0] != 'I' || file[1] != 'I' || get_u32(file, 4) != 8)
+        return false;
+
+    //Values of the ImageWidth and ImageLength entries
+    return (get_u32(file, 18) == unsigned(size.x) &&
+            get_u32(file, 30) == unsigned(size.y));
+}
+
+bool FrameWriter::is_complete_png(const vector<byte>& file, 
+                                  const ivec2& size)
+{
+    static const byte signature[] = {137, 80, 78, 71, 13, 10, 26, 10};
+
+    //Signature, IHDR and IEND chunks
+    if (file.size() < 8 + 25 + 12)
+        return false;
+
+    if (memcmp(&file[0], signature, 8) != 0 || 
+        memcmp(&file[12], "IHDR", 4) != 0)
+        return false;
+
+    if (get_u32_be(file, 16) != unsigned(size.x) || 
+        get_u32_be(file, 20) != unsigned(size.y))
+        return false;
+
+    return memcmp(&file[file.size() - 8], "IEND", 4) == 0;
+}
+
+bool FrameWriter::is_complete_exr(const vector<byte>& file, 
+                                  const ivec2& size)
+{
+    if (file.size() < 8 || get_u32(file, 0) != 20000630)
+        return false;
+
+    //Skip the attributes, each is a name, a type, a size and a value
+    size_t offset = 8;
+    ivec2 data_size(0);
+
+    while (offset < file.size() && file[offset] != 0) {
+        const char* name = (const char*)&file[offset];
+        size_t type = offset + strnlen(name, file.size() - offset) + 1;
+
+        if (type >= file.size())
+            return false;
+
+        size_t value_size = type + strnlen((const char*)&file[type], 
+                                           file.size() - type) + 1;
+
+        if (value_size + 4 > file.size())
+            return false;
+
+        size_t value = value_size + 4;
+
+        if (value + get_u32(file, value_size) > file.size())
+            return false;
+
+        if (strcmp(name, "dataWindow") == 0 && value + 16 <= file.size()) {
+            data_size.x = get_u32(file, value + 8) - get_u32(file, value) + 1;
+            data_size.y = get_u32(file, value + 12) - get_u32(file, value + 4)
+                          + 1;
+        }
+
+        offset = value + get_u32(file, value_size);
+    }
+
+    if (data_size.x != size.x || data_size.y != size.y)
+        return false;
+
+    //The last scanline has to end with the file
+    size_t table = offset + 1;
+    size_t last_entry = table + (size.y - 1) * 8;
+
+    if (last_entry + 8 > file.size())
+        return false;
+
+    uint64_t last_block = get_u32(file, last_entry) | 
+        (uint64_t(get_u32(file, last_entry + 4)) << 32);
+
+    return last_block + 8 + size.x * 3 * 2 == file.size();
+}
@@ -0,0 +1,121 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef FRAMEWRITER_H
+#define FRAMEWRITER_H
+
+#include "common.h"
+
+/**
+ * Saves rendered frames without stalling the renderer. Pixels are read 
+ * into a ring of pixel buffer objects, so the read back finishes while 
+ * the following frames are drawn. Once a buffer is reused, its pixels are
+ * queued for a pool of threads encoding and writing the image files. 
+ * capture() blocks if the encoders fall behind.
+ */
+class FrameWriter : boost::noncopyable
+{
+    public:
+
+    enum Format {
+        TIFF, /**< Uncompressed 8 bit RGB */
+        PNG,  /**< Deflate compressed 8 bit RGB */
+        EXR   /**< Uncompressed half float RGB */
+    };
+
+    /**
+     * @param size Size of the captured frames in pixels.
+     * @param format Format of the written files.
+     * @param frames_in_flight Number of pixel buffers read into before 
+     * the first one is waited for.
+     * @param thread_count Number of encoding threads.
+     */
+    FrameWriter(const ivec2& size, Format format, 
+                int frames_in_flight, int thread_count);
+
+    /**
+     * Writes all frames still in flight, see finish().
+     */
+    ~FrameWriter();
+
+    /**
+     * Starts reading the frame from the current read buffer. It will be 
+     * written to filename, which should not have an extension.
+     * @param offset Lower left corner of the frame in the read buffer.
+     */
+    void capture(const ivec2& offset, const string& filename);
+
+    /**
+     * Waits until all captured frames have been written.
+     */
+    void finish();
+
+    /**
+     * File extension for the format, including the dot.
+     */
+    static string extension(Format format);
+
+    /**
+     * Number of frames that could not be written so far.
+     */
+    int failed_count() const;
+
+    /**
+     * Checks whether filename holds a complete image of the given format 
+     * and size, as written by a FrameWriter.
+     */
+    static bool is_complete(const string& filename, Format format, 
+                            const ivec2& size);
+
+    private:
+
+    struct Image;
+    struct State;
+    class Encoder;
+
+    struct Readback {
+        GLuint buffer;
+        GLsync fence;
+        string filename;
+    };
+
+    ivec2 _size;
+    Format _format;
+    size_t _image_size;
+
+    vector<Readback> _ring;
+    size_t _next;
+
+    State* _state;
+
+    void retire(Readback& readback);
+    void encode();
+
+    static bool write_tiff(const Image& image, const string& filename);
+    static bool write_png(const Image& image, const string& filename);
+    static bool write_exr(const Image& image, const string& filename);
+
+    static bool is_complete_tiff(const vector<byte>& file, const ivec2& size);
+    static bool is_complete_png(const vector<byte>& file, const ivec2& size);
+    static bool is_complete_exr(const vector<byte>& file, const ivec2& size);
+};
+
+#endif
@@ -25,14 +25,21 @@ Geometry::Geometry(const string& id,
                    const GPUMeshRef& mesh, 
                    const TransformNodeRef& node,
                    const MaterialInstanceRef& material,
-                   const string& mat_str_id) : 
+                   const string& mat_str_id,
+                   const SkinInstanceRef& skin) : 
     SceneObject(id, node),
     _mesh(mesh), _material_instance(material),
-    _material_str_id(mat_str_id)
+    _material_str_id(mat_str_id),
+    _skin(skin)
 {
     update_bounding_volume();
 }
 
+bool Geometry::has_changed() const {
+    return SceneObject::transform_node()->has_changed() ||
+        (_skin && _skin->has_changed());
+}
+
 void Geometry::prepare(const Shader& shader) const {
 }
 
@@ -43,9 +50,9 @@ void Geometry::draw(const Shader& shader) const {
 
 const BoundingVolume& Geometry::bounding_volume() const {
 
-    //we only update the bounding volume, if the trafo has
+    //we only update the bounding volume, if the trafo or the skin has
     //changed
-    if (SceneObject::transform_node()->has_changed()) {
+    if (has_changed()) {
         update_bounding_volume();
     }
 
@@ -53,6 +60,12 @@ const BoundingVolume& Geometry::bounding_volume() const {
 }
 
 void Geometry::update_bounding_volume() const {
+    //the joints of a skin are already in world space
+    if (_skin && _skin->has_bounds()) {
+        _bounding_volume = BoundingVolume(_skin->bounding_sphere());
+        return;
+    }
+
     const mat4& model_m = SceneObject::get_local_to_world();
     //TODO: we should use OBB in here... 
 
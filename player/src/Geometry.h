@@ -28,6 +28,7 @@
 #include "BoundingVolume.h"
 
 #include "MaterialManager.h"
+#include "SkinInstance.h"
 
 /**
  * A simple runtime-class representing an instance of a
@@ -43,15 +44,23 @@ public:
              const GPUMeshRef& mesh,
              const TransformNodeRef& node,
              const MaterialInstanceRef& material,
-             const string& mat_str_id);
+             const string& mat_str_id,
+             const SkinInstanceRef& skin = SkinInstanceRef());
 
     virtual ~Geometry() {}
 
+    /**
+     * Whether the transform node or the skin changed in the last update.
+     */
+    bool has_changed() const;
+
     void draw(const Shader& shader) const;
     void prepare(const Shader& shader) const;
 
     const BoundingVolume& bounding_volume() const;
 
+    const GPUMeshRef& mesh() const { return _mesh; }
+
     int material_id() const { return _material_instance->material_id(); }
 
     const string& material_string_id() const { return _material_str_id; }
@@ -65,6 +74,11 @@ public:
 
     void reset_material() { _material_instance.reset(); } 
 
+    /**
+     * The skin that deforms the mesh, or NULL.
+     */
+    const SkinInstanceRef& skin() const { return _skin; }
+
 private:
     //In future this will also be a collection of tuple<GPUMeshRef, Material>
     //However, we have no real material system yet.
@@ -73,6 +87,8 @@ private:
 
     string _material_str_id;
 
+    SkinInstanceRef _skin;
+
     void update_bounding_volume() const;
 
     mutable BoundingVolume _bounding_volume;
@@ -23,6 +23,7 @@
 #include "Runtime.h"
 #include "RtrPlayerConfig.h"
 #include "Timer.h"
+#include "Profiler.h"
 
 InputHandler* input_handler_callback_object = NULL;
 
@@ -134,6 +135,8 @@ void InputHandler::key_callback(int key, int action)
             cout << "Activating bounding box geometry." << endl;
             config.set_draw_bounding_geometry(true);
         }
+    } else if (key == GLFW_KEY_F9) {
+        Profiler::set_enabled(!Profiler::enabled());
     } else if (key == GLFW_KEY_RIGHT) {
         if (glfwGetKey(GLFW_KEY_LSHIFT)) {
             _timer.fast_forward();
@@ -36,9 +36,11 @@ GPULayerSource::GPULayerSource(const LayerSourceInitializer& init) {
 
     if (source_data.access_elements<float>() != NULL) {
         _element_size = sizeof(float);
+        _type = GL_FLOAT;
         gl_read_ptr = source_data.access_elements<float>();
     } else if (source_data.access_elements<int>() != NULL) {
         _element_size = sizeof(int);
+        _type = GL_INT;
         gl_read_ptr = source_data.access_elements<int>();
     } else {
         std::cerr << "Error type of source data in LayerSourceInitializer "
@@ -79,6 +81,20 @@ int GPULayerSource::element_size() const {
     return _element_size;
 }
 
+void GPULayerSource::update(const float* data) {
+    assert(_type == GL_FLOAT);
+
+    glBindBuffer(GL_ARRAY_BUFFER, _vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, _num_elements*_element_size, NULL, 
+                 GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, _num_elements*_element_size, data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GPULayerSource::bind_feedback(GLuint index) const {
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, index, _vertex_buffer);
+}
+
 LayerSourceInitializer::LayerSourceInitializer() :
     _id("EMPTY")
 {}
@@ -109,11 +125,6 @@ LayerSourceInitializer(const rtr_format::LayerSource& layer_source) :
                   << std::endl;
         assert(NULL);
     }
-
-    if (_data.get_gl_type() != GL_FLOAT) {
-        cout << "Error: Layer source declares to hold non-float data. This " 
-             << "is currently not supported." << endl;
-    }
 }
 
 LayerSourceInitializer::LayerSourceInitializer( const string& id,
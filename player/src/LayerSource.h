@@ -70,11 +70,29 @@ public:
      */
     int element_size() const;
 
+    /**
+     * GL_FLOAT or GL_INT, the type of the initial data.
+     */
+    GLenum type() const { return _type; }
+
+    /**
+     * Replaces all elements of a float source, used for data that changes 
+     * every frame. The old storage is orphaned, so this doesn't wait for 
+     * draw calls still reading it.
+     */
+    void update(const float* data);
+
+    /**
+     * Binds the VBO as output of transform feedback.
+     */
+    void bind_feedback(GLuint index) const;
+
 private:
 
     GLuint _vertex_buffer;
     int _num_elements;
     int _element_size;
+    GLenum _type;
     string _id;
 
 };
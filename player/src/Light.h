@@ -57,13 +57,13 @@ public:
 
     vec3 calc_multiplied_intensity();
 
-    Type get_type() { return _type; }
+    Type get_type() const { return _type; }
 
     vec3 world_position();
     vec3 world_direction();
 
-    vec4 attenuation() { return _attenuation; }
-    vec2 spot_attenuation() { return _spot_attenuation; }
+    vec4 attenuation() const { return _attenuation; }
+    vec2 spot_attenuation() const { return _spot_attenuation; }
     int shadowmap_id() { return _shadowmap_id; }
 
     void set_attenuation(vec4 attenuation) { _attenuation = attenuation; }
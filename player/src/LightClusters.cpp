@@ -0,0 +1,650 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "LightClusters.h"
+#include "BufferTexture.h"
+#include "Shader.h"
+#include "Profiler.h"
+
+#include <glm/gtc/matrix_projection.hpp>
+#include <glm/gtx/transform2.hpp>
+
+#include <cmath>
+#include <limits>
+#include <cstdlib>
+
+//see DBLoader.h
+#undef ERROR
+#undef SYNCHRONIZE
+
+#include <kcutil.h>
+
+namespace kc = kyotocabinet;
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LIGHT_CLUSTERS_USE_SSE
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+    /**
+     * Tile that contains a coordinate in normalized device coordinates,
+     * clamped to the grid.
+     */
+    int find_tile(float ndc, int count)
+    {
+        float tile = (ndc * 0.5f + 0.5f) * count;
+        
+        if (tile < 0.0f)
+            return 0;
+        if (tile >= count)
+            return count - 1;
+
+        return int(tile);
+    }
+
+    /**
+     * Distance of a value to an interval, 0 if it is inside.
+     */
+    float distance(float value, float min, float max)
+    {
+        return std::max(std::max(min - value, value - max), 0.0f);
+    }
+
+    /**
+     * Whether a sphere intersects a cone with the given range. Conservative
+     * close to the apex.
+     */
+    bool cone_intersects_sphere(const vec3& apex, const vec3& direction,
+                                float cos_angle, float sin_angle, 
+                                float range, 
+                                const vec3& center, float radius)
+    {
+        vec3 v = center - apex;
+        float v_len_sq = glm::dot(v, v);
+        float v1_len = glm::dot(v, direction);
+        float closest = cos_angle * 
+                        std::sqrt(std::max(v_len_sq - v1_len * v1_len, 0.0f)) -
+                        v1_len * sin_angle;
+
+        return !(closest > radius || 
+                 v1_len > radius + range || 
+                 v1_len < -radius);
+    }
+
+    float segment_distance(const vec3& p, const vec3& a, const vec3& b)
+    {
+        vec3 ab = b - a;
+        float t = glm::clamp(glm::dot(p - a, ab) / glm::dot(ab, ab), 
+                             0.0f, 1.0f);
+        return glm::length(p - (a + ab * t));
+    }
+
+    /**
+     * Exact distance of a point to a convex hexahedron with planar faces,
+     * 0 inside. Corner x + 2 * y + 4 * z is the one at (x, y, z) in the 
+     * unit cube.
+     */
+    float hexahedron_distance(const vec3& p, const vec3* corners)
+    {
+        static const int faces[6][4] = {
+            {0, 2, 6, 4}, {1, 3, 7, 5}, 
+            {0, 1, 5, 4}, {2, 3, 7, 6}, 
+            {0, 1, 3, 2}, {4, 5, 7, 6}
+        };
+
+        vec3 centroid(0.0f);
+        for (int i = 0; i < 8; ++i) {
+            centroid += corners[i] * 0.125f;
+        }
+
+        //The closest point is on a face p is outside of
+        float closest = 0.0f;
+        bool inside = true;
+
+        for (int f = 0; f < 6; ++f) {
+            const vec3* v[4] = { &corners[faces[f][0]], &corners[faces[f][1]],
+                                 &corners[faces[f][2]], &corners[faces[f][3]] };
+
+            vec3 n = glm::normalize(glm::cross(*v[2] - *v[0], *v[3] - *v[1]));
+            if (glm::dot(centroid - *v[0], n) > 0.0f)
+                n = -n;
+
+            float d = glm::dot(p - *v[0], n);
+            if (d <= 0.0f)
+                continue;
+
+            //Is the projection onto the plane inside the face?
+            vec3 q = p - n * d;
+            int sides = 0;
+            for (int e = 0; e < 4; ++e) {
+                const vec3& a = *v[e];
+                const vec3& b = *v[(e + 1) % 4];
+                sides += glm::dot(glm::cross(b - a, q - a), n) >= 0.0f ? 
+                         1 : -1;
+            }
+
+            if (sides != 4 && sides != -4) {
+                d = std::numeric_limits<float>::max();
+                for (int e = 0; e < 4; ++e) {
+                    d = std::min(d, segment_distance(p, *v[e], 
+                                                     *v[(e + 1) % 4]));
+                }
+            }
+
+            closest = inside ? d : std::min(closest, d);
+            inside = false;
+        }
+
+        return closest;
+    }
+
+    /**
+     * Point on the near plane for normalized device coordinates.
+     */
+    vec3 unproject(const mat4& inverse_projection, float x, float y, float z)
+    {
+        vec4 p = inverse_projection * vec4(x, y, z, 1.0f);
+        return vec3(p) / p.w;
+    }
+
+    float random_float() {
+        return std::rand() / float(RAND_MAX);
+    }
+
+}
+
+LightClusters::LightClusters(const ivec3& grid, int thread_count) :
+    _grid(glm::max(grid, ivec3(1))),
+    _near(0),
+    _far(0),
+    _projection_scale(1),
+    _x_stride(_grid.x + 3),
+    _slice_depths(_grid.z + 1),
+    _x_min(_grid.z * _x_stride),
+    _x_max(_grid.z * _x_stride),
+    _y_min(_grid.z * _grid.y),
+    _y_max(_grid.z * _grid.y),
+    _assignments(_grid.z),
+    _slice_indices(_grid.z),
+    _counts(cluster_count()),
+    _ranges(cluster_count() * 2),
+    _pool(thread_count)
+{
+}
+
+LightClusters::~LightClusters()
+{
+}
+
+void LightClusters::setup(const vector<Light>& lights,
+                          const mat4& view, const mat4& projection)
+{
+    _near = projection[3][2] / (projection[2][2] - 1.0f);
+    _far = projection[3][2] / (projection[2][2] + 1.0f);
+    _projection_scale = vec2(projection[0][0], projection[1][1]);
+
+    float slice_scale = _grid.z / std::log(_far / _near);
+
+    for (int s = 0; s <= _grid.z; ++s) {
+        _slice_depths[s] = _near * std::pow(_far / _near, float(s) / _grid.z);
+    }
+
+    //Bounding boxes of the tiles, a tile gets wider with the distance
+    for (int s = 0; s < _grid.z; ++s) {
+        float d0 = _slice_depths[s];
+        float d1 = _slice_depths[s + 1];
+
+        for (int x = 0; x < _x_stride; ++x) {
+            int i = s * _x_stride + x;
+
+            if (x >= _grid.x) {
+                //Padding never intersects anything
+                _x_min[i] = std::numeric_limits<float>::max();
+                _x_max[i] = -std::numeric_limits<float>::max();
+                continue;
+            }
+
+            float u0 = -1.0f + 2.0f * x / _grid.x;
+            float u1 = -1.0f + 2.0f * (x + 1) / _grid.x;
+            _x_min[i] = std::min(u0 * d0, u0 * d1) / _projection_scale.x;
+            _x_max[i] = std::max(u1 * d0, u1 * d1) / _projection_scale.x;
+        }
+
+        for (int y = 0; y < _grid.y; ++y) {
+            int i = s * _grid.y + y;
+            float v0 = -1.0f + 2.0f * y / _grid.y;
+            float v1 = -1.0f + 2.0f * (y + 1) / _grid.y;
+            _y_min[i] = std::min(v0 * d0, v0 * d1) / _projection_scale.y;
+            _y_max[i] = std::max(v1 * d0, v1 * d1) / _projection_scale.y;
+        }
+    }
+
+    _lights.resize(lights.size());
+
+    for (size_t i = 0; i < lights.size(); ++i) {
+        const Light& light = lights[i];
+        ViewLight& view_light = _lights[i];
+
+        vec4 center = view * vec4(light.position, 1.0f);
+        vec3 direction = mat3(view) * light.direction;
+
+        view_light.center = vec3(center.x, center.y, -center.z);
+        view_light.radius = light.range;
+        view_light.direction = vec3(direction.x, direction.y, -direction.z);
+        view_light.cos_angle = light.cos_angle;
+        view_light.sin_angle = std::sqrt(std::max(0.0f, 
+                                         1.0f - light.cos_angle * 
+                                                light.cos_angle));
+
+        float front = view_light.center.z - view_light.radius;
+        float back = view_light.center.z + view_light.radius;
+
+        if (back < _near || front > _far) {
+            view_light.first_slice = 1;
+            view_light.last_slice = 0;
+            continue;
+        }
+
+        //One more slice on each side, find_tiles() does the exact test
+        int first = front <= _near ? 0 : 
+            int(std::log(front / _near) * slice_scale) - 1;
+        int last = int(std::log(back / _near) * slice_scale) + 1;
+
+        view_light.first_slice = std::max(first, 0);
+        view_light.last_slice = std::min(last, _grid.z - 1);
+    }
+}
+
+bool LightClusters::find_tiles(const ViewLight& light, int slice,
+                               ivec4& tiles) const
+{
+    float d0 = std::max(light.center.z - light.radius, _slice_depths[slice]);
+    float d1 = std::min(light.center.z + light.radius, 
+                        _slice_depths[slice + 1]);
+
+    if (d0 > d1)
+        return false;
+
+    //Project the corners of the bounding box of the sphere within the slice
+    float left = light.center.x - light.radius;
+    float right = light.center.x + light.radius;
+    float bottom = light.center.y - light.radius;
+    float top = light.center.y + light.radius;
+
+    float x0 = std::min(left / d0, left / d1) * _projection_scale.x;
+    float x1 = std::max(right / d0, right / d1) * _projection_scale.x;
+    float y0 = std::min(bottom / d0, bottom / d1) * _projection_scale.y;
+    float y1 = std::max(top / d0, top / d1) * _projection_scale.y;
+
+    if (x1 < -1.0f || x0 > 1.0f || y1 < -1.0f || y0 > 1.0f)
+        return false;
+
+    tiles = ivec4(find_tile(x0, _grid.x), find_tile(y0, _grid.y),
+                  find_tile(x1, _grid.x), find_tile(y1, _grid.y));
+
+    return true;
+}
+
+bool LightClusters::cone_intersects(const ViewLight& light,
+                                    int x, int y, int slice) const
+{
+    int ix = slice * _x_stride + x;
+    int iy = slice * _grid.y + y;
+
+    vec3 min(_x_min[ix], _y_min[iy], _slice_depths[slice]);
+    vec3 max(_x_max[ix], _y_max[iy], _slice_depths[slice + 1]);
+
+    //The cluster's bounding sphere against the cone
+    return cone_intersects_sphere(light.center, light.direction, 
+                                  light.cos_angle, light.sin_angle,
+                                  light.radius, (min + max) * 0.5f, 
+                                  glm::length(max - min) * 0.5f);
+}
+
+void LightClusters::run_job(int slice)
+{
+    ProfileZone zone("light cluster slice");
+
+    vector<Assignment>& assignments = _assignments[slice];
+    assignments.clear();
+
+    int tile_count = _grid.x * _grid.y;
+    float slice_front = _slice_depths[slice];
+    float slice_back = _slice_depths[slice + 1];
+
+    for (size_t l = 0; l < _lights.size(); ++l) {
+        const ViewLight& light = _lights[l];
+
+        if (slice < light.first_slice || slice > light.last_slice)
+            continue;
+
+        ivec4 tiles;
+        if (!find_tiles(light, slice, tiles))
+            continue;
+
+        float dz = distance(light.center.z, slice_front, slice_back);
+        float radius_sq = light.radius * light.radius;
+        bool is_spot = light.cos_angle > -1.0f;
+
+        const float* x_min = &_x_min[slice * _x_stride];
+        const float* x_max = &_x_max[slice * _x_stride];
+
+#ifdef LIGHT_CLUSTERS_USE_SSE
+        __m128 center_x = _mm_set1_ps(light.center.x);
+        __m128 radius_sq4 = _mm_set1_ps(radius_sq);
+        __m128 zero = _mm_setzero_ps();
+#endif
+
+        for (int y = tiles.y; y <= tiles.w; ++y) {
+            int iy = slice * _grid.y + y;
+            float dy = distance(light.center.y, _y_min[iy], _y_max[iy]);
+            float dyz = dy * dy + dz * dz;
+
+            if (dyz > radius_sq)
+                continue;
+
+#ifdef LIGHT_CLUSTERS_USE_SSE
+            __m128 dyz4 = _mm_set1_ps(dyz);
+
+            for (int x = tiles.x; x <= tiles.z; x += 4) {
+                __m128 dx = _mm_max_ps(
+                    _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(x_min + x), center_x),
+                               _mm_sub_ps(center_x, _mm_loadu_ps(x_max + x))),
+                    zero);
+                __m128 d = _mm_add_ps(_mm_mul_ps(dx, dx), dyz4);
+
+                int mask = _mm_movemask_ps(_mm_cmple_ps(d, radius_sq4));
+
+                //Tiles past the end of the range
+                if (tiles.z - x < 3)
+                    mask &= (1 << (tiles.z - x + 1)) - 1;
+
+                for (int lane = 0; mask != 0; ++lane, mask >>= 1) {
+                    if (!(mask & 1))
+                        continue;
+
+                    if (is_spot && 
+                        !cone_intersects(light, x + lane, y, slice))
+                        continue;
+
+                    Assignment a = { uint32_t(y * _grid.x + x + lane), 
+                                     uint32_t(l) };
+                    assignments.push_back(a);
+                }
+            }
+#else
+            for (int x = tiles.x; x <= tiles.z; ++x) {
+                float dx = distance(light.center.x, x_min[x], x_max[x]);
+
+                if (dx * dx + dyz > radius_sq)
+                    continue;
+
+                if (is_spot && !cone_intersects(light, x, y, slice))
+                    continue;
+
+                Assignment a = { uint32_t(y * _grid.x + x), uint32_t(l) };
+                assignments.push_back(a);
+            }
+#endif
+        }
+    }
+
+    //Sort by cluster, lights stay in ascending order
+    uint32_t* counts = &_counts[slice * tile_count];
+    std::fill(counts, counts + tile_count, 0);
+
+    for (size_t i = 0; i < assignments.size(); ++i) {
+        ++counts[assignments[i].cluster];
+    }
+
+    vector<uint32_t> offsets(tile_count);
+    for (int i = 1; i < tile_count; ++i) {
+        offsets[i] = offsets[i - 1] + counts[i - 1];
+    }
+
+    vector<uint32_t>& indices = _slice_indices[slice];
+    indices.resize(assignments.size());
+
+    for (size_t i = 0; i < assignments.size(); ++i) {
+        indices[offsets[assignments[i].cluster]++] = assignments[i].light;
+    }
+}
+
+void LightClusters::assign(const vector<Light>& lights, 
+                           const mat4& view, const mat4& projection)
+{
+    ProfileZone zone("light clusters");
+
+    setup(lights, view, projection);
+
+    _pool.run(*this, _grid.z);
+
+    //Clusters are ordered by slice, so the slices are just concatenated
+    _indices.clear();
+
+    uint32_t offset = 0;
+    for (int c = 0; c < cluster_count(); ++c) {
+        _ranges[c * 2] = offset;
+        _ranges[c * 2 + 1] = _counts[c];
+        offset += _counts[c];
+    }
+
+    _indices.reserve(offset);
+    for (int s = 0; s < _grid.z; ++s) {
+        _indices.insert(_indices.end(), _slice_indices[s].begin(), 
+                        _slice_indices[s].end());
+    }
+}
+
+void LightClusters::assign_brute_force(const vector<Light>& lights,
+                                       const mat4& view, 
+                                       const mat4& projection)
+{
+    //Only for z_near() and z_far(). The clusters are rebuilt from the 
+    //inverse projection and tested exactly, so neither the tile boxes nor
+    //find_tiles() are trusted here.
+    setup(lights, view, projection);
+
+    mat4 inverse_projection = glm::inverse(projection);
+    float z_near = -unproject(inverse_projection, 0, 0, -1).z;
+    float z_far = -unproject(inverse_projection, 0, 0, 1).z;
+
+    //Lights in view space
+    vector<vec3> centers(lights.size());
+    vector<vec3> directions(lights.size());
+
+    for (size_t l = 0; l < lights.size(); ++l) {
+        centers[l] = vec3(view * vec4(lights[l].position, 1.0f));
+        directions[l] = mat3(view) * lights[l].direction;
+    }
+
+    _indices.clear();
+
+    int c = 0;
+    for (int s = 0; s < _grid.z; ++s) {
+        float d0 = z_near * std::pow(z_far / z_near, float(s) / _grid.z);
+        float d1 = z_near * std::pow(z_far / z_near, float(s + 1) / _grid.z);
+
+        for (int y = 0; y < _grid.y; ++y) {
+            for (int x = 0; x < _grid.x; ++x, ++c) {
+                _ranges[c * 2] = _indices.size();
+
+                //The cluster's eight corners and their bounding box
+                vec3 corners[8];
+                vec3 min(std::numeric_limits<float>::max());
+                vec3 max(-std::numeric_limits<float>::max());
+
+                for (int corner = 0; corner < 4; ++corner) {
+                    float u = -1.0f + 2.0f * (x + (corner & 1)) / _grid.x;
+                    float v = -1.0f + 2.0f * (y + (corner >> 1)) / _grid.y;
+                    vec3 ray = unproject(inverse_projection, u, v, -1.0f);
+
+                    corners[corner] = ray * (d0 / -ray.z);
+                    corners[corner + 4] = ray * (d1 / -ray.z);
+                    min = glm::min(min, glm::min(corners[corner], 
+                                                 corners[corner + 4]));
+                    max = glm::max(max, glm::max(corners[corner], 
+                                                 corners[corner + 4]));
+                }
+
+                for (size_t l = 0; l < lights.size(); ++l) {
+                    const Light& light = lights[l];
+
+                    //The box contains the cluster, only what touches it 
+                    //needs the exact test
+                    vec3 d = glm::clamp(centers[l], min, max) - centers[l];
+                    if (glm::dot(d, d) > light.range * light.range)
+                        continue;
+
+                    if (hexahedron_distance(centers[l], corners) > 
+                        light.range)
+                        continue;
+
+                    if (light.cos_angle > -1.0f) {
+                        float sin_angle = std::sqrt(std::max(0.0f, 
+                                            1.0f - light.cos_angle * 
+                                                   light.cos_angle));
+
+                        if (!cone_intersects_sphere(centers[l], directions[l],
+                                                    light.cos_angle, 
+                                                    sin_angle, light.range,
+                                                    (min + max) * 0.5f,
+                                                    glm::length(max - min) * 
+                                                    0.5f))
+                            continue;
+                    }
+
+                    _indices.push_back(l);
+                }
+
+                _ranges[c * 2 + 1] = _indices.size() - _ranges[c * 2];
+            }
+        }
+    }
+}
+
+void LightClusters::benchmark(const ivec3& grid, int thread_count, 
+                              int light_count)
+{
+    const int kRuns = 100;
+
+    mat4 projection = glm::perspective(60.0f, 16.0f / 9.0f, 0.1f, 1000.0f);
+    mat4 view = glm::lookAt(vec3(0, 0, 0), vec3(0, 0, -1), vec3(0, 1, 0));
+
+    std::srand(1);
+
+    //Small lights in front of the camera, half of them spot lights
+    vector<Light> lights(light_count);
+    for (int i = 0; i < light_count; ++i) {
+        Light& light = lights[i];
+        float depth = 1.0f + random_float() * 300.0f;
+        light.position = vec3((random_float() * 2.0f - 1.0f) * depth,
+                              (random_float() * 2.0f - 1.0f) * depth * 0.6f,
+                              -depth);
+        light.range = 0.5f + random_float() * 10.0f;
+        light.direction = glm::normalize(vec3(random_float() - 0.5f, 
+                                              random_float() - 0.5f,
+                                              random_float() - 0.5f) + 
+                                         vec3(0.001f));
+        light.cos_angle = (i % 2 == 0) ? -1.0f : 
+            std::cos(glm::radians(10.0f + random_float() * 70.0f));
+    }
+
+    cout << "Light clusters, " << grid.x << "x" << grid.y << "x" << grid.z
+         << " clusters, " << light_count << " lights" << endl;
+
+    LightClusters brute_force(grid, 1);
+    double start = kc::time();
+    brute_force.assign_brute_force(lights, view, projection);
+    double brute_force_time = kc::time() - start;
+
+    int counts[] = { 1, thread_count };
+
+    for (int t = 0; t < (thread_count > 1 ? 2 : 1); ++t) {
+        LightClusters clusters(grid, counts[t]);
+
+        start = kc::time();
+        for (int i = 0; i < kRuns; ++i) {
+            clusters.assign(lights, view, projection);
+        }
+        double ms = (kc::time() - start) * 1000.0 / kRuns;
+
+        //assign() is conservative, extra lights are expected. Missing 
+        //lights would be visible errors.
+        int missing = 0;
+        int extra = 0;
+        for (int c = 0; c < clusters.cluster_count(); ++c) {
+            vector<uint32_t>::const_iterator a = 
+                clusters.indices().begin() + clusters.ranges()[c * 2];
+            vector<uint32_t>::const_iterator a_end = 
+                a + clusters.ranges()[c * 2 + 1];
+            vector<uint32_t>::const_iterator b = 
+                brute_force.indices().begin() + brute_force.ranges()[c * 2];
+            vector<uint32_t>::const_iterator b_end = 
+                b + brute_force.ranges()[c * 2 + 1];
+
+            //Both are ascending
+            while (a != a_end || b != b_end) {
+                if (b == b_end || (a != a_end && *a < *b)) {
+                    ++extra;
+                    ++a;
+                } else if (a == a_end || *b < *a) {
+                    ++missing;
+                    ++b;
+                } else {
+                    ++a;
+                    ++b;
+                }
+            }
+        }
+
+        cout << counts[t] << " thread(s): " << ms << " ms per assignment, "
+             << clusters.indices().size() << " assignments, "
+             << missing << " missing and " << extra 
+             << " extra compared to brute force" << endl;
+    }
+
+    cout << "Brute force: " << brute_force_time * 1000.0 << " ms" << endl;
+}
+
+void LightTextures::bind() const
+{
+    data->bind();
+    ranges->bind();
+    indices->bind();
+}
+
+void LightTextures::unbind() const
+{
+    indices->unbind();
+    ranges->unbind();
+    data->unbind();
+}
+
+void LightTextures::set_uniforms(Shader& shader) const
+{
+    shader.set_uniform("light_data", *data);
+    shader.set_uniform("light_ranges", *ranges);
+    shader.set_uniform("light_indices", *indices);
+}
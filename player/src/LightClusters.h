@@ -0,0 +1,180 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef LIGHTCLUSTERS_H
+#define LIGHTCLUSTERS_H
+
+#include "common.h"
+#include "WorkerPool.h"
+
+class BufferTexture;
+class Shader;
+
+/**
+ * Assigns lights with a limited range to the clusters of a froxel grid: 
+ * the view frustum is divided into tiles on screen and into slices along
+ * the view direction, spaced exponentially between the near and the far 
+ * plane. Shaders look up the cluster of a fragment and only evaluate its
+ * lights, see eval_light.glsl.
+ *
+ * A light is tested against the bounding box of every cluster its sphere
+ * overlaps on screen, spot lights are tested against the cluster's
+ * bounding sphere with their cone as well. Slices are assigned in 
+ * parallel, four tiles are tested at once with SSE2 where available. 
+ * This class doesn't use OpenGL.
+ */
+class LightClusters : boost::noncopyable, WorkerPool::Task
+{
+    public:
+
+    /**
+     * A light with a limited range, in world space.
+     */
+    struct Light {
+        vec3 position;
+        float range;
+        vec3 direction; /**< Normalized, only used for spot lights */
+        float cos_angle; /**< Cosine of the outer cone angle, or -1 */
+    };
+
+    /**
+     * @param grid Number of tiles along x and y and number of slices.
+     * @param thread_count Number of threads used by assign(), including 
+     * the calling one.
+     */
+    LightClusters(const ivec3& grid, int thread_count);
+    ~LightClusters();
+
+    /**
+     * Assigns lights for a camera.
+     * @param projection A symmetric perspective projection.
+     */
+    void assign(const vector<Light>& lights, 
+                const mat4& view, const mat4& projection);
+
+    /**
+     * Same as assign(), but tests the sphere of every light exactly against
+     * every cluster, built from the inverse projection. Shares none of the
+     * culling of assign(), slow, used to validate it. Spot light cones are
+     * tested against the bounding sphere of the cluster like in assign().
+     */
+    void assign_brute_force(const vector<Light>& lights,
+                            const mat4& view, const mat4& projection);
+
+    const ivec3& grid() const { return _grid; }
+    int cluster_count() const { return _grid.x * _grid.y * _grid.z; }
+
+    float z_near() const { return _near; }
+    float z_far() const { return _far; }
+
+    /**
+     * Two values per cluster: offset into indices() and number of lights.
+     * Clusters are ordered by x, then y, then by slice from near to far.
+     */
+    const vector<uint32_t>& ranges() const { return _ranges; }
+
+    /**
+     * Indices into the lights passed to assign(), ascending per cluster.
+     */
+    const vector<uint32_t>& indices() const { return _indices; }
+
+    /**
+     * Assigns random lights with the configured grid and threads, compares 
+     * the result with assign_brute_force() and prints the timings.
+     */
+    static void benchmark(const ivec3& grid, int thread_count, 
+                          int light_count);
+
+    private:
+
+    /**
+     * A light in view space, with z pointing away from the camera.
+     */
+    struct ViewLight {
+        vec3 center;
+        float radius;
+        vec3 direction;
+        float cos_angle;
+        float sin_angle;
+        int first_slice;
+        int last_slice;
+    };
+
+    struct Assignment {
+        uint32_t cluster; /**< Index of the cluster within its slice */
+        uint32_t light;
+    };
+
+    void setup(const vector<Light>& lights, 
+               const mat4& view, const mat4& projection);
+    void run_job(int slice);
+
+    bool find_tiles(const ViewLight& light, int slice, ivec4& tiles) const;
+    bool cone_intersects(const ViewLight& light, 
+                         int x, int y, int slice) const;
+
+    ivec3 _grid;
+
+    float _near;
+    float _far;
+    vec2 _projection_scale;
+
+    //Bounding boxes of the tiles in each slice. Rows of x values are padded
+    //so four of them can always be loaded at once.
+    int _x_stride;
+    vector<float> _slice_depths;
+    vector<float> _x_min;
+    vector<float> _x_max;
+    vector<float> _y_min;
+    vector<float> _y_max;
+
+    vector<ViewLight> _lights;
+
+    //Written by the jobs, one entry per slice
+    vector<vector<Assignment> > _assignments;
+    vector<vector<uint32_t> > _slice_indices;
+    vector<uint32_t> _counts;
+
+    vector<uint32_t> _ranges;
+    vector<uint32_t> _indices;
+
+    WorkerPool _pool;
+};
+
+/**
+ * Buffer textures with the lights and their clusters, they have to be bound
+ * by everything using eval_light.glsl.
+ */
+struct LightTextures {
+    BufferTexture* data;
+    BufferTexture* ranges;
+    BufferTexture* indices;
+
+    void bind() const;
+    void unbind() const;
+
+    /**
+     * Sets the samplers of eval_light.glsl, has to be called while bound.
+     */
+    void set_uniforms(Shader& shader) const;
+};
+
+#endif
@@ -23,8 +23,65 @@
 #include <math.h>
 #include "BoundingVolume.h"
 #include <limits>
+#include <algorithm>
+#include <queue>
+#include "Profiler.h"
 
-LooseOctree::Node::Node() {
+//Growing the tree beyond this depth would overflow the axis indices.
+static const int kMaxGrowDepth = 30;
+
+//Above this depth, a full array is not feasible anymore.
+static const int kMaxArrayDepth = 7;
+
+//Number of purged nodes after which the purge budget is checked.
+static const int kPurgeCheckInterval = 16;
+
+//FALSE for NaN and infinity
+static bool is_finite(float f) {
+    return (f - f) == 0.0f;
+}
+
+//Overlap tests of query_sphere() and query_aabb()
+struct SphereOverlap {
+    const Sphere& sphere;
+
+    SphereOverlap(const Sphere& sphere) : sphere(sphere) {}
+
+    bool cell(const AABB& bounds) const { 
+        return overlap_sphere_aabb(sphere, bounds); 
+    }
+    bool geometry(const Sphere& bounds) const { 
+        return overlap_sphere_sphere(sphere, bounds); 
+    }
+};
+
+struct BoxOverlap {
+    const AABB& box;
+
+    BoxOverlap(const AABB& box) : box(box) {}
+
+    bool cell(const AABB& bounds) const { 
+        return overlap_aabb_aabb(box, bounds); 
+    }
+    bool geometry(const Sphere& bounds) const { 
+        return overlap_sphere_aabb(bounds, box); 
+    }
+};
+
+//Keeps the k nearest hits as a max-heap, i.e. the k-th nearest on top
+static void offer_nearest(vector<LooseOctree::Hit>& heap, size_t k, 
+                          const LooseOctree::Hit& hit) {
+    if (heap.size() < k) {
+        heap.push_back(hit);
+        std::push_heap(heap.begin(), heap.end());
+    } else if (hit.distance < heap.front().distance) {
+        std::pop_heap(heap.begin(), heap.end());
+        heap.back() = hit;
+        std::push_heap(heap.begin(), heap.end());
+    }
+}
+
+LooseOctree::Node::Node() : max_radius(0) {
     for (int ix = 0; ix<2; ++ix)
         for (int iy = 0; iy<2; ++iy)
             for (int iz = 0; iz<2; ++iz)
@@ -43,6 +100,22 @@ bool LooseOctree::Node::has_children() const {
 
 }
 
+bool LooseOctree::subtree_is_empty(const Node* node) {
+
+    if (!node->geometries.empty())
+        return false;
+
+    for (int ix = 0; ix<2; ++ix)
+        for (int iy = 0; iy<2; ++iy)
+            for (int iz = 0; iz<2; ++iz) {
+                const Node* child = node->children[ix][iy][iz];
+                if (child != NULL && !subtree_is_empty(child))
+                    return false;
+            }
+
+    return true;
+}
+
 LooseOctree::LooseOctree( float world_size, 
                           const vec3& center, 
                           int max_depth, 
@@ -54,12 +127,14 @@ LooseOctree::LooseOctree( float world_size,
       _center(center),
       _storage_type(storage_type),
       _do_collect_statistics(do_collect_statistics),
-      _do_collect_debug_info(do_collect_debug_info)
+      _do_collect_debug_info(do_collect_debug_info),
+      _purge_budget(0.0005),
+      _grow_count(0)
 {
 
     if (storage_type == FULL_ARRAY) {
 
-        if (max_depth > 7) {
+        if (max_depth > kMaxArrayDepth) {
             std::cerr << "Warning, you are using an extraordinary amount of "
                       << " memory for tree with depth " << max_depth << "."
                       << "Consider using SPARSE_MAP storage type instead." 
@@ -77,6 +152,9 @@ LooseOctree::LooseOctree( float world_size,
 
     _statistics.nodes_queried = 0;
     _statistics.objects_visible = 0;
+    _statistics.objects_tested = 0;
+    _statistics.objects_contribution_culled = 0;
+    _statistics.nodes_contribution_culled = 0;
     _statistics.storage_size = 0;
     _statistics.nodes_reinserted = 0;
 
@@ -90,10 +168,28 @@ void LooseOctree::reset_statistics() {
     _statistics.nodes_queried = 0;
     _statistics.nodes_reinserted = 0;
     _statistics.objects_visible = 0;
+    _statistics.objects_tested = 0;
+    _statistics.objects_contribution_culled = 0;
+    _statistics.nodes_contribution_culled = 0;
     _statistics.storage_size = 0;
 }
 
-void LooseOctree::query(const Frustum& f, QueryResult& query_out) const {
+void LooseOctree::set_collect_statistics(bool enabled) {
+    _do_collect_statistics = enabled;
+    reset_statistics();
+}
+
+unsigned long LooseOctree::estimate_storage_size(StorageType storage_type,
+                                                 int max_depth,
+                                                 unsigned long node_count) {
+    if (storage_type == FULL_ARRAY)
+        return ArrayStorage::estimated_size(max_depth, node_count);
+    else
+        return MapStorage::estimated_size(max_depth, node_count);
+}
+
+void LooseOctree::query(const Frustum& f, QueryResult& query_out,
+                        const ContributionCulling& c) const {
 
     const Node& root_node = _storage->root_node();
 
@@ -104,6 +200,9 @@ void LooseOctree::query(const Frustum& f, QueryResult& query_out) const {
     if (_do_collect_statistics) {
         _statistics.nodes_queried = 1; //root node will always be queried
         _statistics.objects_visible = 0;
+        _statistics.objects_tested = 0;
+        _statistics.objects_contribution_culled = 0;
+        _statistics.nodes_contribution_culled = 0;
     }
 
     if (_do_collect_debug_info) {
@@ -118,7 +217,11 @@ void LooseOctree::query(const Frustum& f, QueryResult& query_out) const {
     Visibility v = compute_visibility(root_node_coords, f);
 
     if (v != NOT_VISIBLE)
-        query(&root_node, root_node_coords, v, f, query_out);
+        query(&root_node, root_node_coords, v, f, c, query_out);
+
+    //geometries which did not fit into the tree are tested one by one
+    if (!_overflow.empty())
+        query_geometries(_overflow, f, c, query_out);
 
     if (_do_collect_statistics) {
         _statistics.storage_size = _storage->current_size();
@@ -130,6 +233,7 @@ void LooseOctree::query( const Node * const n,
                          const NodeCoords& n_c, 
                          Visibility v, 
                          const Frustum& f, 
+                         const ContributionCulling& c,
                          QueryResult& query_out) const {
 
     //If a node is null, it means, no children exists, 
@@ -147,30 +251,25 @@ void LooseOctree::query( const Node * const n,
             return;
     }
 
-    //obviously, this node is visible, collect its
-    //geometries, and enter them into query results
-    list<const Geometry*>::const_iterator it;
-    bool cell_has_visible_geo = false;
-    for (it = n->geometries.begin(); it != n->geometries.end(); ++it) {
-
-        //TODO: in here you should cull against the bounding sphere, again
-        //Create an AABB of the bounding sphere
-        const Sphere& sphere = (*it)->bounding_volume().sphere();
-
-        const vec3 radius_vec(sphere.radius());
-        const vec3 aabb_min = sphere.center() - radius_vec;
-        const vec3 aabb_max = sphere.center() + radius_vec;
-
-        const AABB aabb(aabb_min, aabb_max);
-
-        if (intersect_aabb_frustum(aabb, f) != OUTSIDE) { 
-            query_out[(*it)->material_id()].push_back(*it);
+    //even the largest geometry of this node and its children is too small
+    //when placed at the point of the node closest to the eye
+    if (c.is_enabled()) {
+        vec3 center = calc_node_center(n_c);
+        float s = calc_node_spacing(n_c.depth_level);
+        AABB bounding_box(center - vec3(s), center + vec3(s));
+        float distance = glm::sqrt(distance_sq_point_aabb(c.eye, bounding_box));
+        if (c.rejects(n->max_radius, distance)) {
             if (_do_collect_statistics)
-                _statistics.objects_visible++;
-            cell_has_visible_geo = true;
+                _statistics.nodes_contribution_culled++;
+            return;
         }
     }
 
+    //obviously, this node is visible, collect its
+    //geometries, and enter them into query results
+    bool cell_has_visible_geo = query_geometries(n->geometries, f, c, 
+                                                 query_out);
+
     if (_do_collect_debug_info && cell_has_visible_geo) {
         vec3 center = calc_node_center(n_c);
         float s = calc_node_spacing(n_c.depth_level);
@@ -186,12 +285,53 @@ void LooseOctree::query( const Node * const n,
         for (int iy = 0; iy<2; ++iy) {
             for (int iz = 0; iz<2; ++iz) {
                 NodeCoords child_c = descend(n_c, ix, iy, iz);
-                query(n->children[ix][iy][iz], child_c, v, f, query_out);
+                query(n->children[ix][iy][iz], child_c, v, f, c, query_out);
             }
         }
     }
 }
 
+bool LooseOctree::query_geometries( const list<const Geometry*>& geometries,
+                                    const Frustum& f,
+                                    const ContributionCulling& c,
+                                    QueryResult& query_out) const {
+
+    list<const Geometry*>::const_iterator it;
+    bool has_visible_geo = false;
+    for (it = geometries.begin(); it != geometries.end(); ++it) {
+
+        //TODO: in here you should cull against the bounding sphere, again
+        //Create an AABB of the bounding sphere
+        const Sphere& sphere = (*it)->bounding_volume().sphere();
+
+        if ( c.is_enabled() && 
+             c.rejects(sphere.radius(), glm::length(sphere.center() - c.eye)) ) 
+        {
+            if (_do_collect_statistics)
+                _statistics.objects_contribution_culled++;
+            continue;
+        }
+
+        const vec3 radius_vec(sphere.radius());
+        const vec3 aabb_min = sphere.center() - radius_vec;
+        const vec3 aabb_max = sphere.center() + radius_vec;
+
+        const AABB aabb(aabb_min, aabb_max);
+
+        if (_do_collect_statistics)
+            _statistics.objects_tested++;
+
+        if (intersect_aabb_frustum(aabb, f) != OUTSIDE) { 
+            query_out[(*it)->material_id()].push_back(*it);
+            if (_do_collect_statistics)
+                _statistics.objects_visible++;
+            has_visible_geo = true;
+        }
+    }
+
+    return has_visible_geo;
+}
+
 LooseOctree::Visibility LooseOctree::compute_visibility( const NodeCoords& n_c, 
                                                          const Frustum& f ) const {
     
@@ -216,6 +356,266 @@ LooseOctree::Visibility LooseOctree::compute_visibility( const NodeCoords& n_c,
 
 }
 
+LooseOctree::TraversalEntry LooseOctree::root_entry() const {
+    TraversalEntry e;
+    e.node = &_storage->root_node();
+    e.center = _center;
+    e.spacing = _world_size;
+    e.distance = 0;
+    return e;
+}
+
+LooseOctree::TraversalEntry 
+LooseOctree::child_entry(const TraversalEntry& parent, int ix, int iy, int iz) {
+    //child cells are offset by a quarter of the parent's spacing
+    TraversalEntry e;
+    e.node = parent.node->children[ix][iy][iz];
+    e.spacing = parent.spacing * 0.5f;
+    e.center = parent.center + 
+               vec3(ix - 0.5f, iy - 0.5f, iz - 0.5f) * e.spacing;
+    e.distance = 0;
+    return e;
+}
+
+bool LooseOctree::intersect_ray(const Geometry * geo, const Ray& ray, 
+                                float max_distance, const RayTest* test,
+                                float& distance) {
+
+    if ( !intersect_ray_sphere(ray, geo->bounding_volume().sphere(), distance)
+         || distance > max_distance )
+        return false;
+
+    if ( test != NULL && 
+         (!test->intersect(geo, ray, distance) || distance > max_distance) )
+        return false;
+
+    return true;
+}
+
+bool LooseOctree::query_ray_first(const Ray& ray, float max_distance, 
+                                  Hit& hit_out, const RayTest* test) const {
+
+    float closest = max_distance;
+    bool has_hit = false;
+    float distance;
+
+    list<const Geometry*>::const_iterator it;
+    for (it = _overflow.begin(); it != _overflow.end(); ++it) {
+        if (intersect_ray(*it, ray, closest, test, distance)) {
+            closest = distance;
+            hit_out = Hit(*it, distance);
+            has_hit = true;
+        }
+    }
+
+    vector<TraversalEntry> stack;
+    stack.reserve(64);
+
+    TraversalEntry root = root_entry();
+    if (intersect_ray_aabb(ray, root.bounds(), closest, root.distance))
+        stack.push_back(root);
+
+    TraversalEntry children[8];
+
+    while (!stack.empty()) {
+        TraversalEntry e = stack.back();
+        stack.pop_back();
+
+        //a closer hit might have been found since the cell was pushed
+        if (e.distance > closest)
+            continue;
+
+        const list<const Geometry*>& geometries = e.node->geometries;
+        for (it = geometries.begin(); it != geometries.end(); ++it) {
+            if (intersect_ray(*it, ray, closest, test, distance)) {
+                closest = distance;
+                hit_out = Hit(*it, distance);
+                has_hit = true;
+            }
+        }
+
+        int child_count = 0;
+        for (int ix = 0; ix<2; ++ix) {
+            for (int iy = 0; iy<2; ++iy) {
+                for (int iz = 0; iz<2; ++iz) {
+                    if (e.node->children[ix][iy][iz] == NULL)
+                        continue;
+
+                    TraversalEntry c = child_entry(e, ix, iy, iz);
+                    if (intersect_ray_aabb(ray, c.bounds(), closest, 
+                                           c.distance))
+                        children[child_count++] = c;
+                }
+            }
+        }
+
+        //sorted far to near, the nearest child is visited next
+        std::sort(children, children + child_count);
+        stack.insert(stack.end(), children, children + child_count);
+    }
+
+    return has_hit;
+}
+
+void LooseOctree::query_ray_all(const Ray& ray, float max_distance, 
+                                vector<Hit>& hits_out,
+                                const RayTest* test) const {
+
+    hits_out.clear();
+    float distance;
+
+    list<const Geometry*>::const_iterator it;
+    for (it = _overflow.begin(); it != _overflow.end(); ++it) {
+        if (intersect_ray(*it, ray, max_distance, test, distance))
+            hits_out.push_back(Hit(*it, distance));
+    }
+
+    vector<TraversalEntry> stack;
+    stack.reserve(64);
+
+    TraversalEntry root = root_entry();
+    if (intersect_ray_aabb(ray, root.bounds(), max_distance, root.distance))
+        stack.push_back(root);
+
+    while (!stack.empty()) {
+        TraversalEntry e = stack.back();
+        stack.pop_back();
+
+        const list<const Geometry*>& geometries = e.node->geometries;
+        for (it = geometries.begin(); it != geometries.end(); ++it) {
+            if (intersect_ray(*it, ray, max_distance, test, distance))
+                hits_out.push_back(Hit(*it, distance));
+        }
+
+        for (int ix = 0; ix<2; ++ix) {
+            for (int iy = 0; iy<2; ++iy) {
+                for (int iz = 0; iz<2; ++iz) {
+                    if (e.node->children[ix][iy][iz] == NULL)
+                        continue;
+
+                    TraversalEntry c = child_entry(e, ix, iy, iz);
+                    if (intersect_ray_aabb(ray, c.bounds(), max_distance, 
+                                           c.distance))
+                        stack.push_back(c);
+                }
+            }
+        }
+    }
+
+    std::sort(hits_out.begin(), hits_out.end());
+}
+
+template<class Overlap>
+void LooseOctree::query_overlap(const Overlap& overlap, 
+                                vector<const Geometry*>& query_out) const {
+
+    query_out.clear();
+
+    list<const Geometry*>::const_iterator it;
+    for (it = _overflow.begin(); it != _overflow.end(); ++it) {
+        if (overlap.geometry((*it)->bounding_volume().sphere()))
+            query_out.push_back(*it);
+    }
+
+    vector<TraversalEntry> stack;
+    stack.reserve(64);
+
+    TraversalEntry root = root_entry();
+    if (overlap.cell(root.bounds()))
+        stack.push_back(root);
+
+    while (!stack.empty()) {
+        TraversalEntry e = stack.back();
+        stack.pop_back();
+
+        const list<const Geometry*>& geometries = e.node->geometries;
+        for (it = geometries.begin(); it != geometries.end(); ++it) {
+            if (overlap.geometry((*it)->bounding_volume().sphere()))
+                query_out.push_back(*it);
+        }
+
+        for (int ix = 0; ix<2; ++ix) {
+            for (int iy = 0; iy<2; ++iy) {
+                for (int iz = 0; iz<2; ++iz) {
+                    if (e.node->children[ix][iy][iz] == NULL)
+                        continue;
+
+                    TraversalEntry c = child_entry(e, ix, iy, iz);
+                    if (overlap.cell(c.bounds()))
+                        stack.push_back(c);
+                }
+            }
+        }
+    }
+}
+
+void LooseOctree::query_sphere(const Sphere& sphere, 
+                               vector<const Geometry*>& query_out) const {
+    query_overlap(SphereOverlap(sphere), query_out);
+}
+
+void LooseOctree::query_aabb(const AABB& box, 
+                             vector<const Geometry*>& query_out) const {
+    query_overlap(BoxOverlap(box), query_out);
+}
+
+void LooseOctree::query_nearest(const vec3& point, size_t k, 
+                                vector<Hit>& hits_out) const {
+
+    hits_out.clear();
+    if (k == 0)
+        return;
+
+    list<const Geometry*>::const_iterator it;
+    for (it = _overflow.begin(); it != _overflow.end(); ++it) {
+        const Sphere& sphere = (*it)->bounding_volume().sphere();
+        float distance = glm::length(point - sphere.center()) - sphere.radius();
+        offer_nearest(hits_out, k, Hit(*it, glm::max(distance, 0.0f)));
+    }
+
+    //cells are visited nearest first, until the nearest remaining cell is 
+    //further away than the k-th nearest geometry
+    std::priority_queue<TraversalEntry> cells;
+
+    TraversalEntry root = root_entry();
+    root.distance = glm::sqrt(distance_sq_point_aabb(point, root.bounds()));
+    cells.push(root);
+
+    while (!cells.empty()) {
+        TraversalEntry e = cells.top();
+        cells.pop();
+
+        if (hits_out.size() == k && e.distance >= hits_out.front().distance)
+            break;
+
+        const list<const Geometry*>& geometries = e.node->geometries;
+        for (it = geometries.begin(); it != geometries.end(); ++it) {
+            const Sphere& sphere = (*it)->bounding_volume().sphere();
+            float distance = glm::length(point - sphere.center()) - 
+                             sphere.radius();
+            offer_nearest(hits_out, k, Hit(*it, glm::max(distance, 0.0f)));
+        }
+
+        for (int ix = 0; ix<2; ++ix) {
+            for (int iy = 0; iy<2; ++iy) {
+                for (int iz = 0; iz<2; ++iz) {
+                    if (e.node->children[ix][iy][iz] == NULL)
+                        continue;
+
+                    TraversalEntry c = child_entry(e, ix, iy, iz);
+                    c.distance = glm::sqrt(distance_sq_point_aabb(point, 
+                                                                  c.bounds()));
+                    if ( hits_out.size() < k || 
+                         c.distance < hits_out.front().distance )
+                        cells.push(c);
+                }
+            }
+        }
+    }
+
+    std::sort_heap(hits_out.begin(), hits_out.end());
+}
+
 float LooseOctree::calc_node_spacing(int depth) const {
     return ( _world_size / glm::pow(2.0f, (float)depth) );
 }
@@ -312,18 +712,40 @@ LooseOctree::NodeCoords LooseOctree::get_node_coords(const Geometry * geo) const
     return node;
 }
 
+bool LooseOctree::find_node_coords(const Geometry * geo, NodeCoords& node) {
+
+    const Sphere& sphere = geo->bounding_volume().sphere();
+
+    //a broken bounding volume would let us grow forever
+    if ( !is_finite(sphere.radius()) || !is_finite(sphere.center().x) ||
+         !is_finite(sphere.center().y) || !is_finite(sphere.center().z) )
+        return false;
+
+    node = get_node_coords(geo);
+
+    while (!is_valid(node)) {
+        if (!grow(sphere.center()))
+            return false;
+
+        node = get_node_coords(geo);
+    }
+
+    return true;
+}
+
 void LooseOctree::insert(const Geometry * geo) {
 
     //check the location where to insert the geometry
     //this is solely based on the geometry's bounding volume, 
-    //constant time operation
+    //constant time operation, unless the tree has to grow
 
-    NodeCoords query = get_node_coords(geo);
+    NodeCoords query;
+    bool fits = find_node_coords(geo, query);
 
-    if (!is_valid(query)) {
-        cerr << "Error: Retrieved node coordinates are not valid." << endl;
-        cerr << "       Skipping geometry " << geo->get_id() << endl;
-        return;
+    if (!fits) {
+        cerr << "Warning: Geometry " << geo->get_id() << " does not fit " 
+             << "into the octree, it will be tested separately." << endl;
+        query = overflow_coords();
     }
 
     if (!_node_lookup.insert(std::make_pair(geo, query)).second) {
@@ -333,11 +755,52 @@ void LooseOctree::insert(const Geometry * geo) {
     }
 
     //perform the actual insertion in the data storage
-    Node* node = _storage->get_node(query);
-    node->geometries.push_back(geo);
+    if (fits) {
+        Node* node = _storage->get_node(query);
+        node->geometries.push_back(geo);
+        expand_max_radius(query, geo->bounding_volume().sphere().radius());
+    } else {
+        _overflow.push_back(geo);
+    }
 
 }
 
+bool LooseOctree::insert_cell(int depth_level, int x, int y, int z,
+                              const Geometry * const * geometries, 
+                              size_t count) 
+{
+    if (depth_level < 0 || depth_level > _max_depth)
+        return false;
+
+    NodeCoords nc(depth_level, x, y, z);
+
+    if (!is_valid(nc))
+        return false;
+
+    Node* node = _storage->get_node(nc);
+    float max_radius = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!_node_lookup.insert(std::make_pair(geometries[i], nc)).second) {
+            cerr << "Warning: Geometry " << geometries[i]->get_id()
+                 << " is already contained in the octree." << endl;
+            continue;
+        }
+        node->geometries.push_back(geometries[i]);
+        max_radius = glm::max(max_radius, 
+                              geometries[i]->bounding_volume().sphere().radius());
+    }
+
+    expand_max_radius(nc, max_radius);
+
+    return true;
+}
+
+void LooseOctree::reserve(size_t geometry_count) {
+    _node_lookup.rehash(static_cast<std::size_t>(
+                    geometry_count / _node_lookup.max_load_factor()) + 1);
+}
+
 bool LooseOctree::remove(const Geometry * geo) {
 
     NodeCoordsMap::iterator it = _node_lookup.find(geo);
@@ -345,18 +808,19 @@ bool LooseOctree::remove(const Geometry * geo) {
         return false;
     }
 
-    Node* node = _storage->get_node(it->second);
-    if (node->geometries.size() > 1) {
-        node->geometries.remove(geo);
+    if (it->second == overflow_coords()) {
+        _overflow.remove(geo);
     } else {
-        //seems to be the last geometry in the node, trigger
-        //removal
-        _storage->remove_node(it->second);
+        Node* node = _storage->get_node(it->second);
+        node->geometries.remove(geo);
+        //the node itself is removed later on, see purge_empty_nodes()
+        if (node->geometries.empty())
+            _purge_candidates.push_back(it->second);
     }
 
     //finally, also remove this node from the 
     //lookup data structure
-    _node_lookup.erase(geo);
+    _node_lookup.erase(it);
 
     return true;
 }
@@ -364,44 +828,122 @@ bool LooseOctree::remove(const Geometry * geo) {
 bool LooseOctree::update() {
     NodeCoordsMap::iterator it;
     for (it = _node_lookup.begin(); it != _node_lookup.end(); ++it) {
-        if (it->first->transform_node()->has_changed()) {
-            //check if we are still in the right place
-            NodeCoords nc = get_node_coords(it->first);
 
-            bool is_ok = ( (it->second.depth_level == nc.depth_level) && 
-                           (it->second.x == nc.x) && 
-                           (it->second.y == nc.y) &&
-                           (it->second.z == nc.z) );
+        bool in_overflow = (it->second == overflow_coords());
 
-            if (!is_ok) {
+        //geometries in the overflow might fit after the tree has grown
+        if (!in_overflow && !it->first->has_changed())
+            continue;
 
-                if (!is_valid(nc)) {
-                    return false;
-                }
+        //check if we are still in the right place, this might grow the
+        //tree which also updates the coordinates in it->second
+        NodeCoords nc;
+        bool fits = find_node_coords(it->first, nc);
 
-                //remove, and reinsert
-                //note that these are constant time operations
+        //the geometry might have been scaled without changing the node
+        if (fits)
+            expand_max_radius(nc, it->first->bounding_volume().sphere().radius());
+        else
+            nc = overflow_coords();
 
-                Node* old_node = _storage->get_node(it->second);
-                old_node->geometries.remove(it->first);
-                //NOTE: We could move the removal of empty nodes to some 
-                //"purge" method that we might call only every 5 seconds or so.
-                if ( old_node->geometries.empty() && 
-                    (!old_node->has_children())) {
-                    _storage->remove_node(it->second);
-                }
+        if (it->second == nc)
+            continue;
 
-                //add at new location
-                Node* new_node = _storage->get_node(nc);
-                new_node->geometries.push_back(it->first);
+        //remove, and reinsert
+        //note that these are constant time operations
 
-                it->second = nc;
+        if (in_overflow) {
+            _overflow.remove(it->first);
+        } else {
+            Node* old_node = _storage->get_node(it->second);
+            old_node->geometries.remove(it->first);
+            if (old_node->geometries.empty())
+                _purge_candidates.push_back(it->second);
+        }
 
-                if (_do_collect_statistics)
-                    _statistics.nodes_reinserted++;
-            }               
+        //add at new location
+        if (fits) {
+            Node* new_node = _storage->get_node(nc);
+            new_node->geometries.push_back(it->first);
+        } else {
+            _overflow.push_back(it->first);
         }
+
+        it->second = nc;
+
+        if (_do_collect_statistics)
+            _statistics.nodes_reinserted++;
+    }
+
+    purge_empty_nodes();
+
+    return true;
+}
+
+void LooseOctree::purge_empty_nodes() {
+
+    if (_purge_candidates.empty())
+        return;
+
+    //Profiler::now() does not depend on a window, which keeps the budget
+    //working in the headless benchmarks.
+    double start = Profiler::now();
+    NodeCoords root_nc;
+
+    int purged = 0;
+    while (!_purge_candidates.empty()) {
+
+        if ( (++purged % kPurgeCheckInterval) == 0 && 
+             (Profiler::now() - start) > _purge_budget )
+            break;
+
+        NodeCoords nc = _purge_candidates.front();
+        _purge_candidates.pop_front();
+
+        //the node might have been removed or refilled in the meantime
+        if (nc == root_nc || !_storage->exists(nc))
+            continue;
+
+        //removing a node also removes its subtree and all ancestors that
+        //became empty, which collapses empty interior nodes as well
+        Node* node = _storage->get_node(nc);
+        if (subtree_is_empty(node))
+            _storage->remove_node(nc);
     }
+}
+
+bool LooseOctree::grow(const vec3& target) {
+
+    if (_max_depth >= kMaxGrowDepth)
+        return false;
+
+    //the current root becomes the octant which faces away from the target
+    int ox = (target.x < _center.x) ? 1 : 0;
+    int oy = (target.y < _center.y) ? 1 : 0;
+    int oz = (target.z < _center.z) ? 1 : 0;
+
+    if (!_storage->grow(ox, oy, oz))
+        return false;
+
+    float h = _world_size * 0.5f;
+    _center += vec3( ox ? -h : h, oy ? -h : h, oz ? -h : h );
+    _world_size *= 2.0f;
+    _max_depth++;
+
+    NodeCoordsMap::iterator it;
+    for (it = _node_lookup.begin(); it != _node_lookup.end(); ++it) {
+        if (it->second != overflow_coords())
+            it->second = regrow(it->second, ox, oy, oz);
+    }
+
+    for (size_t i = 0; i < _purge_candidates.size(); ++i) {
+        _purge_candidates[i] = regrow(_purge_candidates[i], ox, oy, oz);
+    }
+
+    //the old root might be empty
+    _purge_candidates.push_back(regrow(NodeCoords(), ox, oy, oz));
+
+    _grow_count++;
 
     return true;
 }
@@ -409,6 +951,12 @@ bool LooseOctree::update() {
 void LooseOctree::clear() {
     NodeCoords root_node;
     _storage->remove_node(root_node);
+    _storage->root_node().geometries.clear();
+    _storage->root_node().max_radius = 0;
+
+    _node_lookup.clear();
+    _overflow.clear();
+    _purge_candidates.clear();
 }
 
 /**
@@ -460,7 +1008,7 @@ LooseOctree::Node& LooseOctree::ArrayStorage::root_node() {
     return *_node_array[0];
 }
 
-unsigned long LooseOctree::ArrayStorage::num_elements_at_depth(int depth) const {
+unsigned long LooseOctree::ArrayStorage::num_elements_at_depth(int depth) {
     float s = 1.0f/7.0f;
     unsigned long num_elements = 
                 (unsigned long)glm::round( s * glm::pow(8.0f, (float)(depth+1)) - s );
@@ -487,6 +1035,24 @@ bool LooseOctree::ArrayStorage::exists(const NodeCoords& n) const {
 
 }
 
+void LooseOctree::expand_max_radius(const NodeCoords& n, float radius) {
+    NodeCoords nc = n;
+    while (true) {
+        Node* node = _storage->get_node(nc);
+
+        //the parents are at least as large already
+        if (node->max_radius >= radius)
+            return;
+
+        node->max_radius = radius;
+
+        if (nc.depth_level == 0)
+            return;
+
+        nc = ascend(nc);
+    }
+}
+
 LooseOctree::NodeCoords LooseOctree::ascend(const LooseOctree::NodeCoords& n) {
     
     NodeCoords ascended;
@@ -510,6 +1076,21 @@ LooseOctree::NodeCoords LooseOctree::descend( const NodeCoords& n,
     return descended;
 }
 
+LooseOctree::NodeCoords LooseOctree::regrow( const NodeCoords& n, 
+                                             int ox, int oy, int oz) {
+
+    //at depth d+1, the octant of the old root starts at index 2^d
+    AxisIndex offset = static_cast<AxisIndex>(1) << n.depth_level;
+
+    NodeCoords regrown;
+    regrown.depth_level = n.depth_level + 1;
+    regrown.x = n.x + ox * offset;
+    regrown.y = n.y + oy * offset;
+    regrown.z = n.z + oz * offset;
+
+    return regrown;
+}
+
 
 bool LooseOctree::is_valid(const NodeCoords& node) const {
 
@@ -658,18 +1239,66 @@ void LooseOctree::ArrayStorage::remove_node(const NodeCoords& n) {
     //that's it
 }
 
+bool LooseOctree::ArrayStorage::grow(int ox, int oy, int oz) {
+
+    //the layout of the array depends on the depth, rebuild it
+    if (_max_depth + 1 > kMaxArrayDepth)
+        return false;
+
+    Node** old_array = _node_array;
+    int old_depth = _max_depth;
+
+    _max_depth++;
+    unsigned long num_elements = num_elements_at_depth(_max_depth);
+    _node_array = new Node*[num_elements];
+    std::fill( &_node_array[0], 
+               &_node_array[num_elements], 
+               static_cast<Node*>(NULL) );
+
+    for (int d = 0; d <= old_depth; ++d) {
+        unsigned int divnum = 1u << d;
+        for (unsigned int iz = 0; iz < divnum; ++iz) {
+            for (unsigned int iy = 0; iy < divnum; ++iy) {
+                for (unsigned int ix = 0; ix < divnum; ++ix) {
+                    NodeCoords n(d, ix, iy, iz);
+                    Node* node = old_array[get_address(n)];
+                    if (node != NULL)
+                        _node_array[get_address(regrow(n, ox, oy, oz))] = node;
+                }
+            }
+        }
+    }
+
+    Node* new_root = new Node();
+    new_root->children[ox][oy][oz] = old_array[0];
+    new_root->max_radius = old_array[0]->max_radius;
+    _node_array[0] = new_root;
+
+    delete[] old_array;
+
+    return true;
+}
+
 unsigned long LooseOctree::ArrayStorage::current_size() const {
     //calculate the total size 
 
-    unsigned long size = sizeof(Node**);
     unsigned long num_elements = num_elements_at_depth(_max_depth);
-    size += sizeof(Node*) * num_elements;
+    unsigned long node_count = 0;
     for (unsigned long i = 0; i<num_elements; ++i) {
         if (_node_array[i] != NULL) {
-            size += sizeof(Node);
+            ++node_count;
         }
     }
 
+    return estimated_size(_max_depth, node_count);
+}
+
+unsigned long 
+LooseOctree::ArrayStorage::estimated_size(int max_depth, 
+                                          unsigned long node_count) {
+    unsigned long size = sizeof(Node**);
+    size += sizeof(Node*) * num_elements_at_depth(max_depth);
+    size += sizeof(Node) * node_count;
     return size;
 }
 
@@ -841,10 +1470,40 @@ void LooseOctree::MapStorage::remove_node(const NodeCoords& n){
     //that's it
 }
 
+bool LooseOctree::MapStorage::grow(int ox, int oy, int oz) {
+
+    NodeCoords root_nc;
+    Node* old_root = _node_map.at(root_nc);
+
+    //only the keys change, nodes and their child pointers stay valid
+    NodeMap grown;
+    grown.rehash(_node_map.bucket_count());
+
+    NodeMap::const_iterator it;
+    for (it = _node_map.begin(); it != _node_map.end(); ++it) {
+        grown.insert(NodeMap::value_type(regrow(it->first, ox, oy, oz), 
+                                         it->second));
+    }
+
+    Node* new_root = new Node();
+    new_root->children[ox][oy][oz] = old_root;
+    new_root->max_radius = old_root->max_radius;
+    grown.insert(NodeMap::value_type(root_nc, new_root));
+
+    _node_map.swap(grown);
+    _max_depth++;
+
+    return true;
+}
+
 unsigned long LooseOctree::MapStorage::current_size() const{
-    unsigned long estimated_size = sizeof(NodeMap);
-    estimated_size += _node_map.size() * sizeof(Node);
-    return estimated_size;
+    return estimated_size(_max_depth, _node_map.size());
+}
+
+unsigned long 
+LooseOctree::MapStorage::estimated_size(int /*max_depth*/, 
+                                        unsigned long node_count) {
+    return sizeof(NodeMap) + node_count * sizeof(Node);
 }
 
 
@@ -25,6 +25,10 @@
 #include "common.h"
 #include "Geometry.h"
 #include "Camera.h"
+#include "CullingStructure.h"
+#include "BoundingVolume.h"
+
+#include <deque>
 
 /**
  * Implements a loose octree as described by U. Thatcher, Game Programming Gems,
@@ -33,6 +37,13 @@
  *
  * The main purpose of this class is to performance View-Frustum culling, i.e. 
  * this tree can be queried with a Frustum.
+ *
+ * Besides frustums, the tree answers ray, sphere, box and k-nearest queries,
+ * e.g. for picking and proximity tests. These skip cells as early as 
+ * possible (behind the closest hit so far, or further away than the k-th 
+ * nearest geometry) and write to flat buffers, which are cleared first.
+ * Unlike query(), they do not touch the statistics and can be run from 
+ * several threads at once, as long as the tree is not modified.
  * 
  * Furthermore this tree is separate from its storage back-end. You can choose
  * between the following implementations: 
@@ -50,7 +61,7 @@
  *          than 6 the array size is growing exponentially and is not feasible
  *          to use. The previous storage should be preferred.
  */
-class LooseOctree : noncopyable {
+class LooseOctree : public CullingStructure {
 
 public:
 
@@ -59,34 +70,6 @@ public:
         SPARSE_MAP
     } StorageType;
 
-    /**
-     * The vector is indexed by some prioritization that
-     * we formulate. For example, we might use this as the material id.
-     * The list of each vector element is roughly sorted along viewers direction 
-     * with the earlier entries being closer to the viewer. Note that 
-     * this is not strict sorting, however.
-     */
-    typedef vector<list<const Geometry * > > QueryResult;
-
-    //A list of axis aligned bounding boxes used for debug rendering
-    typedef list<AABB > DebugQueryResult;
-
-    //Some statistics which can be collected optionally.
-    struct Statistics {
-        //The number of visible objects that were identified 
-        //during a traversal
-        int objects_visible;
-        //The number of octree nodes that had to be traversed
-        //in order to determine visibility
-        int nodes_queried;
-        //The number of nodes that had to be re-inserted
-        //due to animation updates
-        int nodes_reinserted;
-        //The current amount of memory (in bytes) that the octree's 
-        //storage occupies
-        unsigned long storage_size;
-    };
-    
     /**
      * Creates a new octree.
      * @param world_size The size of the Octree, i.e. the width of the highest
@@ -112,7 +95,7 @@ public:
                 bool do_collect_statistics = false, 
                 bool do_collect_debug_info = false);
 
-    ~LooseOctree();
+    virtual ~LooseOctree();
 
     /**
      * Queries the Octree with a particular frustum. The results of the query
@@ -121,14 +104,110 @@ public:
      * @param[out] An out parameter where the results of the query will be 
      * written to. Note that the vector's size of QueryResult must have the 
      * correct size.
+     * @param contribution Geometries which are too small on screen are 
+     * rejected, and so are whole nodes whose largest geometry is too small
+     * at the distance of the node.
+     */
+    virtual void query(const Frustum& frustum, QueryResult& query_out,
+                       const ContributionCulling& contribution = 
+                           ContributionCulling()) const;
+
+    /**
+     * A geometry found by one of the spatial queries below, with its 
+     * distance along the ray or from the query point.
+     */
+    struct Hit {
+        const Geometry * geometry;
+        float distance;
+
+        Hit() : geometry(NULL), distance(0) {}
+        Hit(const Geometry * geometry, float distance) : 
+            geometry(geometry), distance(distance) {}
+
+        bool operator<(const Hit& other) const { 
+            return distance < other.distance; 
+        }
+    };
+
+    /**
+     * Exact intersection test for the ray queries, e.g. against the 
+     * triangles of a geometry. It is only called for geometries whose 
+     * bounding sphere is hit.
+     */
+    class RayTest {
+    public:
+        virtual ~RayTest() {}
+
+        /**
+         * @param[out] distance The distance along the ray to the hit.
+         * @return FALSE if the ray misses the geometry.
+         */
+        virtual bool intersect(const Geometry * geo, const Ray& ray, 
+                               float& distance) const = 0;
+    };
+
+    /**
+     * Finds the geometry whose bounding sphere (or exact shape, see 
+     * RayTest) is hit first by the ray.
+     * @param max_distance Hits beyond this distance are ignored.
+     * @param test Optional exact test.
+     * @return FALSE if nothing is hit.
+     */
+    bool query_ray_first(const Ray& ray, float max_distance, Hit& hit_out,
+                         const RayTest* test = NULL) const;
+
+    /**
+     * Finds all geometries hit by the ray, sorted by distance.
      */
-    void query(const Frustum& frustum, QueryResult& query_out) const;
+    void query_ray_all(const Ray& ray, float max_distance, 
+                       vector<Hit>& hits_out,
+                       const RayTest* test = NULL) const;
+
+    /**
+     * Finds all geometries whose bounding sphere overlaps the sphere.
+     */
+    void query_sphere(const Sphere& sphere, 
+                      vector<const Geometry*>& query_out) const;
+
+    /**
+     * Finds all geometries whose bounding sphere overlaps the box.
+     */
+    void query_aabb(const AABB& box, 
+                    vector<const Geometry*>& query_out) const;
+
+    /**
+     * Finds the k geometries closest to a point, sorted by distance. The
+     * distance is measured to the bounding sphere, 0 if the point is inside.
+     */
+    void query_nearest(const vec3& point, size_t k, 
+                       vector<Hit>& hits_out) const;
 
     /**
      * Inserts a geometry object into the tree based on its bounding sphere.
      * @param geo The geometry to insert into the tree.
      */
-    void insert(const Geometry * geo);
+    virtual void insert(const Geometry * geo);
+
+    /**
+     * Bulk-inserts a set of geometries into one particular node, e.g. as 
+     * prebuilt by the bakery. The node is created only once and the
+     * geometries' bounding volumes are not evaluated. It is up to the caller
+     * to make sure that the geometries actually fit into this node.
+     * @param depth_level The depth of the node.
+     * @param x The X-index of the node at this level.
+     * @param y The Y-index of the node at this level.
+     * @param z The Z-index of the node at this level.
+     * @param geometries Pointer to count geometries to insert.
+     * @param count The number of geometries.
+     * @return FALSE if the coordinates are not valid for this tree.
+     */
+    bool insert_cell(int depth_level, int x, int y, int z,
+                     const Geometry * const * geometries, size_t count);
+
+    /**
+     * Prepares the tree for holding at least geometry_count geometries.
+     */
+    void reserve(size_t geometry_count);
 
     /**
      * Removes a geometry from this tree.
@@ -136,41 +215,64 @@ public:
      * @return TRUE if the geometry was contained in the tree and could be
      * removed, FALSE otherwise.
      */
-    bool remove(const Geometry * geo);
+    virtual bool remove(const Geometry * geo);
     
     /**
      * Checks all contained geometries, if they need to be updated, e.g. when
      * their positions or orientations changed during animation.
-     * @return TRUE if updated geometries still fit into the octree, FALSE if
-     * a geometry went outside the octree. It's the callers decision if this
-     * tree should then be destructed and resized. Geometries that fall outside
-     * the octree will be silently exluded from queries.
+     * If a geometry leaves the octree, the tree grows by placing its current
+     * root as one octant under a new root of twice the size. Existing nodes
+     * and their contents are kept as they are. Geometries that the tree 
+     * can not grow to are kept in an overflow list which is tested 
+     * separately during queries.
+     * Nodes that became empty are purged within the time budget set by
+     * set_purge_budget(), the rest is left for the next call.
+     * @return Always TRUE, the tree never has to be rebuilt.
+     */
+    virtual bool update();
+
+    /**
+     * Sets the time in seconds that update() may spend on removing empty
+     * nodes. At least a few nodes are purged per call, regardless of this
+     * budget.
+     */
+    void set_purge_budget(double seconds) { _purge_budget = seconds; }
+
+    /**
+     * Returns how often the root of this tree has been doubled so far.
+     */
+    int grow_count() const { return _grow_count; }
+
+    /**
+     * Returns the number of geometries that are held outside of the tree.
      */
-    bool update();
+    size_t overflow_count() const { return _overflow.size(); }
 
     /**
      * Removes all elements from the Octree.
      */
-    void clear();
+    virtual void clear();
 
     /**
      * Returns some statistical information which is collected during traversal.
      * Note that you must have set the parameter do_collect_statistics to TRUE
      * during construction in order to retrieve meaningful information.
      */
-    const Statistics& statistics() const { return _statistics; }
+    virtual const Statistics& statistics() const { return _statistics; }
 
     /**
      * Return a list of axis aligned bounding boxes which represent all non-
      * empty nodes of the last query-traversal. Note that you must have set the 
      * parameter do_collect_debug_info to TRUE during construction of this tree.
      */
-    const DebugQueryResult& debug_info() const { return _debug_query; }
+    virtual const DebugQueryResult& debug_info() const { return _debug_query; }
 
     /**
      * Reset statistical data that is not automatically reset on each traversal.
      */
-    void reset_statistics();
+    virtual void reset_statistics();
+
+    virtual void set_collect_statistics(bool enabled);
 
     /**
      * Returns the storage type of this Octree. The storage is only to be
@@ -178,10 +280,18 @@ public:
      */
     StorageType storage_type() const { return _storage_type; }
 
-    bool has_debug_info() const { return _do_collect_debug_info; }
+    /**
+     * Returns the storage size a tree of this storage type and maximum 
+     * depth reports in its statistics once it holds node_count nodes.
+     */
+    static unsigned long estimate_storage_size(StorageType storage_type,
+                                               int max_depth,
+                                               unsigned long node_count);
 
-    float world_size() const { return _world_size; }
-    const vec3& center() const { return _center; }
+    virtual bool has_debug_info() const { return _do_collect_debug_info; }
+
+    virtual float world_size() const { return _world_size; }
+    virtual const vec3& center() const { return _center; }
 
 private:
 
@@ -193,6 +303,9 @@ private:
     struct Node {
         list<const Geometry *> geometries;
         Node* children[2][2][2];
+        //The largest radius of the geometries in this node and its children.
+        //It is not reduced when geometries are removed, i.e. an upper bound.
+        float max_radius;
         Node();
         bool has_children() const;
     };
@@ -285,6 +398,15 @@ private:
         virtual void remove_node(const NodeCoords& n) = 0;
         virtual unsigned long current_size() const = 0;
 
+        /**
+         * Implementations should place the current root as child 
+         * [ox][oy][oz] under a new root, i.e. every node (d, x, y, z) 
+         * moves to (d+1, x + ox*2^d, y + oy*2^d, z + oz*2^d). Nodes
+         * themselves must not be touched.
+         * @return FALSE if the storage can not grow any further.
+         */
+        virtual bool grow(int ox, int oy, int oz) = 0;
+
     };
 
     /**
@@ -304,11 +426,15 @@ private:
         virtual Node* get_node(const NodeCoords& n);
         virtual void remove_node(const NodeCoords& n);
         virtual unsigned long current_size() const;
+        virtual bool grow(int ox, int oy, int oz);
+
+        static unsigned long estimated_size(int max_depth, 
+                                            unsigned long node_count);
 
     private:
 
         Node* create_or_get_node(const NodeCoords& n);
-        unsigned long num_elements_at_depth(int depth) const;
+        static unsigned long num_elements_at_depth(int depth);
         unsigned long get_address(const NodeCoords& n) const;
         bool is_valid(const NodeCoords& node) const;
 
@@ -338,6 +464,10 @@ private:
         virtual Node* get_node(const NodeCoords& n);
         virtual void remove_node(const NodeCoords& n);
         virtual unsigned long current_size() const;
+        virtual bool grow(int ox, int oy, int oz);
+
+        static unsigned long estimated_size(int max_depth, 
+                                            unsigned long node_count);
 
     private:
 
@@ -362,14 +492,73 @@ private:
      * @param v The visibility of the node to visit which had been determined
      * before.
      * @param f The frustum that should be tested against.
+     * @param c Rejects geometries and nodes which are too small on screen.
      * @param[out] The out_parameter to store the visible Geometries into.
      */
     void query( const Node * const n, 
                 const NodeCoords& n_c, 
                 Visibility v, 
                 const Frustum& f, 
+                const ContributionCulling& c,
                 QueryResult& query_out) const;
 
+    /**
+     * Collects the geometries of a list which intersect the frustum and
+     * are large enough on screen.
+     * @return TRUE if at least one geometry is visible.
+     */
+    bool query_geometries(const list<const Geometry*>& geometries,
+                          const Frustum& f,
+                          const ContributionCulling& c,
+                          QueryResult& query_out) const;
+
+    /**
+     * Raises the max_radius of a node and its parents to radius.
+     */
+    void expand_max_radius(const NodeCoords& n, float radius);
+
+    /**
+     * A node visited by the spatial queries, with the center and spacing of
+     * its cell and its distance to the query. The loose bounds of the node 
+     * are center +- spacing.
+     */
+    struct TraversalEntry {
+        const Node * node;
+        vec3 center;
+        float spacing;
+        float distance;
+
+        AABB bounds() const { 
+            return AABB(center - vec3(spacing), center + vec3(spacing)); 
+        }
+
+        //reversed, std::priority_queue is a max-heap
+        bool operator<(const TraversalEntry& other) const {
+            return distance > other.distance;
+        }
+    };
+
+    TraversalEntry root_entry() const;
+
+    static TraversalEntry child_entry(const TraversalEntry& parent, 
+                                      int ix, int iy, int iz);
+
+    /**
+     * Collects all geometries for which overlap.geometry() holds, 
+     * descending into all cells for which overlap.cell() holds.
+     */
+    template<class Overlap>
+    void query_overlap(const Overlap& overlap, 
+                       vector<const Geometry*>& query_out) const;
+
+    /**
+     * Tests a ray against a geometry's bounding sphere and optionally its
+     * exact shape.
+     */
+    static bool intersect_ray(const Geometry * geo, const Ray& ray, 
+                              float max_distance, const RayTest* test,
+                              float& distance);
+
     /**
      * Computes the visibility of a node within in a frustum using AABB/Frustum
      * intersection tests.
@@ -403,6 +592,44 @@ private:
      */
     static NodeCoords descend(const NodeCoords& n, int x, int y, int z);
 
+    /**
+     * Convenience method. Returns the coordinates a node has after the
+     * current root was placed as child [ox][oy][oz] under a new root.
+     */
+    static NodeCoords regrow(const NodeCoords& n, int ox, int oy, int oz);
+
+    /**
+     * Doubles the size of the tree towards a point outside of it. The
+     * current root becomes one of the octants of the new root.
+     * @return FALSE if the tree can not grow any further.
+     */
+    bool grow(const vec3& target);
+
+    /**
+     * Calculates the node coordinates of a geometry like get_node_coords(),
+     * and grows the tree until they are valid.
+     * @return FALSE if the geometry can not be placed into the tree and has
+     * to be kept in the overflow list.
+     */
+    bool find_node_coords(const Geometry * geo, NodeCoords& node);
+
+    /**
+     * Removes nodes that became empty, until the purge budget is spent.
+     */
+    void purge_empty_nodes();
+
+    /**
+     * Returns true if neither the node nor any of its descendants holds
+     * geometries.
+     */
+    static bool subtree_is_empty(const Node* node);
+
+    /**
+     * Coordinates used in the node lookup for geometries in the overflow
+     * list.
+     */
+    static NodeCoords overflow_coords() { return NodeCoords(-1, 0, 0, 0); }
+
     /**
      * Calculates the node spacing at a particular level of depth with in the
      * curren tree.
@@ -437,7 +664,7 @@ private:
     vec3 _center;
     const StorageType _storage_type;
     Storage* _storage;
-    const bool _do_collect_statistics;
+    bool _do_collect_statistics;
     const bool _do_collect_debug_info;
 
     //Statistics and debug info data
@@ -449,6 +676,15 @@ private:
 
     NodeCoordsMap _node_lookup;
 
+    //Geometries that could not be placed into the tree
+    list<const Geometry*> _overflow;
+
+    //Nodes that might have become empty and are due to be removed
+    std::deque<NodeCoords> _purge_candidates;
+    double _purge_budget;
+
+    int _grow_count;
+
 };
 
 //Hash function for NodeCoords as used by MapStorage
@@ -22,7 +22,9 @@
 #include "MaterialManager.h"
 
 #include "Texture.h"
+#include "TextureArray.h"
 #include "Image.h"
+#include "BakedImage.h"
 #include "Shader.h"
 #include "UniformBuffer.h"
 #include "rtr_format.pb.h"
@@ -91,6 +93,34 @@ TextureRef TextureManager::load_texture(const string& file_name)
         path = load_path + "/" + file_name;
     }
 
+    if (config.use_baked_textures()) {
+        // Prefer the container written by the bakery, it already holds the
+        // final pixel format and all mip levels.
+        string baked_path = path + rtr::kBakedTextureExtension();
+
+        if (file_exists(baked_path)) {
+            BakedImage baked_image(baked_path);
+
+            if (baked_image.is_valid()) {
+                // BC5 (RGTC) is core since GL 3.0, BC1/BC3 are baked as 
+                // sRGB and need S3TC as well as EXT_texture_sRGB.
+                bool supported = !baked_image.is_compressed() ||
+                    baked_image.internal_format() == GL_COMPRESSED_RG_RGTC2 ||
+                    (EXTGL_EXT_texture_compression_s3tc && 
+                     EXTGL_EXT_texture_sRGB);
+
+                if (supported) {
+                    return TextureRef(new Texture(baked_image));
+                }
+
+                cerr << "Compressed texture '" << baked_path << "' needs "
+                     << "EXT_texture_compression_s3tc and EXT_texture_sRGB, "
+                     << "which are not supported. Using source image "
+                     << "instead." << endl;
+            }
+        }
+    }
+
     if (!file_exists(path)) {
         cerr << "Could not load texture '" << path << "'. "
              << "Loading default texture instead." << endl;
@@ -154,12 +184,17 @@ void TextureManager::purge()
 }
 
 MaterialInstance::MaterialInstance(int material_id, int instance_id,
-                                   UniformBuffer* params,
+                                   const rtr_format::Material& material,
+                                   const shared_ptr<UniformBufferPool>& pool,
+                                   const shared_ptr<TexturePacker>& packer,
                                    int texture_cnt) :
     _instance_id(instance_id),
     _material_id(material_id),
-    _params(params),
-    _textures(texture_cnt)
+    _params(NULL),
+    _textures(texture_cnt),
+    _material(new rtr_format::Material(material)),
+    _pool(pool),
+    _packer(packer)
 {
 
 }
@@ -170,31 +205,174 @@ MaterialInstance::~MaterialInstance()
 }
 
 void MaterialInstance::reset(int material_id, int instance_id,
-                             UniformBuffer* params, int texture_cnt)
+                             const rtr_format::Material& material,
+                             int texture_cnt)
 {
     _textures.clear();
     delete _params;
 
     _material_id = material_id;
     _instance_id = instance_id;
-    _params = params;
+    _params = NULL;
+    _material.reset(new rtr_format::Material(material));
     _textures.resize(texture_cnt);
 }
 
 void MaterialInstance::set_texture_param(int index,
                                          const string& param_name, 
+                                         const string& file_name,
                                          TextureRef texture)
 {
     _textures[index].name = param_name;
+    _textures[index].file = file_name;
     _textures[index].tex = texture;
 }
 
+void MaterialInstance::set_texture_param(int index,
+                                         const string& param_name, 
+                                         const string& file_name,
+                                         const TexturePacker::Layer& layer)
+{
+    _textures[index].name = param_name;
+    _textures[index].file = file_name;
+    _textures[index].layer = layer;
+}
+
+void MaterialInstance::create_params(Shader& shader)
+{
+    UniformBuffer* ubo = new UniformBuffer(shader, "Material", _pool);
+
+    for (int i = 0; i < _material->parameter_size(); ++i) {
+        const rtr_format::Parameter& p = _material->parameter(i);
+        //If we don't have this parameter either as a free standing
+        //uniform, or as part of the Material uniform block, we skip
+        //it and print a warning.
+        if (! (ubo->has_entry(p.name()) || shader.has_uniform(p.name()) ) ) {
+            cout << "Warning (" << _material->id() << "): Shader '"
+                 << _material->shader() << "' has no parameter named '"
+                 << p.name() << "'. Skipping parameter." << endl;
+            continue;
+        }
+        switch (p.type()) {
+        case rtr_format::TEXTURE: 
+            break;
+        case rtr_format::INT:
+            assert(p.ivalue_size() == 1);
+            ubo->set(p.name(), p.ivalue(0));
+            break;
+        case rtr_format::IVEC2:
+            assert(p.ivalue_size() == 2);
+            ubo->set(p.name(), ivec2(p.ivalue(0), p.ivalue(1)));
+            break;
+        case rtr_format::IVEC3:
+            assert(p.ivalue_size() == 3);
+            ubo->set(p.name(), ivec3(p.ivalue(0), p.ivalue(1), p.ivalue(2)));
+            break;
+        case rtr_format::IVEC4:
+            assert(p.ivalue_size() == 4);
+            ubo->set(p.name(), ivec4(p.ivalue(0), p.ivalue(1), p.ivalue(2), p.ivalue(3)));
+            break;
+        case rtr_format::FLOAT:
+            assert(p.fvalue_size() == 1);
+            ubo->set(p.name(), p.fvalue(0));
+            break;
+        case rtr_format::VEC2:
+            assert(p.fvalue_size() == 2);
+            ubo->set(p.name(), vec2(p.fvalue(0), p.fvalue(1)));
+            break;
+        case rtr_format::VEC3:
+            assert(p.fvalue_size() == 3);
+            ubo->set(p.name(), vec3(p.fvalue(0), p.fvalue(1), p.fvalue(2)));
+            break;
+        case rtr_format::VEC4:
+            assert(p.fvalue_size() == 4);
+            ubo->set(p.name(), vec4(p.fvalue(0), p.fvalue(1), p.fvalue(2), p.fvalue(3)));
+            break;
+        case rtr_format::MAT2:
+            assert(p.fvalue_size() == 4);
+            ubo->set(p.name(), mat2(p.fvalue(0), p.fvalue(1),
+                                    p.fvalue(2), p.fvalue(3)));
+            break;
+        case rtr_format::MAT3:
+            assert(p.fvalue_size() == 9);
+            ubo->set(p.name(), mat3(p.fvalue(0), p.fvalue(1), p.fvalue(2), 
+                                    p.fvalue(3), p.fvalue(4), p.fvalue(5),
+                                    p.fvalue(6), p.fvalue(7), p.fvalue(8)));
+            break;
+        case rtr_format::MAT4:
+            assert(p.fvalue_size() == 16);
+            ubo->set(p.name(), mat4(p.fvalue(0), p.fvalue(1), p.fvalue(2), p.fvalue(3), 
+                                    p.fvalue(4), p.fvalue(5), p.fvalue(6), p.fvalue(7), 
+                                    p.fvalue(8), p.fvalue(9), p.fvalue(10),p.fvalue(11),
+                                    p.fvalue(12),p.fvalue(13),p.fvalue(14),p.fvalue(15)));
+            break;
+        case rtr_format::SPECIAL:
+            break;
+        }
+    }
+
+    //Packed textures are sampled from their layer in the array
+    for (size_t i = 0; i < _textures.size(); ++i) {
+        string layer_name = _textures[i].name + "_layer";
+
+        if (_textures[i].layer.array && ubo->has_entry(layer_name)) {
+            ubo->set(layer_name, GLfloat(_textures[i].layer.layer));
+        }
+    }
+
+    _params = ubo;
+
+    //Parameter values are in the buffer now
+    _material.reset();
+}
+
 void MaterialInstance::bind(Shader& shader)
 {
+    if (_params == NULL) {
+        create_params(shader);
+    }
+
     _params->send_to_GPU();
     _params->bind();
     shader.set_uniform_block("Material", *_params);
+
+    if (config.texture_arrays()) {
+        //Arrays stay bound, often the next instance uses the same ones.
+        //Only the arrays that are not bound yet need a free unit.
+        int unbound = 0;
+        for (size_t i = 0; i < _textures.size(); ++i) {
+            TextureArray* array = _textures[i].layer.array.get();
+
+            if (array == NULL || array->is_bound())
+                continue;
+
+            bool counted = false;
+            for (size_t j = 0; j < i; ++j)
+                counted |= (_textures[j].layer.array.get() == array);
+
+            if (!counted)
+                ++unbound;
+        }
+
+        _packer->reserve(unbound);
+
+        for(size_t i = 0; i < _textures.size(); ++i) {
+            TextureArray* array = _textures[i].layer.array.get();
+
+            if (array == NULL)
+                continue;
+
+            _packer->bind(*array);
+            shader.set_uniform(_textures[i].name, *array);
+        }
+
+        return;
+    }
+
     for(size_t i = 0; i < _textures.size(); ++i) {
+        if (!_textures[i].tex)
+            continue;
+
         _textures[i].tex->bind();
         shader.set_uniform(_textures[i].name, *(_textures[i].tex));
     }
@@ -202,17 +380,32 @@ void MaterialInstance::bind(Shader& shader)
 
 void MaterialInstance::unbind()
 {
-    _params->unbind();
+    if (_params != NULL) {
+        _params->unbind();
+    }
+
+    if (config.texture_arrays()) {
+        return;
+    }
+
     for(size_t i = 0; i < _textures.size(); ++i) {
-        _textures[i].tex->unbind();
+        if (_textures[i].tex) {
+            _textures[i].tex->unbind();
+        }
     }
 }
 
+MaterialManager::MaterialManager() :
+    _parameter_pool(new UniformBufferPool()),
+    _texture_packer(new TexturePacker()),
+    _has_unpacked(false),
+    _statistics_start(-1.0),
+    _statistics_frames(0)
+{
+}
+
 MaterialManager::~MaterialManager()
 {
-    for(size_t i = 0; i < _shader_matrix.size(); ++i) {
-        delete _shader_matrix[i];
-    }
 }
 
 int MaterialManager::add_shader_program(const string& shader_program_name) 
@@ -232,14 +425,20 @@ bool MaterialManager::add_material(const string& material_name)
     _materials[material_name] = id;
 
     for (size_t i = 0; i < _shader_programs.size(); ++i) {
-        Shader* shader = new Shader(_shader_programs[i], material_name);
+        shared_ptr<Shader> shader(new Shader(_shader_programs[i], 
+                                             material_name, true));
 
-        if (!shader->is_valid()) {
+        //Sources that could not be loaded are known to be invalid already,
+        //everything else is compiled on first use.
+        if (shader->is_compiled() && !shader->is_valid()) {
             cerr << "Shader combination " 
                  << _shader_programs[i] << "@" << material_name
-                 << " does not compile." << endl;
+                 << " could not be loaded." << endl;
             valid = false;
-            _valid = false;
+        } else if (_shader_sources.count(shader->source_key()) > 0) {
+            shader = _shader_sources[shader->source_key()];
+        } else {
+            _shader_sources[shader->source_key()] = shader;
         }
 
         _shader_matrix.push_back(shader);
@@ -296,85 +495,13 @@ MaterialInstanceRef MaterialManager::add_instance(const Material& material,
 
     int mat_id = _materials[material.shader()];
 
-    size_t pos = mat_id * _shader_programs.size();
-    Shader* shader = (_shader_matrix[pos]);
-
-    if (!shader->is_valid()) {
-        MaterialInstanceRef error = add_error_material(material.id(), inst);
-        return error;
-    }
-
-    UniformBuffer* ubo = new UniformBuffer(*shader, "Material");
-
     list<rtr_format::Parameter> texture_params;
 
     for (int i = 0; i < material.parameter_size(); ++i) {
         const rtr_format::Parameter& p = material.parameter(i);
-        //If we don't have this parameter either as a free standing
-        //uniform, or as part of the Material uniform block, we skip
-        //it and print a warning.
-        if (! (ubo->has_entry(p.name()) || shader->has_uniform(p.name()) ) ) {
-            cout << "Warning (" << material.id() << "): Shader '"
-                 << material.shader() << "' has no parameter named '"
-                 << p.name() << "'. Skipping parameter." << endl;
-            continue;
-        }
-        switch (p.type()) {
-        case rtr_format::TEXTURE: 
+
+        if (p.type() == rtr_format::TEXTURE) {
             texture_params.push_back(p);
-            break;
-        case rtr_format::INT:
-            assert(p.ivalue_size() == 1);
-            ubo->set(p.name(), p.ivalue(0));
-            break;
-        case rtr_format::IVEC2:
-            assert(p.ivalue_size() == 2);
-            ubo->set(p.name(), ivec2(p.ivalue(0), p.ivalue(1)));
-            break;
-        case rtr_format::IVEC3:
-            assert(p.ivalue_size() == 3);
-            ubo->set(p.name(), ivec3(p.ivalue(0), p.ivalue(1), p.ivalue(2)));
-            break;
-        case rtr_format::IVEC4:
-            assert(p.ivalue_size() == 4);
-            ubo->set(p.name(), ivec4(p.ivalue(0), p.ivalue(1), p.ivalue(2), p.ivalue(3)));
-            break;
-        case rtr_format::FLOAT:
-            assert(p.fvalue_size() == 1);
-            ubo->set(p.name(), p.fvalue(0));
-            break;
-        case rtr_format::VEC2:
-            assert(p.fvalue_size() == 2);
-            ubo->set(p.name(), vec2(p.fvalue(0), p.fvalue(1)));
-            break;
-        case rtr_format::VEC3:
-            assert(p.fvalue_size() == 3);
-            ubo->set(p.name(), vec3(p.fvalue(0), p.fvalue(1), p.fvalue(2)));
-            break;
-        case rtr_format::VEC4:
-            assert(p.fvalue_size() == 4);
-            ubo->set(p.name(), vec4(p.fvalue(0), p.fvalue(1), p.fvalue(2), p.fvalue(3)));
-            break;
-        case rtr_format::MAT2:
-            assert(p.fvalue_size() == 4);
-            ubo->set(p.name(), mat2(p.fvalue(0), p.fvalue(1),
-                                    p.fvalue(2), p.fvalue(3)));
-            break;
-        case rtr_format::MAT3:
-            assert(p.fvalue_size() == 9);
-            ubo->set(p.name(), mat3(p.fvalue(0), p.fvalue(1), p.fvalue(2), 
-                                    p.fvalue(3), p.fvalue(4), p.fvalue(5),
-                                    p.fvalue(6), p.fvalue(7), p.fvalue(8)));
-            break;
-        case rtr_format::MAT4:
-            assert(p.fvalue_size() == 16);
-            ubo->set(p.name(), mat4(p.fvalue(0), p.fvalue(1), p.fvalue(2), p.fvalue(3), 
-                                    p.fvalue(4), p.fvalue(5), p.fvalue(6), p.fvalue(7), 
-                                    p.fvalue(8), p.fvalue(9), p.fvalue(10),p.fvalue(11),
-                                    p.fvalue(12),p.fvalue(13),p.fvalue(14),p.fvalue(15)));
-            break;
-        case rtr_format::SPECIAL:
-            break;
         }
     }
 
@@ -384,11 +511,14 @@ MaterialInstanceRef MaterialManager::add_instance(const Material& material,
         instance = 
             MaterialInstanceRef(new MaterialInstance(mat_id, 
                                                      _material_instances.size(),
-                                                     ubo, texture_params.size()));
+                                                     material,
+                                                     _parameter_pool,
+                                                     _texture_packer,
+                                                     texture_params.size()));
     } else {
         inst->reset(mat_id, 
                     _material_instances.size(), 
-                    ubo, texture_params.size());
+                    material, texture_params.size());
         instance = inst;
     }
 
@@ -404,10 +534,21 @@ MaterialInstanceRef MaterialManager::add_instance(const Material& material,
             continue;
         }
 
-        TextureRef tex = _texture_manager.get_texture(it_tex->svalue());
+        const string& file_name = it_tex->svalue();
+
+        if (_packed_textures.count(file_name) > 0) {
+            instance->set_texture_param(tex_i, it_tex->name(), file_name,
+                                        _packed_textures[file_name]);
+            ++tex_i;
+            continue;
+        }
+
+        TextureRef tex = _texture_manager.get_texture(file_name);
 
         if (tex) {
-            instance->set_texture_param(tex_i, it_tex->name(), tex);
+            instance->set_texture_param(tex_i, it_tex->name(), file_name, 
+                                        tex);
+            _has_unpacked = true;
         }
 
         ++tex_i;
@@ -429,19 +570,80 @@ Shader& MaterialManager::get_shader(int shader_program_id,
 {
     int pos = material_id * _shader_programs.size() + shader_program_id;
 
-    return *(_shader_matrix.at(pos));
+    Shader& shader = *(_shader_matrix.at(pos));
+
+    if (!shader.is_compiled()) {
+        shader.compile();
+    }
+
+    //The Constant material is the fallback, it has id 0
+    if (!shader.is_valid() && material_id != 0) {
+        fall_back(shader_program_id, material_id);
+        return *(_shader_matrix.at(pos));
+    }
+
+    return shader;
 }
 
-void MaterialManager::reload(DBLoader* db_loader)
+void MaterialManager::fall_back(int shader_program_id, int material_id)
+{
+    string material_name;
+    map<string, int>::const_iterator it_mat;
+    for (it_mat = _materials.begin(); it_mat != _materials.end(); ++it_mat) {
+        if (it_mat->second == material_id) {
+            material_name = it_mat->first;
+        }
+    }
+
+    cerr << "Shader combination " 
+         << _shader_programs[shader_program_id] << "@" << material_name
+         << " does not compile." << endl;
+
+    get_shader(shader_program_id, 0);
+
+    for (size_t i = 0; i < _shader_programs.size(); ++i) {
+        _shader_matrix.at(material_id * _shader_programs.size() + i) = 
+            _shader_matrix.at(i);
+    }
+
+    //Replace all live instances of the material by error materials
+    vector<string> names;
+    map<string, weak_ptr<MaterialInstance> >::iterator it;
+    for (it = _material_instances.begin(); 
+         it != _material_instances.end(); ++it) {
+        if (!it->second.expired() && 
+            it->second.lock()->material_id() == material_id) {
+            names.push_back(it->first);
+        }
+    }
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        add_error_material(names[i], _material_instances[names[i]].lock());
+    }
+}
+
+void MaterialManager::warm_up()
 {
     for (size_t i = 0; i < _shader_matrix.size(); ++i) {
-        delete _shader_matrix[i];
+        _shader_matrix[i]->start_compile();
     }
-    
+
+    int programs = _shader_programs.size();
+
+    for (size_t i = 0; i < _shader_matrix.size(); ++i) {
+        get_shader(i % programs, i / programs);
+    }
+}
+
+void MaterialManager::reload(DBLoader* db_loader)
+{
     _shader_matrix.clear();
+    _shader_sources.clear();
     _materials.clear();
-    _shader_matrix.clear();
     _texture_manager.clear();
+    _packed_textures.clear();
+
+    Shader::clear_source_cache();
     
     map<string, weak_ptr<MaterialInstance> > tmp;
 
@@ -465,3 +667,96 @@ void MaterialManager::reload(DBLoader* db_loader)
 
     tmp.clear();
 }
+
+void MaterialManager::pack_textures()
+{
+    if (!config.texture_arrays() || !_has_unpacked) {
+        return;
+    }
+
+    vector<TextureRef> textures;
+    vector<MaterialInstance::TextureParam*> params;
+
+    map<string, weak_ptr<MaterialInstance> >::iterator it;
+    for (it = _material_instances.begin(); 
+         it != _material_instances.end(); ++it) {
+        if (it->second.expired()) {
+            continue;
+        }
+
+        MaterialInstanceRef instance = it->second.lock();
+
+        for (size_t i = 0; i < instance->_textures.size(); ++i) {
+            MaterialInstance::TextureParam& param = instance->_textures[i];
+
+            if (param.tex) {
+                textures.push_back(param.tex);
+                params.push_back(&param);
+            }
+        }
+    }
+
+    int array_count = _texture_packer->array_count();
+    int texture_count = _texture_packer->texture_count();
+
+    vector<TexturePacker::Layer> layers;
+    _texture_packer->pack(textures, layers);
+
+    //The textures are not needed any more once they are in the arrays
+    for (size_t i = 0; i < params.size(); ++i) {
+        params[i]->layer = layers[i];
+        params[i]->tex.reset();
+        _packed_textures[params[i]->file] = layers[i];
+    }
+
+    textures.clear();
+    _texture_manager.purge();
+
+    _has_unpacked = false;
+
+    cout << "Packed " << _texture_packer->texture_count() - texture_count
+         << " material textures into "
+         << _texture_packer->array_count() - array_count 
+         << " texture arrays." << endl;
+}
+
+void MaterialManager::unbind_textures()
+{
+    _texture_packer->unbind_all();
+}
+
+void MaterialManager::report_statistics()
+{
+    double now = glfwGetTime();
+
+    if (_statistics_start < 0.0) {
+        _statistics_start = now;
+        _parameter_pool->reset_statistics();
+    }
+
+    ++_statistics_frames;
+
+    if (now - _statistics_start < 5.0)
+        return;
+
+    const UniformBufferPool::Statistics& s = _parameter_pool->statistics();
+    double frames = _statistics_frames;
+
+    //Uploading on every bind took glBindBuffer, glBufferSubData, 
+    //glBindBuffer, glBindBufferBase and glUniformBlockBinding per bind, 
+    //plus glBindBufferBase per unbind.
+    size_t pooled_calls = s.range_binds + s.uploads * 3;
+    size_t per_bind_calls = s.range_binds * 6;
+
+    cout << "Material parameters per frame: " 
+         << s.range_binds / frames << " binds, "
+         << pooled_calls / frames << " GL calls, "
+         << s.bytes_uploaded / frames << " bytes uploaded "
+         << "(uploading per bind: " << per_bind_calls / frames << " GL calls, "
+         << s.bytes_bound / frames << " bytes), pool size " 
+         << _parameter_pool->size() << " bytes" << endl;
+
+    _parameter_pool->reset_statistics();
+    _statistics_start = now;
+    _statistics_frames = 0;
+}
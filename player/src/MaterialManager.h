@@ -23,6 +23,7 @@
 #define MATERIALMANAGER_H
 
 #include "common.h"
+#include "TexturePacker.h"
 
 namespace rtr_format
 {
@@ -32,6 +33,7 @@ namespace rtr_format
 class Texture;
 class Shader;
 class UniformBuffer;
+class UniformBufferPool;
 class DBLoader;
 
 typedef shared_ptr<Texture> TextureRef;
@@ -56,7 +58,7 @@ class MaterialManager {
 
     public:
 
-    MaterialManager() : _valid(true) {};
+    MaterialManager();
     virtual ~MaterialManager();
 
     // You have to call this before calling get_instance()!
@@ -70,19 +72,60 @@ class MaterialManager {
 
     int get_material_id(int instance_id) { return _instance_map[instance_id]; }
 
+    /**
+     * Returns the permutation of a shader program for a material. 
+     * Permutations are compiled when they are requested for the first time.
+     * If one does not compile, the material's instances are replaced by 
+     * error materials and the Constant permutation is returned instead.
+     */
     Shader& get_shader(int shader_program_id, int material_id);
 
-    bool is_valid() { return _valid; }
+    /**
+     * Compiles all permutations that have not been compiled yet. All of
+     * them are submitted to the driver before waiting for the first one.
+     */
+    void warm_up();
 
     void reload(DBLoader* _db_loader);
 
+    /**
+     * With texture_arrays, copies the textures of instances added since the
+     * last call into texture arrays. Call before drawing.
+     */
+    void pack_textures();
+
+    /**
+     * Unbinds the texture arrays left bound by the instances. Call after
+     * drawing.
+     */
+    void unbind_textures();
+
+    /**
+     * Call once per frame. Every few seconds, prints how many GL calls and
+     * bytes per frame were spent on material parameters, compared to 
+     * uploading them on every bind.
+     */
+    void report_statistics();
+
     private:
 
-    bool _valid;
+    //Parameters of all instances live in one buffer object. Instances hold
+    //a reference as they might outlive the manager.
+    shared_ptr<UniformBufferPool> _parameter_pool;
+    shared_ptr<TexturePacker> _texture_packer;
+
+    //Layers of textures packed already, by file name. Set if instances 
+    //have textures that are not packed yet.
+    map<string, TexturePacker::Layer> _packed_textures;
+    bool _has_unpacked;
+
+    double _statistics_start;
+    int _statistics_frames;
 
     MaterialInstanceRef add_instance(const rtr_format::Material& material,
                                      MaterialInstanceRef inst = MaterialInstanceRef());
     bool add_material(const string& material_name);
+    void fall_back(int shader_program_id, int material_id);
 
     MaterialInstanceRef add_error_material(const string& name,
                                            MaterialInstanceRef inst);
@@ -92,7 +135,10 @@ class MaterialManager {
     vector<int> _instance_map;
     map<string, int> _materials;
     vector<string> _shader_programs;
-    vector<Shader*> _shader_matrix;
+
+    //Permutations with identical preprocessed sources share one Shader
+    vector<shared_ptr<Shader> > _shader_matrix;
+    map<string, shared_ptr<Shader> > _shader_sources;
 };
 
 
@@ -100,9 +146,12 @@ class MaterialInstance {
 
     friend class MaterialManager;
 
+    //With texture arrays, tex is released once it is copied into a layer
     struct TextureParam {
         string name;
+        string file;
         TextureRef tex;
+        TexturePacker::Layer layer;
     };
 
     int _instance_id;
@@ -110,10 +159,24 @@ class MaterialInstance {
     UniformBuffer* _params;
     vector<TextureParam> _textures;
 
+    //The parameter buffer needs the layout of the compiled shader and is
+    //created on the first bind.
+    shared_ptr<rtr_format::Material> _material;
+    shared_ptr<UniformBufferPool> _pool;
+    shared_ptr<TexturePacker> _packer;
+
     MaterialInstance(int material_id, int instance_id,
-                     UniformBuffer* params, int texture_cnt);
+                     const rtr_format::Material& material,
+                     const shared_ptr<UniformBufferPool>& pool,
+                     const shared_ptr<TexturePacker>& packer,
+                     int texture_cnt);
+    void set_texture_param(int index, 
+                           const string& param_name, const string& file_name,
+                           TextureRef texture);
     void set_texture_param(int index, 
-                           const string& param_name, TextureRef texture);
+                           const string& param_name, const string& file_name,
+                           const TexturePacker::Layer& layer);
+    void create_params(Shader& shader);
 
     public:
 
@@ -125,7 +188,7 @@ class MaterialInstance {
     void unbind();
 
     void reset(int material_id, int instance_id,
-               UniformBuffer* params, int texture_cnt);
+               const rtr_format::Material& material, int texture_cnt);
 };
 
 #endif
@@ -21,6 +21,7 @@
 
 #include "Mesh.h"
 #include "Shader.h"
+#include "Profiler.h"
 
 #include "rtr_format.pb.h"
 
@@ -77,17 +78,16 @@ MeshInitializer::MeshInitializer(const rtr_format::Mesh& mesh_buffer)
 
         const rtr_format::Mesh_VertexAttributeLayer& l = mesh_buffer.layer(i);
 
-        //Note: At the moment we assume that all layers only carry
-        //GL_FLOAT data types. At the moment this is a property on a
-        //per-layer-source basis. We would have to pass this information
-        //somewhow, if we allowed int layers as well.
+        //Note: The data type is a property of the layer source, layers on
+        //integer sources are converted by the GPUMesh, see there.
         GLenum gl_type = GL_FLOAT;
 
         add_layer( l.name(), 
                    gl_type, 
                    l.num_components(),
                    l.source_index(),
-                   l.source() );
+                   l.source(),
+                   l.normalized() );
     }
 
     //get the bounding volume data
@@ -102,6 +102,23 @@ MeshInitializer::MeshInitializer(const rtr_format::Mesh& mesh_buffer)
 
     _bounding_sphere = Sphere(b_sphere_radius, b_sphere_center);
 
+    for (int i = 0; i < mesh_buffer.meshlet_size(); ++i) {
+        const rtr_format::Mesh_Meshlet& m = mesh_buffer.meshlet(i);
+        const rtr_format::Mesh_BoundingSphere& s = m.bounding_sphere();
+
+        Meshlet meshlet;
+        meshlet.first_index = m.first_index();
+        meshlet.index_count = m.index_count();
+        meshlet.bounding_sphere = Sphere(s.radius(), vec3(s.center_x(),
+                                                          s.center_y(),
+                                                          s.center_z()));
+        meshlet.cone_axis = vec3(m.cone_axis_x(), 
+                                 m.cone_axis_y(), 
+                                 m.cone_axis_z());
+        meshlet.cone_cutoff = m.cone_cutoff();
+
+        _meshlets.push_back(meshlet);
+    }
 }
 
 void MeshInitializer::store(rtr_format::Mesh& mesh_buffer) const
@@ -132,6 +149,29 @@ void MeshInitializer::store(rtr_format::Mesh& mesh_buffer) const
         l->set_source(i->layer_source_id);
         l->set_source_index(i->source_index);
 
+        if (i->normalized) {
+            l->set_normalized(true);
+        }
+
+    }
+
+    for (vector<Meshlet>::const_iterator i = _meshlets.begin(); 
+         i != _meshlets.end(); ++i) {
+        rtr_format::Mesh_Meshlet* m = mesh_buffer.add_meshlet();
+
+        m->set_first_index(i->first_index);
+        m->set_index_count(i->index_count);
+
+        rtr_format::Mesh_BoundingSphere* s = m->mutable_bounding_sphere();
+        s->set_center_x(i->bounding_sphere.center().x);
+        s->set_center_y(i->bounding_sphere.center().y);
+        s->set_center_z(i->bounding_sphere.center().z);
+        s->set_radius(i->bounding_sphere.radius());
+
+        m->set_cone_axis_x(i->cone_axis.x);
+        m->set_cone_axis_y(i->cone_axis.y);
+        m->set_cone_axis_z(i->cone_axis.z);
+        m->set_cone_cutoff(i->cone_cutoff);
     }
 }
 
@@ -139,7 +179,8 @@ void MeshInitializer::add_layer( string name,
                                  GLenum type, 
                                  GLint components, 
                                  int source_index, 
-                                 const string& layer_source_id )
+                                 const string& layer_source_id,
+                                 bool normalized )
 {
     LayerInfo layer;
 
@@ -149,6 +190,7 @@ void MeshInitializer::add_layer( string name,
         
     layer.layer_source_id = layer_source_id;
     layer.source_index = source_index;
+    layer.normalized = normalized;
 
     _layers.push_back(layer); 
 }
@@ -182,6 +224,7 @@ GPUMesh::GPUMesh(const MeshInitializer& init, const GPULayerSourceMap& sources)
         layer.name = i->name;
         layer.type = i->type;
         layer.components = i->components;
+        layer.normalized = i->normalized;
 
         //Find the converted source
         assert(sources.find(i->layer_source_id) != sources.end());
@@ -189,6 +232,12 @@ GPUMesh::GPUMesh(const MeshInitializer& init, const GPULayerSourceMap& sources)
         GPULayerSourceRef source_data = sources.find(i->layer_source_id)->second;
         layer.source = source_data;
 
+        //Integer sources hold packed bytes, one int per vertex for the 
+        //components of a layer
+        if (source_data->type() == GL_INT) {
+            layer.type = GL_UNSIGNED_BYTE;
+        }
+
         layer.vbo_offset = (GLvoid*)( source_data->element_size()*i->source_index );
 
         _layers.push_back(layer);
@@ -211,6 +260,10 @@ GPUMesh::GPUMesh(const MeshInitializer& init, const GPULayerSourceMap& sources)
     //Getbounding volume info
     _bounding_volume = BoundingVolume(init._bounding_sphere);
 
+    if (_primitive_type == GL_TRIANGLES && _index_count > 0) {
+        _meshlets = init._meshlets;
+    }
+
 }
 
 GPUMesh::~GPUMesh()
@@ -270,7 +323,8 @@ void GPUMesh::prepare_vao(const Shader& shader)
 
             glEnableVertexAttribArray(location);
             glVertexAttribPointer(location, l->components,
-                                  l->type, GL_FALSE, 0, l->vbo_offset);
+                                  l->type, l->normalized ? GL_TRUE : GL_FALSE, 
+                                  0, l->vbo_offset);
 
             //unbind VBOs
             l->source->unbind();
@@ -283,7 +337,7 @@ void GPUMesh::prepare_vao(const Shader& shader)
     _shader_to_vao_map[shader.get_program_ID()] = vao;
 }
 
-void GPUMesh::draw(const Shader& shader)
+void GPUMesh::bind_vao(const Shader& shader)
 {
     if (_shader_to_vao_map.count(shader.get_program_ID()) < 1) {
         prepare_vao(shader);
@@ -291,12 +345,59 @@ void GPUMesh::draw(const Shader& shader)
 
     // This is actually trivial with VAOs.
     glBindVertexArray(_shader_to_vao_map.at(shader.get_program_ID()));
+}
+
+void GPUMesh::count_primitives(int count)
+{
+    Profiler::count(Profiler::DRAW_CALLS);
+    Profiler::count(Profiler::STATE_BINDS);
+
+    if (_primitive_type == GL_TRIANGLES) {
+        Profiler::count(Profiler::TRIANGLES, count / 3);
+    } else if (_primitive_type == GL_TRIANGLE_STRIP || 
+               _primitive_type == GL_TRIANGLE_FAN) {
+        Profiler::count(Profiler::TRIANGLES, std::max(count - 2, 0));
+    }
+}
+
+void GPUMesh::draw(const Shader& shader)
+{
+    bind_vao(shader);
+
+    int count;
 
     if (_index_count > 0) {
         glDrawElements(_primitive_type, _index_count, GL_UNSIGNED_INT, NULL);
+        count = _index_count;
     } else {
         glDrawArrays(_primitive_type, 0, _vertex_count);
+        count = _vertex_count;
+    }
+
+    count_primitives(count);
+
+    glBindVertexArray(0);
+}
+
+void GPUMesh::draw_ranges(const Shader& shader, 
+                          const GLsizei* counts, 
+                          const GLvoid* const* offsets,
+                          int range_count)
+{
+    assert(_index_count > 0);
+
+    bind_vao(shader);
+
+    //Older headers declare the offsets without the inner const
+    glMultiDrawElements(_primitive_type, counts, GL_UNSIGNED_INT, 
+                        const_cast<const GLvoid**>(offsets), range_count);
+
+    int count = 0;
+    for (int i = 0; i < range_count; ++i) {
+        count += counts[i];
     }
 
+    count_primitives(count);
+
     glBindVertexArray(0);
 }
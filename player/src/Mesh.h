@@ -37,6 +37,20 @@ namespace rtr_format {
     class Mesh;
 }
 class Shader;
+
+/**
+ * A cluster of triangles occupying a contiguous index range of a mesh, with
+ * a bounding sphere and a cone around all face normals in object space.
+ * A cone_cutoff <= 0 cannot be used for backface culling.
+ */
+struct Meshlet {
+    GLuint first_index;
+    GLsizei index_count;
+    Sphere bounding_sphere;
+    vec3 cone_axis;
+    float cone_cutoff;
+};
+
 /**
  * Application-side representation of mesh data.
  * This is an utility and storage class that is used to prepare a mesh for 
@@ -77,10 +91,11 @@ public:
      * index references nth element of the native data type of the layer source.
      * @param source The actual layer source data, as expressed by the layer's intermediate data
      * structure.
+     * @param normalized Whether integer data is mapped to [0,1].
      */
     template<typename T> 
     void add_layer(string name, int source_index, 
-                   const string& source);
+                   const string& source, bool normalized=false);
 
 
     /**
@@ -108,6 +123,7 @@ private:
         GLint components;
         string layer_source_id;
         int source_index; 
+        bool normalized;
     };
 
     /**
@@ -117,12 +133,14 @@ private:
      * @param components Number of components per vertex.
      * @param source_index The starting index of this layer into the layer source.
      * @param layer_source_id The id of the layer source element.
+     * @param normalized Whether integer data is mapped to [0,1].
      */
     void add_layer( string name,
                     GLenum type, 
                     GLint components, 
                     int source_index, 
-                    const string& layer_source_id);
+                    const string& layer_source_id,
+                    bool normalized);
 
     string _id;
     GLenum _primitive_type; /**< OpenGL primitive type enum */
@@ -138,6 +156,9 @@ private:
     //Optional index data
     ArrayAdapter _index_data;
 
+    //Optional meshlets, covering all of the index data
+    vector<Meshlet> _meshlets;
+
 };
 
 /**
@@ -182,9 +203,23 @@ public:
      */
     void draw (const Shader& shader);
 
+    /**
+     * Draws only some index ranges with a single glMultiDrawElements call,
+     * used for the visible meshlets of a mesh.
+     * @param counts Number of indices of each range.
+     * @param offsets Byte offset of each range into the index buffer.
+     */
+    void draw_ranges (const Shader& shader, 
+                      const GLsizei* counts, 
+                      const GLvoid* const* offsets,
+                      int range_count);
+
     //returns the bounding volume for this mesh
     const BoundingVolume& bounding_volume() const { return _bounding_volume; }
 
+    //the meshlets of this mesh, empty if it was baked without
+    const vector<Meshlet>& meshlets() const { return _meshlets; }
+
 private:
 
     struct LayerInfo
@@ -194,6 +229,7 @@ private:
         GLint components;
         GPULayerSourceRef source;
         void* vbo_offset; 
+        bool normalized;
     };
 
     string _id;
@@ -216,15 +252,22 @@ private:
 
     BoundingVolume _bounding_volume;
 
+    vector<Meshlet> _meshlets;
+
+    void bind_vao(const Shader& shader);
+    void count_primitives(int count);
+
 };
 
 typedef shared_ptr<GPUMesh> GPUMeshRef;
 
 // TEMPLATE DEFINITIONS:
 template<typename T> 
-void MeshInitializer::add_layer(string name, int source_index, const string& source)
+void MeshInitializer::add_layer(string name, int source_index, const string& source,
+                                bool normalized)
 {
-    add_layer(name, gltype_info<T>::type, gltype_info<T>::components, source_index, source);
+    add_layer(name, gltype_info<T>::type, gltype_info<T>::components, source_index, source,
+              normalized);
 }
 
 #endif
@@ -0,0 +1,1141 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "NullGL.h"
+
+#include <algorithm>
+#include <ostream>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+
+namespace {
+
+/**
+ * Reads an integer parameter of any size.
+ */
+int64_t integer(const extGLarg& arg)
+{
+    switch (arg.size) {
+    case 1: return *(const uint8_t*)arg.value;
+    case 2: return *(const int16_t*)arg.value;
+    case 4: return *(const int32_t*)arg.value;
+    case 8: return *(const int64_t*)arg.value;
+    }
+
+    return 0;
+}
+
+template<typename T> T pointer(const extGLarg& arg)
+{
+    T p;
+    memcpy(&p, arg.value, sizeof(p));
+    return p;
+}
+
+bool is_null(const extGLarg& arg)
+{
+    return pointer<const void*>(arg) == NULL;
+}
+
+/**
+ * Appends the size of a value followed by its bytes.
+ */
+void push_value(vector<byte>& stream, const void* value, size_t size)
+{
+    const byte* bytes = (const byte*)value;
+    stream.push_back(byte(size));
+    stream.insert(stream.end(), bytes, bytes + size);
+}
+
+/**
+ * Writes one value recorded by NullGL::record(), and moves i past it.
+ */
+void write_value(std::ostream& out, const vector<byte>& stream, size_t& i)
+{
+    int size = stream[i++];
+
+    if (size == 0) {
+        out << "NULL";
+    } else if (size == 0xff) {
+        out << "ptr";
+    } else if (size == 0xfe) {
+        uint32_t count = 0;
+        for (int b = 3; b >= 0; --b) {
+            count = (count << 8) | stream[i + b];
+        }
+        i += 4;
+
+        out << "{";
+        for (uint32_t e = 0; e < count; ++e) {
+            if (e > 0)
+                out << ", ";
+            write_value(out, stream, i);
+        }
+        out << "}";
+    } else {
+        uint64_t value = 0;
+        for (int b = size - 1; b >= 0; --b) {
+            value = (value << 8) | stream[i + b];
+        }
+        out << "0x" << std::hex << value << std::dec;
+        i += size;
+    }
+}
+
+void copy_name(const string& name, GLsizei buffer_size, GLsizei* length, 
+               GLchar* buffer)
+{
+    GLsizei n = 0;
+
+    if (buffer != NULL && buffer_size > 0) {
+        n = std::min(GLsizei(name.size()), buffer_size - 1);
+        std::copy(name.begin(), name.begin() + n, buffer);
+        buffer[n] = '\0';
+    }
+
+    if (length != NULL)
+        *length = n;
+}
+
+struct GLSLType {
+    const char* name;
+    GLenum type;
+    int components; /**< Per column */
+    int columns;
+};
+
+const GLSLType kGLSLTypes[] = {
+    {"float", GL_FLOAT, 1, 1},
+    {"vec2", GL_FLOAT_VEC2, 2, 1},
+    {"vec3", GL_FLOAT_VEC3, 3, 1},
+    {"vec4", GL_FLOAT_VEC4, 4, 1},
+    {"int", GL_INT, 1, 1},
+    {"ivec2", GL_INT_VEC2, 2, 1},
+    {"ivec3", GL_INT_VEC3, 3, 1},
+    {"ivec4", GL_INT_VEC4, 4, 1},
+    {"uint", GL_UNSIGNED_INT, 1, 1},
+    {"uvec2", GL_UNSIGNED_INT_VEC2, 2, 1},
+    {"uvec3", GL_UNSIGNED_INT_VEC3, 3, 1},
+    {"uvec4", GL_UNSIGNED_INT_VEC4, 4, 1},
+    {"bool", GL_BOOL, 1, 1},
+    {"bvec2", GL_BOOL_VEC2, 2, 1},
+    {"bvec3", GL_BOOL_VEC3, 3, 1},
+    {"bvec4", GL_BOOL_VEC4, 4, 1},
+    {"mat2", GL_FLOAT_MAT2, 2, 2},
+    {"mat3", GL_FLOAT_MAT3, 3, 3},
+    {"mat4", GL_FLOAT_MAT4, 4, 4},
+    {"sampler1D", GL_SAMPLER_1D, 1, 1},
+    {"sampler2D", GL_SAMPLER_2D, 1, 1},
+    {"sampler3D", GL_SAMPLER_3D, 1, 1},
+    {"samplerCube", GL_SAMPLER_CUBE, 1, 1},
+    {"sampler1DArray", GL_SAMPLER_1D_ARRAY, 1, 1},
+    {"sampler2DArray", GL_SAMPLER_2D_ARRAY, 1, 1},
+    {"sampler2DShadow", GL_SAMPLER_2D_SHADOW, 1, 1},
+    {"sampler2DArrayShadow", GL_SAMPLER_2D_ARRAY_SHADOW, 1, 1},
+    {"sampler2DMS", GL_SAMPLER_2D_MULTISAMPLE, 1, 1},
+    {"samplerBuffer", GL_SAMPLER_BUFFER, 1, 1},
+    {"isamplerBuffer", GL_INT_SAMPLER_BUFFER, 1, 1},
+    {"usamplerBuffer", GL_UNSIGNED_INT_SAMPLER_BUFFER, 1, 1}
+};
+
+/**
+ * Unknown types, e.g. structs, are treated as vec4.
+ */
+const GLSLType& find_type(const string& name)
+{
+    const size_t count = sizeof(kGLSLTypes) / sizeof(kGLSLTypes[0]);
+
+    for (size_t i = 0; i < count; ++i) {
+        if (name == kGLSLTypes[i].name)
+            return kGLSLTypes[i];
+    }
+
+    return kGLSLTypes[3];
+}
+
+struct Declaration {
+    string type;
+    string name;
+    GLint size;
+    bool is_array;
+};
+
+/**
+ * Splits GLSL source into identifiers, numbers and single characters. 
+ * Comments and preprocessor lines are skipped, integer #defines are kept
+ * for array sizes.
+ */
+void tokenize(const string& source, vector<string>& tokens, 
+              map<string, GLint>& defines)
+{
+    size_t i = 0;
+    bool line_start = true;
+
+    while (i < source.size()) {
+        char c = source[i];
+
+        if (c == '\n') {
+            line_start = true;
+            ++i;
+        } else if (isspace(c)) {
+            ++i;
+        } else if (source.compare(i, 2, "//") == 0) {
+            i = source.find('\n', i);
+        } else if (source.compare(i, 2, "/*") == 0) {
+            i = source.find("*/", i);
+            i = (i == string::npos) ? i : i + 2;
+        } else if (c == '#' && line_start) {
+            size_t end = source.find('\n', i);
+            string line = source.substr(i, end - i);
+
+            char name[256];
+            int value;
+            if (sscanf(line.c_str(), "#define %255s %d", name, &value) == 2)
+                defines[name] = value;
+
+            i = end;
+        } else if (isalnum(c) || c == '_') {
+            size_t end = i;
+            while (end < source.size() && 
+                   (isalnum(source[end]) || source[end] == '_' || 
+                    source[end] == '.'))
+                ++end;
+
+            tokens.push_back(source.substr(i, end - i));
+            line_start = false;
+            i = end;
+        } else {
+            tokens.push_back(string(1, c));
+            line_start = false;
+            ++i;
+        }
+    }
+}
+
+/**
+ * Evaluates array sizes such as "MAX_SHADOWMAP_COUNT*4".
+ */
+GLint array_size(const vector<string>& tokens, size_t begin, size_t end,
+                 const map<string, GLint>& defines)
+{
+    GLint size = 1;
+
+    for (size_t i = begin; i < end; ++i) {
+        if (tokens[i] == "*")
+            continue;
+
+        map<string, GLint>::const_iterator it = defines.find(tokens[i]);
+        size *= (it != defines.end()) ? it->second : atoi(tokens[i].c_str());
+    }
+
+    return size;
+}
+
+/**
+ * Parses "type a, b[N];" starting at tokens[i]. Returns the index after 
+ * the semicolon.
+ */
+size_t parse_declarations(const vector<string>& tokens, size_t i,
+                          const map<string, GLint>& defines,
+                          vector<Declaration>& declarations)
+{
+    while (i < tokens.size() && (tokens[i] == "highp" || 
+                                 tokens[i] == "mediump" || 
+                                 tokens[i] == "lowp"))
+        ++i;
+
+    if (i >= tokens.size())
+        return i;
+
+    string type = tokens[i++];
+
+    while (i < tokens.size() && tokens[i] != ";") {
+        if (tokens[i] == ",") {
+            ++i;
+            continue;
+        }
+
+        Declaration d = { type, tokens[i++], 1, false };
+
+        if (i < tokens.size() && tokens[i] == "[") {
+            size_t end = std::find(tokens.begin() + i, tokens.end(), "]") -
+                         tokens.begin();
+            d.size = std::max(array_size(tokens, i + 1, end, defines), 1);
+            d.is_array = true;
+            i = end + 1;
+        }
+
+        declarations.push_back(d);
+    }
+
+    return i + 1;
+}
+
+size_t round_up(size_t value, size_t alignment)
+{
+    return ((value + alignment - 1) / alignment) * alignment;
+}
+
+}
+
+NullGL::Statistics::Statistics() :
+    calls(0), draw_calls(0), upload_bytes(0), stream_bytes(0),
+    function_calls(EXTGL_FUNCTION_COUNT, 0)
+{
+}
+
+void NullGL::Statistics::add(const Statistics& other)
+{
+    calls += other.calls;
+    draw_calls += other.draw_calls;
+    upload_bytes += other.upload_bytes;
+    stream_bytes += other.stream_bytes;
+
+    for (size_t i = 0; i < function_calls.size(); ++i) {
+        function_calls[i] += other.function_calls[i];
+    }
+}
+
+NullGL::NullGL() :
+    _frame_count(0),
+    _is_draw(EXTGL_FUNCTION_COUNT, false),
+    _uniform_components(EXTGL_FUNCTION_COUNT, 0),
+    _next_name(1),
+    _vertex_array(0)
+{
+    for (int f = 0; f < EXTGL_FUNCTION_COUNT; ++f) {
+        string name(extGL_function_names[f]);
+
+        _is_draw[f] = name.compare(0, 6, "glDraw") == 0 || 
+                      name.compare(0, 11, "glMultiDraw") == 0;
+
+        // glUniform3fv, glUniformMatrix4x3fv, ...
+        if (name.compare(0, 9, "glUniform") != 0)
+            continue;
+
+        string suffix = name.substr(9);
+
+        if (suffix.compare(0, 6, "Matrix") == 0 && isdigit(suffix[6])) {
+            int columns = suffix[6] - '0';
+            int rows = (suffix[7] == 'x') ? suffix[8] - '0' : columns;
+            _uniform_components[f] = columns * rows;
+        } else if (!suffix.empty() && isdigit(suffix[0])) {
+            _uniform_components[f] = suffix[0] - '0';
+        }
+    }
+}
+
+GLintptr NullGL::call(extGLfunction function, 
+                      const extGLarg* args, int arg_count)
+{
+    record(function, args, arg_count);
+
+    ++_frame.calls;
+    ++_frame.function_calls[function];
+    if (_is_draw[function])
+        ++_frame.draw_calls;
+
+    count_upload(function, args);
+
+    return execute(function, args);
+}
+
+void NullGL::end_frame(std::ostream* trace, const string& name)
+{
+    _frame.stream_bytes = _stream.size();
+
+    if (trace != NULL) {
+        *trace << "# " << name << "\n";
+        write_calls(*trace, _stream);
+    }
+
+    _last_frame = _frame;
+    _total.add(_frame);
+    ++_frame_count;
+
+    _frame = Statistics();
+    _stream.clear();
+}
+
+void NullGL::reset_statistics()
+{
+    _total = Statistics();
+    _frame_count = 0;
+}
+
+void NullGL::print_statistics() const
+{
+    if (_frame_count == 0)
+        return;
+
+    double n = _frame_count;
+
+    cout << "GL calls per frame: " << _total.calls / n
+         << ", draw calls: " << _total.draw_calls / n
+         << ", uploaded: " << _total.upload_bytes / n / 1024.0 << " KiB"
+         << ", command stream: " << _total.stream_bytes / n / 1024.0 
+         << " KiB" << endl;
+
+    vector<std::pair<int64_t, int> > functions;
+    for (int f = 0; f < EXTGL_FUNCTION_COUNT; ++f) {
+        if (_total.function_calls[f] > 0)
+            functions.push_back(std::make_pair(-_total.function_calls[f], f));
+    }
+
+    std::sort(functions.begin(), functions.end());
+
+    cout << "Most called functions per frame:" << endl;
+    for (size_t i = 0; i < std::min(functions.size(), size_t(10)); ++i) {
+        cout << "  " << extGL_function_names[functions[i].second] << ": " 
+             << -functions[i].first / n << endl;
+    }
+}
+
+void NullGL::record(extGLfunction function, 
+                    const extGLarg* args, int arg_count)
+{
+    // Function (16 bit), argument count and per argument its size followed
+    // by its bytes. Pointers differ between runs, only NULL (0) or not 
+    // (0xff) is kept. Pointers which are offsets into a bound buffer are 
+    // kept as values, and the client arrays of glMultiDrawElements as 0xfe, 
+    // their length (32 bit) and their values.
+    _stream.push_back(byte(function & 0xff));
+    _stream.push_back(byte(function >> 8));
+    _stream.push_back(byte(arg_count));
+
+    for (int i = 0; i < arg_count; ++i) {
+        if (!args[i].is_pointer) {
+            push_value(_stream, args[i].value, args[i].size);
+            continue;
+        }
+
+        GLenum target = offset_target(function, i);
+        bool is_offset = (target != 0) && is_bound(target);
+
+        if (function == EXTGL_FN_MultiDrawElements && (i == 1 || i == 3) &&
+            !is_null(args[i])) {
+
+            uint32_t count = uint32_t(integer(args[4]));
+            const byte* count_bytes = (const byte*)&count;
+            _stream.push_back(0xfe);
+            _stream.insert(_stream.end(), count_bytes, count_bytes + 4);
+
+            const GLsizei* counts = pointer<const GLsizei*>(args[i]);
+            const GLvoid* const* offsets = 
+                pointer<const GLvoid* const*>(args[i]);
+
+            for (uint32_t e = 0; e < count; ++e) {
+                if (i == 1) {
+                    push_value(_stream, counts + e, sizeof(GLsizei));
+                } else if (is_offset) {
+                    push_value(_stream, offsets + e, sizeof(GLvoid*));
+                } else {
+                    _stream.push_back(offsets[e] == NULL ? 0 : 0xff);
+                }
+            }
+            continue;
+        }
+
+        if (is_offset) {
+            push_value(_stream, args[i].value, args[i].size);
+        } else {
+            _stream.push_back(is_null(args[i]) ? 0 : 0xff);
+        }
+    }
+}
+
+void NullGL::write_calls(std::ostream& out, const vector<byte>& stream)
+{
+    size_t i = 0;
+
+    while (i + 3 <= stream.size()) {
+        int function = stream[i] | (stream[i + 1] << 8);
+        int arg_count = stream[i + 2];
+        i += 3;
+
+        out << extGL_function_names[function] << "(";
+
+        for (int a = 0; a < arg_count; ++a) {
+            if (a > 0)
+                out << ", ";
+
+            write_value(out, stream, i);
+        }
+
+        out << ")\n";
+    }
+}
+
+void NullGL::count_upload(extGLfunction function, const extGLarg* args)
+{
+    int64_t bytes = 0;
+
+    switch (function) {
+    case EXTGL_FN_BufferData:
+        bytes = is_null(args[2]) ? 0 : integer(args[1]);
+        break;
+    case EXTGL_FN_BufferSubData:
+        bytes = integer(args[2]);
+        break;
+    case EXTGL_FN_MapBufferRange:
+        if (integer(args[3]) & GL_MAP_WRITE_BIT)
+            bytes = integer(args[2]);
+        break;
+    case EXTGL_FN_TexImage1D:
+        if (!is_null(args[7]) || is_unpacking())
+            bytes = integer(args[3]) * 
+                    pixel_size(integer(args[5]), integer(args[6]));
+        break;
+    case EXTGL_FN_TexImage2D:
+        if (!is_null(args[8]) || is_unpacking())
+            bytes = integer(args[3]) * integer(args[4]) * 
+                    pixel_size(integer(args[6]), integer(args[7]));
+        break;
+    case EXTGL_FN_TexImage3D:
+        if (!is_null(args[9]) || is_unpacking())
+            bytes = integer(args[3]) * integer(args[4]) * integer(args[5]) *
+                    pixel_size(integer(args[7]), integer(args[8]));
+        break;
+    case EXTGL_FN_TexSubImage1D:
+        bytes = integer(args[3]) * 
+                pixel_size(integer(args[4]), integer(args[5]));
+        break;
+    case EXTGL_FN_TexSubImage2D:
+        bytes = integer(args[4]) * integer(args[5]) * 
+                pixel_size(integer(args[6]), integer(args[7]));
+        break;
+    case EXTGL_FN_TexSubImage3D:
+        bytes = integer(args[5]) * integer(args[6]) * integer(args[7]) *
+                pixel_size(integer(args[8]), integer(args[9]));
+        break;
+    case EXTGL_FN_CompressedTexImage1D:
+    case EXTGL_FN_CompressedTexSubImage1D:
+        bytes = integer(args[5]);
+        break;
+    case EXTGL_FN_CompressedTexImage2D:
+        bytes = integer(args[6]);
+        break;
+    case EXTGL_FN_CompressedTexSubImage2D:
+    case EXTGL_FN_CompressedTexImage3D:
+        bytes = integer(args[7]);
+        break;
+    case EXTGL_FN_CompressedTexSubImage3D:
+        bytes = integer(args[9]);
+        break;
+    default:
+        if (_uniform_components[function] > 0) {
+            const char* name = extGL_function_names[function];
+            bool is_vector = name[strlen(name) - 1] == 'v';
+            int64_t count = is_vector ? integer(args[1]) : 1;
+            bytes = count * _uniform_components[function] * 4;
+        }
+        break;
+    }
+
+    _frame.upload_bytes += bytes;
+}
+
+GLintptr NullGL::execute(extGLfunction function, const extGLarg* args)
+{
+    switch (function) {
+    case EXTGL_FN_GenBuffers:
+    case EXTGL_FN_GenTextures:
+    case EXTGL_FN_GenVertexArrays:
+    case EXTGL_FN_GenFramebuffers:
+    case EXTGL_FN_GenRenderbuffers:
+    case EXTGL_FN_GenQueries:
+    case EXTGL_FN_GenSamplers:
+        {
+            GLuint* names = pointer<GLuint*>(args[1]);
+            for (int64_t i = 0; i < integer(args[0]); ++i) {
+                names[i] = _next_name++;
+            }
+        }
+        return 0;
+    case EXTGL_FN_CreateShader:
+        {
+            GLuint name = _next_name++;
+            ShaderObject shader = { GLenum(integer(args[0])), "" };
+            _shaders[name] = shader;
+            return name;
+        }
+    case EXTGL_FN_CreateProgram:
+        {
+            GLuint name = _next_name++;
+            _programs[name] = Program();
+            return name;
+        }
+    case EXTGL_FN_FenceSync:
+        return _next_name++;
+    case EXTGL_FN_ClientWaitSync:
+        return GL_ALREADY_SIGNALED;
+    case EXTGL_FN_CheckFramebufferStatus:
+        return GL_FRAMEBUFFER_COMPLETE;
+    case EXTGL_FN_UnmapBuffer:
+        return GL_TRUE;
+    case EXTGL_FN_GetString:
+        switch (integer(args[0])) {
+        case GL_VENDOR: return GLintptr("pixelnoir");
+        case GL_RENDERER: return GLintptr("NullGL");
+        case GL_VERSION: return GLintptr("3.3 NullGL");
+        case GL_SHADING_LANGUAGE_VERSION: return GLintptr("3.30");
+        }
+        return GLintptr("");
+
+    case EXTGL_FN_GetIntegerv:
+        *pointer<GLint*>(args[1]) = GLint(get_integer(integer(args[0])));
+        return 0;
+    case EXTGL_FN_GetInteger64v:
+        *pointer<GLint64*>(args[1]) = get_integer(integer(args[0]));
+        return 0;
+    case EXTGL_FN_GetFloatv:
+        *pointer<GLfloat*>(args[1]) = GLfloat(get_integer(integer(args[0])));
+        return 0;
+    case EXTGL_FN_GetBooleanv:
+        *pointer<GLboolean*>(args[1]) = get_integer(integer(args[0])) != 0;
+        return 0;
+    case EXTGL_FN_GetQueryObjectiv:
+    case EXTGL_FN_GetQueryObjectuiv:
+        *pointer<GLint*>(args[2]) = 
+            (integer(args[1]) == GL_QUERY_RESULT_AVAILABLE) ? GL_TRUE : 0;
+        return 0;
+    case EXTGL_FN_GetQueryObjecti64v:
+    case EXTGL_FN_GetQueryObjectui64v:
+        *pointer<GLint64*>(args[2]) = 
+            (integer(args[1]) == GL_QUERY_RESULT_AVAILABLE) ? GL_TRUE : 0;
+        return 0;
+
+    case EXTGL_FN_BindBuffer:
+        _bound_buffers[integer(args[0])] = integer(args[1]);
+
+        // The element buffer binding is part of the vertex array object
+        if (integer(args[0]) == GL_ELEMENT_ARRAY_BUFFER)
+            _element_buffers[_vertex_array] = integer(args[1]);
+        return 0;
+    case EXTGL_FN_BindVertexArray:
+        _vertex_array = integer(args[0]);
+        _bound_buffers[GL_ELEMENT_ARRAY_BUFFER] = 
+            _element_buffers[_vertex_array];
+        return 0;
+    case EXTGL_FN_BindBufferBase:
+    case EXTGL_FN_BindBufferRange:
+        _bound_buffers[integer(args[0])] = integer(args[2]);
+        return 0;
+    case EXTGL_FN_BufferData:
+    case EXTGL_FN_BufferStorage:
+        bound_buffer(integer(args[0])).resize(integer(args[1]));
+        return 0;
+    case EXTGL_FN_MapBuffer:
+        {
+            vector<byte>& data = bound_buffer(integer(args[0]));
+            data.resize(std::max(data.size(), size_t(1)));
+            return GLintptr(&data[0]);
+        }
+    case EXTGL_FN_MapBufferRange:
+        {
+            vector<byte>& data = bound_buffer(integer(args[0]));
+            size_t end = integer(args[1]) + integer(args[2]);
+            data.resize(std::max(data.size(), std::max(end, size_t(1))));
+            return GLintptr(&data[0] + integer(args[1]));
+        }
+    case EXTGL_FN_DeleteBuffers:
+        {
+            const GLuint* names = pointer<const GLuint*>(args[1]);
+            for (int64_t i = 0; i < integer(args[0]); ++i) {
+                _buffers.erase(names[i]);
+            }
+        }
+        return 0;
+
+    case EXTGL_FN_ShaderSource:
+        {
+            ShaderObject& shader = _shaders[integer(args[0])];
+            const GLchar* const* strings = 
+                pointer<const GLchar* const*>(args[2]);
+            const GLint* lengths = pointer<const GLint*>(args[3]);
+
+            shader.source.clear();
+            for (int64_t i = 0; i < integer(args[1]); ++i) {
+                if (lengths != NULL && lengths[i] >= 0)
+                    shader.source.append(strings[i], lengths[i]);
+                else
+                    shader.source.append(strings[i]);
+            }
+        }
+        return 0;
+    case EXTGL_FN_AttachShader:
+        _programs[integer(args[0])].shaders.push_back(integer(args[1]));
+        return 0;
+    case EXTGL_FN_LinkProgram:
+        link(_programs[integer(args[0])]);
+        return 0;
+    case EXTGL_FN_DeleteShader:
+        _shaders.erase(integer(args[0]));
+        return 0;
+    case EXTGL_FN_DeleteProgram:
+        _programs.erase(integer(args[0]));
+        return 0;
+    case EXTGL_FN_GetShaderiv:
+        {
+            GLint* params = pointer<GLint*>(args[2]);
+            switch (integer(args[1])) {
+            case GL_COMPILE_STATUS: *params = GL_TRUE; break;
+            case GL_SHADER_TYPE: 
+                *params = _shaders[integer(args[0])].type; 
+                break;
+            default: *params = 0;
+            }
+        }
+        return 0;
+    case EXTGL_FN_GetProgramiv:
+        get_program(_programs[integer(args[0])], integer(args[1]), 
+                    pointer<GLint*>(args[2]));
+        return 0;
+    case EXTGL_FN_GetActiveUniformName:
+        {
+            const Program& program = _programs[integer(args[0])];
+            size_t index = integer(args[1]);
+            copy_name(index < program.uniforms.size() ? 
+                          program.uniforms[index].name : "", 
+                      integer(args[2]), pointer<GLsizei*>(args[3]), 
+                      pointer<GLchar*>(args[4]));
+        }
+        return 0;
+    case EXTGL_FN_GetActiveUniformsiv:
+        {
+            const Program& program = _programs[integer(args[0])];
+            const GLuint* indices = pointer<const GLuint*>(args[2]);
+            GLint* params = pointer<GLint*>(args[4]);
+
+            for (int64_t i = 0; i < integer(args[1]); ++i) {
+                if (indices[i] < program.uniforms.size())
+                    get_uniform(program.uniforms[indices[i]], 
+                                integer(args[3]), params + i);
+            }
+        }
+        return 0;
+    case EXTGL_FN_GetUniformLocation:
+        {
+            const Program& program = _programs[integer(args[0])];
+            string name(pointer<const GLchar*>(args[1]));
+
+            for (size_t i = 0; i < program.uniforms.size(); ++i) {
+                if (program.uniforms[i].name == name && 
+                    program.uniforms[i].block < 0)
+                    return i;
+            }
+        }
+        return -1;
+    case EXTGL_FN_GetUniformBlockIndex:
+        {
+            const Program& program = _programs[integer(args[0])];
+            string name(pointer<const GLchar*>(args[1]));
+
+            for (size_t i = 0; i < program.blocks.size(); ++i) {
+                if (program.blocks[i].name == name)
+                    return i;
+            }
+        }
+        return GL_INVALID_INDEX;
+    case EXTGL_FN_GetActiveUniformBlockName:
+        {
+            const Program& program = _programs[integer(args[0])];
+            size_t index = integer(args[1]);
+            copy_name(index < program.blocks.size() ? 
+                          program.blocks[index].name : "", 
+                      integer(args[2]), pointer<GLsizei*>(args[3]), 
+                      pointer<GLchar*>(args[4]));
+        }
+        return 0;
+    case EXTGL_FN_GetActiveUniformBlockiv:
+        {
+            const Program& program = _programs[integer(args[0])];
+            size_t index = integer(args[1]);
+            if (index < program.blocks.size())
+                get_block(program.blocks[index], integer(args[2]), 
+                          pointer<GLint*>(args[3]));
+        }
+        return 0;
+    case EXTGL_FN_GetActiveAttrib:
+        {
+            const Program& program = _programs[integer(args[0])];
+            size_t index = integer(args[1]);
+            if (index >= program.attributes.size())
+                return 0;
+
+            *pointer<GLint*>(args[4]) = 1;
+            *pointer<GLenum*>(args[5]) = program.attributes[index].type;
+            copy_name(program.attributes[index].name, integer(args[2]), 
+                      pointer<GLsizei*>(args[3]), pointer<GLchar*>(args[6]));
+        }
+        return 0;
+    case EXTGL_FN_GetAttribLocation:
+        {
+            const Program& program = _programs[integer(args[0])];
+            string name(pointer<const GLchar*>(args[1]));
+
+            for (size_t i = 0; i < program.attributes.size(); ++i) {
+                if (program.attributes[i].name == name)
+                    return i;
+            }
+        }
+        return -1;
+
+    default:
+        return 0;
+    }
+}
+
+vector<byte>& NullGL::bound_buffer(GLenum target)
+{
+    return _buffers[_bound_buffers[target]];
+}
+
+bool NullGL::is_bound(GLenum target) const
+{
+    map<GLenum, GLuint>::const_iterator it = _bound_buffers.find(target);
+
+    return it != _bound_buffers.end() && it->second != 0;
+}
+
+bool NullGL::is_unpacking() const
+{
+    return is_bound(GL_PIXEL_UNPACK_BUFFER);
+}
+
+GLenum NullGL::offset_target(extGLfunction function, int arg)
+{
+    switch (function) {
+    case EXTGL_FN_VertexAttribPointer:
+        return (arg == 5) ? GL_ARRAY_BUFFER : 0;
+    case EXTGL_FN_VertexAttribIPointer:
+        return (arg == 4) ? GL_ARRAY_BUFFER : 0;
+    case EXTGL_FN_DrawElements:
+    case EXTGL_FN_DrawElementsInstanced:
+    case EXTGL_FN_MultiDrawElements:
+        return (arg == 3) ? GL_ELEMENT_ARRAY_BUFFER : 0;
+    case EXTGL_FN_DrawRangeElements:
+        return (arg == 5) ? GL_ELEMENT_ARRAY_BUFFER : 0;
+    default:
+        return 0;
+    }
+}
+
+GLint64 NullGL::get_integer(GLenum pname)
+{
+    switch (pname) {
+    case GL_MAJOR_VERSION: return 3;
+    case GL_MINOR_VERSION: return 3;
+    case GL_CONTEXT_PROFILE_MASK: return GL_CONTEXT_CORE_PROFILE_BIT;
+    case GL_MAX_TEXTURE_SIZE: return 16384;
+    case GL_MAX_3D_TEXTURE_SIZE: return 2048;
+    case GL_MAX_ARRAY_TEXTURE_LAYERS: return 2048;
+    case GL_MAX_RENDERBUFFER_SIZE: return 16384;
+    case GL_MAX_TEXTURE_BUFFER_SIZE: return 1 << 27;
+    case GL_MAX_TEXTURE_IMAGE_UNITS: return 16;
+    case GL_MAX_VERTEX_TEXTURE_IMAGE_UNITS: return 16;
+    case GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS: return 48;
+    case GL_MAX_VERTEX_ATTRIBS: return 16;
+    case GL_MAX_UNIFORM_BUFFER_BINDINGS: return 36;
+    case GL_MAX_UNIFORM_BLOCK_SIZE: return 65536;
+    case GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT: return 256;
+    case GL_MAX_COLOR_ATTACHMENTS: return 8;
+    case GL_MAX_DRAW_BUFFERS: return 8;
+    case GL_MAX_SAMPLES: return 8;
+    case GL_MAX_COLOR_TEXTURE_SAMPLES: return 8;
+    case GL_MAX_DEPTH_TEXTURE_SAMPLES: return 8;
+    case GL_MAX_INTEGER_SAMPLES: return 8;
+    }
+
+    return 0;
+}
+
+size_t NullGL::pixel_size(GLenum format, GLenum type)
+{
+    switch (type) {
+    case GL_UNSIGNED_SHORT_5_6_5:
+    case GL_UNSIGNED_SHORT_4_4_4_4:
+    case GL_UNSIGNED_SHORT_5_5_5_1:
+        return 2;
+    case GL_UNSIGNED_INT_8_8_8_8:
+    case GL_UNSIGNED_INT_8_8_8_8_REV:
+    case GL_UNSIGNED_INT_10_10_10_2:
+    case GL_UNSIGNED_INT_2_10_10_10_REV:
+    case GL_UNSIGNED_INT_24_8:
+    case GL_UNSIGNED_INT_10F_11F_11F_REV:
+    case GL_UNSIGNED_INT_5_9_9_9_REV:
+        return 4;
+    case GL_FLOAT_32_UNSIGNED_INT_24_8_REV:
+        return 8;
+    }
+
+    size_t components;
+
+    switch (format) {
+    case GL_RG:
+    case GL_RG_INTEGER:
+    case GL_DEPTH_STENCIL:
+        components = 2;
+        break;
+    case GL_RGB:
+    case GL_BGR:
+    case GL_RGB_INTEGER:
+    case GL_BGR_INTEGER:
+        components = 3;
+        break;
+    case GL_RGBA:
+    case GL_BGRA:
+    case GL_RGBA_INTEGER:
+    case GL_BGRA_INTEGER:
+        components = 4;
+        break;
+    default:
+        components = 1;
+    }
+
+    switch (type) {
+    case GL_SHORT:
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT:
+        return components * 2;
+    case GL_INT:
+    case GL_UNSIGNED_INT:
+    case GL_FLOAT:
+        return components * 4;
+    }
+
+    return components;
+}
+
+void NullGL::get_program(const Program& program, GLenum pname,
+                         GLint* params) const
+{
+    size_t length = 0;
+
+    switch (pname) {
+    case GL_LINK_STATUS:
+    case GL_VALIDATE_STATUS:
+        *params = GL_TRUE;
+        break;
+    case GL_ACTIVE_UNIFORMS:
+        *params = program.uniforms.size();
+        break;
+    case GL_ACTIVE_UNIFORM_BLOCKS:
+        *params = program.blocks.size();
+        break;
+    case GL_ACTIVE_ATTRIBUTES:
+        *params = program.attributes.size();
+        break;
+    case GL_ACTIVE_UNIFORM_MAX_LENGTH:
+        for (size_t i = 0; i < program.uniforms.size(); ++i) {
+            length = std::max(length, program.uniforms[i].name.size());
+        }
+        *params = length + 1;
+        break;
+    case GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH:
+        for (size_t i = 0; i < program.blocks.size(); ++i) {
+            length = std::max(length, program.blocks[i].name.size());
+        }
+        *params = length + 1;
+        break;
+    case GL_ACTIVE_ATTRIBUTE_MAX_LENGTH:
+        for (size_t i = 0; i < program.attributes.size(); ++i) {
+            length = std::max(length, program.attributes[i].name.size());
+        }
+        *params = length + 1;
+        break;
+    default:
+        *params = 0;
+    }
+}
+
+void NullGL::get_block(const Block& block, GLenum pname, 
+                       GLint* params) const
+{
+    switch (pname) {
+    case GL_UNIFORM_BLOCK_DATA_SIZE:
+        *params = block.size;
+        break;
+    case GL_UNIFORM_BLOCK_NAME_LENGTH:
+        *params = block.name.size() + 1;
+        break;
+    case GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS:
+        *params = block.uniforms.size();
+        break;
+    case GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES:
+        std::copy(block.uniforms.begin(), block.uniforms.end(), params);
+        break;
+    default:
+        *params = 0;
+    }
+}
+
+void NullGL::get_uniform(const Uniform& uniform, GLenum pname, 
+                         GLint* params) const
+{
+    switch (pname) {
+    case GL_UNIFORM_TYPE: *params = uniform.type; break;
+    case GL_UNIFORM_SIZE: *params = uniform.size; break;
+    case GL_UNIFORM_NAME_LENGTH: *params = uniform.name.size() + 1; break;
+    case GL_UNIFORM_BLOCK_INDEX: *params = uniform.block; break;
+    case GL_UNIFORM_OFFSET: *params = uniform.offset; break;
+    case GL_UNIFORM_ARRAY_STRIDE: *params = uniform.array_stride; break;
+    case GL_UNIFORM_MATRIX_STRIDE: *params = uniform.matrix_stride; break;
+    default: *params = 0;
+    }
+}
+
+void NullGL::link(Program& program)
+{
+    program.uniforms.clear();
+    program.blocks.clear();
+    program.attributes.clear();
+
+    for (size_t i = 0; i < program.shaders.size(); ++i) {
+        map<GLuint, ShaderObject>::const_iterator shader = 
+            _shaders.find(program.shaders[i]);
+
+        if (shader != _shaders.end())
+            reflect(shader->second, program);
+    }
+}
+
+void NullGL::reflect(const ShaderObject& shader, Program& program)
+{
+    vector<string> tokens;
+    map<string, GLint> defines;
+    tokenize(shader.source, tokens, defines);
+
+    // Array uniforms are named without "[0]", which is how the player 
+    // looks them up.
+    int depth = 0;
+    size_t i = 0;
+
+    while (i < tokens.size()) {
+        const string& token = tokens[i];
+
+        if (token == "{" || token == "(") {
+            ++depth;
+        } else if (token == "}" || token == ")") {
+            --depth;
+        }
+
+        if (depth != 0 || (token != "uniform" && token != "in")) {
+            ++i;
+            continue;
+        }
+
+        bool is_block = i + 2 < tokens.size() && tokens[i + 2] == "{";
+        vector<Declaration> declarations;
+
+        if (token == "in") {
+            if (shader.type != GL_VERTEX_SHADER || is_block) {
+                ++i;
+                continue;
+            }
+
+            i = parse_declarations(tokens, i + 1, defines, declarations);
+
+            for (size_t d = 0; d < declarations.size(); ++d) {
+                Attribute attribute = { declarations[d].name, 
+                                        find_type(declarations[d].type).type };
+                program.attributes.push_back(attribute);
+            }
+        } else if (!is_block) {
+            i = parse_declarations(tokens, i + 1, defines, declarations);
+
+            for (size_t d = 0; d < declarations.size(); ++d) {
+                bool exists = false;
+                for (size_t u = 0; u < program.uniforms.size(); ++u) {
+                    exists = exists || 
+                             program.uniforms[u].name == declarations[d].name;
+                }
+                if (exists)
+                    continue;
+
+                Uniform uniform = { declarations[d].name, 
+                                    find_type(declarations[d].type).type, 
+                                    declarations[d].size, -1, -1, -1, -1 };
+                program.uniforms.push_back(uniform);
+            }
+        } else {
+            Block block = { tokens[i + 1], 0, vector<GLint>() };
+            i += 3;
+
+            while (i < tokens.size() && tokens[i] != "}") {
+                i = parse_declarations(tokens, i, defines, declarations);
+            }
+
+            // Skips the instance name
+            while (i < tokens.size() && tokens[i] != ";") {
+                ++i;
+            }
+
+            bool exists = false;
+            for (size_t b = 0; b < program.blocks.size(); ++b) {
+                exists = exists || program.blocks[b].name == block.name;
+            }
+            if (exists)
+                continue;
+
+            // std140: vec3 and vec4 are aligned to 16 bytes, as are array 
+            // elements and matrix columns
+            size_t offset = 0;
+            GLint block_index = program.blocks.size();
+
+            for (size_t d = 0; d < declarations.size(); ++d) {
+                const GLSLType& type = find_type(declarations[d].type);
+
+                size_t size = type.components * 4;
+                size_t alignment = (type.components == 3) ? 16 : size;
+                GLint matrix_stride = 0;
+                GLint array_stride = 0;
+
+                if (type.columns > 1) {
+                    matrix_stride = 16;
+                    alignment = 16;
+                    size = type.columns * 16;
+                }
+
+                if (declarations[d].is_array) {
+                    alignment = 16;
+                    array_stride = round_up(size, 16);
+                    size = array_stride * declarations[d].size;
+                }
+
+                offset = round_up(offset, alignment);
+
+                Uniform uniform = { declarations[d].name, type.type, 
+                                    declarations[d].size, block_index, 
+                                    GLint(offset), array_stride, 
+                                    matrix_stride };
+                block.uniforms.push_back(program.uniforms.size());
+                program.uniforms.push_back(uniform);
+
+                offset += size;
+            }
+
+            block.size = round_up(offset, 16);
+            program.blocks.push_back(block);
+        }
+    }
+}
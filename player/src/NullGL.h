@@ -0,0 +1,190 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef NULLGL_H
+#define NULLGL_H
+
+#include "common.h"
+
+#include <iosfwd>
+
+/**
+ * A GL backend without a GPU, installed with init_opengl_backend(). Calls 
+ * are not executed but recorded into a compact command stream per frame,
+ * which can be written as text to compare the GL usage of two builds.
+ *
+ * Queries are answered as far as the player needs them: objects get 
+ * consecutive names, compiling and linking always succeeds, uniforms, 
+ * uniform blocks (laid out after std140) and vertex attributes are read 
+ * from the shader sources, and mapped buffers point to memory of the 
+ * buffer's size. Nothing is drawn and read backs leave memory unchanged.
+ */
+class NullGL : public ExtGLBackend, boost::noncopyable
+{
+    public:
+
+    /**
+     * Counts of one or more frames.
+     */
+    struct Statistics {
+        int64_t calls;
+        int64_t draw_calls;
+        int64_t upload_bytes; /**< Buffer, texture and uniform data */
+        int64_t stream_bytes; /**< Size of the recorded command stream */
+
+        /**
+         * Calls per function, indexed by extGLfunction.
+         */
+        vector<int64_t> function_calls;
+
+        Statistics();
+        void add(const Statistics& other);
+    };
+
+    NullGL();
+
+    virtual GLintptr call(extGLfunction function, 
+                          const extGLarg* args, int arg_count);
+
+    /**
+     * Ends the current frame. Its counts are added to total().
+     * @param trace If set, the calls of the frame are written to it as 
+     * text, one per line.
+     * @param name Heading of the frame in the trace.
+     */
+    void end_frame(std::ostream* trace, const string& name);
+
+    /**
+     * The last ended frame.
+     */
+    const Statistics& frame() const { return _last_frame; }
+
+    /**
+     * All frames ended so far.
+     */
+    const Statistics& total() const { return _total; }
+    int frame_count() const { return _frame_count; }
+
+    /**
+     * Clears total(), e.g. after loading.
+     */
+    void reset_statistics();
+
+    /**
+     * Prints the counts per frame and the most called functions.
+     */
+    void print_statistics() const;
+
+    private:
+
+    struct Uniform {
+        string name;
+        GLenum type;
+        GLint size; /**< Number of array elements */
+        GLint block; /**< -1 for uniforms outside of a block */
+        GLint offset;
+        GLint array_stride;
+        GLint matrix_stride;
+    };
+
+    struct Block {
+        string name;
+        GLint size;
+        vector<GLint> uniforms;
+    };
+
+    struct Attribute {
+        string name;
+        GLenum type;
+    };
+
+    struct ShaderObject {
+        GLenum type;
+        string source;
+    };
+
+    struct Program {
+        vector<GLuint> shaders;
+        vector<Uniform> uniforms;
+        vector<Block> blocks;
+        vector<Attribute> attributes;
+    };
+
+    vector<byte> _stream;
+
+    Statistics _frame;
+    Statistics _last_frame;
+    Statistics _total;
+    int _frame_count;
+
+    /**
+     * Per function: whether it draws, and the components written by 
+     * glUniform* functions (0 for all others).
+     */
+    vector<bool> _is_draw;
+    vector<int> _uniform_components;
+
+    GLuint _next_name;
+
+    map<GLuint, ShaderObject> _shaders;
+    map<GLuint, Program> _programs;
+    map<GLenum, GLuint> _bound_buffers;
+    map<GLuint, vector<byte> > _buffers;
+    GLuint _vertex_array;
+    map<GLuint, GLuint> _element_buffers; /**< Per vertex array object */
+
+    void record(extGLfunction function, const extGLarg* args, int arg_count);
+    void count_upload(extGLfunction function, const extGLarg* args);
+    GLintptr execute(extGLfunction function, const extGLarg* args);
+
+    vector<byte>& bound_buffer(GLenum target);
+
+    /**
+     * A buffer other than 0 is bound to target.
+     */
+    bool is_bound(GLenum target) const;
+
+    /**
+     * Texture data is read from a pixel buffer object.
+     */
+    bool is_unpacking() const;
+
+    /**
+     * The buffer that a pointer argument is an offset into while a buffer 
+     * is bound to it, 0 for pointers to client memory.
+     */
+    static GLenum offset_target(extGLfunction function, int arg);
+    void link(Program& program);
+
+    void get_program(const Program& program, GLenum pname, 
+                     GLint* params) const;
+    void get_block(const Block& block, GLenum pname, GLint* params) const;
+    void get_uniform(const Uniform& uniform, GLenum pname, 
+                     GLint* params) const;
+
+    static GLint64 get_integer(GLenum pname);
+    static size_t pixel_size(GLenum format, GLenum type);
+
+    static void reflect(const ShaderObject& shader, Program& program);
+    static void write_calls(std::ostream& out, const vector<byte>& stream);
+};
+
+#endif
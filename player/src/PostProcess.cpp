@@ -38,7 +38,7 @@ SimplePostProcess::SimplePostProcess(const Viewport& viewport) :
 
 void SimplePostProcess::apply(const Viewport& viewport, 
                               Texture& color_buffer,
-                              Camera& camera,
+                              float focus_depth,
                               Texture& particle_overlay)
 {
     glDisable(GL_DEPTH_TEST);
@@ -136,13 +136,11 @@ DepthOfFieldPostProcess::~DepthOfFieldPostProcess()
 
 void DepthOfFieldPostProcess::apply(const Viewport& viewport,
                                     Texture& rgbz_buffer,
-                                    Camera& camera,
+                                    float focus_depth,
                                     Texture& particle_overlay)
 {
     glDisable(GL_DEPTH_TEST);
 
-    float focus_depth = camera.calculate_focus_depth();
-
     vec4 d = config.dof_depth_range_100() * focus_depth / 100.0f;
     vec4 dof_world( 1/(d[0]-d[1]), -d[1]/(d[0]-d[1]), 
                    -1/(d[2]-d[3]),  d[2]/(d[2]-d[3]));
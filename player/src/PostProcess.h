@@ -36,7 +36,7 @@ class PostProcess
 
     virtual void apply(const Viewport& viewport, 
                        Texture& rgbz_buffer,
-                       Camera& camera,
+                       float focus_depth,
                        Texture& particle_overlay) = 0;
 
     virtual ~PostProcess() {};
@@ -50,7 +50,7 @@ class SimplePostProcess : public PostProcess
 
     virtual void apply(const Viewport& viewport,  
                        Texture& color_buffer,
-                       Camera& camera,
+                       float focus_depth,
                        Texture& particle_overlay);
     private: 
 
@@ -68,7 +68,7 @@ class DepthOfFieldPostProcess : public PostProcess
 
     virtual void apply(const Viewport& viewport, 
                        Texture& rgbz_buffer,
-                       Camera& camera,
+                       float focus_depth,
                        Texture& particle_overlay);
 
     private:
@@ -0,0 +1,502 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "Profiler.h"
+
+#include "RtrPlayerConfig.h"
+
+#include <deque>
+#include <fstream>
+#include <cstdio>
+
+//see DBLoader.h
+#undef ERROR
+#undef SYNCHRONIZE
+
+#include <kcthread.h>
+#include <kcutil.h>
+
+namespace kc = kyotocabinet;
+
+int64_t Profiler::_counters[Profiler::COUNTER_COUNT];
+
+namespace {
+
+/**
+ * Written by the render thread, read by all threads that record zones.
+ */
+kc::AtomicInt64 enabled_flag;
+
+const char* counter_names[Profiler::COUNTER_COUNT] = {
+    "draw calls", "state binds", "triangles", "UBO bytes", 
+    "nodes queried", "objects visible", "objects too small",
+    "meshlet triangles culled", "shadow casters rejected",
+    "animated nodes skipped"
+};
+
+struct Zone {
+    const char* name;
+    double start;
+    double end;
+};
+
+/**
+ * Zones of one thread. Only that thread writes, the render thread reads 
+ * everything from the read up to the written count. A slot is only 
+ * written again after it was read, zones that don't fit are dropped.
+ */
+struct ZoneRing {
+    static const int64_t SIZE = 1 << 14;
+
+    ZoneRing(int thread_id, const char* thread_name) : 
+        zones(SIZE), written(0), read(0), dropped(0),
+        thread_id(thread_id), thread_name(thread_name) {}
+
+    vector<Zone> zones;
+    kc::AtomicInt64 written;
+    kc::AtomicInt64 read;
+    kc::AtomicInt64 dropped;
+    int thread_id;
+    const char* thread_name;
+};
+
+struct TraceZone {
+    const char* name;
+    int thread_id;
+    double start;
+    double end;
+};
+
+struct TraceFrame {
+    double end;
+    vector<TraceZone> zones;
+    int64_t counters[Profiler::COUNTER_COUNT];
+};
+
+struct GPUZone {
+    const char* name;
+    GLuint begin;
+    GLuint end;
+};
+
+struct ZoneSummary {
+    ZoneSummary() : cpu(0.0), gpu(0.0) {}
+
+    double cpu;
+    double gpu;
+};
+
+const int GPU_THREAD_ID = 0;
+
+}
+
+struct Profiler::State {
+    State() : 
+        ring_key(), next_thread_id(GPU_THREAD_ID + 1), 
+        gpu_offset(0.0), first_gpu_zone(0),
+        summary_frames(0), summary_start(-1.0), dropped(0) {}
+
+    kc::TSDKey ring_key;
+    kc::Mutex ring_mutex;
+    vector<ZoneRing*> rings;
+    int next_thread_id;
+
+    std::deque<GPUZone> gpu_zones;
+    vector<GLuint> free_queries;
+    double gpu_offset; /**< CPU time of GPU timestamp 0 */
+    int first_gpu_zone; /**< Id of gpu_zones.front() */
+
+    vector<TraceZone> zones; /**< Collected, but not yet ended frame */
+    std::deque<TraceFrame> frames;
+
+    /**
+     * Zones in the order they were first seen.
+     */
+    vector<string> summary_names;
+    map<string, ZoneSummary> summary;
+    int64_t summary_counters[COUNTER_COUNT];
+    int summary_frames;
+    double summary_start;
+
+    int64_t dropped;
+};
+
+Profiler::State& Profiler::state()
+{
+    static State s;
+    return s;
+}
+
+double Profiler::now()
+{
+    return kc::time();
+}
+
+bool Profiler::enabled()
+{
+    return enabled_flag.get() != 0;
+}
+
+void Profiler::set_enabled(bool enabled)
+{
+    if (enabled == Profiler::enabled())
+        return;
+
+    State& s = state();
+
+    if (enabled) {
+        GLint64 timestamp;
+        glGetInteger64v(GL_TIMESTAMP, &timestamp);
+        s.gpu_offset = now() - timestamp * 1e-9;
+
+        s.frames.clear();
+        s.zones.clear();
+
+        //Zones recorded before are skipped
+        kc::ScopedMutex lock(&s.ring_mutex);
+        for (size_t i = 0; i < s.rings.size(); ++i) {
+            s.rings[i]->read.set(s.rings[i]->written.get());
+            s.rings[i]->dropped.set(0);
+        }
+
+        for (int i = 0; i < COUNTER_COUNT; ++i) {
+            _counters[i] = 0;
+            s.summary_counters[i] = 0;
+        }
+
+        s.summary.clear();
+        s.summary_names.clear();
+        s.summary_frames = 0;
+        s.summary_start = now();
+        s.dropped = 0;
+
+        enabled_flag.set(1);
+
+        cout << "Profiler ENABLED." << endl;
+    } else {
+        enabled_flag.set(0);
+
+        cout << "Profiler DISABLED." << endl;
+
+        write_trace(config.profiler_trace_file());
+    }
+}
+
+void Profiler::set_thread_name(const char* name)
+{
+    State& s = state();
+    ZoneRing* ring = (ZoneRing*)s.ring_key.get();
+
+    if (ring != NULL) {
+        ring->thread_name = name;
+        return;
+    }
+
+    kc::ScopedMutex lock(&s.ring_mutex);
+    ring = new ZoneRing(s.next_thread_id++, name);
+    s.rings.push_back(ring);
+    s.ring_key.set(ring);
+}
+
+void Profiler::record(const char* name, double start, double end)
+{
+    State& s = state();
+    ZoneRing* ring = (ZoneRing*)s.ring_key.get();
+
+    if (ring == NULL) {
+        set_thread_name("Thread");
+        ring = (ZoneRing*)s.ring_key.get();
+    }
+
+    //The ring is large enough for many frames. The slot is reserved 
+    //before it is written, so end_frame() never reads a slot that is
+    //being overwritten.
+    int64_t index = ring->written.get();
+
+    if (index - ring->read.get() >= ZoneRing::SIZE) {
+        ring->dropped.add(1);
+        return;
+    }
+
+    Zone& zone = ring->zones[index % ZoneRing::SIZE];
+    zone.name = name;
+    zone.start = start;
+    zone.end = end;
+    ring->written.add(1);
+}
+
+int Profiler::begin_gpu_zone(const char* name)
+{
+    State& s = state();
+
+    GPUZone zone;
+    zone.name = name;
+    zone.end = 0;
+
+    if (s.free_queries.empty()) {
+        glGenQueries(1, &zone.begin);
+    } else {
+        zone.begin = s.free_queries.back();
+        s.free_queries.pop_back();
+    }
+
+    glQueryCounter(zone.begin, GL_TIMESTAMP);
+    s.gpu_zones.push_back(zone);
+
+    return s.first_gpu_zone + int(s.gpu_zones.size()) - 1;
+}
+
+void Profiler::end_gpu_zone(int query)
+{
+    State& s = state();
+    GPUZone& zone = s.gpu_zones[query - s.first_gpu_zone];
+
+    if (s.free_queries.empty()) {
+        glGenQueries(1, &zone.end);
+    } else {
+        zone.end = s.free_queries.back();
+        s.free_queries.pop_back();
+    }
+
+    glQueryCounter(zone.end, GL_TIMESTAMP);
+}
+
+void Profiler::collect_gpu_zones()
+{
+    State& s = state();
+
+    //Results become available in order, so waiting stops at the first
+    //zone that is still open or pending
+    while (!s.gpu_zones.empty() && s.gpu_zones.front().end != 0) {
+        GPUZone& zone = s.gpu_zones.front();
+
+        GLint available = 0;
+        glGetQueryObjectiv(zone.end, GL_QUERY_RESULT_AVAILABLE, &available);
+
+        if (!available)
+            break;
+
+        GLuint64 begin, end;
+        glGetQueryObjectui64v(zone.begin, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(zone.end, GL_QUERY_RESULT, &end);
+
+        if (enabled()) {
+            TraceZone trace_zone;
+            trace_zone.name = zone.name;
+            trace_zone.thread_id = GPU_THREAD_ID;
+            trace_zone.start = s.gpu_offset + begin * 1e-9;
+            trace_zone.end = s.gpu_offset + end * 1e-9;
+            s.zones.push_back(trace_zone);
+        }
+
+        s.free_queries.push_back(zone.begin);
+        s.free_queries.push_back(zone.end);
+        s.gpu_zones.pop_front();
+        ++s.first_gpu_zone;
+    }
+}
+
+void Profiler::end_frame()
+{
+    collect_gpu_zones();
+
+    if (!enabled())
+        return;
+
+    State& s = state();
+
+    {
+        kc::ScopedMutex lock(&s.ring_mutex);
+
+        for (size_t i = 0; i < s.rings.size(); ++i) {
+            ZoneRing& ring = *s.rings[i];
+            int64_t written = ring.written.get();
+            int64_t read = ring.read.get();
+
+            for (; read < written; ++read) {
+                const Zone& zone = ring.zones[read % ZoneRing::SIZE];
+
+                TraceZone trace_zone;
+                trace_zone.name = zone.name;
+                trace_zone.thread_id = ring.thread_id;
+                trace_zone.start = zone.start;
+                trace_zone.end = zone.end;
+                s.zones.push_back(trace_zone);
+            }
+
+            //the slots can be reused from now on
+            ring.read.set(written);
+            s.dropped += ring.dropped.set(0);
+        }
+    }
+
+    for (size_t i = 0; i < s.zones.size(); ++i) {
+        const TraceZone& zone = s.zones[i];
+        
+        if (s.summary.count(zone.name) == 0) {
+            s.summary_names.push_back(zone.name);
+        }
+
+        ZoneSummary& summary = s.summary[zone.name];
+        double duration = zone.end - zone.start;
+
+        if (zone.thread_id == GPU_THREAD_ID) {
+            summary.gpu += duration;
+        } else {
+            summary.cpu += duration;
+        }
+    }
+
+    //Only the last frames are kept for the trace
+    size_t max_frames = std::max(config.profiler_trace_frames(), 1);
+
+    if (s.frames.size() >= max_frames) {
+        s.frames.pop_front();
+    }
+
+    s.frames.push_back(TraceFrame());
+    TraceFrame& frame = s.frames.back();
+    frame.end = now();
+    frame.zones.swap(s.zones);
+
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+        frame.counters[i] = _counters[i];
+        s.summary_counters[i] += _counters[i];
+        _counters[i] = 0;
+    }
+
+    ++s.summary_frames;
+
+    float interval = config.profiler_summary_interval();
+
+    if (interval > 0.0f && frame.end - s.summary_start >= interval) {
+        print_summary();
+    }
+}
+
+void Profiler::print_summary()
+{
+    State& s = state();
+
+    printf("Profile of %d frames, per frame:\n", s.summary_frames);
+    printf("  %-24s %10s %10s\n", "zone", "CPU ms", "GPU ms");
+
+    for (size_t i = 0; i < s.summary_names.size(); ++i) {
+        const ZoneSummary& summary = s.summary[s.summary_names[i]];
+
+        printf("  %-24s %10.3f %10.3f\n", s.summary_names[i].c_str(),
+               summary.cpu * 1000.0 / s.summary_frames,
+               summary.gpu * 1000.0 / s.summary_frames);
+    }
+
+    for (int i = 0; i < COUNTER_COUNT; ++i) {
+        printf("  %-24s %10.0f\n", counter_names[i], 
+               double(s.summary_counters[i]) / s.summary_frames);
+        s.summary_counters[i] = 0;
+    }
+
+    if (s.dropped > 0) {
+        printf("  %lld zones were dropped, end_frame() is called too "
+               "rarely.\n", (long long)s.dropped);
+        s.dropped = 0;
+    }
+
+    s.summary.clear();
+    s.summary_names.clear();
+    s.summary_frames = 0;
+    s.summary_start = now();
+}
+
+bool Profiler::write_trace(const string& filename)
+{
+    State& s = state();
+
+    std::ofstream out(filename.c_str());
+
+    if (!out) {
+        cerr << "Could not open file " << filename << " for writing." << endl;
+        return false;
+    }
+
+    if (s.frames.empty()) {
+        out << "{\"traceEvents\":[]}" << endl;
+        return out.good();
+    }
+
+    //Chrome traces use microseconds, starting with the first frame
+    double origin = s.frames.front().end;
+    
+    for (size_t i = 0; i < s.frames.front().zones.size(); ++i) {
+        origin = std::min(origin, s.frames.front().zones[i].start);
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << endl;
+
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" 
+        << GPU_THREAD_ID << ",\"args\":{\"name\":\"GPU\"}}";
+
+    {
+        kc::ScopedMutex lock(&s.ring_mutex);
+
+        for (size_t i = 0; i < s.rings.size(); ++i) {
+            out << "," << endl 
+                << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                << "\"tid\":" << s.rings[i]->thread_id 
+                << ",\"args\":{\"name\":\"" << s.rings[i]->thread_name 
+                << " " << s.rings[i]->thread_id << "\"}}";
+        }
+    }
+
+    char buffer[256];
+
+    for (size_t i = 0; i < s.frames.size(); ++i) {
+        const TraceFrame& frame = s.frames[i];
+
+        for (size_t j = 0; j < frame.zones.size(); ++j) {
+            const TraceZone& zone = frame.zones[j];
+
+            sprintf(buffer, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,"
+                    "\"tid\":%d,\"ts\":%.1f,\"dur\":%.1f}",
+                    zone.name, zone.thread_id, 
+                    (zone.start - origin) * 1e6, 
+                    (zone.end - zone.start) * 1e6);
+            out << buffer;
+        }
+
+        sprintf(buffer, ",\n{\"name\":\"counters\",\"ph\":\"C\",\"pid\":1,"
+                "\"ts\":%.1f,\"args\":{", (frame.end - origin) * 1e6);
+        out << buffer;
+
+        for (int c = 0; c < COUNTER_COUNT; ++c) {
+            out << (c > 0 ? "," : "") << "\"" << counter_names[c] << "\":" 
+                << frame.counters[c];
+        }
+
+        out << "}}";
+    }
+
+    out << endl << "]}" << endl;
+
+    cout << "Wrote profile of " << s.frames.size() << " frames to '" 
+         << filename << "'." << endl;
+
+    return out.good();
+}
@@ -0,0 +1,152 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "common.h"
+
+/**
+ * Collects timings of named zones on all threads, GPU timings of passes 
+ * and per-frame counters of the render thread.
+ *
+ * Zones are written to a ring per thread without locking and collected by
+ * end_frame() on the render thread. GPU zones are measured with timestamp
+ * queries, which are read a few frames later when their results are 
+ * available. While enabled, the last frames are kept for export as a 
+ * Chrome trace (chrome://tracing) and a summary is printed periodically.
+ */
+class Profiler
+{
+    public:
+
+    enum Counter {
+        DRAW_CALLS,
+        STATE_BINDS, /**< Programs, textures, vertex arrays, buffer ranges */
+        TRIANGLES,
+        UBO_BYTES, /**< Uploaded to uniform buffers */
+        NODES_QUERIED, /**< Culling, with octree_statistics only */
+        OBJECTS_VISIBLE, /**< Culling, with octree_statistics only */
+        OBJECTS_TOO_SMALL, /**< Culling, with octree_statistics only */
+        MESHLET_TRIANGLES_CULLED, /**< Of visible meshes */
+        SHADOW_CASTERS_REJECTED, /**< Summed over all shadow passes */
+        ANIMATED_NODES_SKIPPED, /**< Lazy animation, channels not evaluated */
+        COUNTER_COUNT
+    };
+
+    /**
+     * Starts or stops profiling. When stopped, the recorded frames are 
+     * written to the profiler_trace_file.
+     */
+    static void set_enabled(bool enabled);
+
+    /**
+     * Safe to call from any thread.
+     */
+    static bool enabled();
+
+    /**
+     * Adds to a counter of the current frame. Render thread only.
+     */
+    static void count(Counter counter, int64_t value = 1)
+    {
+        if (enabled())
+            _counters[counter] += value;
+    }
+
+    /**
+     * Names the calling thread in traces. name has to be a literal.
+     */
+    static void set_thread_name(const char* name);
+
+    /**
+     * Collects the zones and counters of the frame. Called by the render 
+     * thread once per frame.
+     */
+    static void end_frame();
+
+    /**
+     * Writes the recorded frames as Chrome trace.
+     */
+    static bool write_trace(const string& filename);
+
+    /**
+     * Seconds since an arbitrary point, safe to call from any thread.
+     */
+    static double now();
+
+    /**
+     * Used by ProfileZone.
+     */
+    static void record(const char* name, double start, double end);
+    static int begin_gpu_zone(const char* name);
+    static void end_gpu_zone(int query);
+
+    private:
+
+    struct State;
+
+    static State& state();
+
+    static void collect_gpu_zones();
+    static void print_summary();
+
+    static int64_t _counters[COUNTER_COUNT];
+};
+
+/**
+ * Measures the time until it goes out of scope. GPU zones additionally 
+ * measure the GPU time of the commands issued within, they may only be
+ * used on the render thread.
+ */
+class ProfileZone : boost::noncopyable
+{
+    const char* _name;
+    double _start;
+    int _gpu_query;
+
+    public:
+
+    /**
+     * @param name Name of the zone, has to be a literal.
+     */
+    ProfileZone(const char* name, bool gpu = false) :
+        _name(name), _start(-1.0), _gpu_query(-1)
+    {
+        if (Profiler::enabled()) {
+            _start = Profiler::now();
+
+            if (gpu)
+                _gpu_query = Profiler::begin_gpu_zone(name);
+        }
+    }
+
+    ~ProfileZone()
+    {
+        if (_gpu_query >= 0)
+            Profiler::end_gpu_zone(_gpu_query);
+
+        if (_start >= 0.0)
+            Profiler::record(_name, _start, Profiler::now());
+    }
+};
+
+#endif
@@ -33,17 +33,49 @@
 #include <glm/gtc/matrix_projection.hpp>
 
 #include <limits>
+#include <algorithm>
 
 #include "TextureArray.h"
 
 #include "GaussianBlur.h"
 
+#include "CullingBenchmark.h"
+#include "CullingTuner.h"
+#include "BufferTexture.h"
+#include "Profiler.h"
+
+//These have to match shared.glsl
+#define MAX_SHADOWMAP_COUNT 12
+
+#define POINT_LIGHT 0
+#define DIRECTIONAL_LIGHT 1
+#define SPOT_LIGHT 2
+#define SHADOWED_SPOT_LIGHT 3
+
+//Number of cull camera frusta along the animation used for estimating the
+//visible fraction of the scene at load time
+#define CULLING_TUNE_SAMPLES 16
+
+//Lazy animation is disabled if the swept bounds of geometries would take
+//more poses than this, there is one at each key and one between two keys
+#define LAZY_ANIMATION_MAX_SAMPLES 4096
+
+//A baked octree is kept if it costs at most this much more than the best
+//candidate, and online tuning only switches for this much of a gain
+#define CULLING_TUNE_TOLERANCE 1.1f
+
 Runtime::Runtime(const rtr_format::Scene& scene,
                  DBLoader* db_loader,
                  const Viewport& viewport) :
     _db_loader(db_loader), 
     _material_manager(), 
-    _octree(NULL), 
+    _culling(NULL), 
+    _use_bvh(false),
+    _octree_storage(LooseOctree::SPARSE_MAP),
+    _octree_depth(0),
+    _is_tuning(false),
+    _predicted_cost(0),
+    _tune_statistics(),
     _viewport(viewport),
     _shadowmap_count(0),
     _shadow_shader("shadow"),
@@ -51,7 +83,15 @@ Runtime::Runtime(const rtr_format::Scene& scene,
                  GL_RGBA, GL_RGBA16F, 
                  GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE),
     _dust_particles(config.dust_center(), config.dust_size(), 
-                    viewport.render_size())
+                    viewport.render_size()),
+    _drawn_frame(0),
+    _updated_frame(0),
+    _skinning(NULL),
+    _skin_shader(NULL),
+    _skin_palettes(NULL),
+    _update_pool(NULL),
+    _update_timer(0),
+    _meshlet_statistics()
 {
     _standard_program = _material_manager.add_shader_program("standard");
 
@@ -90,7 +130,9 @@ Runtime::Runtime(const rtr_format::Scene& scene,
         start_animation(scene.animation(i), config.animation_offset());
     }
 
-    setup_octree();
+    if (config.shader_warm_up()) {
+        _material_manager.warm_up();
+    }
 
     // Pick the first shader from the material manager.
     // Since all material-shaders have to support the shared and transform
@@ -100,6 +142,7 @@ Runtime::Runtime(const rtr_format::Scene& scene,
     Shader& some_shader = _material_manager.get_shader(0,0);
     _shared_UBO = new UniformBuffer(some_shader, "Shared");
     _transform_UBO = new UniformBuffer(some_shader, "Transform");
+    resolve_uniform_fields();
 
     //if we haven't imported any cameras, we must create a default one
     if (_cameras.empty()) {
@@ -110,6 +153,15 @@ Runtime::Runtime(const rtr_format::Scene& scene,
 
     create_observer_camera();
 
+    setup_lazy_animation();
+
+    //tuning samples the frusta of the cull camera
+    tune_culling(scene.has_spatial_index() ? 
+                 (int)scene.spatial_index().max_depth() : -1);
+
+    if (!setup_baked_octree(scene))
+        setup_octree();
+
     FBOFormat format;
     format.add_renderbuffer(GL_DEPTH_COMPONENT32, GL_DEPTH_ATTACHMENT);
     format.add_renderbuffer(GL_RGBA16F, GL_COLOR_ATTACHMENT0);
@@ -154,18 +206,53 @@ Runtime::Runtime(const rtr_format::Scene& scene,
     } else {
         _shadow_blur = NULL;
     }
+
+    vec3 cluster_grid = config.light_cluster_grid();
+    _light_clusters = new LightClusters(ivec3(cluster_grid), 
+                                        config.light_cluster_thread_count());
+
+    _light_textures.data = new BufferTexture(GL_RGBA32F);
+    _light_textures.ranges = new BufferTexture(GL_RG32UI);
+    _light_textures.indices = new BufferTexture(GL_R32UI);
+
+    if (config.gpu_skinning()) {
+        _skin_shader = new Shader("skin", "", true);
+
+        vector<string> varyings;
+        varyings.push_back("skinned_vertex");
+        varyings.push_back("skinned_normal");
+        varyings.push_back("skinned_tangent");
+        _skin_shader->set_feedback_varyings(varyings);
+        _skin_shader->compile();
+
+        _skin_palettes = new BufferTexture(GL_RGBA32F);
+    } else {
+        _skinning = new Skinning(config.skinning_thread_count());
+    }
+
+    if (config.pipelined_frames()) {
+        _update_pool = new WorkerPool(2);
+    }
     
     cout << "Shadowmap count: " << _shadowmap_count << endl;
 }
 
 Runtime::~Runtime()
 {
-    delete _octree;
+    delete _update_pool;
+    delete _culling;
     delete _shared_UBO;
     delete _transform_UBO;
     delete _fbo;
     delete _shadow_fbo;
     delete _line_shader;
+    delete _light_clusters;
+    delete _light_textures.data;
+    delete _light_textures.ranges;
+    delete _light_textures.indices;
+    delete _skinning;
+    delete _skin_shader;
+    delete _skin_palettes;
     
     if (_shadow_fbo != NULL) {
         delete _shadow_blur;
@@ -335,10 +422,19 @@ void Runtime::insert_light(const rtr_format::Light& light)
         assert(0);
     }
 
+    bool use_shadowmaps = light.use_shadowmaps();
+
+    if (use_shadowmaps && type == Light::SPOT && 
+        _shadowmap_count == MAX_SHADOWMAP_COUNT) {
+        cout << "Warning: Only " << MAX_SHADOWMAP_COUNT << " lights can "
+             << "use shadowmaps, light " << id << " does not." << endl;
+        use_shadowmaps = false;
+    }
+
     LightRef light_ref(new Light(id, 
                                  type, 
                                  intensity, 
-                                 light.use_shadowmaps(),
+                                 use_shadowmaps,
                                  multiplier, 
                                  _evaluator, 
                                  node));
@@ -434,9 +530,30 @@ void Runtime::insert_geometry(const rtr_format::Geometry& geometry)
         material_instance = _material_manager.get_instance(*material);
     }
 
-    GPUMeshRef mesh = get_mesh(mesh_id);
+    GPUMeshRef mesh;
+    SkinInstanceRef skin;
+
+    //A skinned geometry draws its own copy of the mesh, with the skinned
+    //vertices instead of the bind pose
+    if (geometry.has_skin()) {
+        shared_ptr<rtr_format::Mesh> mesh_buffer;
+        _db_loader->read(mesh_id, mesh_buffer);
+
+        if (mesh_buffer) {
+            skin = get_skin(geometry, *mesh_buffer);
+        }
+
+        if (skin) {
+            mesh = create_skinned_mesh(*mesh_buffer, *skin);
+        }
+    }
+
+    if (!mesh) {
+        mesh = get_mesh(mesh_id);
+    }
 
-    GeometryRef geo(new Geometry(id, mesh, node, material_instance, material_id));
+    GeometryRef geo(new Geometry(id, mesh, node, material_instance, material_id,
+                                 skin));
 
     //We have to be a little more careful about housekeeping our _geometries 
     //When overwriting an existing entry in _geometries, pointers in the Octree
@@ -472,20 +589,7 @@ GPUMeshRef Runtime::get_mesh(const string& mesh_id)
         primitive_type = GL_TRIANGLE_STRIP; break;
     }
 
-    //iterator over layer sources, if we haven't initialize a GPU layer source
-    //yet, add it to the cache.
-    for (int i = 0; i < mesh->layer_size(); ++i) {
-        const string& source_id = mesh->layer(i).source();
-        boost::shared_ptr<rtr_format::LayerSource> layer;
-        _db_loader->read(source_id, layer);
-
-        LayerSourceInitializer source(*layer);
-        
-        if (_sources.count(source_id) < 1) {
-            _sources[source_id] = 
-                GPULayerSourceRef(new GPULayerSource(source));
-        }
-    }
+    load_sources(*mesh);
 
     MeshInitializer initializer(*mesh);
 
@@ -495,383 +599,1170 @@ GPUMeshRef Runtime::get_mesh(const string& mesh_id)
     return gpu_mesh;
 }
 
-void Runtime::start_animation(const string& animation_id, float offset)
+void Runtime::load_sources(const rtr_format::Mesh& mesh)
 {
-    shared_ptr<rtr_format::Animation > anim;
-    _db_loader->read(animation_id, anim);
-    if (_animations_holder.count(anim->id()) > 0) {
-        cerr << "Animation with ID " << anim->id() << " already exists."
-             << "Your rtr file might be corrupt. Skipping animation." << endl;
-        return;
-    }
-    _animations_holder[anim->id()] = anim;
-    _evaluator.add_animation(*anim.get(), offset);
-}
-
-void Runtime::reload_materials() {
-    _material_manager.reload(_db_loader);
+    //iterator over layer sources, if we haven't initialize a GPU layer source
+    //yet, add it to the cache.
+    for (int i = 0; i < mesh.layer_size(); ++i) {
+        const string& source_id = mesh.layer(i).source();
 
-    clear_query(_octree_query);
-}
-                             
-void Runtime::update(const Timer& timer)
-{
-    _evaluator.update_absolute(timer.now());
+        if (_sources.count(source_id) > 0) 
+            continue;
 
-    for (size_t i = 0; i < _nodes.size(); ++i) {
-        _nodes[i]->update();
-    }
+        boost::shared_ptr<rtr_format::LayerSource> layer;
+        _db_loader->read(source_id, layer);
 
-    if (!_octree->update()) {
-        cout << "Octree is too small and will be resized." << endl;
-        setup_octree();
+        LayerSourceInitializer source(*layer);
+        
+        _sources[source_id] = GPULayerSourceRef(new GPULayerSource(source));
     }
-
-    _dust_particles.update(timer.diff(), _render_camera);
 }
 
-void Runtime::setup_octree()
+SkinInstanceRef Runtime::get_skin(const rtr_format::Geometry& geometry,
+                                  const rtr_format::Mesh& mesh)
 {
-    Sphere world_sphere;
+    static const char* layer_names[] = { "vertex", "normal", "tangent",
+                                         "joint_index", "joint_weight" };
+    const int layer_count = sizeof(layer_names) / sizeof(layer_names[0]);
 
-    //If we previously had an octree, we will use the previous world size as
-    //a starting point. Therefore, if animated objects move outside the existing
-    //octree, the new octree will also accomodate the size of the previous octree
-    if (_octree != NULL) {
-        world_sphere = Sphere(_octree->world_size()*0.5f, _octree->center());
-    } else if (_geometries.size() > 0) {
-        world_sphere = _geometries.begin()->second->bounding_volume().sphere();
-    } else {
-        cout << "Error: No geometries to insert." << endl;
-        return;
+    map<string, string> source_ids;
+    for (int i = 0; i < mesh.layer_size(); ++i) {
+        source_ids[mesh.layer(i).name()] = mesh.layer(i).source();
     }
 
-    //from the current we get a good estimate for
-    //the world size.
-    map<string, GeometryRef>::const_iterator it_geo;
-    for (it_geo = _geometries.begin(); it_geo != _geometries.end(); ++it_geo)
-    {
-        world_sphere = Sphere::unite(world_sphere, 
-                                    it_geo->second->bounding_volume().sphere());
+    for (int i = 0; i < layer_count; ++i) {
+        if (source_ids.count(layer_names[i]) == 0) {
+            cout << "Warning: Skinned geometry '" << geometry.id() 
+                 << "' has no layer '" << layer_names[i] << "', it is "
+                 << "drawn in its bind pose." << endl;
+            return SkinInstanceRef();
+        }
     }
 
-    float world_size = world_sphere.radius() * 2;
-    vec3 world_center = world_sphere.center();
-
-    cout << "World size: " << world_size << endl;
-    cout << "World center: " << world_center << endl;
+    //The geometries of a skin controller share their node and vertices
+    const string& source_id = source_ids["vertex"];
+    string instance_id = geometry.transform_node() + "_" + source_id;
 
-    int octree_depth = config.octree_max_depth();
-    bool do_collect_statistics = config.octree_statistics();
-    bool do_debug_rendering = config.octree_debug();
+    if (_skin_instances.count(instance_id) > 0) {
+        return _skin_instances[instance_id];
+    }
 
-    LooseOctree::StorageType octree_storage_type;
-    if (config.octree_storage_type() == RtrPlayerConfig::FULL_ARRAY)
-        octree_storage_type = LooseOctree::FULL_ARRAY;
-    else if (config.octree_storage_type() == RtrPlayerConfig::SPARSE_MAP)
-        octree_storage_type = LooseOctree::SPARSE_MAP;
+    SkinSourceRef& source = _skin_sources[source_id];
 
-    if (_octree != NULL) {
-        delete _octree;
-        _octree = NULL;
-    }
+    if (!source) {
+        shared_ptr<rtr_format::LayerSource> layers[layer_count];
 
-    _octree = new LooseOctree(world_size, world_center,
-                              octree_depth, octree_storage_type,
-                              do_collect_statistics,
-                              do_debug_rendering);
-    
-    //finally, insert into the octree
-    for (it_geo = _geometries.begin(); it_geo != _geometries.end(); ++it_geo)
-    {
-        _octree->insert(it_geo->second.get());
-    }
-}
+        for (int i = 0; i < layer_count; ++i) {
+            _db_loader->read(source_ids[layer_names[i]], layers[i]);
 
-void Runtime::clear_query(LooseOctree::QueryResult& octree_query) 
-{
-    if ((int)octree_query.size() != _material_manager.material_count()) {
-        octree_query.resize(_material_manager.material_count());
-    }
+            if (!layers[i]) {
+                cout << "Could not load layer source " 
+                     << source_ids[layer_names[i]] << "." << endl;
+                return SkinInstanceRef();
+            }
+        }
 
-    for (size_t i = 0; i < octree_query.size(); ++i) {
-        octree_query[i].clear();
+        source = SkinSourceRef(new SkinSource(*layers[0], *layers[1], 
+                                              *layers[2], *layers[3], 
+                                              *layers[4], 
+                                              config.gpu_skinning()));
     }
-}
 
-void Runtime::draw_with_octree(const Frustum& frustum, int program)
-{
-    float aspect = _viewport.aspect();
+    const rtr_format::Skin& skin = geometry.skin();
 
-    clear_query(_octree_query);
+    if (source->bind_pose().vertex_count == 0 ||
+        source->joint_count() > skin.joint_node_size()) {
+        cout << "Warning: Skin of geometry '" << geometry.id() << "' doesn't"
+             << " match its mesh, it is drawn in its bind pose." << endl;
+        return SkinInstanceRef();
+    }
 
-    _octree->query(frustum, _octree_query);
+    vector<TransformNodeRef> joints;
 
-    TextureArray& shadowmaps = _shadow_fbo->get_texture_array(1);
-    shadowmaps.bind();
+    for (int i = 0; i < skin.joint_node_size(); ++i) {
+        map<string, TransformNodeRef>::const_iterator it = 
+            _node_map.find(skin.joint_node(i));
 
+        if (it == _node_map.end()) {
+            cout << "Warning: Joint '" << skin.joint_node(i) << "' of "
+                 << "geometry '" << geometry.id() << "' doesn't exist, it "
+                 << "is drawn in its bind pose." << endl;
+            return SkinInstanceRef();
+        }
 
-    for (size_t i = 0; i < _octree_query.size(); ++i) {
-        if (_octree_query[i].size() < 1)
-            continue;
+        joints.push_back(it->second);
+    }
 
-        Shader& shader = _material_manager.get_shader(program, i);
+    SkinInstanceRef instance(new SkinInstance(instance_id, skin, 
+                                              _node_map[geometry.transform_node()],
+                                              joints, source));
+    _skin_instances[instance_id] = instance;
 
-        shader.bind();
-        shader.set_uniform_block("Shared", *_shared_UBO);
-        shader.set_uniform("shadowmaps", shadowmaps);
+    return instance;
+}
 
-        list<const Geometry*>::const_iterator geo_it;
-        for (geo_it = _octree_query[i].begin(); 
-             geo_it != _octree_query[i].end(); ++geo_it) {
-            const Geometry* geo = *geo_it;
+GPUMeshRef Runtime::create_skinned_mesh(const rtr_format::Mesh& mesh,
+                                        const SkinInstance& skin)
+{
+    load_sources(mesh);
 
-            const MaterialInstanceRef& material = geo->material_instance();
+    GPULayerSourceMap sources;
 
-            material->bind(shader);
+    for (int i = 0; i < mesh.layer_size(); ++i) {
+        const string& name = mesh.layer(i).name();
+        const string& source_id = mesh.layer(i).source();
 
-            setup_transform_uniforms(*_transform_UBO,
-                                     geo->get_local_to_world(),
-                                     _render_camera->get_world_to_local(),
-                                     _render_camera->get_projection_matrix(aspect));
-            shader.set_uniform_block("Transform", *_transform_UBO);
+        if (name == "vertex") {
+            sources[source_id] = skin.positions();
+        } else if (name == "normal") {
+            sources[source_id] = skin.normals();
+        } else if (name == "tangent") {
+            sources[source_id] = skin.tangents();
+        } else {
+            sources[source_id] = _sources[source_id];
+        }
+    }
 
-            geo->draw(shader);
+    MeshInitializer initializer(mesh);
 
-            material->unbind();
-        }
+    return GPUMeshRef(new GPUMesh(initializer, sources));
+}
 
-        shader.unbind();
+void Runtime::update_skins()
+{
+    map<string, SkinInstanceRef>::iterator it;
+    for (it = _skin_instances.begin(); it != _skin_instances.end(); ++it) {
+        it->second->update();
     }
+}
 
-    shadowmaps.unbind();
+void Runtime::setup_lazy_animation()
+{
+    float end_time = _evaluator.end_time();
 
-    //If enabled we draw bounding geometry
-    //Note that we rather re-iterate the block as we want to avoid
-    //to many shader-switches (which is the whole point of the query
-    //structure)
-    if (config.draw_bounding_geometry()) {
+    //Without culling every geometry is drawn, so everything is relevant
+    if (!config.lazy_animation() || !config.enable_octree_culling() ||
+        end_time <= 0)
+        return;
 
-        _line_shader->bind();
-        _line_shader->set_uniform("color", vec4(0, 0, 1, 1)); 
+    int node_count = (int)_nodes.size();
 
-        for (size_t i = 0; i < _octree_query.size(); ++i) {
-            
-            if (_octree_query[i].size() < 1)
-                continue;
+    map<const TransformNode*, int> node_index;
+    for (int i = 0; i < node_count; ++i) {
+        node_index[_nodes[i].get()] = i;
+    }
 
-            list<const Geometry*>::const_iterator geo_it;
-            for (geo_it = _octree_query[i].begin(); 
-                 geo_it != _octree_query[i].end(); ++geo_it) {
-            
-                const Sphere& bounding_sphere = (*geo_it)->bounding_volume().sphere();                
+    //Nodes moving a camera, its target or a light are eager, everything 
+    //else only moves the geometries collected here
+    vector<char> eager(node_count, 0);
+    vector<vector<int> > node_geometries(node_count);
+    vector<const Geometry*> geometries;
 
-                float aspect = _viewport.aspect();
-                const mat4& view_matrix = _render_camera->get_world_to_local();
-                mat4 projection_matrix = _render_camera->get_projection_matrix(aspect);
+    for (map<string, CameraRef>::const_iterator i = _cameras.begin();
+         i != _cameras.end(); ++i) {
+        eager[node_index[i->second->transform_node().get()]] = 1;
 
-                float scale_factor = bounding_sphere.radius() / glm::sqrt(3.0f);
-                mat4 model = 
-                    glm::translate(bounding_sphere.center()) * 
-                    glm::scale(vec3(scale_factor, scale_factor, scale_factor));
+        if (i->second->target())
+            eager[node_index[i->second->target().get()]] = 1;
+    }
 
-                mat4 model_view_projection = projection_matrix * view_matrix * model;
+    for (map<string, LightRef>::const_iterator i = _lights.begin();
+         i != _lights.end(); ++i) {
+        eager[node_index[i->second->transform_node().get()]] = 1;
+    }
 
-                _line_shader->set_uniform("model_view_projection", model_view_projection);
+    collect_geometries(geometries);
 
-                _wired_cube->draw(*_line_shader);
+    for (size_t g = 0; g < geometries.size(); ++g) {
+        const Geometry* geo = geometries[g];
+        node_geometries[node_index[geo->transform_node().get()]].push_back(g);
 
+        //joints move the vertices of their skin
+        if (geo->skin()) {
+            const vector<TransformNodeRef>& joints = geo->skin()->joints();
+            for (size_t j = 0; j < joints.size(); ++j) {
+                node_geometries[node_index[joints[j].get()]].push_back(g);
             }
         }
-
-        _line_shader->unbind();
     }
-    
-    if (config.octree_debug()) {
-        draw_debug_info();
+
+    //A node moves everything its children move. Parents are inserted 
+    //before their children, so walking backwards visits children first.
+    for (int i = node_count - 1; i >= 0; --i) {
+        const TransformNode* parent = _nodes[i]->dependency();
+        if (parent == NULL)
+            continue;
+
+        int p = node_index[parent];
+        eager[p] = eager[p] || eager[i];
+        node_geometries[p].insert(node_geometries[p].end(),
+                                  node_geometries[i].begin(),
+                                  node_geometries[i].end());
     }
 
-    draw_cull_frustum();
+    //Listeners shared by several transform nodes are left ungrouped
+    vector<vector<string> > node_listeners(node_count);
+    map<string, int> listener_uses;
+    std::set<string> node_listener_set;
 
-}
+    for (int i = 0; i < node_count; ++i) {
+        _nodes[i]->listener_names(node_listeners[i]);
+        for (size_t l = 0; l < node_listeners[i].size(); ++l) {
+            ++listener_uses[node_listeners[i][l]];
+            node_listener_set.insert(node_listeners[i][l]);
+        }
+    }
 
-void Runtime::draw_debug_info()
-{
-    //If octree debugging is enabled, we will render the bounding boxes as well
-    //render debug info of octree
-    if (_octree->has_debug_info() && !config.use_depth_of_field()) {
+    std::set<string> animated;
+    _evaluator.animated_listeners(animated);
 
-        float aspect = _viewport.aspect();
+    //Animated nodes that only move geometries, with their listeners
+    vector<int> candidates;
 
-        const mat4& view_matrix = _render_camera->get_world_to_local();
-        mat4 projection_matrix = _render_camera->get_projection_matrix(aspect);
+    for (int i = 0; i < node_count; ++i) {
+        if (eager[i])
+            continue;
 
-        _line_shader->bind();
-        _line_shader->set_uniform("color", vec4(1, 0, 0, 1)); 
+        vector<string> grouped;
+        for (size_t l = 0; l < node_listeners[i].size(); ++l) {
+            const string& name = node_listeners[i][l];
+            if (animated.count(name) > 0 && listener_uses[name] == 1) {
+                grouped.push_back(name);
+            }
+        }
 
-        LooseOctree::DebugQueryResult::const_iterator it_entry;
-        for ( it_entry = _octree->debug_info().begin(); 
-              it_entry !=_octree->debug_info().end(); 
-              ++it_entry ) {
+        if (grouped.empty())
+            continue;
 
-            //translate to center
-            float scale_factor = glm::length(it_entry->half_diagonal()) / glm::sqrt(3.0f);
-            mat4 model = glm::translate(it_entry->center()) * glm::scale(vec3(scale_factor, scale_factor, scale_factor));
+        node_listeners[i].swap(grouped);
 
-            mat4 model_view_projection = projection_matrix * view_matrix * model;
+        vector<int>& dependents = node_geometries[i];
+        std::sort(dependents.begin(), dependents.end());
+        dependents.erase(std::unique(dependents.begin(), dependents.end()),
+                         dependents.end());
 
-            _line_shader->set_uniform("model_view_projection", model_view_projection);
+        candidates.push_back(i);
+    }
 
-            _wired_cube->draw(*_line_shader);
+    if (candidates.empty())
+        return;
 
-        }
+    //Between two consecutive keys of all transform channels and their 
+    //midpoints, every channel moves along a part of a single segment
+    vector<float> keys;
+    _evaluator.key_times(node_listener_set, keys);
+    keys.push_back(0);
+    keys.push_back(end_time);
 
-        _line_shader->unbind();
+    for (size_t k = 0; k < keys.size(); ++k) {
+        keys[k] = glm::clamp(keys[k], 0.0f, end_time);
     }
-}
 
-void Runtime::draw_cull_frustum() {
-    //We draw the cull frustum, if the render camera is not the cull camera
-    //(e.g. in observer mode)
-    if ( (_render_camera != _cull_camera) && !config.use_depth_of_field()) {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
 
-        glDisable(GL_DEPTH_TEST);
+    if ((int)keys.size() * 2 - 1 > LAZY_ANIMATION_MAX_SAMPLES) {
+        cout << "Lazy animation disabled, the animation has too many keys ("
+             << keys.size() << ")." << endl;
+        return;
+    }
+
+    vector<float> times;
+    for (size_t k = 0; k < keys.size(); ++k) {
+        if (k > 0) {
+            times.push_back((keys[k - 1] + keys[k]) * 0.5f);
+        }
+        times.push_back(keys[k]);
+    }
 
-        float aspect = _viewport.aspect();
+    //The swept bounds unite the bounds of each pose, padded by the largest
+    //step between poses for the motion in between. Geometries moving 
+    //further than their own radius between two poses may sweep past the
+    //padding, the nodes moving them stay eager.
+    _swept_spheres.resize(geometries.size());
+    _sphere_visible.resize(geometries.size());
+    vector<float> max_step(geometries.size(), 0);
+    vector<float> min_radius(geometries.size(), 
+                             std::numeric_limits<float>::max());
+    vector<vec3> last_center(geometries.size());
+
+    for (size_t i = 0; i < times.size(); ++i) {
+        _evaluator.update_absolute(times[i]);
+        for (size_t n = 0; n < _nodes.size(); ++n) {
+            _nodes[n]->update();
+        }
+        update_skins();
+
+        for (size_t g = 0; g < geometries.size(); ++g) {
+            const Sphere& sphere = geometries[g]->bounding_volume().sphere();
+
+            if (i == 0) {
+                _swept_spheres[g] = sphere;
+            } else {
+                _swept_spheres[g] = Sphere::unite(_swept_spheres[g], sphere);
+                max_step[g] = glm::max(max_step[g], 
+                                       glm::distance(sphere.center(), 
+                                                     last_center[g]));
+            }
 
-        const mat4& render_view_matrix = 
-            _render_camera->get_world_to_local();
+            last_center[g] = sphere.center();
+            min_radius[g] = glm::min(min_radius[g], sphere.radius());
+        }
+    }
 
-        mat4 render_projection_matrix = 
-            _render_camera->get_projection_matrix(aspect);
+    for (size_t g = 0; g < geometries.size(); ++g) {
+        _swept_spheres[g] = Sphere(_swept_spheres[g].radius() + max_step[g],
+                                   _swept_spheres[g].center());
+    }
 
-        mat4 cull_projection_matrix = 
-            _cull_camera->get_projection_matrix(aspect);
+    _evaluator.update_absolute(0);
+    for (size_t n = 0; n < _nodes.size(); ++n) {
+        _nodes[n]->update();
+    }
+    update_skins();
 
-        mat4 cull_projection_matrix_inv = 
-            glm::inverse(cull_projection_matrix);
+    int unreliable = 0;
 
-        mat4 model = 
-            _cull_camera->get_local_to_world() * cull_projection_matrix_inv;
+    for (size_t c = 0; c < candidates.size(); ++c) {
+        int i = candidates[c];
+        const vector<int>& dependents = node_geometries[i];
 
-        mat4 model_view_projection = 
-            render_projection_matrix * render_view_matrix * model;
+        bool reliable = true;
+        for (size_t g = 0; g < dependents.size() && reliable; ++g) {
+            reliable = max_step[dependents[g]] <= min_radius[dependents[g]];
+        }
 
-        _line_shader->bind();
-        _line_shader->set_uniform("color", vec4(0, 1, 0, 1));
+        //Its channels are evaluated every frame
+        if (!reliable) {
+            ++unreliable;
+            continue;
+        }
 
-        _line_shader->set_uniform("model_view_projection", model_view_projection);
+        int group = (int)_lazy_nodes.size();
+        for (size_t l = 0; l < node_listeners[i].size(); ++l) {
+            _evaluator.set_listener_group(node_listeners[i][l], group);
+        }
 
-        _wired_cube->draw(*_line_shader);
+        LazyNode lazy_node;
+        lazy_node.node = _nodes[i].get();
+        lazy_node.geometries = dependents;
+        _lazy_nodes.push_back(lazy_node);
+    }
 
-        _line_shader->unbind();
+    if (_lazy_nodes.empty()) {
+        _swept_spheres.clear();
+        _sphere_visible.clear();
+        return;
+    }
 
-        glEnable(GL_DEPTH_TEST);
+    //Nodes not moving cameras or lights are updated after the groups
+    for (int i = 0; i < node_count; ++i) {
+        if (eager[i]) {
+            _eager_nodes.push_back(_nodes[i]);
+        } else {
+            _late_nodes.push_back(_nodes[i]);
+        }
     }
+
+    cout << "Lazy animation: " << _lazy_nodes.size() << " of " 
+         << node_count << " transform nodes are only animated when their "
+         << "geometries could be visible, " << unreliable << " move them "
+         << "too fast between keys." << endl;
 }
 
-void Runtime::draw_directly(int program)
+int Runtime::update_lazy_animation()
 {
-    float aspect = _viewport.aspect();
-    
-    TextureArray& shadowmaps = _shadow_fbo->get_texture_array(1);
-
-    shadowmaps.bind();
+    for (size_t i = 0; i < _eager_nodes.size(); ++i) {
+        _eager_nodes[i]->update();
+    }
 
-    for(map<string, GeometryRef>::iterator i = _geometries.begin();
-        i != _geometries.end(); ++i) {
-        GeometryRef& geo = i->second;
-        const MaterialInstanceRef& material = geo->material_instance();
-        Shader& shader = 
-            _material_manager.get_shader(program, material->material_id());
+    //Cameras and lights are in place now. A geometry is relevant if its 
+    //swept bounds touch the cull frustum or a frustum it casts shadows in.
+    vector<Frustum> frusta;
+    frusta.push_back(_cull_camera->get_frustum(_viewport.aspect()));
 
-        shader.bind();
-        material->bind(shader);
-        shader.set_uniform_block("Shared", *_shared_UBO);
-        shader.set_uniform("shadowmaps", shadowmaps);
+    if (config.use_shadowmaps()) {
+        for (map<string, LightRef>::const_iterator i = _lights.begin();
+             i != _lights.end(); ++i) {
+            const Light& light = *i->second;
 
-        setup_transform_uniforms(*_transform_UBO,
-                                 geo->get_local_to_world(),
-                                 _render_camera->get_world_to_local(),
-                                 _render_camera->get_projection_matrix(aspect));
-        shader.set_uniform_block("Transform", *_transform_UBO);
+            if (!light.use_shadowmaps() || light.get_type() != Light::SPOT)
+                continue;
 
-        geo->draw(shader);
+            float far_plane;
+            mat4 projection = shadow_projection(light, far_plane);
+            frusta.push_back(Frustum(projection * light.get_world_to_local()));
+        }
+    }
 
-        material->unbind();
-        shader.unbind();
+    for (size_t g = 0; g < _swept_spheres.size(); ++g) {
+        _sphere_visible[g] = 0;
+        for (size_t f = 0; f < frusta.size(); ++f) {
+            if (intersect_sphere_frustum(_swept_spheres[g], frusta[f]) != 
+                OUTSIDE) {
+                _sphere_visible[g] = 1;
+                break;
+            }
+        }
     }
-    
-    shadowmaps.unbind();
-}
 
+    //Skipped groups keep their last values, they snap to the current 
+    //time once they are evaluated again
+    int skipped = 0;
 
-void Runtime::draw_shadow(mat4 shadow_transform, mat4 shadow_view)
-{
-    _shadow_shader.bind();
+    {
+        ProfileZone zone("lazy animation");
 
-    _shadow_shader.set_uniform("depth_bias", config.shadowmap_bias());
+        for (size_t i = 0; i < _lazy_nodes.size(); ++i) {
+            const vector<int>& geometries = _lazy_nodes[i].geometries;
 
-    for(map<string, GeometryRef>::iterator i = _geometries.begin();
-        i != _geometries.end(); ++i) {
-        GeometryRef& geo = i->second;
+            bool relevant = false;
+            for (size_t g = 0; g < geometries.size() && !relevant; ++g) {
+                relevant = _sphere_visible[geometries[g]] != 0;
+            }
 
-        mat4 model = geo->get_local_to_world();
+            if (relevant) {
+                _evaluator.update_group(i);
+            } else {
+                ++skipped;
+            }
+        }
+    }
 
-        _shadow_shader.set_uniform("model_view_projection", 
-                                   shadow_transform * model);
-        _shadow_shader.set_uniform("model_view", 
-                                   shadow_view * model);
-        geo->draw(_shadow_shader);
+    for (size_t i = 0; i < _late_nodes.size(); ++i) {
+        _late_nodes[i]->update();
     }
 
-    _shadow_shader.unbind();
+    return skipped;
 }
 
-void Runtime::draw_shadow_with_octree(const Frustum& frustum, 
-                                      mat4 shadow_transform,
-                                      mat4 shadow_view)
+void Runtime::start_animation(const string& animation_id, float offset)
 {
-    clear_query(_octree_query);
-
-    _octree->query(frustum, _octree_query);
-    
-    _shadow_shader.bind();
-
-    _shadow_shader.set_uniform("depth_bias", config.shadowmap_bias());
-    for (size_t i = 0; i < _octree_query.size(); ++i) {
-        list<const Geometry*>::const_iterator geo_it;
-        for (geo_it = _octree_query[i].begin(); 
-             geo_it != _octree_query[i].end(); ++geo_it) {
+    shared_ptr<rtr_format::Animation > anim;
+    _db_loader->read(animation_id, anim);
+    if (_animations_holder.count(anim->id()) > 0) {
+        cerr << "Animation with ID " << anim->id() << " already exists."
+             << "Your rtr file might be corrupt. Skipping animation." << endl;
+        return;
+    }
+    _animations_holder[anim->id()] = anim;
+    _evaluator.add_animation(*anim.get(), offset);
+}
+
+void Runtime::reload_materials() {
+    _material_manager.reload(_db_loader);
+
+    if (config.shader_warm_up()) {
+        _material_manager.warm_up();
+    }
+
+    clear_query(_octree_query);
+
+    //Material ids may have changed, the next frame must not be drawn with
+    //the old lists
+    Frame& frame = _frames[_drawn_frame];
+    collect_draw_items(_cull_camera->get_frustum(_viewport.aspect()),
+                       frame.draw_list, cull_contribution());
+}
+                             
+void Runtime::update(const Timer& timer)
+{
+    ProfileZone zone("update");
+
+    Frame& frame = _frames[_updated_frame];
+
+    {
+        ProfileZone zone("animation");
+        _evaluator.update_ungrouped(timer.now());
+    }
+
+    {
+        ProfileZone zone("transforms");
+
+        if (_lazy_nodes.empty()) {
+            for (size_t i = 0; i < _nodes.size(); ++i) {
+                _nodes[i]->update();
+            }
+
+            frame.animated_nodes_skipped = 0;
+        } else {
+            frame.animated_nodes_skipped = update_lazy_animation();
+        }
+
+        update_skins();
+    }
+
+    //both the octree and the hierarchy adapt to moving geometries by
+    //themselves, a rebuild is only the last resort
+    ProfileZone culling_zone("culling update");
+
+    if (!_culling->update()) {
+        cout << "Octree is too small and will be resized." << endl;
+        setup_octree();
+    }
+
+    if (_is_tuning && (int)_tune_frusta.size() >= config.octree_tune_frames())
+        refine_culling();
+
+    prepare_frame(frame, timer);
+}
+
+void Runtime::start_update(const Timer& timer)
+{
+    assert(_update_pool != NULL);
+
+    _update_timer = timer;
+    _updated_frame = 1 - _drawn_frame;
+    _update_pool->start(*this, 1);
+}
+
+void Runtime::finish_update()
+{
+    _update_pool->wait();
+    _drawn_frame = _updated_frame;
+}
+
+void Runtime::run_job(int job)
+{
+    update(_update_timer);
+}
+
+void Runtime::setup_octree()
+{
+    //The hierarchy adapts to the scene by itself, it doesn't need a world size
+    if (_use_bvh) {
+        delete _culling;
+        _culling = new BoundingVolumeHierarchy(config.bvh_rebuild_threshold(),
+                                               config.bvh_background_rebuild(),
+                                               config.octree_statistics() ||
+                                               _is_tuning,
+                                               config.octree_debug());
+
+        map<string, GeometryRef>::const_iterator it_geo;
+        for (it_geo = _geometries.begin(); it_geo != _geometries.end(); ++it_geo)
+        {
+            _culling->insert(it_geo->second.get());
+        }
+        return;
+    }
+
+    if (_geometries.empty()) {
+        cout << "Error: No geometries to insert." << endl;
+        return;
+    }
+
+    //from the current we get a good estimate for
+    //the world size.
+    Sphere world_sphere = geometry_bounds();
+
+    //If we previously had an octree, we will use the previous world size as
+    //a starting point. Therefore, if animated objects move outside the existing
+    //octree, the new octree will also accomodate the size of the previous octree
+    if (_culling != NULL) {
+        world_sphere = Sphere::unite(world_sphere, 
+                                     Sphere(_culling->world_size()*0.5f, 
+                                            _culling->center()));
+    }
+
+    float world_size = world_sphere.radius() * 2;
+    vec3 world_center = world_sphere.center();
+
+    cout << "World size: " << world_size << endl;
+    cout << "World center: " << world_center << endl;
+
+    LooseOctree* octree = create_octree(world_size, world_center);
+    delete _culling;
+    _culling = octree;
+    
+    //finally, insert into the octree
+    map<string, GeometryRef>::const_iterator it_geo;
+    for (it_geo = _geometries.begin(); it_geo != _geometries.end(); ++it_geo)
+    {
+        _culling->insert(it_geo->second.get());
+    }
+}
+
+bool Runtime::setup_baked_octree(const rtr_format::Scene& scene)
+{
+    if (!scene.has_spatial_index() || _use_bvh)
+        return false;
+
+    const rtr_format::SpatialIndex& index = scene.spatial_index();
+
+    if ((int)index.max_depth() != _octree_depth) {
+        cout << "Baked spatial index has depth " << index.max_depth() 
+             << " instead of " << _octree_depth << ". "
+             << "Building the octree at runtime." << endl;
+        return false;
+    }
+
+    //resolve the scene's geometries in scene order. Duplicates were skipped
+    //by insert_geometry and stay NULL in here.
+    vector<const Geometry*> scene_geometries(scene.geometry_size(), NULL);
+    std::set<string> resolved_ids;
+    for (int i = 0; i < scene.geometry_size(); ++i) {
+        const string& id = scene.geometry(i).id();
+        map<string, GeometryRef>::const_iterator it = _geometries.find(id);
+        if (it != _geometries.end() && resolved_ids.insert(id).second)
+            scene_geometries[i] = it->second.get();
+    }
+
+    vector<const Geometry*> cell_geometries;
+    cell_geometries.reserve(index.geometry_index_size());
+    vector<bool> is_placed(scene_geometries.size(), false);
+
+    for (int i = 0; i < index.geometry_index_size(); ++i) {
+        unsigned int geo_idx = index.geometry_index(i);
+        if (geo_idx >= scene_geometries.size() || is_placed[geo_idx]) {
+            cout << "Baked spatial index is corrupt. "
+                 << "Building the octree at runtime." << endl;
+            return false;
+        }
+        is_placed[geo_idx] = true;
+        cell_geometries.push_back(scene_geometries[geo_idx]);
+    }
+
+    vec3 center(index.center().x(), index.center().y(), index.center().z());
+    LooseOctree* octree = create_octree(index.world_size(), center);
+    octree->reserve(scene_geometries.size());
+
+    //static geometries are placed with one node lookup per cell
+    vector<const Geometry*> cell;
+    for (int i = 0; i < index.cell_size(); ++i) {
+        const rtr_format::SpatialIndex_Cell& c = index.cell(i);
+
+        bool is_ok = ( c.first() <= cell_geometries.size() && 
+                       c.count() <= cell_geometries.size() - c.first() );
+
+        if (is_ok) {
+            cell.clear();
+            for (unsigned int j = c.first(); j < c.first() + c.count(); ++j) {
+                if (cell_geometries[j] != NULL)
+                    cell.push_back(cell_geometries[j]);
+            }
+
+            is_ok = cell.empty() || 
+                    octree->insert_cell(c.depth(), c.x(), c.y(), c.z(), 
+                                         &cell[0], cell.size());
+        }
+
+        if (!is_ok) {
+            cout << "Baked spatial index does not match the scene. "
+                 << "Building the octree at runtime." << endl;
+            delete octree;
+            return false;
+        }
+    }
+
+    //animated geometries (and everything else the bakery could not place)
+    //are inserted individually
+    int dynamic_count = 0;
+    for (size_t i = 0; i < scene_geometries.size(); ++i) {
+        if (!is_placed[i] && scene_geometries[i] != NULL) {
+            octree->insert(scene_geometries[i]);
+            ++dynamic_count;
+        }
+    }
+
+    cout << "World size: " << index.world_size() << endl;
+    cout << "World center: " << center << endl;
+    cout << "Octree loaded from baked index with " << cell_geometries.size()
+         << " static and " << dynamic_count << " dynamic geometries." << endl;
+
+    delete _culling;
+    _culling = octree;
+
+    return true;
+}
+
+LooseOctree* Runtime::create_octree(float world_size, 
+                                    const vec3& world_center) const
+{
+    bool do_collect_statistics = config.octree_statistics() || _is_tuning;
+    bool do_debug_rendering = config.octree_debug();
+
+    LooseOctree* octree = new LooseOctree(world_size, world_center,
+                                          _octree_depth, _octree_storage,
+                                          do_collect_statistics,
+                                          do_debug_rendering);
+
+    octree->set_purge_budget(config.octree_purge_budget() / 1000.0);
+
+    return octree;
+}
+
+void Runtime::tune_culling(int baked_depth)
+{
+    _use_bvh = (config.octree_storage_type() == RtrPlayerConfig::BVH);
+    _octree_storage = LooseOctree::SPARSE_MAP;
+    if (config.octree_storage_type() == RtrPlayerConfig::FULL_ARRAY)
+        _octree_storage = LooseOctree::FULL_ARRAY;
+    _octree_depth = config.octree_max_depth();
+
+    _is_tuning = config.octree_tune_frames() > 0 && 
+                 config.enable_octree_culling();
+
+    if (!config.octree_auto_tune() || _geometries.empty())
+        return;
+
+    vector<const Geometry*> geometries;
+    collect_geometries(geometries);
+
+    CullingTuner tuner(geometries, geometry_bounds(), 
+                       _material_manager.material_count());
+    tuner.print_histogram();
+
+    //nothing is built at load time, online tuning measures the candidates
+    const CullingTuner::Candidate* choice = 
+        &tuner.estimate(tuner.visible_fraction(sample_cull_frusta()));
+
+    //a baked index of about the same cost saves building the octree
+    const CullingTuner::Candidate* baked = 
+        tuner.find_octree(LooseOctree::SPARSE_MAP, baked_depth);
+
+    if ( baked != NULL && choice->max_depth != baked_depth &&
+         baked->cost <= choice->cost * CULLING_TUNE_TOLERANCE ) {
+        choice = baked;
+    }
+
+    _use_bvh = choice->is_bvh;
+    if (!_use_bvh) {
+        _octree_storage = choice->storage_type;
+        _octree_depth = choice->max_depth;
+    }
+    _predicted_cost = choice->cost;
+
+    cout << "Culling tuner: using ";
+    CullingTuner::print(cout, *choice);
+    cout << ", predicted cost " << _predicted_cost 
+         << " bounding box tests per query." << endl;
+}
+
+void Runtime::refine_culling()
+{
+    _is_tuning = false;
+
+    int frame_count = (int)_tune_frusta.size();
+    float measured_cost = CullingTuner::query_cost(_tune_statistics, 
+                                                   frame_count);
+
+    cout << "Culling tuner: predicted cost " << _predicted_cost 
+         << ", measured " << measured_cost << " bounding box tests per query "
+         << "over " << frame_count << " frames." << endl;
+
+    //the geometries are evaluated where they are now, the frusta are the 
+    //ones actually used
+    vector<const Geometry*> geometries;
+    collect_geometries(geometries);
+
+    CullingTuner tuner(geometries, geometry_bounds(), 
+                       _material_manager.material_count());
+    const CullingTuner::Candidate& best = tuner.tune(_tune_frusta);
+
+    const CullingTuner::Candidate* current = _use_bvh ? 
+        tuner.find_bvh() : tuner.find_octree(_octree_storage, _octree_depth);
+    float current_cost = (current != NULL) ? current->cost : measured_cost;
+
+    _tune_frusta.clear();
+    _tune_statistics = CullingStructure::Statistics();
+
+    if (best.cost * CULLING_TUNE_TOLERANCE > current_cost) {
+        //statistics were only collected for tuning
+        _culling->set_collect_statistics(config.octree_statistics());
+        return;
+    }
+
+    _use_bvh = best.is_bvh;
+    if (!_use_bvh) {
+        _octree_storage = best.storage_type;
+        _octree_depth = best.max_depth;
+    }
+    _predicted_cost = best.cost;
+
+    cout << "Culling tuner: switching to ";
+    CullingTuner::print(cout, best);
+    cout << ", predicted cost " << _predicted_cost 
+         << " bounding box tests per query." << endl;
+
+    setup_octree();
+    _culling->update();
+}
+
+vector<Frustum> Runtime::sample_cull_frusta()
+{
+    vector<Frustum> frusta;
+
+    float end_time = _evaluator.end_time();
+    int sample_count = (end_time > 0) ? CULLING_TUNE_SAMPLES : 1;
+
+    for (int i = 0; i < sample_count; ++i) {
+        _evaluator.update_absolute(end_time * i / 
+                                   glm::max(sample_count - 1, 1));
+        for (size_t n = 0; n < _nodes.size(); ++n) {
+            _nodes[n]->update();
+        }
+
+        frusta.push_back(_cull_camera->get_frustum(_viewport.aspect()));
+    }
+
+    //back to the start, geometries are inserted where they are now
+    _evaluator.update_absolute(0);
+    for (size_t n = 0; n < _nodes.size(); ++n) {
+        _nodes[n]->update();
+    }
+    update_skins();
+
+    return frusta;
+}
+
+void Runtime::collect_geometries(vector<const Geometry*>& geometries) const
+{
+    map<string, GeometryRef>::const_iterator it_geo;
+    for (it_geo = _geometries.begin(); it_geo != _geometries.end(); ++it_geo)
+    {
+        geometries.push_back(it_geo->second.get());
+    }
+}
+
+Sphere Runtime::geometry_bounds() const
+{
+    if (_geometries.empty())
+        return Sphere();
+
+    map<string, GeometryRef>::const_iterator it_geo = _geometries.begin();
+    Sphere bounds = it_geo->second->bounding_volume().sphere();
+
+    for (++it_geo; it_geo != _geometries.end(); ++it_geo)
+    {
+        bounds = Sphere::unite(bounds, 
+                               it_geo->second->bounding_volume().sphere());
+    }
+
+    return bounds;
+}
+
+void Runtime::benchmark_culling()
+{
+    CullingBenchmark benchmark(_material_manager.material_count());
+
+    vector<const Geometry*> geometries;
+    collect_geometries(geometries);
+
+    benchmark.run("scene", geometries);
+
+    if (!_geometries.empty())
+        benchmark.run_synthetic(*_geometries.begin()->second, 100000);
+}
+
+void Runtime::clear_query(CullingStructure::QueryResult& octree_query) 
+{
+    if ((int)octree_query.size() != _material_manager.material_count()) {
+        octree_query.resize(_material_manager.material_count());
+    }
+
+    for (size_t i = 0; i < octree_query.size(); ++i) {
+        octree_query[i].clear();
+    }
+}
+
+void Runtime::prepare_frame(Frame& frame, const Timer& timer)
+{
+    float aspect = _viewport.aspect();
+
+    frame.time_diff = timer.diff();
+
+    frame.view = _render_camera->get_world_to_local();
+    frame.projection = _render_camera->get_projection_matrix(aspect);
+    frame.camera_position = _render_camera->get_world_location();
+    frame.z_far = _render_camera->get_z_far();
+    frame.focus_depth = _render_camera->calculate_focus_depth();
+
+    mat4 cull_projection = _cull_camera->get_projection_matrix(aspect);
+
+    frame.show_cull_frustum = _render_camera != _cull_camera;
+    frame.cull_frustum_model = _cull_camera->get_local_to_world() * 
+                               glm::inverse(cull_projection);
+
+    {
+        ProfileZone zone("culling");
+
+        Frustum cull_frustum = _cull_camera->get_frustum(aspect);
+        collect_draw_items(cull_frustum, frame.draw_list, 
+                           cull_contribution());
+
+        frame.meshlet_counts.clear();
+        frame.meshlet_offsets.clear();
+        frame.meshlet_triangles_culled = 0;
+
+        if (config.meshlet_culling()) {
+            cull_meshlets(frame, 
+                          cull_projection * _cull_camera->get_world_to_local(),
+                          _cull_camera->get_world_location());
+        }
+
+        if (config.octree_statistics() && config.enable_octree_culling()) {
+            frame.culling_statistics = _culling->statistics();
+        }
+
+        if (_is_tuning) {
+            const CullingStructure::Statistics& s = _culling->statistics();
+            _tune_statistics.nodes_queried += s.nodes_queried;
+            _tune_statistics.objects_tested += s.objects_tested;
+            _tune_frusta.push_back(cull_frustum);
+        }
+    }
+
+    //Debug geometry is copied as well, the culling structure changes 
+    //while the frame is drawn
+    frame.bounding_spheres.clear();
+    if (config.draw_bounding_geometry() && config.enable_octree_culling()) {
+        for (size_t i = 0; i < frame.draw_list.size(); ++i) {
+            for (size_t j = 0; j < frame.draw_list[i].size(); ++j) {
+                const Geometry* geo = frame.draw_list[i][j].geometry;
+                frame.bounding_spheres.push_back(
+                                        geo->bounding_volume().sphere());
+            }
+        }
+    }
+
+    frame.debug_boxes.clear();
+    if (config.octree_debug() && config.enable_octree_culling() && 
+        _culling->has_debug_info()) {
+        CullingStructure::DebugQueryResult::const_iterator it_entry;
+        for ( it_entry = _culling->debug_info().begin(); 
+              it_entry !=_culling->debug_info().end(); 
+              ++it_entry ) {
+
+            //translate to center
+            float scale_factor = glm::length(it_entry->half_diagonal()) / glm::sqrt(3.0f);
+            mat4 model = glm::translate(it_entry->center()) * glm::scale(vec3(scale_factor, scale_factor, scale_factor));
+
+            frame.debug_boxes.push_back(model);
+        }
+    }
+
+    frame.shadow_passes.clear();
+    frame.shadow_casters_rejected = 0;
+    if (config.use_shadowmaps() && _shadowmap_count > 0) {
+        prepare_shadow_passes(frame, _cull_camera->get_frustum(aspect));
+    }
+
+    prepare_lights(frame);
+
+    if (!_skin_instances.empty()) {
+        ProfileZone zone("skinning");
+        prepare_skins(frame);
+    }
+}
+
+/**
+ * Returns false if the meshlet is outside of the frustum or all of its
+ * triangles face away from camera. Everything is in object space.
+ */
+static bool meshlet_visible(const Meshlet& meshlet, 
+                            const Frustum& frustum,
+                            const vec3& camera,
+                            bool use_cone)
+{
+    const Sphere& sphere = meshlet.bounding_sphere;
+
+    if (intersect_sphere_frustum(sphere, frustum) == OUTSIDE)
+        return false;
+
+    if (!use_cone || meshlet.cone_cutoff <= 0.0f)
+        return true;
+
+    //A triangle with normal n through p faces away if dot(p - camera, n) is
+    //positive. With the normals within angle a of the cone axis, and the
+    //axis at angle b to the direction towards the sphere center, this holds
+    //for the whole sphere if cos(a + b) * distance > radius.
+    vec3 to_center = sphere.center() - camera;
+    float distance = glm::length(to_center);
+
+    if (distance <= sphere.radius())
+        return true;
+
+    float cos_b = glm::dot(to_center, meshlet.cone_axis) / distance;
+    float sin_b = glm::sqrt(glm::max(1.0f - cos_b * cos_b, 0.0f));
+    float cos_a = meshlet.cone_cutoff;
+    float sin_a = glm::sqrt(glm::max(1.0f - cos_a * cos_a, 0.0f));
+
+    return (cos_a * cos_b - sin_a * sin_b) * distance <= sphere.radius();
+}
+
+void Runtime::cull_meshlets(Frame& frame, const mat4& cull_view_projection,
+                            const vec3& cull_position)
+{
+    for (size_t i = 0; i < frame.draw_list.size(); ++i) {
+        vector<DrawItem>& items = frame.draw_list[i];
+        size_t kept = 0;
+
+        for (size_t j = 0; j < items.size(); ++j) {
+            DrawItem& item = items[j];
+            const vector<Meshlet>& meshlets = 
+                                        item.geometry->mesh()->meshlets();
+
+            if (!meshlets.empty()) {
+                Frustum frustum(cull_view_projection * item.local_to_world);
+                vec3 camera = vec3(glm::inverse(item.local_to_world) * 
+                                   vec4(cull_position, 1));
+
+                //Mirroring transforms flip the winding of all triangles
+                bool use_cone = 
+                        glm::determinant(mat3(item.local_to_world)) > 0.0f;
+
+                item.first_range = frame.meshlet_counts.size();
+
+                int64_t triangles = 0;
+                int64_t culled = 0;
+                GLuint range_end = 0;
+
+                for (size_t k = 0; k < meshlets.size(); ++k) {
+                    const Meshlet& m = meshlets[k];
+                    triangles += m.index_count / 3;
+
+                    if (!meshlet_visible(m, frustum, camera, use_cone)) {
+                        culled += m.index_count / 3;
+                        continue;
+                    }
+
+                    //Consecutive visible meshlets are merged into one range
+                    if ((int)frame.meshlet_counts.size() > item.first_range &&
+                        range_end == m.first_index) {
+                        frame.meshlet_counts.back() += m.index_count;
+                    } else {
+                        frame.meshlet_counts.push_back(m.index_count);
+                        frame.meshlet_offsets.push_back((const GLvoid*)
+                                (m.first_index * sizeof(GLuint)));
+                    }
+
+                    range_end = m.first_index + m.index_count;
+                }
+
+                item.range_count = frame.meshlet_counts.size() - 
+                                   item.first_range;
+
+                frame.meshlet_triangles_culled += culled;
+                _meshlet_statistics.triangles += triangles;
+                _meshlet_statistics.triangles_culled += culled;
+
+                if (item.range_count == 0)
+                    continue;
+            }
+
+            items[kept++] = item;
+        }
+
+        items.resize(kept);
+    }
+}
+
+/**
+ * Returns false if the shadow a sphere casts from a point light cannot 
+ * reach into the frustum. Up to light_range, the shadow is bounded by the
+ * convex hull of the sphere and the sphere scaled away from the light until
+ * its tangent points to the light are at light_range. The hull is outside 
+ * the frustum if both spheres are outside of the same plane.
+ */
+static bool shadow_reaches_frustum(const Sphere& caster, 
+                                   const vec3& light_position,
+                                   float light_range,
+                                   const Frustum& frustum)
+{
+    vec3 to_caster = caster.center() - light_position;
+    float distance = glm::length(to_caster);
+
+    if (distance <= caster.radius() || distance >= light_range)
+        return true;
+
+    float tangent_distance = glm::sqrt(distance * distance - 
+                                       caster.radius() * caster.radius());
+    float scale = light_range / tangent_distance;
+
+    vec4 near_center(caster.center(), 1);
+    vec4 far_center(light_position + to_caster * scale, 1);
+    float far_radius = caster.radius() * scale;
+
+    for (int i = 0; i < 6; ++i) {
+        const vec4& plane = frustum.get_plane(i);
+
+        if (glm::dot(near_center, plane) > caster.radius() &&
+            glm::dot(far_center, plane) > far_radius)
+            return false;
+    }
+
+    return true;
+}
+
+CullingStructure::ContributionCulling Runtime::cull_contribution() const
+{
+    if (config.contribution_culling_size() <= 0)
+        return CullingStructure::ContributionCulling();
+
+    return CullingStructure::ContributionCulling(
+                        _cull_camera->get_world_location(),
+                        _cull_camera->get_projection_matrix(_viewport.aspect()),
+                        _viewport.render_size().y,
+                        config.contribution_culling_size());
+}
+
+void Runtime::collect_draw_items(const Frustum& frustum, DrawList& draw_list,
+                    const CullingStructure::ContributionCulling& contribution)
+{
+    //Keep the lists to reuse their memory
+    for (size_t i = 0; i < draw_list.size(); ++i) {
+        draw_list[i].clear();
+    }
+
+    DrawItem item;
+    item.first_range = -1;
+    item.range_count = 0;
 
-            mat4 model = (*geo_it)->get_local_to_world();
+    if (!config.enable_octree_culling()) {
+        for(map<string, GeometryRef>::iterator i = _geometries.begin();
+            i != _geometries.end(); ++i) {
+            const Geometry* geo = i->second.get();
+            size_t material = geo->material_id();
+
+            if (draw_list.size() <= material) {
+                draw_list.resize(material + 1);
+            }
 
-            _shadow_shader.set_uniform("model_view_projection", 
-                                       shadow_transform * model);
-            _shadow_shader.set_uniform("model_view", 
-                                       shadow_view * model);
-            (*geo_it)->draw(_shadow_shader);
+            item.geometry = geo;
+            item.local_to_world = geo->get_local_to_world();
+            draw_list[material].push_back(item);
         }
+
+        return;
     }
 
-    _shadow_shader.unbind();
-}
+    clear_query(_octree_query);
 
-void Runtime::prepare_shadowmaps()
-{
-    glEnable(GL_DEPTH_TEST);
-    
-    _shadowmap_matrices.resize(_shadowmap_count);
+    _culling->query(frustum, _octree_query, contribution);
 
-    _shadow_fbo->bind();
+    if (draw_list.size() < _octree_query.size()) {
+        draw_list.resize(_octree_query.size());
+    }
 
-    mat4 tex(0.5, 0.0, 0.0, 0.0,
-             0.0, 0.5, 0.0, 0.0,
-             0.0, 0.0, 1.0, 0.0,
-             0.5, 0.5, 0.0, 1.0);
+    for (size_t i = 0; i < _octree_query.size(); ++i) {
+        list<const Geometry*>::const_iterator geo_it;
+        for (geo_it = _octree_query[i].begin(); 
+             geo_it != _octree_query[i].end(); ++geo_it) {
+            item.geometry = *geo_it;
+            item.local_to_world = (*geo_it)->get_local_to_world();
+            draw_list[i].push_back(item);
+        }
+    }
+}
+
+void Runtime::prepare_shadow_passes(Frame& frame, const Frustum& cull_frustum)
+{
+    ProfileZone zone("shadow culling");
 
     //float sm_far = config.shadowmap_far();                       
 
+    DrawList draw_list;
+
     for (map<string, LightRef>::iterator i = _lights.begin();
          i != _lights.end(); ++i) {
         LightRef light = i->second;
@@ -880,51 +1771,230 @@ void Runtime::prepare_shadowmaps()
              (light->get_type() != Light::SPOT) )
             continue;
 
-        _shadow_fbo->set_array_index(1, light->shadowmap_id());
+        float far_att;
+        mat4 view = light->get_world_to_local();
+        mat4 projection = shadow_projection(*light, far_att);
 
-        glClearColor(std::numeric_limits<float>::quiet_NaN(),
-                     std::numeric_limits<float>::quiet_NaN(), 
-                     0, 
-                     0);
+        frame.shadow_passes.push_back(ShadowPass());
+        ShadowPass& pass = frame.shadow_passes.back();
 
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        pass.shadowmap_id = light->shadowmap_id();
+        pass.view = view;
+        pass.view_projection = projection * view;
+
+        //The shadow shader is the same for all materials
+        collect_draw_items(Frustum(pass.view_projection), draw_list);
+
+        vec3 light_position = light->world_position();
 
-        float angle_factor = config.shadowmap_spot_angle_factor();
-        float fov_angle = float(light->spot_attenuation().y);
+        for (size_t j = 0; j < draw_list.size(); ++j) {
+            if (!config.shadow_caster_culling()) {
+                pass.items.insert(pass.items.end(), 
+                                  draw_list[j].begin(), draw_list[j].end());
+                continue;
+            }
 
-        //Note: the bakery usually ensures that a spot lights that uses
-        //dynamic shadow maps, has to set near/far attenuation values 
-        //properly. Of course that does not mean it could not contain
-        //useless values anyway.
+            for (size_t k = 0; k < draw_list[j].size(); ++k) {
+                const DrawItem& item = draw_list[j][k];
 
-        vec4 att = light->attenuation();
+                if (!shadow_reaches_frustum(
+                                    item.geometry->bounding_volume().sphere(),
+                                    light_position, far_att, cull_frustum)) {
+                    ++frame.shadow_casters_rejected;
+                    continue;
+                }
 
-        float near_att = light->attenuation().x;
-        if (near_att <= 0) {
-            near_att = config.shadowmap_near();
+                pass.items.push_back(item);
+            }
         }
+    }
+}
+
+mat4 Runtime::shadow_projection(const Light& light, float& far_plane) const
+{
+    float angle_factor = config.shadowmap_spot_angle_factor();
+    float fov_angle = float(light.spot_attenuation().y);
+
+    //Note: the bakery usually ensures that a spot lights that uses
+    //dynamic shadow maps, has to set near/far attenuation values 
+    //properly. Of course that does not mean it could not contain
+    //useless values anyway.
+
+    float near_att = light.attenuation().x;
+    if (near_att <= 0) {
+        near_att = config.shadowmap_near();
+    }
+
+    far_plane = light.attenuation().w;
+    if (far_plane <= 0) {
+        far_plane = config.shadowmap_far();
+    }
+
+    return glm::perspective(angle_factor * fov_angle, 
+                            1.0f, near_att, far_plane);
+}
+
+void Runtime::draw_geometry(const Frame& frame, int program)
+{
+    TextureArray& shadowmaps = _shadow_fbo->get_texture_array(1);
+    shadowmaps.bind();
+    _light_textures.bind();
+
+    for (size_t i = 0; i < frame.draw_list.size(); ++i) {
+        if (frame.draw_list[i].empty())
+            continue;
+
+        Shader& shader = _material_manager.get_shader(program, i);
+
+        shader.bind();
+        shader.set_uniform_block("Shared", *_shared_UBO);
+        shader.set_uniform("shadowmaps", shadowmaps);
+        _light_textures.set_uniforms(shader);
+
+        for (size_t j = 0; j < frame.draw_list[i].size(); ++j) {
+            const DrawItem& item = frame.draw_list[i][j];
+
+            const MaterialInstanceRef& material = 
+                item.geometry->material_instance();
 
-        float far_att = light->attenuation().w;
-        if (far_att <= 0) {
-            far_att = config.shadowmap_far();
+            material->bind(shader);
+
+            setup_transform_uniforms(*_transform_UBO,
+                                     item.local_to_world,
+                                     frame.view,
+                                     frame.projection);
+            shader.set_uniform_block("Transform", *_transform_UBO);
+
+            if (item.first_range < 0) {
+                item.geometry->draw(shader);
+            } else {
+                item.geometry->mesh()->draw_ranges(shader,
+                                &frame.meshlet_counts[item.first_range],
+                                &frame.meshlet_offsets[item.first_range],
+                                item.range_count);
+            }
+
+            material->unbind();
         }
 
-        mat4 view = light->get_world_to_local();
-        mat4 projection = glm::perspective(angle_factor * fov_angle, 
-                                           1.0f, near_att, far_att);
+        shader.unbind();
+    }
 
-        mat4 vp = projection * view;
-        
-        Frustum frustum(projection * view);
+    _material_manager.unbind_textures();
+    _light_textures.unbind();
+    shadowmaps.unbind();
+}
 
-        if (config.enable_octree_culling()) {
-            draw_shadow_with_octree(frustum,  vp, view);
-        } else {
-            draw_shadow(vp, view);
+void Runtime::draw_bounding_geometry(const Frame& frame)
+{
+    //Note that we rather re-iterate the draw list as we want to avoid
+    //to many shader-switches (which is the whole point of the query
+    //structure)
+    _line_shader->bind();
+    _line_shader->set_uniform("color", vec4(0, 0, 1, 1)); 
+
+    mat4 view_projection = frame.projection * frame.view;
+
+    for (size_t i = 0; i < frame.bounding_spheres.size(); ++i) {
+        const Sphere& bounding_sphere = frame.bounding_spheres[i];
+
+        float scale_factor = bounding_sphere.radius() / glm::sqrt(3.0f);
+        mat4 model = 
+            glm::translate(bounding_sphere.center()) * 
+            glm::scale(vec3(scale_factor, scale_factor, scale_factor));
+
+        _line_shader->set_uniform("model_view_projection", 
+                                  view_projection * model);
+
+        _wired_cube->draw(*_line_shader);
+    }
+
+    _line_shader->unbind();
+}
+
+void Runtime::draw_debug_info(const Frame& frame)
+{
+    //If octree debugging is enabled, we will render the bounding boxes as well
+    //render debug info of octree
+    if (!config.use_depth_of_field()) {
+
+        _line_shader->bind();
+        _line_shader->set_uniform("color", vec4(1, 0, 0, 1)); 
+
+        mat4 view_projection = frame.projection * frame.view;
+
+        for (size_t i = 0; i < frame.debug_boxes.size(); ++i) {
+            _line_shader->set_uniform("model_view_projection", 
+                                      view_projection * frame.debug_boxes[i]);
+
+            _wired_cube->draw(*_line_shader);
         }
 
-        _shadowmap_matrices[light->shadowmap_id()] = tex * vp;
-        
+        _line_shader->unbind();
+    }
+}
+
+void Runtime::draw_cull_frustum(const Frame& frame) {
+    //We draw the cull frustum, if the render camera is not the cull camera
+    //(e.g. in observer mode)
+    if (frame.show_cull_frustum && !config.use_depth_of_field()) {
+
+        glDisable(GL_DEPTH_TEST);
+
+        mat4 model_view_projection = 
+            frame.projection * frame.view * frame.cull_frustum_model;
+
+        _line_shader->bind();
+        _line_shader->set_uniform("color", vec4(0, 1, 0, 1));
+
+        _line_shader->set_uniform("model_view_projection", model_view_projection);
+
+        _wired_cube->draw(*_line_shader);
+
+        _line_shader->unbind();
+
+        glEnable(GL_DEPTH_TEST);
+    }
+}
+
+void Runtime::draw_shadow(const ShadowPass& pass)
+{
+    _shadow_shader.bind();
+
+    _shadow_shader.set_uniform("depth_bias", config.shadowmap_bias());
+
+    for (size_t i = 0; i < pass.items.size(); ++i) {
+        const DrawItem& item = pass.items[i];
+
+        _shadow_shader.set_uniform("model_view_projection", 
+                                   pass.view_projection * item.local_to_world);
+        _shadow_shader.set_uniform("model_view", 
+                                   pass.view * item.local_to_world);
+        item.geometry->draw(_shadow_shader);
+    }
+
+    _shadow_shader.unbind();
+}
+
+void Runtime::draw_shadowmaps(const Frame& frame)
+{
+    glEnable(GL_DEPTH_TEST);
+    
+    _shadow_fbo->bind();
+
+    for (size_t i = 0; i < frame.shadow_passes.size(); ++i) {
+        const ShadowPass& pass = frame.shadow_passes[i];
+
+        _shadow_fbo->set_array_index(1, pass.shadowmap_id);
+
+        glClearColor(std::numeric_limits<float>::quiet_NaN(),
+                     std::numeric_limits<float>::quiet_NaN(), 
+                     0, 
+                     0);
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        draw_shadow(pass);
     }
 
     _shadow_fbo->unbind();
@@ -942,10 +2012,39 @@ void Runtime::prepare_shadowmaps()
 
 void Runtime::draw()
 {
-    float aspect = _viewport.aspect();
+    ProfileZone zone("draw");
 
-    if (config.use_shadowmaps() && _shadowmap_count > 0) {
-        prepare_shadowmaps();
+    const Frame& frame = _frames[_drawn_frame];
+
+    _material_manager.pack_textures();
+
+    if (config.octree_statistics() && config.enable_octree_culling()) {
+        const CullingStructure::Statistics& stats = frame.culling_statistics;
+        Profiler::count(Profiler::NODES_QUERIED, stats.nodes_queried);
+        Profiler::count(Profiler::OBJECTS_VISIBLE, stats.objects_visible);
+        Profiler::count(Profiler::OBJECTS_TOO_SMALL, 
+                        stats.objects_contribution_culled);
+    }
+
+    Profiler::count(Profiler::MESHLET_TRIANGLES_CULLED, 
+                    frame.meshlet_triangles_culled);
+    Profiler::count(Profiler::SHADOW_CASTERS_REJECTED, 
+                    frame.shadow_casters_rejected);
+    Profiler::count(Profiler::ANIMATED_NODES_SKIPPED, 
+                    frame.animated_nodes_skipped);
+
+    //The dust is simulated straight into a mapped buffer, which is only 
+    //possible on the thread owning the context
+    _dust_particles.update(frame.time_diff, frame.camera_position);
+
+    if (!frame.skins.empty()) {
+        ProfileZone zone("skinning", true);
+        draw_skins(frame);
+    }
+
+    if (!frame.shadow_passes.empty()) {
+        ProfileZone zone("shadowmaps", true);
+        draw_shadowmaps(frame);
     }
 
     if (config.draw_wireframe()) {
@@ -958,27 +2057,39 @@ void Runtime::draw()
     glClearColor(config.clear_color().r,
                  config.clear_color().g,
                  config.clear_color().b,
-                 _render_camera->get_z_far());
+                 frame.z_far);
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    setup_shared_uniforms();
-    _shared_UBO->bind();
-    _transform_UBO->bind();
+    {
+        ProfileZone zone("geometry", true);
 
-    Frustum cull_frustum = _cull_camera->get_frustum(aspect);
+        setup_shared_uniforms(frame);
+        _shared_UBO->bind();
+        _transform_UBO->bind();
 
-    if (config.enable_octree_culling()) {
-        draw_with_octree(cull_frustum, _standard_program);
-    } else {
-        draw_directly(_standard_program);
+        draw_geometry(frame, _standard_program);
+    
+        _transform_UBO->unbind();
+        _shared_UBO->unbind();
     }
+
+    if (config.enable_octree_culling()) {
+        //If enabled we draw bounding geometry
+        if (config.draw_bounding_geometry()) {
+            draw_bounding_geometry(frame);
+        }
     
-    _transform_UBO->unbind();
-    _shared_UBO->unbind();
+        if (config.octree_debug()) {
+            draw_debug_info(frame);
+        }
+
+        draw_cull_frustum(frame);
+    }
+
+    if (config.material_statistics())
+        _material_manager.report_statistics();
 
-    mat4 view =  _render_camera->get_world_to_local();
-    mat4 projection = _render_camera->get_projection_matrix(aspect);
-    mat4 vp = projection * view;
+    mat4 vp = frame.projection * frame.view;
 
     if (config.dust_debug()) {
         mat4 model = glm::translate(_dust_particles.center());
@@ -1007,111 +2118,274 @@ void Runtime::draw()
               ivec2(0,0), _viewport.render_size(),
               GL_NEAREST);
 
-    _dust_particles.render(_rgbz_buffer, *_shared_UBO, 
-                           _shadow_fbo->get_texture_array(1),
-                           vp);
+    {
+        ProfileZone zone("dust", true);
+        _dust_particles.render(_rgbz_buffer, *_shared_UBO, 
+                               _shadow_fbo->get_texture_array(1),
+                               _light_textures, vp);
+    }
 
     // Apply post-process effects
-    _post_process->apply(_viewport, _rgbz_buffer, *_render_camera, 
+    ProfileZone post_process_zone("post-process", true);
+    _post_process->apply(_viewport, _rgbz_buffer, frame.focus_depth, 
                          _dust_particles.get_particle_layer());
 
 }
 
-#define MAX_LIGHT_COUNT 12
+void Runtime::resolve_uniform_fields()
+{
+    SharedFields& s = _shared_fields;
+    s.ambient = _shared_UBO->field<vec3>("ambient");
+    s.shadow_matrices = _shared_UBO->field<vec4>("shadow_matrices");
+    s.shadowmap_min_variance = 
+                    _shared_UBO->field<GLfloat>("shadowmap_min_variance");
+    s.shadow_bleed_bias = _shared_UBO->field<GLfloat>("shadow_bleed_bias");
+    s.light_count = _shared_UBO->field<GLint>("light_count");
+    s.global_light_count = _shared_UBO->field<GLint>("global_light_count");
+    s.cluster_view_projection = 
+                    _shared_UBO->field<mat4>("cluster_view_projection");
+    s.cluster_grid = _shared_UBO->field<ivec3>("cluster_grid");
+    s.cluster_depth = _shared_UBO->field<vec2>("cluster_depth");
+    s.camera_world_position = 
+                    _shared_UBO->field<vec3>("camera_world_position");
+
+    TransformFields& t = _transform_fields;
+    t.model = _transform_UBO->field<mat4>("model");
+    t.model_view_projection = 
+                    _transform_UBO->field<mat4>("model_view_projection");
+    t.normal_matrix = _transform_UBO->field<mat3>("normal_matrix");
+}
 
-#define POINT_LIGHT 0
-#define DIRECTIONAL_LIGHT 1
-#define SPOT_LIGHT 2
-#define SHADOWED_SPOT_LIGHT 3
+void Runtime::append_light_data(Light& light, vector<vec4>& light_data)
+{
+    bool is_shadowed = light.get_type() == Light::SPOT && 
+                       light.use_shadowmaps() && config.use_shadowmaps();
+    int type = POINT_LIGHT;
+    float shadow_id = 0;
+
+    if (light.get_type() == Light::DIRECTIONAL) {
+        type = DIRECTIONAL_LIGHT;
+    } else if (is_shadowed) {
+        type = SHADOWED_SPOT_LIGHT;
+        shadow_id = light.shadowmap_id();
+    } else if (light.get_type() == Light::SPOT) {
+        type = SPOT_LIGHT;
+    }
+
+    vec2 spot_att(cosf(light.spot_attenuation().x * M_PI/180.0 * 0.5),
+                  cosf(light.spot_attenuation().y * M_PI/180.0 * 0.5));
+
+    //Layout as expected by light_texel() in eval_light.glsl
+    light_data.push_back(vec4(light.world_position(), type));
+    light_data.push_back(vec4(light.world_direction(), shadow_id));
+    light_data.push_back(vec4(light.calc_multiplied_intensity(), 0));
+    light_data.push_back(light.attenuation());
+    light_data.push_back(vec4(spot_att, 0, 0));
+}
 
-void Runtime::setup_shared_uniforms()
+void Runtime::prepare_lights(Frame& frame)
 {
-    int light_count = 0;
+    //Lights without a far attenuation reach everything, they are evaluated
+    //everywhere like directional lights. Only the others are clustered.
+    vector<LightRef> clustered_lights;
+    _clustered_lights.clear();
+    frame.light_data.clear();
+
     for (map<string, LightRef>::iterator i = _lights.begin();
          i != _lights.end(); ++i) {
-        LightRef light = i->second;
+        Light& light = *i->second;
+        vec4 attenuation = light.attenuation();
+
+        if (light.get_type() != Light::DIRECTIONAL && 
+            attenuation.w > attenuation.z) {
+            clustered_lights.push_back(i->second);
+            continue;
+        }
+
+        append_light_data(light, frame.light_data);
+    }
 
-        if (light_count + 1 == MAX_LIGHT_COUNT) {
-            cerr << "Too many light sources!!" << endl;
-            break;
+    frame.global_light_count = frame.light_data.size() / 5;
+
+    for (size_t i = 0; i < clustered_lights.size(); ++i) {
+        Light& light = *clustered_lights[i];
+
+        LightClusters::Light cluster_light;
+        cluster_light.position = light.world_position();
+        cluster_light.range = light.attenuation().w;
+        cluster_light.direction = light.world_direction();
+        cluster_light.cos_angle = -1.0f;
+
+        if (light.get_type() == Light::SPOT) {
+            float angle = std::max(light.spot_attenuation().x,
+                                   light.spot_attenuation().y);
+            cluster_light.cos_angle = cosf(angle * M_PI/180.0 * 0.5);
         }
 
-        if (light->get_type() == Light::POINT) {
-
-            _shared_UBO->set("light_positions", light_count, 
-                             light->world_position());
-            _shared_UBO->set("light_intensities", light_count,
-                             light->calc_multiplied_intensity());
-            _shared_UBO->set("light_attenuations", light_count,
-                             light->attenuation());
-            _shared_UBO->set("light_types", light_count, POINT_LIGHT);
-                        
-        } else if (light->get_type() == Light::DIRECTIONAL) {
-
-            _shared_UBO->set("light_directions", light_count, 
-                             light->world_direction());
-            _shared_UBO->set("light_intensities", light_count, 
-                             light->calc_multiplied_intensity());
-            _shared_UBO->set("light_types", light_count, DIRECTIONAL_LIGHT);
-                    
-        } else if (light->get_type() == Light::SPOT && 
-                   light->use_shadowmaps() &&
-                   config.use_shadowmaps() ) 
-        {
+        _clustered_lights.push_back(cluster_light);
+        append_light_data(light, frame.light_data);
+    }
+
+    frame.light_count = frame.light_data.size() / 5;
+
+    _light_clusters->assign(_clustered_lights, frame.view, frame.projection);
+
+    frame.light_ranges = _light_clusters->ranges();
+    frame.light_indices = _light_clusters->indices();
+
+    //Buffer textures must not be empty
+    if (frame.light_data.empty()) {
+        frame.light_data.push_back(vec4(0));
+    }
+
+    if (frame.light_indices.empty()) {
+        frame.light_indices.push_back(0);
+    }
 
-            vec2 spot_att(cosf(light->spot_attenuation().x * M_PI/180.0 * 0.5),
-                          cosf(light->spot_attenuation().y * M_PI/180.0 * 0.5));
-
-            int id = light->shadowmap_id();
-
-            _shared_UBO->set("light_positions", light_count, 
-                             light->world_position());
-            _shared_UBO->set("light_directions", light_count, 
-                             light->world_direction());
-            _shared_UBO->set("light_intensities", light_count, 
-                             light->calc_multiplied_intensity());
-            _shared_UBO->set("light_attenuations", light_count,
-                             light->attenuation());
-            _shared_UBO->set("light_spot_attenuations", light_count, spot_att);
-            _shared_UBO->set("light_shadow_ids", light_count, 
-                              id);
-            _shared_UBO->set("light_types", light_count, SHADOWED_SPOT_LIGHT);
-
-            //This is a workaround for Catalyst 11.1, where uploading mat4
-            //arrays had a bug. Therefeore, until this bug is fixed, we upload
-            //four vec4's instead of one mat4.
-            _shared_UBO->set("shadow_matrices", id*4, _shadowmap_matrices[id][0]);
-            _shared_UBO->set("shadow_matrices", id*4+1, _shadowmap_matrices[id][1]);
-            _shared_UBO->set("shadow_matrices", id*4+2, _shadowmap_matrices[id][2]);
-            _shared_UBO->set("shadow_matrices", id*4+3, _shadowmap_matrices[id][3]);
-
-        } else if (light->get_type() == Light::SPOT) {
-
-            vec2 spot_att(cosf(light->spot_attenuation().x * M_PI/180.0 * 0.5),
-                          cosf(light->spot_attenuation().y * M_PI/180.0 * 0.5));
-
-            _shared_UBO->set("light_positions", light_count, 
-                             light->world_position());
-            _shared_UBO->set("light_directions", light_count, 
-                             light->world_direction());
-            _shared_UBO->set("light_intensities", light_count, 
-                             light->calc_multiplied_intensity());
-            _shared_UBO->set("light_attenuations", light_count,
-                             light->attenuation());
-            _shared_UBO->set("light_spot_attenuations", light_count, spot_att);
-            _shared_UBO->set("light_types", light_count, SPOT_LIGHT);
+    const ivec3& grid = _light_clusters->grid();
+
+    frame.cluster_grid = grid;
+    frame.cluster_depth = vec2(_light_clusters->z_near(), 
+                               grid.z / std::log(_light_clusters->z_far() / 
+                                                 _light_clusters->z_near()));
+}
+
+void Runtime::prepare_skins(Frame& frame)
+{
+    frame.skins.clear();
+    frame.palettes.clear();
+    frame.palette_offsets.clear();
+
+    //Skins of geometries in any pass, each one once
+    for (size_t i = 0; i < frame.draw_list.size(); ++i) {
+        for (size_t j = 0; j < frame.draw_list[i].size(); ++j) {
+            SkinInstance* skin = frame.draw_list[i][j].geometry->skin().get();
+            if (skin != NULL && skin->needs_skinning())
+                frame.skins.push_back(skin);
         }
-        
-        ++light_count;  
     }
 
-    _shared_UBO->set("shadowmap_min_variance", config.shadowmap_min_variance());
-    _shared_UBO->set("shadow_bleed_bias", config.shadowmap_bleed_bias());
+    for (size_t i = 0; i < frame.shadow_passes.size(); ++i) {
+        const vector<DrawItem>& items = frame.shadow_passes[i].items;
+        for (size_t j = 0; j < items.size(); ++j) {
+            SkinInstance* skin = items[j].geometry->skin().get();
+            if (skin != NULL && skin->needs_skinning())
+                frame.skins.push_back(skin);
+        }
+    }
+
+    std::sort(frame.skins.begin(), frame.skins.end());
+    frame.skins.erase(std::unique(frame.skins.begin(), frame.skins.end()),
+                      frame.skins.end());
+
+    for (size_t i = 0; i < frame.skins.size(); ++i) {
+        const vector<mat4>& palette = frame.skins[i]->palette();
+
+        frame.palette_offsets.push_back(frame.palettes.size());
+        frame.palettes.insert(frame.palettes.end(), 
+                              palette.begin(), palette.end());
+
+        frame.skins[i]->set_skinned();
+    }
+
+    if (_skinning == NULL)
+        return;
+
+    frame.skinned.resize(frame.skins.size());
+
+    for (size_t i = 0; i < frame.skins.size(); ++i) {
+        _skinning->add(frame.skins[i]->source()->bind_pose(), 
+                       &frame.palettes[frame.palette_offsets[i]],
+                       frame.skinned[i]);
+    }
+
+    _skinning->run();
+}
+
+void Runtime::draw_skins(const Frame& frame)
+{
+    if (_skin_shader == NULL) {
+        for (size_t i = 0; i < frame.skins.size(); ++i) {
+            frame.skins[i]->upload(frame.skinned[i]);
+        }
+        return;
+    }
+
+    //All palettes are uploaded at once, every skin is one draw call
+    _skin_palettes->set_data(&frame.palettes[0], 
+                             frame.palettes.size() * sizeof(mat4));
+    _skin_palettes->bind();
+
+    _skin_shader->bind();
+    _skin_shader->set_uniform("palettes", *_skin_palettes);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+
+    for (size_t i = 0; i < frame.skins.size(); ++i) {
+        SkinInstance* skin = frame.skins[i];
+
+        _skin_shader->set_uniform("palette_offset", frame.palette_offsets[i]);
+
+        skin->bind_feedback();
+
+        glBeginTransformFeedback(GL_POINTS);
+        skin->source()->points()->draw(*_skin_shader);
+        glEndTransformFeedback();
+    }
+
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    for (GLuint i = 0; i < 3; ++i) {
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, i, 0);
+    }
+
+    _skin_shader->unbind();
+    _skin_palettes->unbind();
+}
+
+void Runtime::setup_shared_uniforms(const Frame& frame)
+{
+    _light_textures.data->set_data(&frame.light_data[0], 
+                                   frame.light_data.size() * sizeof(vec4));
+    _light_textures.ranges->set_data(&frame.light_ranges[0], 
+                     frame.light_ranges.size() * sizeof(uint32_t));
+    _light_textures.indices->set_data(&frame.light_indices[0],
+                     frame.light_indices.size() * sizeof(uint32_t));
+
+    mat4 tex(0.5, 0.0, 0.0, 0.0,
+             0.0, 0.5, 0.0, 0.0,
+             0.0, 0.0, 1.0, 0.0,
+             0.5, 0.5, 0.0, 1.0);
+
+    for (size_t i = 0; i < frame.shadow_passes.size(); ++i) {
+        const ShadowPass& pass = frame.shadow_passes[i];
+        mat4 shadow_matrix = tex * pass.view_projection;
+
+        //This is a workaround for Catalyst 11.1, where uploading mat4
+        //arrays had a bug. Therefeore, until this bug is fixed, we upload
+        //four vec4's instead of one mat4.
+        for (int j = 0; j < 4; ++j) {
+            _shared_UBO->set(_shared_fields.shadow_matrices, 
+                             pass.shadowmap_id*4+j, shadow_matrix[j]);
+        }
+    }
 
-    _shared_UBO->set("light_count", light_count);
-    _shared_UBO->set("ambient", vec3(0,0,0));
-    _shared_UBO->set("camera_world_position",
-                     _render_camera->get_world_location());
+    _shared_UBO->set(_shared_fields.light_count, frame.light_count);
+    _shared_UBO->set(_shared_fields.global_light_count, 
+                     frame.global_light_count);
+    _shared_UBO->set(_shared_fields.cluster_view_projection, 
+                     frame.projection * frame.view);
+    _shared_UBO->set(_shared_fields.cluster_grid, frame.cluster_grid);
+    _shared_UBO->set(_shared_fields.cluster_depth, frame.cluster_depth);
+
+    _shared_UBO->set(_shared_fields.shadowmap_min_variance, 
+                     config.shadowmap_min_variance());
+    _shared_UBO->set(_shared_fields.shadow_bleed_bias, 
+                     config.shadowmap_bleed_bias());
+
+    _shared_UBO->set(_shared_fields.ambient, vec3(0,0,0));
+    _shared_UBO->set(_shared_fields.camera_world_position,
+                     frame.camera_position);
     _shared_UBO->send_to_GPU();
 }
 
@@ -1133,8 +2407,9 @@ void Runtime::setup_transform_uniforms(UniformBuffer& transform,
     mat3 normal_matrix = mat3(glm::transpose(glm::inverse(model)));
     mat4 model_view_projection = projection * view * model;
 
-    transform.set("model", model);
-    transform.set("model_view_projection", model_view_projection);
-    transform.set("normal_matrix", normal_matrix);
+    transform.set(_transform_fields.model, model);
+    transform.set(_transform_fields.model_view_projection, 
+                  model_view_projection);
+    transform.set(_transform_fields.normal_matrix, normal_matrix);
     transform.send_to_GPU();
 }
@@ -33,16 +33,30 @@
 #include "Mesh.h"
 #include "UniformBuffer.h"
 #include "LooseOctree.h"
+#include "BoundingVolumeHierarchy.h"
 #include "ObjectIndex.h"
 #include "PostProcess.h"
 #include "DustParticles.h"
+#include "LightClusters.h"
+#include "WorkerPool.h"
+#include "Skinning.h"
+#include "SkinInstance.h"
 
 class DBLoader;
 class FBO;
 class Viewport;
 class GaussianBlur;
 
-class Runtime
+/**
+ * The scene and everything needed to draw it.
+ *
+ * update() advances the scene and copies what draw() needs into a frame:
+ * camera matrices, culled draw lists, shadow passes and lights. draw() 
+ * only reads that frame, so with pipelined frames the next frame can be 
+ * updated on another thread with start_update() while the current one is
+ * drawn.
+ */
+class Runtime : WorkerPool::Task
 {
     public:
 
@@ -57,6 +71,19 @@ class Runtime
     void update(const Timer& timer);
     void draw();
 
+    /**
+     * Runs update() for the next frame on a worker thread. Until 
+     * finish_update() returns, only draw() may be called and the scene 
+     * must not be changed. Requires the pipelined_frames setting.
+     */
+    void start_update(const Timer& timer);
+
+    /**
+     * Waits for start_update() to finish, the following draw() shows the
+     * updated frame.
+     */
+    void finish_update();
+
     void insert_node(const rtr_format::TransformNode& node);
     void insert_light(const rtr_format::Light& light);
     void insert_camera(const rtr_format::Camera& camera);
@@ -81,8 +108,28 @@ class Runtime
 
     void toggle_observer_camera();
 
+    /**
+     * Compares all culling structures on the current scene and on synthetic
+     * scenes built from its first geometry, see CullingBenchmark.
+     */
+    void benchmark_culling();
+
     DustParticles& get_particle_system() { return _dust_particles; }
 
+    /**
+     * Triangles of visible meshes with meshlets and how many of them were
+     * culled with their meshlets, summed over all updates.
+     */
+    struct MeshletStatistics {
+        int64_t triangles;
+        int64_t triangles_culled;
+    };
+
+    const MeshletStatistics& meshlet_statistics() const 
+    { 
+        return _meshlet_statistics; 
+    }
+
     private:
 
     FBO* _fbo;
@@ -101,6 +148,13 @@ class Runtime
     map<string, GPUMeshRef> _meshes;
     map<string, GPULayerSourceRef> _sources;
 
+    /**
+     * Skin instances by transform node and bind pose, shared by the 
+     * geometries of a skin controller.
+     */
+    map<string, SkinSourceRef> _skin_sources;
+    map<string, SkinInstanceRef> _skin_instances;
+
     //TODO: this should be removed, we should not hold rtr_format datastructures,
     //however, animation evaluation needs it atm
     map<string, shared_ptr<rtr_format::Animation> > _animations_holder;
@@ -113,8 +167,47 @@ class Runtime
     UniformBuffer* _shared_UBO;
     UniformBuffer* _transform_UBO;
 
-    LooseOctree* _octree;
-    LooseOctree::QueryResult _octree_query;
+    /**
+     * Members of the Shared and Transform blocks, resolved once.
+     */
+    struct SharedFields {
+        UniformBuffer::Field<vec3> ambient;
+        UniformBuffer::Field<vec4> shadow_matrices;
+        UniformBuffer::Field<GLfloat> shadowmap_min_variance;
+        UniformBuffer::Field<GLfloat> shadow_bleed_bias;
+        UniformBuffer::Field<GLint> light_count;
+        UniformBuffer::Field<GLint> global_light_count;
+        UniformBuffer::Field<mat4> cluster_view_projection;
+        UniformBuffer::Field<ivec3> cluster_grid;
+        UniformBuffer::Field<vec2> cluster_depth;
+        UniformBuffer::Field<vec3> camera_world_position;
+    } _shared_fields;
+
+    struct TransformFields {
+        UniformBuffer::Field<mat4> model;
+        UniformBuffer::Field<mat4> model_view_projection;
+        UniformBuffer::Field<mat3> normal_matrix;
+    } _transform_fields;
+
+    CullingStructure* _culling;
+    CullingStructure::QueryResult _octree_query;
+
+    /**
+     * The culling structure to build, taken from the config or chosen by 
+     * tune_culling().
+     */
+    bool _use_bvh;
+    LooseOctree::StorageType _octree_storage;
+    int _octree_depth;
+
+    /**
+     * While tuning online, the cull frusta of the first octree_tune_frames
+     * frames and the statistics of their queries are collected.
+     */
+    bool _is_tuning;
+    float _predicted_cost;
+    vector<Frustum> _tune_frusta;
+    CullingStructure::Statistics _tune_statistics;
 
     const Viewport& _viewport;
 
@@ -122,7 +215,6 @@ class Runtime
 
     int _shadowmap_count;
     FBO* _shadow_fbo;
-    vector<mat4> _shadowmap_matrices;
 
     Shader _shadow_shader;
     GaussianBlur* _shadow_blur;
@@ -131,26 +223,187 @@ class Runtime
 
     DustParticles _dust_particles;
 
+    /**
+     * Lights are passed to shaders in buffer textures: the global lights 
+     * first, followed by the clustered ones.
+     */
+    LightClusters* _light_clusters;
+    LightTextures _light_textures;
+    vector<LightClusters::Light> _clustered_lights;
+
+    /**
+     * Skins are either skinned on the CPU by _skinning, or on the GPU by 
+     * _skin_shader with the palettes of all skins in _skin_palettes.
+     */
+    Skinning* _skinning;
+    Shader* _skin_shader;
+    BufferTexture* _skin_palettes;
+
+    /**
+     * Lazy animation: eager nodes are updated first, they move cameras or 
+     * lights. The channels of each animated lazy node are a group of the 
+     * evaluator, evaluated only while one of the geometries it moves could
+     * be visible. Geometries are tested with their bounds over the whole 
+     * animation in _swept_spheres. Without lazy nodes all nodes are eager.
+     */
+    struct LazyNode {
+        const TransformNode* node;
+        vector<int> geometries; /**< Indices into _swept_spheres */
+    };
+
+    vector<TransformNodeRef> _eager_nodes;
+    vector<TransformNodeRef> _late_nodes;
+    vector<LazyNode> _lazy_nodes;
+    vector<Sphere> _swept_spheres;
+    vector<char> _sphere_visible;
+
+    struct DrawItem {
+        const Geometry* geometry;
+        mat4 local_to_world;
+
+        /**
+         * The visible meshlets as index ranges in the frame's meshlet_counts 
+         * and meshlet_offsets. first_range is -1 to draw the whole mesh.
+         */
+        int first_range;
+        int range_count;
+    };
+
+    /**
+     * Geometries to draw, grouped by material id.
+     */
+    typedef vector<vector<DrawItem> > DrawList;
+
+    struct ShadowPass {
+        int shadowmap_id;
+        mat4 view;
+        mat4 view_projection;
+        vector<DrawItem> items;
+    };
+
+    /**
+     * Everything draw() reads from the scene, written by update().
+     */
+    struct Frame {
+        float time_diff;
+
+        mat4 view;
+        mat4 projection;
+        vec3 camera_position;
+        float z_far;
+        float focus_depth;
+
+        /**
+         * Set if the cull camera differs from the render camera, then its
+         * frustum is drawn.
+         */
+        bool show_cull_frustum;
+        mat4 cull_frustum_model;
+
+        DrawList draw_list;
+        vector<ShadowPass> shadow_passes;
+
+        vector<Sphere> bounding_spheres;
+        vector<mat4> debug_boxes;
+
+        /**
+         * Of the camera query, with octree_statistics only.
+         */
+        CullingStructure::Statistics culling_statistics;
+
+        vector<GLsizei> meshlet_counts;
+        vector<const GLvoid*> meshlet_offsets;
+        int64_t meshlet_triangles_culled;
+
+        /**
+         * Geometries inside a light frustum, whose shadow would not fall 
+         * into the cull frustum, summed over all shadow passes.
+         */
+        int shadow_casters_rejected;
+
+        /**
+         * Lazy nodes whose channels were not evaluated.
+         */
+        int animated_nodes_skipped;
+
+        vector<vec4> light_data;
+        int global_light_count;
+        int light_count;
+        vector<uint32_t> light_ranges;
+        vector<uint32_t> light_indices;
+        ivec3 cluster_grid;
+        vec2 cluster_depth;
+
+        /**
+         * Skins of the geometries in any pass that changed since they were
+         * last skinned, with their palettes one after the other. Skinned 
+         * on the CPU, the vertices of each skin are in skinned.
+         */
+        vector<SkinInstance*> skins;
+        vector<mat4> palettes;
+        vector<int> palette_offsets;
+        vector<Skinning::Output> skinned;
+    };
+
+    Frame _frames[2];
+    int _drawn_frame;
+    int _updated_frame;
+
+    WorkerPool* _update_pool;
+    Timer _update_timer;
+
+    MeshletStatistics _meshlet_statistics;
+
     GPUMeshRef get_mesh(const string& mesh_id);
+    void load_sources(const rtr_format::Mesh& mesh);
+    SkinInstanceRef get_skin(const rtr_format::Geometry& geometry,
+                             const rtr_format::Mesh& mesh);
+    GPUMeshRef create_skinned_mesh(const rtr_format::Mesh& mesh,
+                                   const SkinInstance& skin);
+    void update_skins();
+    void setup_lazy_animation();
+    int update_lazy_animation();
     void create_observer_camera();
     void setup_octree();
-    void clear_query(LooseOctree::QueryResult& octree_query); 
-    void setup_shared_uniforms();
+    bool setup_baked_octree(const rtr_format::Scene& scene);
+    LooseOctree* create_octree(float world_size, 
+                               const vec3& world_center) const;
+    void tune_culling(int baked_depth);
+    void refine_culling();
+    vector<Frustum> sample_cull_frusta();
+    void collect_geometries(vector<const Geometry*>& geometries) const;
+    Sphere geometry_bounds() const;
+    void clear_query(CullingStructure::QueryResult& octree_query); 
+    void resolve_uniform_fields();
+
+    void run_job(int job);
+    void prepare_frame(Frame& frame, const Timer& timer);
+    void collect_draw_items(const Frustum& frustum, DrawList& draw_list,
+                            const CullingStructure::ContributionCulling& 
+                                contribution = 
+                                CullingStructure::ContributionCulling());
+    CullingStructure::ContributionCulling cull_contribution() const;
+    void cull_meshlets(Frame& frame, const mat4& cull_view_projection,
+                       const vec3& cull_position);
+    void prepare_shadow_passes(Frame& frame, const Frustum& cull_frustum);
+    mat4 shadow_projection(const Light& light, float& far_plane) const;
+    void prepare_lights(Frame& frame);
+    void prepare_skins(Frame& frame);
+    void append_light_data(Light& light, vector<vec4>& light_data);
+
+    void setup_shared_uniforms(const Frame& frame);
     void setup_transform_uniforms(UniformBuffer& transform,
                                   const mat4& model,
                                   const mat4& world,
                                   const mat4& projection);
-    void draw_with_octree(const Frustum& frustum, int program);
-    void draw_directly(int program);
-    void draw_debug_info();
-    void draw_cull_frustum();
+    void draw_geometry(const Frame& frame, int program);
+    void draw_bounding_geometry(const Frame& frame);
+    void draw_debug_info(const Frame& frame);
+    void draw_cull_frustum(const Frame& frame);
     
-    void draw_shadow(mat4 shadow_transform,
-                     mat4 shadow_view);
-    void draw_shadow_with_octree(const Frustum& frustum, 
-                                 mat4 shadow_transform,
-                                 mat4 shadow_view);
-    void prepare_shadowmaps();
+    void draw_skins(const Frame& frame);
+    void draw_shadow(const ShadowPass& pass);
+    void draw_shadowmaps(const Frame& frame);
 };
 
 #endif
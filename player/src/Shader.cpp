@@ -22,8 +22,10 @@
 #include "Shader.h"
 
 #include <boost/regex.hpp>
+#include <sstream>
 #include <fstream>
 #include "RtrPlayerConfig.h"
+#include "ShaderCache.h"
 
 #define LOG_BUFFER_SIZE 1024*64
 
@@ -67,6 +69,35 @@ void shader_log(GLuint shader, const string& filename)
     }
 };
 
+/**
+ * Include and material files are shared by many permutations, keep them
+ * around instead of reading them again for every shader.
+ */
+map<string, string>& source_cache()
+{
+    static map<string, string> cache;
+    return cache;
+}
+
+bool read_cached_file(const string& filename, std::stringstream& ss)
+{
+    map<string, string>::iterator it = source_cache().find(filename);
+
+    if (it == source_cache().end()) {
+        if (!file_exists(filename)) {
+            cerr << "Could not find file " << filename << endl;
+            return false;
+        }
+
+        it = source_cache().insert(make_pair(filename, 
+                                             read_file(filename))).first;
+    }
+
+    ss << it->second;
+
+    return true;
+}
+
 bool load_shader_source(const string& shader, 
                         const string& material,
                         const string& file_extension,
@@ -75,8 +106,8 @@ bool load_shader_source(const string& shader,
     const int MAX_LENGTH = 1024;
     char buffer[MAX_LENGTH];
 
-    const boost::regex include_pattern("@include\\s+<(.+)>.*");
-    const boost::regex material_pattern("@material.*");
+    static const boost::regex include_pattern("@include\\s+<(.+)>.*");
+    static const boost::regex material_pattern("@material.*");
     boost::match_results<std::string::const_iterator> match;
 
 
@@ -97,60 +128,54 @@ bool load_shader_source(const string& shader,
             //for VS2010
             string includefile = config.shader_dir()+"/"+match.str(1);
 
-            if (!file_exists(includefile)) {
-                cerr << "Could not find file " << includefile << endl;
+            if (!read_cached_file(includefile, ss)) {
                 return false;
             }
-            
-            ss << read_file(includefile);
         } else if (boost::regex_match(line, match, material_pattern)) {
             
-            if (!file_exists(materialfile)) {
-                cerr << "Could not find file " << materialfile << endl;
+            if (!read_cached_file(materialfile, ss)) {
                 return false;
             }
-            
-            ss << read_file(materialfile);
         } else {
             ss << line << endl;
+
+            //Material shaders sample texture arrays, see shared.glsl
+            if (config.texture_arrays() && 
+                line.compare(0, 8, "#version") == 0) {
+                ss << "#define TEXTURE_ARRAYS" << endl;
+            }
         }
     }
 
     return true;
 }
 
-/**
- * Load and compile a GLSL shader file.
- * @param filename GLSL file name.
- * @param type GLSL shader type enum.
- * @return Shader handle in case of success, 0 otherwise.
- */
-GLuint compile_shader_object(const string& shader, 
-                             const string& material,
-                             GLenum type) 
+string file_extension(GLenum type)
 {
-    std::stringstream ss;
-
-    string file_extension;
-
     switch(type) {
-    case GL_VERTEX_SHADER: file_extension = ".vert"; break;
-    case GL_GEOMETRY_SHADER: file_extension = ".geom"; break;
-    case GL_FRAGMENT_SHADER: file_extension = ".frag"; break;
+    case GL_VERTEX_SHADER: return ".vert";
+    case GL_GEOMETRY_SHADER: return ".geom";
+    case GL_FRAGMENT_SHADER: return ".frag";
 #ifdef GL_VERSION_4_0
-    case GL_TESS_CONTROL_SHADER: file_extension = ".tess_ctrl"; break;
-    case GL_TESS_EVALUATION_SHADER: file_extension = ".tess_eval"; break;
+    case GL_TESS_CONTROL_SHADER: return ".tess_ctrl";
+    case GL_TESS_EVALUATION_SHADER: return ".tess_eval";
 #endif
     default:
         assert(0);
     }
 
-    if (!load_shader_source(shader, material, file_extension, ss)) {
-        return 0;
-    }
-
-    string source = ss.str();
+    return "";
+}
 
+/**
+ * Submit a GLSL shader source for compilation. The compile status is not
+ * queried, so that the driver does not have to finish compiling yet.
+ * @param source Preprocessed GLSL source.
+ * @param type GLSL shader type enum.
+ * @return Shader handle.
+ */
+GLuint compile_shader_object(const string& source, GLenum type) 
+{
     GLuint shader_handle = glCreateShader(type);
 
     const char * csource = source.c_str();
@@ -160,89 +185,232 @@ GLuint compile_shader_object(const string& shader,
 
     glCompileShader(shader_handle);
 
+    return shader_handle;
+}
+
+/**
+ * Check the compile status of a shader and print its log on failure.
+ * @return True if the shader compiled correctly.
+ */
+bool check_shader_object(GLuint shader_handle, const string& filename)
+{
+    if (shader_handle == 0) {
+        return true;
+    }
+
     GLint status;
 
     glGetShaderiv(shader_handle, GL_COMPILE_STATUS, &status);
     
     if (status == GL_FALSE) {
-        shader_log(shader_handle, shader+file_extension+"@"+material);
-
-        // std::string line;
-        // int line_no = 0;
-        // while (std::getline(ss, line)) {
-        //     cerr << ++line_no << " " << line << endl;
-        // }
-
-        glDeleteShader(shader_handle);
-        return 0;
+        shader_log(shader_handle, filename);
+        return false;
     }
 
-    return shader_handle;
+    return true;
 }
 }
 
 Shader::Shader(const string& shader,
-               const string& material) :
+               const string& material,
+               bool deferred) :
+    _state(PENDING),
     _valid(false),
+    _from_cache(false),
     _program(0),
     _vertex_shader(0),
     _geometry_shader(0),
     _fragment_shader(0),
     _tess_ctrl_shader(0),
     _tess_eval_shader(0),
-    _name(shader)
+    _name(shader),
+    _material(material)
 {
+    GLenum types[] = { GL_VERTEX_SHADER, 
+                       GL_FRAGMENT_SHADER, 
+                       GL_GEOMETRY_SHADER,
+#ifdef GL_VERSION_4_0
+                       GL_TESS_CONTROL_SHADER,
+                       GL_TESS_EVALUATION_SHADER
+#endif
+    };
+
+    bool has_tess_ctrl = false;
+    bool has_tess_eval = false;
+
+    // Load and preprocess the sources of all stages
+    for (size_t i = 0; i < sizeof(types)/sizeof(GLenum); ++i) {
+        std::stringstream ss;
+
+        if (!load_shader_source(shader, material, file_extension(types[i]), 
+                                ss)) {
+            // Vertex and fragment shaders are mandatory
+            if (types[i] == GL_VERTEX_SHADER || 
+                types[i] == GL_FRAGMENT_SHADER) {
+                _sources.clear();
+                _state = COMPILED;
+                return;
+            }
+
+            continue;
+        }
 
-    // Load an compile shaders
-    _vertex_shader = compile_shader_object(shader, material, GL_VERTEX_SHADER);
-    _fragment_shader = compile_shader_object(shader, material, GL_FRAGMENT_SHADER);
-    _geometry_shader = compile_shader_object(shader, material, GL_GEOMETRY_SHADER);
+#ifdef GL_VERSION_4_0
+        has_tess_ctrl |= (types[i] == GL_TESS_CONTROL_SHADER);
+        has_tess_eval |= (types[i] == GL_TESS_EVALUATION_SHADER);
+#endif
 
+        _sources.push_back(make_pair(types[i], ss.str()));
+    }
 
-    // Test for errors
-    if (_vertex_shader == 0 || _fragment_shader == 0) {
-        clean_up();
+    // Tessellation shaders are only used in pairs, a single one was loaded
+    // last
+    if (has_tess_ctrl != has_tess_eval) {
+        _sources.pop_back();
+    }
+
+    //Lengths keep the boundaries between the stages unambiguous
+    std::ostringstream key;
+    for (size_t i = 0; i < _sources.size(); ++i) {
+        key << _sources[i].first << ":" << _sources[i].second.size() << ":"
+            << _sources[i].second;
+    }
+    _source_key = key.str();
+
+    if (!deferred) {
+        compile();
+    }
+}
+
+Shader::~Shader()
+{
+    clean_up();
+}
+
+void Shader::clear_source_cache()
+{
+    source_cache().clear();
+}
+
+void Shader::set_feedback_varyings(const vector<string>& varyings)
+{
+    assert(_state == PENDING);
+
+    _feedback_varyings = varyings;
+
+    std::ostringstream key;
+    for (size_t i = 0; i < varyings.size(); ++i) {
+        key << "varying:" << varyings[i].size() << ":" << varyings[i];
+    }
+    _source_key += key.str();
+}
+
+void Shader::start_compile()
+{
+    if (_state != PENDING) {
         return;
     }
 
+    _state = LINKING;
     _program = glCreateProgram();
 
-    // Attach shaders to program
-    glAttachShader(_program, _vertex_shader);
-    glAttachShader(_program, _fragment_shader);
-
-    if (_geometry_shader != 0) {
-        glAttachShader(_program, _geometry_shader);
+    if (ShaderCache::load(_source_key, _program)) {
+        _from_cache = true;
+        return;
     }
 
+    compile_sources();
+}
 
+void Shader::compile_sources()
+{
+    for (size_t i = 0; i < _sources.size(); ++i) {
+        GLuint handle = compile_shader_object(_sources[i].second, 
+                                              _sources[i].first);
+
+        switch (_sources[i].first) {
+        case GL_VERTEX_SHADER: _vertex_shader = handle; break;
+        case GL_GEOMETRY_SHADER: _geometry_shader = handle; break;
+        case GL_FRAGMENT_SHADER: _fragment_shader = handle; break;
 #ifdef GL_VERSION_4_0
-    _tess_ctrl_shader = compile_shader_object(shader, material,
-                                              GL_TESS_CONTROL_SHADER);
-    _tess_eval_shader = compile_shader_object(shader, material,
-                                              GL_TESS_EVALUATION_SHADER);
-
-    if (_tess_eval_shader != 0 && _tess_ctrl_shader != 0) {
-        glAttachShader(_program, _tess_ctrl_shader);
-        glAttachShader(_program, _tess_eval_shader);
-    }
+        case GL_TESS_CONTROL_SHADER: _tess_ctrl_shader = handle; break;
+        case GL_TESS_EVALUATION_SHADER: _tess_eval_shader = handle; break;
 #endif
+        }
+
+        glAttachShader(_program, handle);
+    }
 
-    // Link and check for success
+    if (ShaderCache::is_enabled()) {
+        glProgramParameteri(_program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, 
+                            GL_TRUE);
+    }
+
+    if (!_feedback_varyings.empty()) {
+        vector<const GLchar*> names;
+        for (size_t i = 0; i < _feedback_varyings.size(); ++i) {
+            names.push_back(_feedback_varyings[i].c_str());
+        }
+
+        glTransformFeedbackVaryings(_program, names.size(), &names[0], 
+                                    GL_SEPARATE_ATTRIBS);
+    }
+
+    // Link, the status is checked in finish_compile()
     glLinkProgram(_program);
+}
+
+void Shader::finish_compile()
+{
+    if (_state == PENDING) {
+        start_compile();
+    }
+
+    if (_state != LINKING) {
+        return;
+    }
+
+    _state = COMPILED;
 
     GLint status;
 
     glGetProgramiv(_program, GL_LINK_STATUS, &status);
+
+    if (status == GL_FALSE && _from_cache) {
+        // The driver rejected the binary, e.g. after a driver update
+        ShaderCache::remove(_source_key);
+        _from_cache = false;
+
+        glDeleteProgram(_program);
+        _program = glCreateProgram();
+        compile_sources();
+
+        glGetProgramiv(_program, GL_LINK_STATUS, &status);
+    }
     
     if (status == GL_FALSE) {
-        program_log(_program, shader+"@"+material);
+        check_shader_object(_vertex_shader, _name+".vert@"+_material);
+        check_shader_object(_fragment_shader, _name+".frag@"+_material);
+        check_shader_object(_geometry_shader, _name+".geom@"+_material);
+        check_shader_object(_tess_ctrl_shader, 
+                            _name+".tess_ctrl@"+_material);
+        check_shader_object(_tess_eval_shader, 
+                            _name+".tess_eval@"+_material);
+
+        program_log(_program, _name+"@"+_material);
 
         clean_up();
+        _sources.clear();
         
         return;
     }
 
+    if (!_from_cache) {
+        ShaderCache::store(_source_key, _program);
+    }
+
+    _sources.clear();
+
     _valid = true;
 
     GLint active_uniforms, active_uniform_blocks;
@@ -263,15 +431,11 @@ Shader::Shader(const string& shader,
         glGetActiveUniformBlockName(_program, uniform_block, 
                                      1000, NULL, buffer);
         string uniform_block_name(buffer);
-        _uniform_block_map[uniform_block_name] = uniform_block;
+        UniformBlock block = { uniform_block, 0xffffffff };
+        _uniform_block_map[uniform_block_name] = block;
     }
 }
 
-Shader::~Shader()
-{
-    clean_up();
-}
-
 void Shader::clean_up()
 {
     if (_program != 0) {
@@ -299,6 +463,7 @@ void Shader::clean_up()
     }
 
     _program = _vertex_shader = _geometry_shader = _fragment_shader = 0;
+    _tess_ctrl_shader = _tess_eval_shader = 0;
 }
 
 GLint Shader::get_attrib_count() const
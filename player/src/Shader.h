@@ -26,15 +26,30 @@
 #include "type_info.h"
 #include "Texture.h"
 #include "TextureArray.h"
+#include "BufferTexture.h"
 
 #include "UniformBuffer.h"
+#include "Profiler.h"
 
 /**
  * Represents a compiled GLSL shader.
+ *
+ * Compilation can be deferred: the sources are then only loaded and 
+ * preprocessed, and compiled on compile(). Compilation is split into two 
+ * steps so that several shaders can be submitted to the driver before 
+ * waiting for any of them. Linked programs are kept in the ShaderCache.
  */
 class Shader
 {
+    typedef enum {
+        PENDING, /**< Sources are loaded, but not compiled */
+        LINKING, /**< Compilation has been started */
+        COMPILED /**< Compilation has finished, see is_valid() */
+    } CompileState;
+
+    CompileState _state;
     bool _valid; /**< State variable for testing compilation success */
+    bool _from_cache; /**< The program was loaded from a binary */
 
     GLuint _program; /**< Shader program handle. */
 
@@ -45,11 +60,36 @@ class Shader
     GLuint _tess_eval_shader; /**< Tessellation evaluation shader handle */
 
     string _name;
+    string _material;
+
+    /**
+     * Preprocessed sources per shader stage, kept until compilation.
+     */
+    vector<std::pair<GLenum, string> > _sources;
+
+    /**
+     * Stage types, preprocessed sources and feedback varyings in one 
+     * string, identifies the program.
+     */
+    string _source_key;
+
+    /**
+     * Outputs captured with transform feedback, one buffer each.
+     */
+    vector<string> _feedback_varyings;
 
     typedef boost::unordered_map<string, GLint> UniformMap;
     UniformMap _uniform_map;
 
-    typedef boost::unordered_map<string, GLuint> UniformBlockMap;
+    /**
+     * Index of a uniform block and the binding point it was last set to.
+     */
+    struct UniformBlock {
+        GLuint index;
+        GLuint binding;
+    };
+
+    typedef boost::unordered_map<string, UniformBlock> UniformBlockMap;
     UniformBlockMap _uniform_block_map;
 
     public:
@@ -58,16 +98,64 @@ class Shader
      * Load and compile a shader.
      * @param shader Name of the shader. Don't add a file-extension or dir.
      * @param material Name of the material. Optional.
+     * @param deferred If TRUE, the sources are only loaded. They have to be
+     * compiled with compile() before the shader can be used.
      */
-    Shader(const string& shader, const string& material="");
+    Shader(const string& shader, const string& material="", 
+           bool deferred=false);
     ~Shader();
 
+    /**
+     * Captures vertex shader outputs with transform feedback, each one into
+     * a separate buffer in the given order. Only for deferred shaders, 
+     * before compilation.
+     */
+    void set_feedback_varyings(const vector<string>& varyings);
+
+    /**
+     * Starts compiling and linking, without waiting for the result.
+     */
+    void start_compile();
+
+    /**
+     * Waits for compilation to finish and checks the result. Starts 
+     * compilation if that has not happened yet.
+     */
+    void finish_compile();
+
+    void compile()
+    {
+        start_compile();
+        finish_compile();
+    }
+
+    bool is_compiled() const
+    {
+        return _state == COMPILED;
+    }
+
+    /**
+     * The preprocessed sources of all stages and the feedback varyings. 
+     * Shaders with the same key result in the same program.
+     */
+    const string& source_key() const
+    {
+        return _source_key;
+    }
+
+    /**
+     * Forgets the include and material files read so far, e.g. when they
+     * are reloaded.
+     */
+    static void clear_source_cache();
+
     /**
      * Bind the shader object
      */
     void bind() const
     {
         glUseProgram(_program);
+        Profiler::count(Profiler::STATE_BINDS);
     }
 
     /**
@@ -120,6 +208,16 @@ class Shader
         gltype_info<GLint>::set_uniform(it->second, texture.get_unit_number());
     }
 
+    void set_uniform(const string& uniform_name, const BufferTexture& texture)
+    {
+        UniformMap::iterator it = _uniform_map.find(uniform_name);
+        
+        if (it == _uniform_map.end())
+            return;
+
+        gltype_info<GLint>::set_uniform(it->second, texture.get_unit_number());
+    }
+
     void set_uniform_block(const string& block_name, 
                            const UniformBuffer& UBO) 
     {
@@ -128,7 +226,13 @@ class Shader
         if (it == _uniform_block_map.end())
             return;
 
-        glUniformBlockBinding(_program, it->second, UBO.get_binding());
+        //pooled buffers always use the same binding point
+        GLuint binding = UBO.get_binding();
+        if (it->second.binding == binding)
+            return;
+
+        glUniformBlockBinding(_program, it->second.index, binding);
+        it->second.binding = binding;
     };
 
     /**
@@ -152,7 +256,8 @@ class Shader
     string get_attrib_name(GLint index) const;
 
     /**
-     * Used for checking if a shader has compiled correctly.
+     * Used for checking if a shader has compiled correctly. Deferred 
+     * shaders are not valid until they have been compiled.
      */
     bool is_valid() const
     {
@@ -161,6 +266,7 @@ class Shader
     
     private:
 
+    void compile_sources();
     void clean_up();
 };
 
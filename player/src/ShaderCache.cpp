@@ -0,0 +1,171 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "ShaderCache.h"
+
+#include "RtrPlayerConfig.h"
+
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+
+//see DBLoader.h
+#undef ERROR
+#undef SYNCHRONIZE
+
+#include <kcfile.h>
+
+namespace kc = kyotocabinet;
+
+namespace {
+    //"RTPB", followed by the binary format, the length of the sources, the
+    //length of the binary, the sources and the binary
+    const uint32_t kMagic = 0x42505452;
+}
+
+bool ShaderCache::is_enabled()
+{
+    return EXTGL_ARB_get_program_binary && !config.shader_cache_dir().empty();
+}
+
+size_t ShaderCache::driver_hash()
+{
+    static size_t hash = 0;
+    static bool initialized = false;
+
+    if (!initialized) {
+        const GLenum names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+        for (int i = 0; i < 3; ++i) {
+            const GLubyte* s = glGetString(names[i]);
+            boost::hash_combine(hash, string(s ? (const char*)s : ""));
+        }
+        initialized = true;
+    }
+
+    return hash;
+}
+
+string ShaderCache::file_name(const string& source_key)
+{
+    size_t key = boost::hash_value(source_key);
+    boost::hash_combine(key, driver_hash());
+
+    std::ostringstream oss;
+    oss << config.shader_cache_dir() << "/" 
+        << std::hex << std::setw(sizeof(size_t)*2) << std::setfill('0') 
+        << key << ".bin";
+
+    return oss.str();
+}
+
+bool ShaderCache::load(const string& source_key, GLuint program)
+{
+    if (!is_enabled())
+        return false;
+
+    std::ifstream is(file_name(source_key).c_str(), std::ios::binary);
+
+    if (!is)
+        return false;
+
+    is.seekg(0, std::ios::end);
+    std::streamoff file_size = is.tellg();
+    is.seekg(0, std::ios::beg);
+
+    uint32_t header[4];
+    is.read((char*)header, sizeof(header));
+
+    if (!is || header[0] != kMagic || header[3] == 0)
+        return false;
+
+    //Truncated or otherwise damaged files are ignored
+    if (file_size != (std::streamoff)sizeof(header) + header[2] + header[3])
+        return false;
+
+    //Another program with the same hash
+    if (header[2] != source_key.size())
+        return false;
+
+    vector<char> sources(header[2]);
+    if (!sources.empty())
+        is.read(&sources[0], sources.size());
+
+    if (!is || !std::equal(sources.begin(), sources.end(), 
+                           source_key.begin()))
+        return false;
+
+    vector<char> binary(header[3]);
+    is.read(&binary[0], binary.size());
+
+    if (!is)
+        return false;
+
+    glProgramBinary(program, header[1], &binary[0], binary.size());
+
+    return true;
+}
+
+void ShaderCache::store(const string& source_key, GLuint program)
+{
+    if (!is_enabled())
+        return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+
+    if (length <= 0)
+        return;
+
+    vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, NULL, &format, &binary[0]);
+
+    const string& dir = config.shader_cache_dir();
+    kc::File::Status status;
+    if (!kc::File::status(dir, &status) && !kc::File::make_directory(dir)) {
+        cerr << "Could not create shader cache directory '" << dir << "'." 
+             << endl;
+        return;
+    }
+
+    string path = file_name(source_key);
+    std::ofstream os(path.c_str(), std::ios::binary);
+
+    uint32_t header[4] = { kMagic, format, (uint32_t)source_key.size(), 
+                           (uint32_t)length };
+    os.write((const char*)header, sizeof(header));
+    os.write(source_key.data(), source_key.size());
+    os.write(&binary[0], binary.size());
+
+    if (!os) {
+        cerr << "Could not write shader cache file '" << path << "'." << endl;
+    }
+}
+
+void ShaderCache::remove(const string& source_key)
+{
+    if (!is_enabled())
+        return;
+
+    kc::File::remove(file_name(source_key));
+}
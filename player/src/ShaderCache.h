@@ -0,0 +1,69 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include "common.h"
+
+/**
+ * On-disk cache of linked shader programs, using the program binary API
+ * (ARB_get_program_binary). Files are named by a hash of the preprocessed 
+ * shader sources and of the driver (vendor, renderer and version string), 
+ * so a driver update invalidates all entries. The sources are stored along
+ * with the binary and compared on load, so a hash collision only costs a 
+ * compile. Drivers may still reject a binary, callers have to fall back to
+ * compiling the sources.
+ * The cache is disabled if the extension is missing or shader_cache_dir is
+ * empty.
+ */
+class ShaderCache
+{
+    public:
+
+    /**
+     * Loads a cached binary into program. The caller still has to check the
+     * link status of the program.
+     * @param source_key See Shader::source_key().
+     * @return FALSE if there is no valid binary for these sources.
+     */
+    static bool load(const string& source_key, GLuint program);
+
+    /**
+     * Stores the binary of a successfully linked program. The program must
+     * have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT.
+     */
+    static void store(const string& source_key, GLuint program);
+
+    /**
+     * Removes the binary for this source, e.g. after it has been rejected.
+     */
+    static void remove(const string& source_key);
+
+    static bool is_enabled();
+
+    private:
+
+    static string file_name(const string& source_key);
+    static size_t driver_hash();
+};
+
+#endif
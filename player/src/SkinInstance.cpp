@@ -0,0 +1,218 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "SkinInstance.h"
+
+#include "rtr_format.pb.h"
+
+namespace {
+
+    /**
+     * Copies the float data of a source, padded or cut to a length.
+     */
+    void copy_floats(const rtr_format::LayerSource& source, int length,
+                     vector<float>& data)
+    {
+        data.assign(source.float_data().begin(), source.float_data().end());
+        data.resize(length, 0.0f);
+    }
+
+    void copy_ints(const rtr_format::LayerSource& source, int length,
+                   uint32_t pad, vector<uint32_t>& data)
+    {
+        data.assign(source.int_data().begin(), source.int_data().end());
+        data.resize(length, pad);
+    }
+
+    GPULayerSourceRef create_source(const string& id, 
+                                    const vector<float>& data)
+    {
+        ArrayAdapter adapter(&data[0], data.size());
+        return GPULayerSourceRef(new GPULayerSource(
+                                     LayerSourceInitializer(id, adapter)));
+    }
+
+    GPULayerSourceRef create_source(const string& id, 
+                                    const vector<uint32_t>& data)
+    {
+        const int* elements = reinterpret_cast<const int*>(&data[0]);
+        ArrayAdapter adapter(elements, data.size());
+        return GPULayerSourceRef(new GPULayerSource(
+                                     LayerSourceInitializer(id, adapter)));
+    }
+
+}
+
+SkinSource::SkinSource(const rtr_format::LayerSource& positions,
+                       const rtr_format::LayerSource& normals,
+                       const rtr_format::LayerSource& tangents,
+                       const rtr_format::LayerSource& joint_indices,
+                       const rtr_format::LayerSource& joint_weights,
+                       bool with_points) :
+    _id(positions.id()),
+    _joint_count(0)
+{
+    int vertex_count = positions.float_data_size() / 3;
+
+    _bind_pose.vertex_count = vertex_count;
+    copy_floats(positions, vertex_count * 3, _bind_pose.positions);
+    copy_floats(normals, vertex_count * 3, _bind_pose.normals);
+    copy_floats(tangents, vertex_count * 4, _bind_pose.tangents);
+
+    //Vertices without influences stay with the first joint
+    copy_ints(joint_indices, vertex_count, 0, _bind_pose.joint_indices);
+    copy_ints(joint_weights, vertex_count, 255, _bind_pose.joint_weights);
+
+    for (int v = 0; v < vertex_count; ++v) {
+        for (int i = 0; i < 4; ++i) {
+            int shift = i * 8;
+            if (((_bind_pose.joint_weights[v] >> shift) & 0xff) == 0)
+                continue;
+
+            int joint = (_bind_pose.joint_indices[v] >> shift) & 0xff;
+            _joint_count = std::max(_joint_count, joint + 1);
+        }
+    }
+
+    if (!with_points || vertex_count == 0) 
+        return;
+
+    GPULayerSourceMap sources;
+    sources["vertex"] = create_source(_id + "_vertex", _bind_pose.positions);
+    sources["normal"] = create_source(_id + "_normal", _bind_pose.normals);
+    sources["tangent"] = create_source(_id + "_tangent", _bind_pose.tangents);
+    sources["joint_index"] = create_source(_id + "_joint_index", 
+                                           _bind_pose.joint_indices);
+    sources["joint_weight"] = create_source(_id + "_joint_weight", 
+                                            _bind_pose.joint_weights);
+
+    MeshInitializer points(_id + "_points", GL_POINTS, vertex_count);
+    points.add_layer<vec3>("vertex", 0, "vertex");
+    points.add_layer<vec3>("normal", 0, "normal");
+    points.add_layer<vec4>("tangent", 0, "tangent");
+    points.add_layer<vec4>("joint_index", 0, "joint_index");
+    points.add_layer<vec4>("joint_weight", 0, "joint_weight", true);
+
+    _points = GPUMeshRef(new GPUMesh(points, sources));
+}
+
+SkinInstance::SkinInstance(const string& id,
+                           const rtr_format::Skin& skin,
+                           const TransformNodeRef& node,
+                           const vector<TransformNodeRef>& joints,
+                           const SkinSourceRef& source) :
+    _node(node),
+    _joints(joints),
+    _source(source),
+    _palette(joints.size(), mat4(1.0f)),
+    _has_bounds(false),
+    _has_changed(true),
+    _version(0),
+    _skinned_version(-1)
+{
+    for (size_t j = 0; j < joints.size(); ++j) {
+        mat4 m(1.0f);
+
+        if ((int)(j * 16 + 15) < skin.inverse_bind_matrix_size()) {
+            for (int c = 0; c < 4; ++c)
+                for (int r = 0; r < 4; ++r)
+                    m[c][r] = skin.inverse_bind_matrix(j * 16 + c * 4 + r);
+        }
+
+        _inverse_bind_matrices.push_back(m);
+
+        if ((int)(j * 4 + 3) < skin.joint_bounds_size()) {
+            vec3 center(skin.joint_bounds(j * 4), 
+                        skin.joint_bounds(j * 4 + 1),
+                        skin.joint_bounds(j * 4 + 2));
+            _joint_bounds.push_back(Sphere(skin.joint_bounds(j * 4 + 3), 
+                                           center));
+        } else {
+            _joint_bounds.push_back(Sphere(-1.0f, vec3(0.0f)));
+        }
+    }
+
+    const Skinning::BindPose& pose = source->bind_pose();
+
+    _positions = create_source(id + "_vertex", pose.positions);
+    _normals = create_source(id + "_normal", pose.normals);
+    _tangents = create_source(id + "_tangent", pose.tangents);
+
+    calculate();
+}
+
+void SkinInstance::update()
+{
+    _has_changed = _node->has_changed();
+
+    for (size_t j = 0; j < _joints.size() && !_has_changed; ++j) {
+        _has_changed = _joints[j]->has_changed();
+    }
+
+    if (_has_changed) {
+        calculate();
+    }
+}
+
+void SkinInstance::calculate()
+{
+    ++_version;
+
+    const mat4& world_to_node = _node->get_inverse_matrix();
+
+    _has_bounds = false;
+
+    for (size_t j = 0; j < _joints.size(); ++j) {
+        const mat4& joint_to_world = _joints[j]->get_matrix();
+
+        _palette[j] = world_to_node * joint_to_world * 
+                      _inverse_bind_matrices[j];
+
+        const Sphere& bounds = _joint_bounds[j];
+        if (bounds.radius() < 0.0f)
+            continue;
+
+        //Same as for geometries, this works only with uniform scale
+        vec4 center = joint_to_world * vec4(bounds.center(), 1.0f);
+        vec4 p = joint_to_world * (vec4(bounds.center(), 1.0f) + 
+                                   vec4(0.0f, 0.0f, bounds.radius(), 0.0f));
+
+        Sphere s(glm::length(p - center), vec3(center));
+
+        _bounding_sphere = _has_bounds ? 
+            Sphere::unite(_bounding_sphere, s) : s;
+        _has_bounds = true;
+    }
+}
+
+void SkinInstance::upload(const Skinning::Output& output)
+{
+    _positions->update(&output.positions[0]);
+    _normals->update(&output.normals[0]);
+    _tangents->update(&output.tangents[0]);
+}
+
+void SkinInstance::bind_feedback() const
+{
+    _positions->bind_feedback(0);
+    _normals->bind_feedback(1);
+    _tangents->bind_feedback(2);
+}
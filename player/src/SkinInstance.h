@@ -0,0 +1,174 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef SKININSTANCE_H
+#define SKININSTANCE_H
+
+#include "common.h"
+#include "Skinning.h"
+#include "Transform.h"
+#include "LayerSource.h"
+#include "Mesh.h"
+#include "BoundingVolume.h"
+
+namespace rtr_format {
+    class Skin;
+    class LayerSource;
+}
+
+/**
+ * The bind pose of the vertex buffers of a skinned geometry, shared by all
+ * of its instances.
+ */
+class SkinSource : boost::noncopyable
+{
+    public:
+
+    /**
+     * Normals and tangents that are shorter than the positions, like the 
+     * fallback layers of the bakery, are padded with zeros.
+     * @param with_points Also creates points(), for skinning on the GPU.
+     */
+    SkinSource(const rtr_format::LayerSource& positions,
+               const rtr_format::LayerSource& normals,
+               const rtr_format::LayerSource& tangents,
+               const rtr_format::LayerSource& joint_indices,
+               const rtr_format::LayerSource& joint_weights,
+               bool with_points);
+
+    const string& id() const { return _id; }
+
+    const Skinning::BindPose& bind_pose() const { return _bind_pose; }
+
+    /**
+     * Number of joints the vertices are bound to, the highest index + 1.
+     */
+    int joint_count() const { return _joint_count; }
+
+    /**
+     * The bind pose as one point per vertex, drawn with skin.vert.
+     */
+    const GPUMeshRef& points() const { return _points; }
+
+    private:
+
+    string _id;
+    Skinning::BindPose _bind_pose;
+    int _joint_count;
+    GPUMeshRef _points;
+};
+
+typedef shared_ptr<SkinSource> SkinSourceRef;
+
+/**
+ * A skin bound to a transform node and to the transform nodes of its 
+ * joints. The skinned vertices are kept in separate layer sources in the
+ * space of the node, so geometries draw them like any other mesh.
+ */
+class SkinInstance : boost::noncopyable
+{
+    public:
+
+    /**
+     * @param joints The transform nodes of the skin's joints, in order.
+     */
+    SkinInstance(const string& id,
+                 const rtr_format::Skin& skin,
+                 const TransformNodeRef& node,
+                 const vector<TransformNodeRef>& joints,
+                 const SkinSourceRef& source);
+
+    /**
+     * Recalculates the palette and the bounds if the node or any joint has 
+     * changed. Call after the transform nodes were updated.
+     */
+    void update();
+
+    /**
+     * Whether the last update() changed the palette.
+     */
+    bool has_changed() const { return _has_changed; }
+
+    /**
+     * Whether the palette changed since set_skinned() was last called.
+     */
+    bool needs_skinning() const { return _skinned_version != _version; }
+    void set_skinned() { _skinned_version = _version; }
+
+    /**
+     * One matrix per joint, from the bind pose to the space of the node.
+     */
+    const vector<mat4>& palette() const { return _palette; }
+
+    /**
+     * Bounds of all joints with vertices in world space. Without joint 
+     * bounds in the skin, the bounds of the mesh have to be used.
+     */
+    bool has_bounds() const { return _has_bounds; }
+    const Sphere& bounding_sphere() const { return _bounding_sphere; }
+
+    const SkinSourceRef& source() const { return _source; }
+
+    const vector<TransformNodeRef>& joints() const { return _joints; }
+
+    /**
+     * The skinned vertices, in bind pose until the first skinning.
+     */
+    const GPULayerSourceRef& positions() const { return _positions; }
+    const GPULayerSourceRef& normals() const { return _normals; }
+    const GPULayerSourceRef& tangents() const { return _tangents; }
+
+    /**
+     * Uploads vertices skinned on the CPU.
+     */
+    void upload(const Skinning::Output& output);
+
+    /**
+     * Binds the skinned vertices as outputs of skin.vert.
+     */
+    void bind_feedback() const;
+
+    private:
+
+    TransformNodeRef _node;
+    vector<TransformNodeRef> _joints;
+    vector<mat4> _inverse_bind_matrices;
+    vector<Sphere> _joint_bounds; /**< Negative radius without vertices */
+
+    SkinSourceRef _source;
+    GPULayerSourceRef _positions;
+    GPULayerSourceRef _normals;
+    GPULayerSourceRef _tangents;
+
+    vector<mat4> _palette;
+    bool _has_bounds;
+    Sphere _bounding_sphere;
+
+    bool _has_changed;
+    int _version;
+    int _skinned_version;
+
+    void calculate();
+};
+
+typedef shared_ptr<SkinInstance> SkinInstanceRef;
+
+#endif
@@ -0,0 +1,326 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "Skinning.h"
+#include "Profiler.h"
+
+#include <glm/gtx/transform.hpp>
+
+#include <cmath>
+#include <cstdlib>
+
+//see DBLoader.h
+#undef ERROR
+#undef SYNCHRONIZE
+
+#include <kcutil.h>
+
+namespace kc = kyotocabinet;
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SKINNING_USE_SSE
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+    //Vertices per block, large enough to keep the overhead of handing out 
+    //jobs small
+    const int kBlockSize = 2048;
+
+    const float kWeightScale = 1.0f / 255.0f;
+
+    int influence(uint32_t packed, int i) {
+        return (packed >> (i * 8)) & 0xff;
+    }
+
+    float random_float() {
+        return std::rand() / float(RAND_MAX);
+    }
+
+}
+
+Skinning::Skinning(int thread_count) :
+    _pool(thread_count)
+{
+}
+
+void Skinning::add(const BindPose& pose, const mat4* palette, Output& output)
+{
+    output.positions.resize(pose.vertex_count * 3);
+    output.normals.resize(pose.vertex_count * 3);
+    output.tangents.resize(pose.vertex_count * 4);
+
+    for (int first = 0; first < pose.vertex_count; first += kBlockSize) {
+        Block block;
+        block.pose = &pose;
+        block.palette = palette;
+        block.output = &output;
+        block.first_vertex = first;
+        block.vertex_count = std::min(kBlockSize, pose.vertex_count - first);
+
+        _blocks.push_back(block);
+    }
+}
+
+void Skinning::run()
+{
+    if (!_blocks.empty()) {
+        _pool.run(*this, _blocks.size());
+    }
+
+    _blocks.clear();
+}
+
+void Skinning::run_job(int block)
+{
+    ProfileZone zone("skinning block");
+
+    skin(_blocks[block]);
+}
+
+void Skinning::skin(const Block& block)
+{
+    const BindPose& pose = *block.pose;
+    Output& output = *block.output;
+
+    const float* positions = &pose.positions[0];
+    const float* normals = &pose.normals[0];
+    const float* tangents = &pose.tangents[0];
+
+    int end = block.first_vertex + block.vertex_count;
+
+    for (int v = block.first_vertex; v < end; ++v) {
+        uint32_t joints = pose.joint_indices[v];
+        uint32_t weights = pose.joint_weights[v];
+
+        const float* p = positions + v * 3;
+        const float* n = normals + v * 3;
+        const float* t = tangents + v * 4;
+
+#ifdef SKINNING_USE_SSE
+        //Blend the columns of the influencing matrices
+        __m128 c0 = _mm_setzero_ps();
+        __m128 c1 = _mm_setzero_ps();
+        __m128 c2 = _mm_setzero_ps();
+        __m128 c3 = _mm_setzero_ps();
+
+        for (int i = 0; i < 4; ++i) {
+            int weight = influence(weights, i);
+            if (weight == 0)
+                continue;
+
+            const float* m = &block.palette[influence(joints, i)][0][0];
+            __m128 w = _mm_set1_ps(weight * kWeightScale);
+
+            c0 = _mm_add_ps(c0, _mm_mul_ps(_mm_loadu_ps(m), w));
+            c1 = _mm_add_ps(c1, _mm_mul_ps(_mm_loadu_ps(m + 4), w));
+            c2 = _mm_add_ps(c2, _mm_mul_ps(_mm_loadu_ps(m + 8), w));
+            c3 = _mm_add_ps(c3, _mm_mul_ps(_mm_loadu_ps(m + 12), w));
+        }
+
+        float result[4];
+
+        __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(p[0])),
+                                         _mm_mul_ps(c1, _mm_set1_ps(p[1]))),
+                              _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(p[2])),
+                                         c3));
+        _mm_storeu_ps(result, r);
+        std::copy(result, result + 3, &output.positions[v * 3]);
+
+        r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(n[0])),
+                                  _mm_mul_ps(c1, _mm_set1_ps(n[1]))),
+                       _mm_mul_ps(c2, _mm_set1_ps(n[2])));
+        _mm_storeu_ps(result, r);
+        std::copy(result, result + 3, &output.normals[v * 3]);
+
+        r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(t[0])),
+                                  _mm_mul_ps(c1, _mm_set1_ps(t[1]))),
+                       _mm_mul_ps(c2, _mm_set1_ps(t[2])));
+        _mm_storeu_ps(result, r);
+        result[3] = t[3];
+        std::copy(result, result + 4, &output.tangents[v * 4]);
+#else
+        mat4 m(0.0f);
+
+        for (int i = 0; i < 4; ++i) {
+            int weight = influence(weights, i);
+            if (weight == 0)
+                continue;
+
+            m += block.palette[influence(joints, i)] * (weight * kWeightScale);
+        }
+
+        vec4 position = m * vec4(p[0], p[1], p[2], 1.0f);
+        vec4 normal = m * vec4(n[0], n[1], n[2], 0.0f);
+        vec4 tangent = m * vec4(t[0], t[1], t[2], 0.0f);
+
+        float* out_p = &output.positions[v * 3];
+        float* out_n = &output.normals[v * 3];
+        float* out_t = &output.tangents[v * 4];
+
+        for (int c = 0; c < 3; ++c) {
+            out_p[c] = position[c];
+            out_n[c] = normal[c];
+            out_t[c] = tangent[c];
+        }
+        out_t[3] = t[3];
+#endif
+    }
+}
+
+void Skinning::skin_reference(const BindPose& pose, const mat4* palette, 
+                              Output& output)
+{
+    output.positions.assign(pose.vertex_count * 3, 0.0f);
+    output.normals.assign(pose.vertex_count * 3, 0.0f);
+    output.tangents.assign(pose.vertex_count * 4, 0.0f);
+
+    for (int v = 0; v < pose.vertex_count; ++v) {
+        vec4 p(pose.positions[v*3], pose.positions[v*3+1], 
+               pose.positions[v*3+2], 1.0f);
+        vec4 n(pose.normals[v*3], pose.normals[v*3+1], 
+               pose.normals[v*3+2], 0.0f);
+        vec4 t(pose.tangents[v*4], pose.tangents[v*4+1], 
+               pose.tangents[v*4+2], 0.0f);
+
+        vec4 position(0.0f), normal(0.0f), tangent(0.0f);
+
+        for (int i = 0; i < 4; ++i) {
+            float weight = influence(pose.joint_weights[v], i) * kWeightScale;
+            if (weight == 0.0f)
+                continue;
+
+            const mat4& m = palette[influence(pose.joint_indices[v], i)];
+
+            position += (m * p) * weight;
+            normal += (m * n) * weight;
+            tangent += (m * t) * weight;
+        }
+
+        for (int c = 0; c < 3; ++c) {
+            output.positions[v*3+c] = position[c];
+            output.normals[v*3+c] = normal[c];
+            output.tangents[v*4+c] = tangent[c];
+        }
+        output.tangents[v*4+3] = pose.tangents[v*4+3];
+    }
+}
+
+bool Skinning::benchmark(int vertex_count, int joint_count, int thread_count)
+{
+    const int kRuns = 20;
+    //Summation order differs from the reference, values are around 1
+    const float kTolerance = 1e-4f;
+
+    joint_count = glm::clamp(joint_count, 1, 256);
+
+    std::srand(1);
+
+    //A random cloud of vertices with four random influences each
+    BindPose pose;
+    pose.vertex_count = vertex_count;
+
+    for (int v = 0; v < vertex_count; ++v) {
+        for (int c = 0; c < 3; ++c) {
+            pose.positions.push_back(random_float() * 2.0f - 1.0f);
+            pose.normals.push_back(random_float() * 2.0f - 1.0f);
+            pose.tangents.push_back(random_float() * 2.0f - 1.0f);
+        }
+        pose.tangents.push_back(1.0f);
+
+        uint32_t joints = 0;
+        uint32_t weights = 0;
+        int weight_left = 255;
+
+        for (int i = 0; i < 4; ++i) {
+            int weight = (i == 3) ? weight_left : 
+                std::rand() % (weight_left + 1);
+            weight_left -= weight;
+
+            joints |= uint32_t(std::rand() % joint_count) << (i * 8);
+            weights |= uint32_t(weight) << (i * 8);
+        }
+
+        pose.joint_indices.push_back(joints);
+        pose.joint_weights.push_back(weights);
+    }
+
+    vector<mat4> palette(joint_count);
+    for (int j = 0; j < joint_count; ++j) {
+        palette[j] = glm::translate(random_float(), random_float(), 
+                                    random_float()) *
+                     glm::rotate(random_float() * 360.0f, 
+                                 random_float() - 0.5f, 
+                                 random_float() - 0.5f, 
+                                 random_float() + 0.1f);
+    }
+
+    cout << "Skinning, " << vertex_count << " vertices, " 
+         << joint_count << " joints" << endl;
+
+    Output reference;
+    double start = kc::time();
+    skin_reference(pose, &palette[0], reference);
+    double reference_time = kc::time() - start;
+
+    int counts[] = { 1, thread_count };
+    bool success = true;
+
+    for (int t = 0; t < (thread_count > 1 ? 2 : 1); ++t) {
+        Skinning skinning(counts[t]);
+        Output output;
+
+        start = kc::time();
+        for (int i = 0; i < kRuns; ++i) {
+            skinning.add(pose, &palette[0], output);
+            skinning.run();
+        }
+        double ms = (kc::time() - start) * 1000.0 / kRuns;
+
+        float max_error = 0.0f;
+        for (size_t i = 0; i < output.positions.size(); ++i) {
+            max_error = std::max(max_error, std::abs(output.positions[i] - 
+                                                     reference.positions[i]));
+            max_error = std::max(max_error, std::abs(output.normals[i] - 
+                                                     reference.normals[i]));
+        }
+        for (size_t i = 0; i < output.tangents.size(); ++i) {
+            max_error = std::max(max_error, std::abs(output.tangents[i] - 
+                                                     reference.tangents[i]));
+        }
+
+        cout << counts[t] << " thread(s): " << ms << " ms per mesh, "
+             << vertex_count / (ms * 1000.0) << " million vertices/s, "
+             << "largest difference to reference " << max_error << endl;
+
+        if (!(max_error <= kTolerance)) {
+            cerr << "Skinning differs from the reference by more than " 
+                 << kTolerance << "." << endl;
+            success = false;
+        }
+    }
+
+    cout << "Reference: " << reference_time * 1000.0 << " ms" << endl;
+
+    return success;
+}
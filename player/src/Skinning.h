@@ -0,0 +1,120 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef SKINNING_H
+#define SKINNING_H
+
+#include "common.h"
+#include "WorkerPool.h"
+
+/**
+ * Linear blend skinning on the CPU. Every vertex is transformed by the sum
+ * of up to four palette matrices, weighted by its influences. Normals and 
+ * tangents use the upper 3x3 part of that sum instead of its inverse 
+ * transpose, here and in skin.vert. This is only correct for joints that 
+ * are scaled uniformly, non-uniform scale skews the normals. They are not 
+ * renormalized, shaders do that anyway.
+ *
+ * Meshes are split into blocks of vertices that are skinned in parallel, 
+ * with SSE2 where available. This class doesn't use OpenGL.
+ */
+class Skinning : boost::noncopyable, WorkerPool::Task
+{
+    public:
+
+    /**
+     * The vertices of a skinned mesh in the pose the skin was bound in. 
+     * The joints and weights of the four influences of a vertex are packed
+     * as bytes, the first influence in the lowest byte. Weights sum up to 
+     * 255.
+     */
+    struct BindPose {
+        int vertex_count;
+        vector<float> positions; /**< Three per vertex */
+        vector<float> normals; /**< Three per vertex */
+        vector<float> tangents; /**< Four per vertex, w is the handedness */
+        vector<uint32_t> joint_indices;
+        vector<uint32_t> joint_weights;
+    };
+
+    /**
+     * Skinned vertices, laid out like the bind pose.
+     */
+    struct Output {
+        vector<float> positions;
+        vector<float> normals;
+        vector<float> tangents;
+    };
+
+    /**
+     * @param thread_count Number of threads used by run(), including the 
+     * calling one.
+     */
+    Skinning(int thread_count);
+
+    /**
+     * Queues a mesh for the next run(). The pose, the palette and the output
+     * must stay valid until then.
+     * @param palette One matrix per joint, from bind pose to skinned space.
+     */
+    void add(const BindPose& pose, const mat4* palette, Output& output);
+
+    /**
+     * Skins all queued meshes and clears the queue.
+     */
+    void run();
+
+    /**
+     * Same as run() for a single mesh, but transforms every vertex by each
+     * of its joints and blends the results. Slow, used to validate run().
+     */
+    static void skin_reference(const BindPose& pose, const mat4* palette, 
+                               Output& output);
+
+    /**
+     * Skins a random mesh with the given threads, compares the result with
+     * skin_reference() and prints the timings.
+     * @return False if the result differs from the reference.
+     */
+    static bool benchmark(int vertex_count, int joint_count, 
+                          int thread_count);
+
+    private:
+
+    /**
+     * A range of vertices of a queued mesh.
+     */
+    struct Block {
+        const BindPose* pose;
+        const mat4* palette;
+        Output* output;
+        int first_vertex;
+        int vertex_count;
+    };
+
+    vector<Block> _blocks;
+    WorkerPool _pool;
+
+    void run_job(int block);
+    static void skin(const Block& block);
+};
+
+#endif
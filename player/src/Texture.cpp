@@ -21,6 +21,8 @@
 
 #include "Texture.h"
 #include "Image.h"
+#include "BakedImage.h"
+#include "Profiler.h"
 #include "RtrPlayerConfig.h"
 
 Texture::UnitManager Texture::_unit_manager;
@@ -35,11 +37,76 @@ Texture::Texture(const Image& image,
     _dimensions(image.dimensions()),
     _format(image.format()),
     _internal_format(image.internal_format()),
+    _level_count(1),
+    _compressed(false),
     _width(image.width()), _height(image.height()), _depth(image.depth())
 {
     setup(image.const_data(), image.type(), 0);
 }
 
+Texture::Texture(const BakedImage& image,
+                 GLenum mag_filter, GLenum min_filter,
+                 GLenum wrap_method) :
+    _bound_unit(0),
+    _target(GL_TEXTURE_2D),
+    _min_filter(min_filter),
+    _mag_filter(mag_filter),
+    _wrap_method(wrap_method),
+    _dimensions(2),
+    _format(image.format()),
+    _internal_format(image.internal_format()),
+    _level_count(1),
+    _compressed(image.is_compressed()),
+    _width(image.width()), _height(image.height()), _depth(0)
+{
+    glGenTextures(1, &_texture_name);
+
+    bind();
+
+    set_parameters();
+
+    // The mip chain was precomputed by the bakery, we upload every level
+    // directly from the mapped file instead of calling glGenerateMipmap.
+    int level_count = image.level_count();
+
+    if (_min_filter == GL_NEAREST || _min_filter == GL_LINEAR) {
+        level_count = 1;
+    }
+
+    glTexParameteri(_target, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(_target, GL_TEXTURE_MAX_LEVEL, level_count - 1);
+
+    _level_count = level_count;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (int i = 0; i < level_count; ++i) {
+        if (image.is_compressed()) {
+            glCompressedTexImage2D(GL_TEXTURE_2D,            // target
+                                   i,                        // level
+                                   _internal_format,         // internalFormat
+                                   image.level_width(i),     // size
+                                   image.level_height(i),
+                                   0,                        // border
+                                   GLsizei(image.level_size(i)), // imageSize
+                                   image.level_data(i));     // data
+            continue;
+        }
+
+        glTexImage2D(GL_TEXTURE_2D,            // target
+                     i,                        // level
+                     _internal_format,         // internalFormat
+                     image.level_width(i),     // size
+                     image.level_height(i),
+                     0,                        // border
+                     _format,                  // format
+                     image.type(),             // type
+                     image.level_data(i));     // pixels
+    }
+
+    unbind();
+}
+
 Texture::Texture(int dimensions, int w, int h, int d,
                  GLenum format, GLenum internal_format,
                  GLenum mag_filter, GLenum min_filter,
@@ -52,6 +119,8 @@ Texture::Texture(int dimensions, int w, int h, int d,
     _dimensions(dimensions),
     _format(format),
     _internal_format(internal_format),
+    _level_count(1),
+    _compressed(false),
     _width(w), _height(h), _depth(d)
 {
     setup(NULL, GL_FLOAT, samples);
@@ -64,14 +133,32 @@ Texture::~Texture()
     glDeleteTextures(1, &_texture_name);
 }
 
+void Texture::set_parameters()
+{
+    assert(_bound_unit != 0);
+
+    GLenum wrap_enums[] = {GL_TEXTURE_WRAP_S, 
+                           GL_TEXTURE_WRAP_T, 
+                           GL_TEXTURE_WRAP_R};
+
+    if (EXTGL_EXT_texture_filter_anisotropic) {
+        glTexParameterf(_target, GL_TEXTURE_MAX_ANISOTROPY_EXT,
+                        config.max_anisotropy());
+    }
+ 
+    glTexParameteri(_target, GL_TEXTURE_MAG_FILTER, _mag_filter);
+    glTexParameteri(_target, GL_TEXTURE_MIN_FILTER, _min_filter);
+
+    for (int i = 0; i < _dimensions; ++i) {
+        glTexParameteri(_target, wrap_enums[i], _wrap_method);
+    }
+}
+
 void Texture::setup(const void* data, GLenum type, int samples)
 { 
     assert(_dimensions >= 1 && _dimensions <= 3);
     
     GLenum targets[] = {GL_TEXTURE_1D, GL_TEXTURE_2D, GL_TEXTURE_3D};
-    GLenum wrap_enums[] = {GL_TEXTURE_WRAP_S, 
-                           GL_TEXTURE_WRAP_T, 
-                           GL_TEXTURE_WRAP_R};
 
     _target = targets[_dimensions-1];
 
@@ -93,17 +180,7 @@ void Texture::setup(const void* data, GLenum type, int samples)
     bind();
 
     if (samples == 0) {
-        if (EXTGL_EXT_texture_filter_anisotropic) {
-            glTexParameterf(_target, GL_TEXTURE_MAX_ANISOTROPY_EXT,
-                            config.max_anisotropy());
-        }
-     
-        glTexParameteri(_target, GL_TEXTURE_MAG_FILTER, _mag_filter);
-        glTexParameteri(_target, GL_TEXTURE_MIN_FILTER, _min_filter);
-
-        for (int i = 0; i < _dimensions; ++i) {
-            glTexParameteri(_target, wrap_enums[i], _wrap_method);
-        }
+        set_parameters();
     }
 
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
@@ -182,6 +259,7 @@ void Texture::bind()
     _bound_unit = _unit_manager.get_unit();
     glActiveTexture(_bound_unit);
     glBindTexture(_target, _texture_name);
+    Profiler::count(Profiler::STATE_BINDS);
 }
 
 void Texture::unbind()
@@ -258,5 +336,12 @@ void Texture::generate_mipmaps()
 
     if (_min_filter != GL_NEAREST && _min_filter != GL_LINEAR) {
         glGenerateMipmap(_target);
+
+        int size = std::max(_width, std::max(_height, _depth));
+        _level_count = 1;
+        while (size > 1) {
+            size /= 2;
+            ++_level_count;
+        }
     }    
 }
@@ -25,6 +25,7 @@
 #include "common.h"
 
 class Image;
+class BakedImage;
 
 /**
  * Represents a texture in GPU memory.
@@ -42,6 +43,8 @@ class Texture : boost::noncopyable
     int _dimensions; /**< Number of dimensions. 1, 2 or 3 */
     GLenum _format; /**< GL image format */
     GLenum _internal_format; /**< GL internal format */
+    int _level_count; /**< Number of mip levels */
+    bool _compressed; /**< Levels hold block-compressed data */
     int _width, /**< image width */
         _height, /**< image height. 0 if 1D */
         _depth; /**< image depth. 0 if 1D or 2D */
@@ -61,6 +64,19 @@ class Texture : boost::noncopyable
             GLenum min_filter = GL_LINEAR_MIPMAP_LINEAR,
             GLenum wrap_method = GL_REPEAT);
 
+    /**
+     * Construct texture from a baked texture container. All mip levels
+     * stored in the container are uploaded, no mipmaps are generated.
+     * @param image The mapped container.
+     * @param mag_filter Magnification filter.
+     * @param min_filter Minification filter.
+     * @param wrap_method Texture wrap method.
+     */
+    Texture(const BakedImage& image,
+            GLenum mag_filter = GL_LINEAR,
+            GLenum min_filter = GL_LINEAR_MIPMAP_LINEAR,
+            GLenum wrap_method = GL_REPEAT);
+
     /**
      * Construct an uninitialized texture.
      * @param dimensions Number of dimensions.
@@ -112,6 +128,16 @@ class Texture : boost::noncopyable
     int width() const { return _width; }
     int height() const { return _height; }
     int depth() const { return _depth; }
+
+    GLenum target() const { return _target; }
+    GLenum format() const { return _format; }
+    GLenum internal_format() const { return _internal_format; }
+    int level_count() const { return _level_count; }
+    bool is_compressed() const { return _compressed; }
+
+    GLenum mag_filter() const { return _mag_filter; }
+    GLenum min_filter() const { return _min_filter; }
+    GLenum wrap_method() const { return _wrap_method; }
     
     private:
 
@@ -122,6 +148,11 @@ class Texture : boost::noncopyable
      */
     void setup(const void* data, GLenum type, int samples);
 
+    /**
+     * Set filter, wrap and anisotropy parameters. Texture has to be bound.
+     */
+    void set_parameters();
+
     public:
           
     /**
@@ -21,7 +21,9 @@
 
 #include "TextureArray.h"
 #include "Texture.h"
+#include "Profiler.h"
 #include "RtrPlayerConfig.h"
+#include "format_map.h"
 
 TextureArray::TextureArray(int width, int height, int count,
                            GLenum format, GLenum internal_format,
@@ -30,22 +32,14 @@ TextureArray::TextureArray(int width, int height, int count,
     _bound_unit(0), _target(GL_TEXTURE_2D_ARRAY),
     _count(count), _width(width), _height(height),
     _min_filter(min_filter), _mag_filter(mag_filter), _wrap_method(wrap_method),
-    _format(format), _internal_format(internal_format)
+    _format(format), _internal_format(internal_format),
+    _level_count(1), _compressed(false)
 {
     glGenTextures(1, &_texture_name);
 
     bind();
 
-    if(EXTGL_EXT_texture_filter_anisotropic) {
-        glTexParameterf(_target, GL_TEXTURE_MAX_ANISOTROPY_EXT,
-                        config.max_anisotropy());
-    }
-
-    glTexParameteri(_target, GL_TEXTURE_MAG_FILTER, _mag_filter);
-    glTexParameteri(_target, GL_TEXTURE_MIN_FILTER, _min_filter);
-
-    glTexParameteri(_target, GL_TEXTURE_WRAP_S, _wrap_method);
-    glTexParameteri(_target, GL_TEXTURE_WRAP_T, _wrap_method);
+    set_parameters();
 
     glTexImage3D(_target,               // target
                  0,                     // level
@@ -62,6 +56,51 @@ TextureArray::TextureArray(int width, int height, int count,
     unbind();
 }
 
+TextureArray::TextureArray(const Texture& layout, int count) :
+    _bound_unit(0), _target(GL_TEXTURE_2D_ARRAY),
+    _count(count), _width(layout.width()), _height(layout.height()),
+    _min_filter(layout.min_filter()), _mag_filter(layout.mag_filter()),
+    _wrap_method(layout.wrap_method()),
+    _format(layout.format()), _internal_format(layout.internal_format()),
+    _level_count(layout.level_count()), _compressed(layout.is_compressed())
+{
+    glGenTextures(1, &_texture_name);
+
+    bind();
+
+    set_parameters();
+
+    glTexParameteri(_target, GL_TEXTURE_BASE_LEVEL, 0);
+    glTexParameteri(_target, GL_TEXTURE_MAX_LEVEL, _level_count - 1);
+
+    for (int i = 0; i < _level_count; ++i) {
+        int w = std::max(1, _width >> i);
+        int h = std::max(1, _height >> i);
+
+        if (_compressed) {
+            // 4x4 blocks of 8 bytes for BC1, 16 bytes for BC3 and BC5
+            GLsizei block_size = 16;
+
+            if (_internal_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+                _internal_format == GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
+                block_size = 8;
+            }
+
+            GLsizei size = ((w + 3) / 4) * ((h + 3) / 4) * block_size;
+
+            glCompressedTexImage3D(_target, i, _internal_format,
+                                   w, h, _count, 0, 
+                                   size * _count, NULL);
+            continue;
+        }
+
+        glTexImage3D(_target, i, _internal_format, w, h, _count, 0,
+                     _format, GL_FLOAT, NULL);
+    }
+
+    unbind();
+}
+
 TextureArray::~TextureArray()
 {
     assert(_bound_unit == 0);
@@ -76,6 +115,7 @@ void TextureArray::bind()
     _bound_unit = Texture::unit_manager().get_unit();
     glActiveTexture(_bound_unit);
     glBindTexture(_target, _texture_name);
+    Profiler::count(Profiler::STATE_BINDS);
 }
 
 void TextureArray::unbind()
@@ -90,6 +130,94 @@ void TextureArray::unbind()
     _bound_unit = 0;
 }
 
+void TextureArray::set_parameters()
+{
+    assert(_bound_unit != 0);
+
+    if(EXTGL_EXT_texture_filter_anisotropic) {
+        glTexParameterf(_target, GL_TEXTURE_MAX_ANISOTROPY_EXT,
+                        config.max_anisotropy());
+    }
+
+    glTexParameteri(_target, GL_TEXTURE_MAG_FILTER, _mag_filter);
+    glTexParameteri(_target, GL_TEXTURE_MIN_FILTER, _min_filter);
+
+    glTexParameteri(_target, GL_TEXTURE_WRAP_S, _wrap_method);
+    glTexParameteri(_target, GL_TEXTURE_WRAP_T, _wrap_method);
+}
+
+void TextureArray::copy_layer(int layer, Texture& texture)
+{
+    assert(layer >= 0 && layer < _count);
+    assert(texture.width() == _width && texture.height() == _height);
+    assert(texture.level_count() == _level_count);
+    assert(texture.is_compressed() == _compressed);
+    assert(texture.target() == GL_TEXTURE_2D);
+
+    // Uncompressed levels are read back in the type of the internal 
+    // format, always as RGBA.
+    GLenum format = _format;
+    GLenum type = GL_UNSIGNED_BYTE;
+
+    if (!_compressed) {
+        get_format_and_type(_internal_format, &format, &type);
+    }
+
+    int type_size = 1;
+
+    if (type == GL_FLOAT || type == GL_INT || type == GL_UNSIGNED_INT) {
+        type_size = 4;
+    } else if (type == GL_HALF_FLOAT || type == GL_SHORT || 
+               type == GL_UNSIGNED_SHORT) {
+        type_size = 2;
+    }
+
+    vector<char> pixels;
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // Read back level by level, the textures are only copied once after
+    // loading.
+    for (int i = 0; i < _level_count; ++i) {
+        int w = std::max(1, _width >> i);
+        int h = std::max(1, _height >> i);
+
+        GLint size = 0;
+
+        texture.bind();
+
+        if (_compressed) {
+            glGetTexLevelParameteriv(GL_TEXTURE_2D, i, 
+                                     GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &size);
+        } else {
+            size = w * h * 4 * type_size;
+        }
+
+        pixels.resize(std::max(size, 1));
+
+        if (_compressed) {
+            glGetCompressedTexImage(GL_TEXTURE_2D, i, &pixels[0]);
+        } else {
+            glGetTexImage(GL_TEXTURE_2D, i, GL_RGBA, type, &pixels[0]);
+        }
+
+        texture.unbind();
+
+        bind();
+
+        if (_compressed) {
+            glCompressedTexSubImage3D(_target, i, 0, 0, layer, w, h, 1,
+                                      _internal_format, size, &pixels[0]);
+        } else {
+            glTexSubImage3D(_target, i, 0, 0, layer, w, h, 1,
+                            GL_RGBA, type, &pixels[0]);
+        }
+
+        unbind();
+    }
+}
+
 void TextureArray::generate_mipmaps()
 {
     assert(_bound_unit != 0);
@@ -24,6 +24,8 @@
 
 #include "common.h"
 
+class Texture;
+
 class TextureArray : boost::noncopyable
 {
     GLenum _bound_unit;
@@ -40,6 +42,11 @@ class TextureArray : boost::noncopyable
     GLenum _format;
     GLenum _internal_format;
 
+    int _level_count;
+    bool _compressed;
+
+    void set_parameters();
+
     public:
 
     TextureArray(int width, int height, int count,
@@ -47,8 +54,21 @@ class TextureArray : boost::noncopyable
                  GLenum mag_filter = GL_NEAREST, GLenum min_filter = GL_NEAREST,
                  GLenum wrap_method = GL_CLAMP_TO_EDGE);
 
+    /**
+     * Creates an array of count layers, each with the size, format, mip 
+     * levels and sampling parameters of the given texture. The layers are
+     * undefined until filled with copy_layer().
+     */
+    TextureArray(const Texture& layout, int count);
+
     ~TextureArray();
 
+    /**
+     * Copies all mip levels of a texture into a layer. The texture must 
+     * match the layout of the array. Both must be unbound.
+     */
+    void copy_layer(int layer, Texture& texture);
+
     void bind();
     void unbind();
 
@@ -0,0 +1,156 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "TexturePacker.h"
+#include "Texture.h"
+#include "TextureArray.h"
+
+namespace {
+
+/**
+ * Arrays stay bound across materials. This leaves enough units for the
+ * shadow maps and light textures.
+ */
+const int MAX_BOUND_ARRAYS = 16;
+
+}
+
+bool TexturePacker::Layout::operator<(const Layout& other) const
+{
+    const GLuint a[] = {target, width, height, level_count, internal_format, 
+                        format, min_filter, mag_filter, wrap_method};
+    const GLuint b[] = {other.target, other.width, other.height, 
+                        other.level_count, other.internal_format, other.format,
+                        other.min_filter, other.mag_filter, other.wrap_method};
+
+    return std::lexicographical_compare(a, a + 9, b, b + 9);
+}
+
+TexturePacker::Layout TexturePacker::layout(const Texture& texture)
+{
+    Layout layout;
+
+    layout.target = texture.target();
+    layout.width = texture.width();
+    layout.height = texture.height();
+    layout.level_count = texture.level_count();
+    layout.internal_format = texture.internal_format();
+    layout.format = texture.format();
+    layout.min_filter = texture.min_filter();
+    layout.mag_filter = texture.mag_filter();
+    layout.wrap_method = texture.wrap_method();
+
+    return layout;
+}
+
+TexturePacker::TexturePacker() :
+    _array_count(0),
+    _texture_count(0)
+{
+}
+
+TexturePacker::~TexturePacker()
+{
+    assert(_bound.empty());
+}
+
+void TexturePacker::pack(const vector<shared_ptr<Texture> >& textures,
+                         vector<Layer>& layers)
+{
+    // Group the distinct textures by layout
+    map<Texture*, size_t> first;
+    map<Layout, vector<size_t> > groups;
+
+    for (size_t i = 0; i < textures.size(); ++i) {
+        Texture* texture = textures[i].get();
+
+        assert(texture != NULL);
+        assert(!texture->is_bound());
+        //the layers of a GL_TEXTURE_2D_ARRAY
+        assert(texture->target() == GL_TEXTURE_2D);
+
+        if (first.count(texture) > 0) {
+            continue;
+        }
+
+        first[texture] = i;
+        groups[layout(*texture)].push_back(i);
+    }
+
+    GLint max_layers = 256;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+
+    layers.resize(textures.size());
+
+    map<Layout, vector<size_t> >::const_iterator it;
+    for (it = groups.begin(); it != groups.end(); ++it) {
+        const vector<size_t>& members = it->second;
+
+        for (size_t start = 0; start < members.size(); start += max_layers) {
+            int count = std::min(int(members.size() - start), int(max_layers));
+
+            shared_ptr<TextureArray> array(
+                new TextureArray(*textures[members[start]], count));
+
+            for (int j = 0; j < count; ++j) {
+                size_t index = members[start + j];
+
+                array->copy_layer(j, *textures[index]);
+
+                layers[index].array = array;
+                layers[index].layer = j;
+            }
+
+            ++_array_count;
+            _texture_count += count;
+        }
+    }
+
+    for (size_t i = 0; i < textures.size(); ++i) {
+        layers[i] = layers[first[textures[i].get()]];
+    }
+}
+
+void TexturePacker::reserve(int count)
+{
+    if (int(_bound.size()) + count > MAX_BOUND_ARRAYS) {
+        unbind_all();
+    }
+}
+
+void TexturePacker::bind(TextureArray& array)
+{
+    if (array.is_bound()) {
+        return;
+    }
+
+    array.bind();
+    _bound.push_back(&array);
+}
+
+void TexturePacker::unbind_all()
+{
+    for (size_t i = 0; i < _bound.size(); ++i) {
+        _bound[i]->unbind();
+    }
+
+    _bound.clear();
+}
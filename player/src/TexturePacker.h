@@ -0,0 +1,102 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef TEXTUREPACKER_H
+#define TEXTUREPACKER_H
+
+#include "common.h"
+
+class Texture;
+class TextureArray;
+
+/**
+ * Copies textures of equal size, format, mip levels and sampling parameters
+ * into the layers of shared texture arrays. Constant colors are 1x1 
+ * textures and end up in one array, which serves as a palette.
+ *
+ * Arrays stay bound once they were bound by a material, the following 
+ * materials that use them do not have to bind anything.
+ */
+class TexturePacker : boost::noncopyable
+{
+    public:
+
+    /**
+     * Where a texture ended up.
+     */
+    struct Layer {
+        shared_ptr<TextureArray> array;
+        int layer;
+    };
+
+    TexturePacker();
+    ~TexturePacker();
+
+    /**
+     * Packs a set of textures, the same texture may occur more than once.
+     * @param layers Receives the layer of each texture, in order.
+     */
+    void pack(const vector<shared_ptr<Texture> >& textures,
+              vector<Layer>& layers);
+
+    /**
+     * Makes room to bind count arrays which are not bound yet. If they 
+     * don't fit next to the arrays bound already, all arrays are unbound 
+     * first.
+     */
+    void reserve(int count);
+
+    /**
+     * Binds an array, unless it is bound already.
+     */
+    void bind(TextureArray& array);
+
+    /**
+     * Unbinds all arrays bound with bind().
+     */
+    void unbind_all();
+
+    int array_count() const { return _array_count; }
+    int texture_count() const { return _texture_count; }
+
+    private:
+
+    /**
+     * Textures can share an array if these are equal.
+     */
+    struct Layout {
+        GLenum target;
+        GLuint width, height, level_count;
+        GLenum internal_format, format;
+        GLenum min_filter, mag_filter, wrap_method;
+
+        bool operator<(const Layout& other) const;
+    };
+
+    static Layout layout(const Texture& texture);
+
+    vector<TextureArray*> _bound;
+
+    int _array_count;
+    int _texture_count;
+};
+
+#endif
@@ -50,6 +50,12 @@ void Timer::update_diff(double diff)
     }
 }
 
+void Timer::seek(double now)
+{
+    _now = now;
+    _diff = 0.0;
+}
+
 void Timer::pause()
 {
     _paused = true;
@@ -45,6 +45,11 @@ class Timer
 
     void update_diff(double diff);
 
+    /**
+     * Jumps to the given time, the time difference is set to 0. 
+     */
+    void seek(double now);
+
     void pause();
     void play();
     void rewind();
@@ -135,6 +135,13 @@ void TransformNode::override_transform(const mat4& matrix)
     _inverse_matrix = glm::inverse(matrix);
 }
 
+void TransformNode::listener_names(vector<string>& names) const
+{
+    for (size_t i = 0; i < _transforms.size(); ++i) {
+        _transforms[i]->listener_names(names);
+    }
+}
+
 Transform::Transform(const string& id) :
     _id(id)
 {}
@@ -183,6 +190,12 @@ bool LookAt::has_changed() const {
     return true;
 }
 
+void LookAt::listener_names(vector<string>& names) const {
+    names.push_back(_position.name());
+    names.push_back(_point_of_interest.name());
+    names.push_back(_up.name());
+}
+
 MatrixTransform::MatrixTransform(const string& id,
                                  const mat4& matrix,
                                  AnimEvaluator& evaluator) :
@@ -200,6 +213,10 @@ bool MatrixTransform::has_changed() const {
     return true;
 }
 
+void MatrixTransform::listener_names(vector<string>& names) const {
+    names.push_back(_matrix.name());
+}
+
 Rotate::Rotate(const string& id,
               const vec3& axis,
               float angle,
@@ -226,6 +243,11 @@ bool Rotate::has_changed() const {
     return true;
 }
 
+void Rotate::listener_names(vector<string>& names) const {
+    names.push_back(_axis.name());
+    names.push_back(_angle.name());
+}
+
 Scale::Scale(const string& id,
              const vec3& value,
              AnimEvaluator& evaluator) :
@@ -245,6 +267,10 @@ bool Scale::has_changed() const {
     return true;
 }
 
+void Scale::listener_names(vector<string>& names) const {
+    names.push_back(_value.name());
+}
+
 Translate::Translate(const string& id,
                      const vec3& value,
                      AnimEvaluator& evaluator) :
@@ -263,3 +289,7 @@ bool Translate::has_changed() const {
     //wee LookAt::has_changed for comments
     return true;
 }
+
+void Translate::listener_names(vector<string>& names) const {
+    names.push_back(_value.name());
+}
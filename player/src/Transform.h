@@ -74,6 +74,11 @@ public:
 
     void override_transform(const mat4& matrix);
 
+    const TransformNode* dependency() const { return _dependency; }
+
+    //Appends the names of the animation listeners of all transforms
+    void listener_names(vector<string>& names) const;
+
 private:
 
     string _id;
@@ -105,6 +110,9 @@ public:
     virtual mat4 calculate_matrix() const = 0;
     virtual bool has_changed() const = 0;
 
+    //Appends the names of the animation listeners of this transform
+    virtual void listener_names(vector<string>& names) const = 0;
+
 protected:
     Transform(const string& id);
 
@@ -121,6 +129,7 @@ public:
 
     virtual mat4 calculate_matrix() const;
     virtual bool has_changed() const ;
+    virtual void listener_names(vector<string>& names) const;
 
     LookAt(const string& id,
             const vec3& position,
@@ -146,6 +155,7 @@ public:
 
     virtual mat4 calculate_matrix() const;
     virtual bool has_changed() const ;
+    virtual void listener_names(vector<string>& names) const;
 
 private:
     
@@ -163,6 +173,7 @@ public:
 
     virtual mat4 calculate_matrix() const;
     virtual bool has_changed() const ;
+    virtual void listener_names(vector<string>& names) const;
 
 private:
     AnimListener<vec3> _axis;
@@ -180,6 +191,7 @@ public:
 
     virtual mat4 calculate_matrix() const;
     virtual bool has_changed() const ;
+    virtual void listener_names(vector<string>& names) const;
 
 private:
 
@@ -196,6 +208,7 @@ public:
     
     virtual mat4 calculate_matrix() const;
     virtual bool has_changed() const ;
+    virtual void listener_names(vector<string>& names) const;
 
 private:
 
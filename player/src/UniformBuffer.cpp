@@ -22,13 +22,59 @@
 #include "UniformBuffer.h"
 
 #include "Shader.h"
+#include "Profiler.h"
 #include <boost/regex.hpp>
 
+#include <cstring>
+
+namespace {
+
+    UniformBuffer::Entry make_entry(GLenum type, size_t offset,
+                                    size_t matrix_stride = 0,
+                                    size_t array_stride = 0,
+                                    size_t array_size = 1)
+    {
+        UniformBuffer::Entry entry = {type, offset, matrix_stride, false,
+                                      array_stride, array_size};
+        return entry;
+    }
+
+    bool check_range(const char* what, size_t begin, size_t end,
+                     size_t expected_begin, size_t expected_end)
+    {
+        if (begin == expected_begin && end == expected_end)
+            return true;
+
+        cerr << "UniformBuffer check: " << what << " marked bytes [" 
+             << begin << ", " << end << ") dirty, expected [" 
+             << expected_begin << ", " << expected_end << ")." << endl;
+        return false;
+    }
+
+}
+
 UniformBuffer::BindingManager UniformBuffer::_binding_manager;
 
 UniformBuffer::UniformBuffer(const Shader& shader,
-                             const string& block_name) 
+                             const string& block_name,
+                             const UniformBufferPoolRef& pool) :
+    _pool(pool)
+{
+    initialize(query_layout(shader, block_name));
+}
+
+UniformBuffer::UniformBuffer(const Layout& layout,
+                             const UniformBufferPoolRef& pool) :
+    _pool(pool)
+{
+    initialize(layout);
+}
+
+UniformBuffer::Layout UniformBuffer::query_layout(const Shader& shader,
+                                                  const string& block_name)
 {
+    Layout layout;
+
     GLuint program = shader.get_program_ID();
     GLint max_uniform_length;
     GLint uniform_count;
@@ -54,9 +100,7 @@ UniformBuffer::UniformBuffer(const Shader& shader,
                               GL_UNIFORM_BLOCK_DATA_SIZE,
                               &uniform_block_size);
 
-    _buffer = new byte[uniform_block_size];
-
-    _buffer_size = uniform_block_size;
+    layout.size = uniform_block_size;
 
 
     const boost::regex pattern(block_name+"\\.(.*)$");  // ..fourth
@@ -66,12 +110,15 @@ UniformBuffer::UniformBuffer(const Shader& shader,
         glGetActiveUniformName(program, uniform_indices[i], 
                                max_uniform_length, NULL, uniform_name);
         
+        GLint type;
         GLint size;
         GLint offset;
         GLint array_stride;
         GLint matrix_stride;
         GLint is_row_major;
 
+        glGetActiveUniformsiv(program, 1, (GLuint*)uniform_indices + i,
+                              GL_UNIFORM_TYPE, &type);
         glGetActiveUniformsiv(program, 1, (GLuint*)uniform_indices + i,
                               GL_UNIFORM_SIZE, &size);
         glGetActiveUniformsiv(program, 1, (GLuint*)uniform_indices + i,
@@ -83,7 +130,8 @@ UniformBuffer::UniformBuffer(const Shader& shader,
         glGetActiveUniformsiv(program, 1, (GLuint*)uniform_indices + i,
                               GL_UNIFORM_IS_ROW_MAJOR, &is_row_major);
 
-        Entry entry = {(size_t)offset,
+        Entry entry = {(GLenum)type,
+                       (size_t)offset,
                        (size_t)matrix_stride,
                        (is_row_major == GL_TRUE) ? true : false,
                        (size_t)array_stride,
@@ -91,9 +139,9 @@ UniformBuffer::UniformBuffer(const Shader& shader,
 
         string uniform_name_str(uniform_name);
         if (boost::regex_match(uniform_name_str, match, pattern)) {
-            _entries[string(match[1])] = entry;
+            layout.entries[string(match[1])] = entry;
         } else {
-            _entries[uniform_name_str] = entry;
+            layout.entries[uniform_name_str] = entry;
         }
 
     }
@@ -101,8 +149,31 @@ UniformBuffer::UniformBuffer(const Shader& shader,
     delete[] uniform_name;
     delete[] uniform_indices;
 
-    glGenBuffers(1, &_buffer_object);
+    return layout;
+}
+
+void UniformBuffer::initialize(const Layout& layout)
+{
+    _buffer_size = layout.size;
+    _buffer = new byte[_buffer_size];
+    std::fill(_buffer, _buffer + _buffer_size, 0);
+    _entries = layout.entries;
 
+    _buffer_object = 0;
+    _buffer_binding = 0xffffffff;
+
+    //everything has to be uploaded once
+    _dirty_begin = 0;
+    _dirty_end = _buffer_size;
+
+    _pool_offset = 0;
+    if (_pool)
+        _pool_offset = _pool->allocate(_buffer_size);
+}
+
+void UniformBuffer::create_buffer()
+{
+    glGenBuffers(1, &_buffer_object);
 
     glBindBuffer(GL_UNIFORM_BUFFER, _buffer_object);
 
@@ -110,17 +181,56 @@ UniformBuffer::UniformBuffer(const Shader& shader,
 
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
 
-    _block_index = block_index;
-    _buffer_binding = 0xffffffff;
+    _dirty_begin = _dirty_end = 0;
+}
+
+UniformBuffer::~UniformBuffer()
+{
+    if (_pool)
+        _pool->release(_pool_offset, _buffer_size);
+
+    if (_buffer_object != 0)
+        glDeleteBuffers(1, &_buffer_object);
+
+    delete[] _buffer;
+}
+
+GLuint UniformBuffer::get_binding() const
+{
+    if (_pool)
+        return _pool->get_binding();
+
+    assert(_buffer_binding != 0xffffffff);
+    return _buffer_binding; 
 }
 
 void UniformBuffer::send_to_GPU()
 {
+    if (_dirty_begin == _dirty_end)
+        return;
+
+    if (_pool) {
+        //the pool uploads its dirty range before the next bind
+        _pool->write(_pool_offset + _dirty_begin, _buffer + _dirty_begin, 
+                     _dirty_end - _dirty_begin);
+        _dirty_begin = _dirty_end = 0;
+        return;
+    }
+
+    if (_buffer_object == 0) {
+        create_buffer();
+        return;
+    }
+
     glBindBuffer(GL_UNIFORM_BUFFER, _buffer_object);
 
-    glBufferSubData(GL_UNIFORM_BUFFER, 0, _buffer_size, _buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, _dirty_begin, 
+                    _dirty_end - _dirty_begin, _buffer + _dirty_begin);
+    Profiler::count(Profiler::UBO_BYTES, _dirty_end - _dirty_begin);
 
     glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    _dirty_begin = _dirty_end = 0;
 }
 
 bool UniformBuffer::has_entry(const string& name) const {
@@ -129,14 +239,27 @@ bool UniformBuffer::has_entry(const string& name) const {
 
 void UniformBuffer::bind()
 {
+    if (_pool) {
+        _pool->bind_range(_pool_offset, _buffer_size);
+        return;
+    }
+
+    if (_buffer_object == 0)
+        create_buffer();
+
     if (_buffer_binding == 0xffffffff) 
         _buffer_binding = _binding_manager.get_binding();
 
     glBindBufferBase(GL_UNIFORM_BUFFER, _buffer_binding, _buffer_object);
+    Profiler::count(Profiler::STATE_BINDS);
 }
 
 void UniformBuffer::unbind()
 {
+    //the binding point of a pool stays reserved
+    if (_pool)
+        return;
+
     if (_buffer_binding == 0xffffffff)
         return;
 
@@ -147,6 +270,120 @@ void UniformBuffer::unbind()
 
 }
 
+bool UniformBuffer::check_std140()
+{
+    //layout(std140) uniform Check {
+    //    float scale;
+    //    vec3 color;
+    //    float alpha;
+    //    mat3 normal_matrix;
+    //    float weights[4];
+    //    vec2 uv;
+    //};
+    Layout layout;
+    layout.size = 160;
+    layout.entries["scale"] = make_entry(GL_FLOAT, 0);
+    layout.entries["color"] = make_entry(GL_FLOAT_VEC3, 16);
+    layout.entries["alpha"] = make_entry(GL_FLOAT, 28);
+    layout.entries["normal_matrix"] = make_entry(GL_FLOAT_MAT3, 32, 16);
+    layout.entries["weights"] = make_entry(GL_FLOAT, 80, 0, 16, 4);
+    layout.entries["uv"] = make_entry(GL_FLOAT_VEC2, 144);
+
+    UniformBuffer buffer(layout);
+
+    Field<float> scale = buffer.field<float>("scale");
+    Field<vec3> color = buffer.field<vec3>("color");
+    Field<float> alpha = buffer.field<float>("alpha");
+    Field<mat3> normal_matrix = buffer.field<mat3>("normal_matrix");
+    Field<float> weights = buffer.field<float>("weights");
+    Field<vec2> uv = buffer.field<vec2>("uv");
+
+    bool success = scale.is_valid() && color.is_valid() && 
+        alpha.is_valid() && normal_matrix.is_valid() && 
+        weights.is_valid() && uv.is_valid();
+
+    if (!success)
+        cerr << "UniformBuffer check: Could not resolve all fields." << endl;
+
+    success &= check_range("a new block", 
+                           buffer._dirty_begin, buffer._dirty_end, 0, 160);
+
+    //Every field is written right after an upload, i.e. on a clean block,
+    //so that each dirty range covers exactly the bytes of that field.
+    float expected[40];
+    std::fill(expected, expected + 40, 0.0f);
+
+    buffer._dirty_begin = buffer._dirty_end = 0;
+    buffer.set(scale, 1.5f);
+    expected[0] = 1.5f;
+    success &= check_range("scale", 
+                           buffer._dirty_begin, buffer._dirty_end, 0, 4);
+
+    buffer._dirty_begin = buffer._dirty_end = 0;
+    buffer.set(color, vec3(2.0f, 3.0f, 4.0f));
+    expected[4] = 2.0f; expected[5] = 3.0f; expected[6] = 4.0f;
+    success &= check_range("color", 
+                           buffer._dirty_begin, buffer._dirty_end, 16, 28);
+
+    //packed into the last component of the vec3 slot
+    buffer._dirty_begin = buffer._dirty_end = 0;
+    buffer.set(alpha, 5.0f);
+    expected[7] = 5.0f;
+    success &= check_range("alpha", 
+                           buffer._dirty_begin, buffer._dirty_end, 28, 32);
+
+    //columns are padded to a vec4
+    buffer._dirty_begin = buffer._dirty_end = 0;
+    buffer.set(normal_matrix, mat3(6.0f, 7.0f, 8.0f,
+                                   9.0f, 10.0f, 11.0f,
+                                   12.0f, 13.0f, 14.0f));
+    for (int c = 0; c < 3; ++c)
+        for (int r = 0; r < 3; ++r)
+            expected[8 + c * 4 + r] = 6.0f + c * 3 + r;
+    success &= check_range("normal_matrix", 
+                           buffer._dirty_begin, buffer._dirty_end, 32, 76);
+
+    //array elements are padded to a vec4
+    for (int i = 0; i < 4; ++i) {
+        buffer._dirty_begin = buffer._dirty_end = 0;
+        buffer.set(weights, i, 20.0f + i);
+        expected[20 + i * 4] = 20.0f + i;
+
+        size_t offset = 80 + i * 16;
+        success &= check_range("weights", 
+                               buffer._dirty_begin, buffer._dirty_end, 
+                               offset, offset + 4);
+    }
+
+    buffer._dirty_begin = buffer._dirty_end = 0;
+    buffer.set(uv, vec2(30.0f, 31.0f));
+    expected[36] = 30.0f; expected[37] = 31.0f;
+    success &= check_range("uv", 
+                           buffer._dirty_begin, buffer._dirty_end, 144, 152);
+
+    //the padding has to be left untouched
+    if (buffer.size() != sizeof(expected) || 
+        std::memcmp(buffer.data(), expected, sizeof(expected)) != 0) {
+        
+        const float* data = reinterpret_cast<const float*>(buffer.data());
+        for (size_t i = 0; i < buffer.size() / 4 && i < 40; ++i) {
+            if (data[i] != expected[i])
+                cerr << "UniformBuffer check: Byte " << i * 4 << " holds " 
+                     << data[i] << ", expected " << expected[i] << "." 
+                     << endl;
+        }
+        success = false;
+    }
+
+    //nothing has been sent to the GPU
+    buffer._dirty_begin = buffer._dirty_end = 0;
+
+    cout << "UniformBuffer std140 check " 
+         << (success ? "passed." : "failed.") << endl;
+
+    return success;
+}
+
 GLuint UniformBuffer::BindingManager::get_binding()
 {
     if (_binding_list == NULL)
@@ -197,3 +434,162 @@ UniformBuffer::BindingManager::~BindingManager() {
     if (_binding_list != NULL)
         delete[] _binding_list;
 }
+
+UniformBufferPool::UniformBufferPool() :
+    _size(0),
+    _alignment(0),
+    _buffer_object(0),
+    _buffer_capacity(0),
+    _binding(0xffffffff),
+    _dirty_begin(0),
+    _dirty_end(0)
+{
+    reset_statistics();
+}
+
+UniformBufferPool::~UniformBufferPool()
+{
+    if (_buffer_object != 0)
+        glDeleteBuffers(1, &_buffer_object);
+
+    if (_binding != 0xffffffff)
+        UniformBuffer::_binding_manager.return_binding(_binding);
+}
+
+void UniformBufferPool::initialize()
+{
+    if (_alignment != 0) return;
+
+    GLint alignment;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    _alignment = (alignment > 0) ? alignment : 256;
+
+    glGenBuffers(1, &_buffer_object);
+    _binding = UniformBuffer::_binding_manager.get_binding();
+}
+
+size_t UniformBufferPool::allocate(size_t size)
+{
+    initialize();
+
+    size_t aligned_size = ((size + _alignment - 1) / _alignment) * _alignment;
+
+    list<Block>::iterator it;
+    for (it = _free_blocks.begin(); it != _free_blocks.end(); ++it) {
+        if (it->size >= aligned_size) {
+            size_t offset = it->offset;
+            it->offset += aligned_size;
+            it->size -= aligned_size;
+            if (it->size == 0)
+                _free_blocks.erase(it);
+            return offset;
+        }
+    }
+
+    size_t offset = _size;
+    _size += aligned_size;
+
+    if (_data.size() < _size)
+        _data.resize(glm::max(_size, _data.size() * 2));
+
+    return offset;
+}
+
+void UniformBufferPool::release(size_t offset, size_t size)
+{
+    size_t aligned_size = ((size + _alignment - 1) / _alignment) * _alignment;
+
+    //Free blocks are sorted by offset, neighbours are merged
+    list<Block>::iterator next = _free_blocks.begin();
+    while (next != _free_blocks.end() && next->offset < offset)
+        ++next;
+
+    assert(next == _free_blocks.end() || offset + aligned_size <= next->offset);
+
+    Block block = { offset, aligned_size };
+    list<Block>::iterator it = _free_blocks.insert(next, block);
+
+    if (next != _free_blocks.end() && it->offset + it->size == next->offset) {
+        it->size += next->size;
+        _free_blocks.erase(next);
+    }
+
+    if (it != _free_blocks.begin()) {
+        list<Block>::iterator previous = it;
+        --previous;
+
+        if (previous->offset + previous->size == it->offset) {
+            previous->size += it->size;
+            _free_blocks.erase(it);
+            it = previous;
+        }
+    }
+
+    //A free block at the end is given back to the pool
+    if (it->offset + it->size == _size) {
+        _size = it->offset;
+        _free_blocks.erase(it);
+    }
+}
+
+void UniformBufferPool::write(size_t offset, const byte* data, size_t size)
+{
+    assert(offset + size <= _size);
+
+    std::memcpy(&_data[offset], data, size);
+
+    if (_dirty_begin == _dirty_end) {
+        _dirty_begin = offset;
+        _dirty_end = offset + size;
+    } else {
+        _dirty_begin = glm::min(_dirty_begin, offset);
+        _dirty_end = glm::max(_dirty_end, offset + size);
+    }
+}
+
+void UniformBufferPool::flush()
+{
+    if (_buffer_capacity < _data.size()) {
+        //the pool grew, reallocate and upload everything
+        glBindBuffer(GL_UNIFORM_BUFFER, _buffer_object);
+        glBufferData(GL_UNIFORM_BUFFER, _data.size(), &_data[0], 
+                     GL_STATIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        _buffer_capacity = _data.size();
+        _statistics.uploads++;
+        _statistics.bytes_uploaded += _data.size();
+        Profiler::count(Profiler::UBO_BYTES, _data.size());
+    } else if (_dirty_begin != _dirty_end) {
+        glBindBuffer(GL_UNIFORM_BUFFER, _buffer_object);
+        glBufferSubData(GL_UNIFORM_BUFFER, _dirty_begin, 
+                        _dirty_end - _dirty_begin, &_data[_dirty_begin]);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        _statistics.uploads++;
+        _statistics.bytes_uploaded += _dirty_end - _dirty_begin;
+        Profiler::count(Profiler::UBO_BYTES, _dirty_end - _dirty_begin);
+    }
+
+    _dirty_begin = _dirty_end = 0;
+}
+
+void UniformBufferPool::bind_range(size_t offset, size_t size)
+{
+    flush();
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, _binding, _buffer_object, 
+                      offset, size);
+
+    _statistics.range_binds++;
+    _statistics.bytes_bound += size;
+    Profiler::count(Profiler::STATE_BINDS);
+}
+
+void UniformBufferPool::reset_statistics()
+{
+    _statistics.range_binds = 0;
+    _statistics.uploads = 0;
+    _statistics.bytes_uploaded = 0;
+    _statistics.bytes_bound = 0;
+}
@@ -25,12 +25,22 @@
 #include "common.h"
 #include "type_info.h"
 
+#include <boost/static_assert.hpp>
+
 class Shader;
+class UniformBufferPool;
+
+typedef shared_ptr<UniformBufferPool> UniformBufferPoolRef;
 
 class UniformBuffer
 {
+    friend class UniformBufferPool;
+
+    public:
+
     struct Entry
     {
+        GLenum type; /**< GL_UNIFORM_TYPE, e.g. GL_FLOAT_VEC3 */
         size_t offset;
         size_t matrix_stride;
         bool matrix_is_row_major;
@@ -38,56 +48,216 @@ class UniformBuffer
         size_t array_size;
     };
 
+    /**
+     * Memory layout of a uniform block, as queried from a linked program or
+     * written down by hand (e.g. the std140 rules), which allows to fill a 
+     * buffer without a GL context.
+     */
+    struct Layout
+    {
+        size_t size;
+        map<string, Entry> entries;
+
+        Layout() : size(0) {}
+    };
+
+    /**
+     * Handle to one member of a uniform block. Resolving a field once with
+     * UniformBuffer::field() avoids the name lookup on every set. The value 
+     * type is fixed at compile-time and checked against the block when the 
+     * field is resolved.
+     */
+    template<typename T> class Field
+    {
+        friend class UniformBuffer;
+
+        Entry _entry;
+        bool _valid;
+
+        //the buffer is written column by column, which needs the glm types
+        //to be tightly packed
+        BOOST_STATIC_ASSERT( gltype_info<T>::column_size * 
+                             gltype_info<T>::columns == 
+                             gltype_info<T>::components * 4 );
+        BOOST_STATIC_ASSERT( sizeof(T) == gltype_info<T>::components * 4 );
+
+        public:
+
+        typedef T value_type;
+
+        Field() : _valid(false) {}
+
+        bool is_valid() const { return _valid; }
+    };
+
+    private:
+
     byte* _buffer;
     size_t _buffer_size;
     map<string, Entry> _entries;
-    GLuint _block_index;
     GLuint _buffer_object;
     GLuint _buffer_binding;
 
+    UniformBufferPoolRef _pool; /**< Pool holding the GPU copy, optional. */
+    size_t _pool_offset;
+
+    //Bytes changed since the last send_to_GPU(), empty if equal
+    size_t _dirty_begin;
+    size_t _dirty_end;
+
     public:
 
+    /**
+     * Creates the CPU side of a uniform block as laid out in shader.
+     * @param pool If set, the block is stored at an offset in the pool's 
+     * buffer object instead of an own one. It is only uploaded when it has 
+     * changed, and bound with glBindBufferRange.
+     */
     UniformBuffer(const Shader& shader, 
-                  const string& block_name);
-    ~UniformBuffer() 
-    { 
-        delete[] _buffer;
+                  const string& block_name,
+                  const UniformBufferPoolRef& pool = UniformBufferPoolRef());
+
+    /**
+     * Creates a uniform block from a layout description. No GL calls are 
+     * made until the block is sent to the GPU or bound.
+     */
+    UniformBuffer(const Layout& layout,
+                  const UniformBufferPoolRef& pool = UniformBufferPoolRef());
+
+    ~UniformBuffer();
+
+    /**
+     * Queries the layout of a uniform block from a linked program.
+     */
+    static Layout query_layout(const Shader& shader, const string& block_name);
+
+    /**
+     * Resolves a member of this block. Returns an invalid field if there is
+     * no such member, or if its type does not match T.
+     */
+    template<typename T> Field<T> field(const string& name) const
+    {
+        Field<T> f;
+
+        map<string, Entry>::const_iterator it = _entries.find(name);
+        if (it == _entries.end())
+            return f;
+
+        if (it->second.type != gltype_info<T>::uniform_type) {
+            cerr << "UniformBuffer: '" << name << "' is accessed with the "
+                 << "wrong type." << endl;
+            return f;
+        }
+
+        f._entry = it->second;
+        f._valid = true;
+        return f;
+    }
+
+    template<typename T> 
+    void set(const Field<T>& field, 
+             const typename Field<T>::value_type& value)
+    {
+        if (!field._valid)
+            return;
+
+        write(field._entry, field._entry.offset, value);
+    }
+
+    template<typename T> 
+    void set(const Field<T>& field, int index, 
+             const typename Field<T>::value_type& value)
+    {
+        if (!field._valid)
+            return;
+
+        assert(index >= 0 && size_t(index) < field._entry.array_size);
+
+        size_t offset = field._entry.offset + 
+                        index * field._entry.array_stride;
+
+        write(field._entry, offset, value);
     }
 
     template<typename T> void set(const string& name, const T& value) 
     {
-        Entry& entry = _entries.at(name);
+        const Entry& entry = _entries.at(name);
 
-        gltype_info<T>::set_memory_location(value, _buffer + entry.offset,
-                                            entry.matrix_stride,
-                                            entry.matrix_is_row_major);
+        write(entry, entry.offset, value);
     }
 
     template<typename T> void set(const string& name, int index, 
                                   const T& value) 
     {
-        Entry& entry = _entries.at(name);
+        const Entry& entry = _entries.at(name);
         
         size_t offset = entry.offset + index * entry.array_stride;
 
-        gltype_info<T>::set_memory_location(value, _buffer + offset,
-                                            entry.matrix_stride,
-                                            entry.matrix_is_row_major);
+        write(entry, offset, value);
     }
     
     void bind();
     void unbind();
+
+    /**
+     * Uploads the bytes that changed since the last call.
+     */
     void send_to_GPU();
 
     bool has_entry(const string& name) const;
 
-    GLuint get_binding() const 
-    { 
-        assert(_buffer_binding != 0xffffffff);
-        return _buffer_binding; 
-    }
+    /**
+     * Fills a hand-written std140 block through field handles and compares
+     * data() and the dirty range of every write with the offsets of the 
+     * std140 rules. No GL calls are made.
+     * @return True if all bytes and ranges match.
+     */
+    static bool check_std140();
+
+    GLuint get_binding() const;
+
+    /**
+     * The CPU copy of this block, e.g. to verify the packing.
+     */
+    const byte* data() const { return _buffer; }
+    size_t size() const { return _buffer_size; }
+
+    /**
+     * Returns the bytes which would be uploaded by the next send_to_GPU().
+     */
+    size_t dirty_size() const { return _dirty_end - _dirty_begin; }
 
     private:
+
+    void initialize(const Layout& layout);
+    void create_buffer();
+
+    void mark_dirty(size_t offset, size_t size)
+    {
+        if (_dirty_begin == _dirty_end) {
+            _dirty_begin = offset;
+            _dirty_end = offset + size;
+        } else {
+            _dirty_begin = glm::min(_dirty_begin, offset);
+            _dirty_end = glm::max(_dirty_end, offset + size);
+        }
+    }
+
+    template<typename T> void write(const Entry& entry, size_t offset, 
+                                    const T& value)
+    {
+        //matrices are written column by column
+        size_t extent = (gltype_info<T>::columns - 1) * entry.matrix_stride +
+                        gltype_info<T>::column_size;
+
+        assert(offset + extent <= _buffer_size);
+
+        mark_dirty(offset, extent);
+
+        gltype_info<T>::set_memory_location(value, _buffer + offset,
+                                            entry.matrix_stride,
+                                            entry.matrix_is_row_major);
+    }
                  
     /**
      * Helper class for automatic buffer-binding management.
@@ -121,4 +291,80 @@ class UniformBuffer
     static BindingManager _binding_manager;
 };
 
+/**
+ * One buffer object which holds many uniform blocks at aligned offsets, e.g.
+ * the parameters of all material instances. All blocks share one binding
+ * point and are selected with glBindBufferRange. Changes are collected in a
+ * CPU copy and uploaded as one dirty range before the next bind.
+ */
+class UniformBufferPool : noncopyable
+{
+    public:
+
+    struct Statistics
+    {
+        size_t range_binds; /**< glBindBufferRange calls */
+        size_t uploads; /**< glBufferData/glBufferSubData calls */
+        size_t bytes_uploaded;
+        size_t bytes_bound; /**< Sum of the sizes of all bound blocks */
+    };
+
+    UniformBufferPool();
+    ~UniformBufferPool();
+
+    /**
+     * Reserves size bytes in the pool.
+     * @return The aligned offset of the block.
+     */
+    size_t allocate(size_t size);
+
+    /**
+     * Frees a block previously returned by allocate(). It is merged with 
+     * adjacent free blocks.
+     */
+    void release(size_t offset, size_t size);
+
+    /**
+     * Copies data into the pool, it is uploaded on the next bind.
+     */
+    void write(size_t offset, const byte* data, size_t size);
+
+    /**
+     * Binds a block to the binding point of this pool.
+     */
+    void bind_range(size_t offset, size_t size);
+
+    GLuint get_binding() const { return _binding; }
+
+    size_t size() const { return _size; }
+
+    const Statistics& statistics() const { return _statistics; }
+    void reset_statistics();
+
+    private:
+
+    struct Block
+    {
+        size_t offset;
+        size_t size;
+    };
+
+    void initialize();
+    void flush();
+
+    vector<byte> _data; /**< CPU copy of the whole buffer */
+    size_t _size; /**< End of the last allocated block */
+    list<Block> _free_blocks; /**< Sorted by offset, never adjacent */
+
+    size_t _alignment;
+    GLuint _buffer_object;
+    size_t _buffer_capacity; /**< Size of the GPU buffer */
+    GLuint _binding;
+
+    size_t _dirty_begin;
+    size_t _dirty_end;
+
+    Statistics _statistics;
+};
+
 #endif
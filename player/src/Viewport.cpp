@@ -50,6 +50,15 @@ Viewport::Viewport(float aspect) :
     resize(w,h);
 }
 
+Viewport::Viewport(const ivec2& size) :
+    _aspect(float(size.x)/float(size.y)),
+    _dynamic_aspect(true),
+    _size(size),
+    _offset(0, 0)
+{
+    set_viewport();
+}
+
 void Viewport::resize(int width, int height) 
 {
     if (!_dynamic_aspect) {
@@ -34,6 +34,12 @@ class Viewport
 
     Viewport(float aspect);
 
+    /**
+     * A viewport of fixed size that isn't tied to the window, for offscreen
+     * rendering. The aspect ratio follows the size.
+     */
+    Viewport(const ivec2& size);
+
     float aspect() const { return _aspect; }
     ivec2 render_size() const { return _size; }
     ivec2 render_pixel_offset() const { return _offset; }
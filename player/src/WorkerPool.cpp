@@ -0,0 +1,184 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#include "WorkerPool.h"
+#include "Profiler.h"
+
+//see DBLoader.h
+#undef ERROR
+#undef SYNCHRONIZE
+
+#include <kcthread.h>
+
+namespace kc = kyotocabinet;
+
+struct WorkerPool::State {
+    vector<Worker*> workers;
+
+    Task* task;
+    int job_count;
+    kc::AtomicInt64 next_job;
+
+    kc::Mutex mutex;
+    kc::CondVar start_cond;
+    kc::CondVar done_cond;
+    int generation;
+    int busy;
+    bool quit;
+};
+
+/**
+ * Waits for a batch to start, then helps with its jobs.
+ */
+class WorkerPool::Worker : public kc::Thread {
+
+public:
+
+    Worker(WorkerPool* pool) : _pool(pool) {}
+
+    void run() {
+        Profiler::set_thread_name("Worker");
+        _pool->work();
+    }
+
+private:
+
+    WorkerPool* _pool;
+};
+
+WorkerPool::WorkerPool(int thread_count) :
+    _state(new State())
+{
+    _state->task = NULL;
+    _state->job_count = 0;
+    _state->generation = 0;
+    _state->busy = 0;
+    _state->quit = false;
+
+    for (int i = 1; i < thread_count; ++i) {
+        _state->workers.push_back(new Worker(this));
+        _state->workers.back()->start();
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    _state->mutex.lock();
+    _state->quit = true;
+    _state->start_cond.broadcast();
+    _state->mutex.unlock();
+
+    for (size_t i = 0; i < _state->workers.size(); ++i) {
+        _state->workers[i]->join();
+        delete _state->workers[i];
+    }
+
+    delete _state;
+}
+
+int WorkerPool::thread_count() const
+{
+    return _state->workers.size() + 1;
+}
+
+void WorkerPool::run(Task& task, int job_count)
+{
+    if (job_count <= 0)
+        return;
+
+    //Not worth waking anyone up for a single job
+    if (_state->workers.empty() || job_count == 1) {
+        _state->task = &task;
+        _state->job_count = job_count;
+        _state->next_job.set(0);
+
+        run_jobs();
+
+        _state->task = NULL;
+        return;
+    }
+
+    start(task, job_count);
+    run_jobs();
+    wait();
+}
+
+void WorkerPool::start(Task& task, int job_count)
+{
+    assert(!_state->workers.empty());
+
+    _state->task = &task;
+    _state->job_count = job_count;
+    _state->next_job.set(0);
+
+    kc::ScopedMutex lock(&_state->mutex);
+    _state->busy = _state->workers.size();
+    ++_state->generation;
+    _state->start_cond.broadcast();
+}
+
+void WorkerPool::wait()
+{
+    {
+        kc::ScopedMutex lock(&_state->mutex);
+        while (_state->busy > 0) {
+            _state->done_cond.wait(&_state->mutex);
+        }
+    }
+
+    _state->task = NULL;
+}
+
+void WorkerPool::work()
+{
+    int generation = 0;
+
+    while (true) {
+        {
+            kc::ScopedMutex lock(&_state->mutex);
+
+            while (_state->generation == generation && !_state->quit) {
+                _state->start_cond.wait(&_state->mutex);
+            }
+
+            if (_state->quit)
+                return;
+
+            generation = _state->generation;
+        }
+
+        run_jobs();
+
+        kc::ScopedMutex lock(&_state->mutex);
+        if (--_state->busy == 0) {
+            _state->done_cond.signal();
+        }
+    }
+}
+
+void WorkerPool::run_jobs()
+{
+    int64_t job;
+
+    while ((job = _state->next_job.add(1)) < _state->job_count) {
+        _state->task->run_job(int(job));
+    }
+}
@@ -0,0 +1,87 @@
+//Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+//                   Thomas Weber <weber (dot) t (at) gmx (dot) at>
+//
+//Permission is hereby granted, free of charge, to any person obtaining a copy
+//of this software and associated documentation files (the "Software"), to deal
+//in the Software without restriction, including without limitation the rights
+//to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+//copies of the Software, and to permit persons to whom the Software is
+//furnished to do so, subject to the following conditions:
+//
+//The above copyright notice and this permission notice shall be included in
+//all copies or substantial portions of the Software.
+//
+//THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+//IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+//FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+//AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+//LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+//OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+//THE SOFTWARE.
+
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include "common.h"
+
+/**
+ * Threads that wait for batches of jobs and work on them together with the
+ * calling thread. Jobs are handed out one at a time through an atomic
+ * counter, so they should be small and of similar size.
+ */
+class WorkerPool : boost::noncopyable
+{
+    public:
+
+    /**
+     * A batch of jobs, identified by their index.
+     */
+    class Task {
+    public:
+        virtual ~Task() {}
+
+        /**
+         * Called from any of the threads, once for every job.
+         */
+        virtual void run_job(int job) = 0;
+    };
+
+    /**
+     * @param thread_count Number of threads working on a batch, including
+     * the one calling run().
+     */
+    WorkerPool(int thread_count);
+    ~WorkerPool();
+
+    /**
+     * Runs the jobs 0 to job_count-1 of task and returns once all of them
+     * are done.
+     */
+    void run(Task& task, int job_count);
+
+    /**
+     * Hands the jobs to the pool's threads and returns immediately, the
+     * calling thread doesn't help. Call wait() before starting anything 
+     * else. The pool needs a thread_count of at least 2 for this.
+     */
+    void start(Task& task, int job_count);
+
+    /**
+     * Returns once all jobs handed out by start() are done.
+     */
+    void wait();
+
+    int thread_count() const;
+
+    private:
+
+    class Worker;
+    struct State;
+
+    void work();
+    void run_jobs();
+
+    State* _state;
+};
+
+#endif
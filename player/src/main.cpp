@@ -51,6 +51,10 @@
 
 #include "Runtime.h"
 #include "DBLoader.h"
+#include "FBO.h"
+#include "FrameWriter.h"
+#include "Profiler.h"
+#include "NullGL.h"
 
 #include "InputHandler.h"
 
@@ -58,16 +62,20 @@
 
 #include <stdexcept>
 
-#include <IL/il.h>
-#include <IL/ilut.h>
 #include <kcfile.h>
 #include <kcthread.h>
 
 #include <sstream>
+#include <fstream>
 
 void test_ogl3(void);
 void main_loop_offline_mode();
 void main_loop_online_mode();
+bool draw_benchmark();
+bool culling_benchmark();
+string offline_frame_filename(const string& dirpath, size_t frame, 
+                              size_t max_num_digits);
+void seek_offline_frame(Timer& timer, size_t frame);
 bool test_config();
 
 /**
@@ -100,6 +108,64 @@ int main (int argc, char** argv)
         RtrPlayerConfig::save_file(config_filename, config);
     }
 
+    if (config.db_benchmark()) {
+        // Measures record decoding only, we don't need a window for that.
+        DBLoader db_loader(config.input());
+        bool success = db_loader.initialize() && db_loader.benchmark();
+
+        google::protobuf::ShutdownProtobufLibrary();
+        return success ? 0 : 1;
+    }
+
+    if (config.dust_benchmark()) {
+        // Measures the CPU side of the dust particles only
+        DustSimulation::benchmark(config.dust_particle_count(),
+                                  config.dust_thread_count(), 600);
+
+        google::protobuf::ShutdownProtobufLibrary();
+        return 0;
+    }
+
+    if (config.light_cluster_benchmark()) {
+        vec3 grid = config.light_cluster_grid();
+        LightClusters::benchmark(ivec3(grid), 
+                                 config.light_cluster_thread_count(), 1000);
+
+        google::protobuf::ShutdownProtobufLibrary();
+        return 0;
+    }
+
+    if (config.skinning_benchmark()) {
+        bool success = 
+            Skinning::benchmark(100000, 64, config.skinning_thread_count());
+
+        google::protobuf::ShutdownProtobufLibrary();
+        return success ? 0 : 1;
+    }
+
+    if (config.culling_benchmark()) {
+        // The scene is set up with GL calls recorded instead of executed
+        bool success = culling_benchmark();
+
+        google::protobuf::ShutdownProtobufLibrary();
+        return success ? 0 : 1;
+    }
+
+    if (config.uniform_buffer_check()) {
+        bool success = UniformBuffer::check_std140();
+
+        google::protobuf::ShutdownProtobufLibrary();
+        return success ? 0 : 1;
+    }
+
+    if (config.draw_benchmark()) {
+        // GL calls are recorded instead of executed, no window is needed.
+        bool success = draw_benchmark();
+
+        google::protobuf::ShutdownProtobufLibrary();
+        return success ? 0 : 1;
+    }
+
     // Set up GLFW
     glfwInit();
 
@@ -161,7 +227,8 @@ int main (int argc, char** argv)
     int swap_interval = config.swap_interval();
 
     if ( (swap_interval != 1) && 
-          config.offline_render_mode() )
+          config.offline_render_mode() &&
+          !config.offline_render_mode_offscreen() )
     {
         std::cout << "Warning: Forcing swap_interval setting to 1, as "
                   << "offline_render_mode option is active." << std::endl;
@@ -189,11 +256,17 @@ int main (int argc, char** argv)
     bool success = test_config();
 
     if (success) {
+        Profiler::set_thread_name("Render");
+        Profiler::set_enabled(config.profiler());
+
         // Start main loop
         if (config.offline_render_mode())
             main_loop_offline_mode();
         else
             main_loop_online_mode();
+
+        // Writes the trace if the profiler is still running
+        Profiler::set_enabled(false);
     }
 
     // Close window and OpenGL context.
@@ -206,12 +279,55 @@ int main (int argc, char** argv)
     return 0;
 }
 
+/**
+ * Resets the output framebuffer when it goes out of scope. Declared after 
+ * the FBO, so that the output is reset before the FBO is deleted.
+ */
+class OutputReset : boost::noncopyable
+{
+    public:
+    ~OutputReset() { FBO::set_output(NULL); }
+};
+
 void main_loop_offline_mode()
 {
     bool running = true;
+    float fps, mspf;
 
-    Viewport viewport(config.aspect_ratio());
-    viewport.set_resize_callbacks();
+    // Offscreen frames are drawn into an FBO of their own size, the window
+    // is neither shown nor swapped.
+    bool offscreen = config.offline_render_mode_offscreen();
+    scoped_ptr<FBO> output;
+    OutputReset output_reset;
+    scoped_ptr<Viewport> viewport;
+
+    if (offscreen) {
+        ivec2 size(config.offline_render_mode_width(), 
+                   config.offline_render_mode_height());
+
+        GLenum output_format = GL_RGBA8;
+        if (config.offline_render_mode_format() == RtrPlayerConfig::EXR) {
+            output_format = GL_RGBA16F;
+        }
+
+        FBOFormat format;
+        format.add_renderbuffer(output_format, GL_COLOR_ATTACHMENT0);
+
+        output.reset(new FBO(size, 0, format));
+
+        if (!output->is_complete()) {
+            cerr << "Could not create the offscreen framebuffer." << endl;
+            return;
+        }
+
+        FBO::set_output(output.get());
+        viewport.reset(new Viewport(size));
+
+        glfwIconifyWindow();
+    } else {
+        viewport.reset(new Viewport(config.aspect_ratio()));
+        viewport->set_resize_callbacks();
+    }
 
     DBLoader db_loader(config.input());
 
@@ -245,27 +361,20 @@ void main_loop_offline_mode()
 
     }
 
-    // Configure the ILut images
-    // Since the scene is already loaded, we expect the IL already to be 
-    // initialized.
-    ilutInit();
-    
-    ILuint image_target = 0;
-    ilGenImages(1, &image_target);
-    ilBindImage(image_target);
-
-    Runtime runtime(*scene, &db_loader, viewport);
-
-    Timer timer(0);
+    FrameWriter::Format image_format = FrameWriter::TIFF;
 
-    // We have to update runtime once before creating the input handler.
-    runtime.update(timer);
-
-    glEnable(GL_CULL_FACE);
+    switch (config.offline_render_mode_format()) {
+    case RtrPlayerConfig::PNG: image_format = FrameWriter::PNG; break;
+    case RtrPlayerConfig::EXR: image_format = FrameWriter::EXR; break;
+    default: break;
+    }
 
-    double time = 0;
+    Runtime runtime(*scene, &db_loader, *viewport);
 
-    double delta_time = 1.0/config.offline_render_mode_fps();
+    // Frames are read back asynchronously and written by encoding threads
+    FrameWriter writer(viewport->render_size(), image_format,
+                       config.offline_render_mode_frames_in_flight(),
+                       config.offline_render_mode_encoder_threads());
 
     size_t num_total_frames = 
         config.offline_render_mode_fps() * 
@@ -275,45 +384,128 @@ void main_loop_offline_mode()
     oss << num_total_frames;
     size_t max_num_digits = oss.str().length();
 
-    for (size_t frame = 0; 
-         (frame < num_total_frames) && running;
-         time += delta_time, ++frame)
+    // The selected range is split into contiguous shards, which can be 
+    // rendered by separate processes.
+    size_t first_frame = std::max(config.offline_render_mode_first_frame(), 0);
+    size_t end_frame = num_total_frames;
+
+    if (config.offline_render_mode_last_frame() >= 0) {
+        end_frame = std::min(end_frame, 
+            size_t(config.offline_render_mode_last_frame()) + 1);
+    }
+
+    end_frame = std::max(end_frame, first_frame);
+
+    size_t shard = config.offline_render_mode_shard();
+    size_t shard_count = config.offline_render_mode_shard_count();
+    size_t range = end_frame - first_frame;
+
+    end_frame = first_frame + range * (shard + 1) / shard_count;
+    first_frame = first_frame + range * shard / shard_count;
+
+    std::cout << "Rendering " << end_frame - first_frame << " of " 
+              << num_total_frames << " frames, starting at frame " 
+              << first_frame << "." << std::endl;
+
+    // Complete files of an earlier run are kept, so an interrupted render
+    // can be resumed.
+    vector<size_t> frames;
+
+    for (size_t frame = first_frame; frame < end_frame; ++frame) {
+        string filename = offline_frame_filename(dirpath, frame, 
+                                                 max_num_digits) + 
+            FrameWriter::extension(image_format);
+
+        if (config.offline_render_mode_skip_existing() && 
+            kc::File::status(filename, &s)) {
+
+            if (FrameWriter::is_complete(filename, image_format, 
+                                         viewport->render_size())) {
+                std::cout << "Skipping frame " << frame << " : " 
+                          << frame << "/" << num_total_frames << std::endl;
+                continue;
+            }
+
+            std::cerr << "Frame file '" << filename << "' is incomplete, "
+                      << "rendering it again." << std::endl;
+        }
+
+        frames.push_back(frame);
+    }
+
+    Timer timer(0);
+
+    if (!frames.empty()) {
+        seek_offline_frame(timer, frames[0]);
+    }
+
+    // We have to update runtime once before creating the input handler.
+    runtime.update(timer);
+
+    glEnable(GL_CULL_FACE);
+
+    // With pipelined frames, frame n+1 is updated while frame n is drawn. 
+    // Every frame sees the same timer as without, so does the image.
+    bool pipelined = config.pipelined_frames();
+
+    if (pipelined) {
+        // Events are polled while no update is running
+        glfwDisable(GLFW_AUTO_POLL_EVENTS);
+    }
+
+    double start_time = glfwGetTime();
+    size_t rendered = 0;
+
+    for (; (rendered < frames.size()) && running; ++rendered)
     {
-        timer.update_diff(delta_time);
+        size_t frame = frames[rendered];
 
-        runtime.update(timer);
+        ProfileZone frame_zone("frame");
+
+        double update_time = glfwGetTime();
+        bool updating = pipelined && rendered + 1 < frames.size();
+
+        // In pipelined mode, the first frame was updated before the loop
+        if (updating) {
+            seek_offline_frame(timer, frames[rendered + 1]);
+            runtime.start_update(timer);
+        } else if (!pipelined) {
+            seek_offline_frame(timer, frame);
+            runtime.update(timer);
+        }
+
+        update_time = glfwGetTime() - update_time;
 
         runtime.draw();
 
-        // Swap buffers, get errors
-        glfwSwapBuffers();
+        string filepath_str = offline_frame_filename(dirpath, frame, 
+                                                     max_num_digits);
 
-        if (!ilutGLScreen()) {
-            std::cerr << "Could not take a screenshot." << std::endl;
-        } else {
-            std::cout << "Frame @ " << time << " : " << frame << "/" 
-                      << num_total_frames << std::endl;
+        // Reads from the back buffer or the offscreen output
+        writer.capture(viewport->render_pixel_offset(), filepath_str);
+
+        std::cout << "Frame @ " << frame / config.offline_render_mode_fps()
+                  << " : " << frame << "/" << num_total_frames << std::endl;
+
+        if (!offscreen) {
+            ProfileZone zone("swap");
+            glfwSwapBuffers();
         }
 
-        //and save
-        std::ostringstream oss;
-        oss << frame;
-        
-        //construct the file path
-        std::string filepath_str =  dirpath + "/offline_render.";
+        if (updating) {
+            ProfileZone zone("wait for update");
+            double wait_start = glfwGetTime();
+            runtime.finish_update();
+            update_time += glfwGetTime() - wait_start;
+        }
 
-        //zero padding of title
-        for (size_t i = oss.str().length()-1; i<max_num_digits; ++i)
-            filepath_str += "0";
-        
-        filepath_str += oss.str() + ".tiff";
-        
-        if (!ilSaveImage(filepath_str.c_str())) {
-            std::cerr << "Could not save image to '" << filepath_str << "'." 
-                      << std::endl;
+        if (pipelined || offscreen) {
+            glfwPollEvents();
         }
 
         get_errors();
+        calc_fps(fps, mspf, update_time);
+        Profiler::end_frame();
 
         // Check if the window has been closed
         running = running && !glfwGetKey( GLFW_KEY_ESC );
@@ -321,8 +513,50 @@ void main_loop_offline_mode()
         running = running && glfwGetWindowParam( GLFW_OPENED );        
     }
 
-    //Cleanup IL stuff
-    ilDeleteImages(1, &image_target);
+    writer.finish();
+
+    double render_time = glfwGetTime() - start_time;
+
+    std::cout << "Rendered " << rendered << " frames in " << render_time 
+              << " s (" << rendered / render_time << " frames/s)." 
+              << std::endl;
+
+    if (writer.failed_count() > 0) {
+        std::cerr << writer.failed_count() << " frames could not be saved." 
+                  << std::endl;
+    }
+}
+
+/**
+ * Path of a frame's image file, without extension.
+ */
+string offline_frame_filename(const string& dirpath, size_t frame, 
+                              size_t max_num_digits)
+{
+    std::ostringstream oss;
+    oss << frame;
+        
+    //construct the file path
+    std::string filepath_str =  dirpath + "/offline_render.";
+
+    //zero padding of title
+    for (size_t i = oss.str().length()-1; i<max_num_digits; ++i)
+        filepath_str += "0";
+        
+    filepath_str += oss.str();
+
+    return filepath_str;
+}
+
+/**
+ * Sets the timer to a frame of the offline renderer, as if it had been 
+ * advanced from the previous frame. The time only depends on the frame 
+ * number, so that any frame range can be rendered on its own.
+ */
+void seek_offline_frame(Timer& timer, size_t frame)
+{
+    timer.seek(frame / config.offline_render_mode_fps());
+    timer.update_diff(1.0 / config.offline_render_mode_fps());
 }
 
 void main_loop_online_mode()
@@ -375,19 +609,55 @@ void main_loop_online_mode()
         sound_controller.play();
     }
 
+    // With pipelined frames, the frame updated in the last iteration is 
+    // drawn while the next one is updated.
+    bool pipelined = config.pipelined_frames();
+
+    if (pipelined) {
+        // Input changes the scene, so events are only polled while no 
+        // update is running
+        glfwDisable(GLFW_AUTO_POLL_EVENTS);
+    }
+
     while (running) {
+        ProfileZone frame_zone("frame");
+
         timer.update(glfwGetTime());
 
-        runtime.update(timer);
-        input_handler.update();
+        double update_time = glfwGetTime();
 
+        if (pipelined) {
+            runtime.start_update(timer);
+        } else {
+            runtime.update(timer);
+            input_handler.update();
+        }
+
+        update_time = glfwGetTime() - update_time;
 
         runtime.draw();
 
         // Swap buffers, get errors
-        glfwSwapBuffers();
+        {
+            ProfileZone zone("swap");
+            glfwSwapBuffers();
+        }
+
+        if (pipelined) {
+            {
+                ProfileZone zone("wait for update");
+                double wait_start = glfwGetTime();
+                runtime.finish_update();
+                update_time += glfwGetTime() - wait_start;
+            }
+
+            glfwPollEvents();
+            input_handler.update();
+        }
+
         get_errors();
-        calc_fps(fps, mspf);
+        calc_fps(fps, mspf, update_time);
+        Profiler::end_frame();
 
         // Check if the window has been closed
         running = running && !glfwGetKey( GLFW_KEY_ESC );
@@ -398,6 +668,144 @@ void main_loop_online_mode()
     sound_controller.stop();
 }
 
+/**
+ * Runs update() and draw() of the startup scene with a fixed time step, 
+ * while all GL calls are recorded by a NullGL backend.
+ */
+bool draw_benchmark()
+{
+    NullGL null_gl;
+    init_opengl_backend(&null_gl);
+
+    std::ofstream trace_file;
+    std::ostream* trace = NULL;
+
+    if (!config.draw_benchmark_trace().empty()) {
+        trace_file.open(config.draw_benchmark_trace().c_str());
+
+        if (!trace_file) {
+            cerr << "Could not open " << config.draw_benchmark_trace() 
+                 << endl;
+            return false;
+        }
+
+        trace = &trace_file;
+    }
+
+    glEnable(GL_PRIMITIVE_RESTART);
+    glPrimitiveRestartIndex(GPUMesh::PRIMITIVE_RESTART_IDX());
+    glEnable(GL_CULL_FACE);
+
+    DBLoader db_loader(config.input());
+
+    if (!db_loader.initialize()) {
+        cerr << "Could not initialize database." << endl;
+        return false;
+    }
+
+    shared_ptr<rtr_format::Scene> scene;
+    db_loader.read(db_loader.startup_scene_id(), scene);
+
+    if (!scene) {
+        cerr << "No startup scene could be loaded." << endl;
+        return false;
+    }
+
+    double start = Profiler::now();
+
+    Viewport viewport(ivec2(config.window_width(), config.window_height()));
+    Runtime runtime(*scene, &db_loader, viewport);
+
+    double setup_time = Profiler::now() - start;
+
+    null_gl.end_frame(trace, "setup");
+
+    cout << "Setup: " << setup_time << " s, " 
+         << null_gl.frame().calls << " GL calls, "
+         << null_gl.frame().upload_bytes / (1024.0 * 1024.0) 
+         << " MiB uploaded" << endl;
+
+    null_gl.reset_statistics();
+
+    Timer timer(0.0);
+    double update_time = 0.0;
+    double draw_time = 0.0;
+
+    int frame_count = config.draw_benchmark_frames();
+
+    for (int frame = 0; frame < frame_count; ++frame) {
+        timer.update_diff(1.0 / 60.0);
+
+        start = Profiler::now();
+        runtime.update(timer);
+        double update_end = Profiler::now();
+        runtime.draw();
+
+        update_time += update_end - start;
+        draw_time += Profiler::now() - update_end;
+
+        null_gl.end_frame(trace, "frame " + to_string(frame));
+    }
+
+    if (frame_count > 0) {
+        cout << "Frames: " << frame_count 
+             << ", update: " << update_time / frame_count * 1000.0 
+             << " ms, draw: " << draw_time / frame_count * 1000.0 
+             << " ms per frame" << endl;
+
+        null_gl.print_statistics();
+
+        const Runtime::MeshletStatistics& meshlets = 
+                                                runtime.meshlet_statistics();
+        if (meshlets.triangles > 0) {
+            cout << "Meshlet culling: " 
+                 << meshlets.triangles_culled / frame_count << " of " 
+                 << meshlets.triangles / frame_count 
+                 << " triangles of visible meshes culled per frame ("
+                 << 100.0 * meshlets.triangles_culled / meshlets.triangles
+                 << "%)" << endl;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Compares the culling structures on the startup scene. The scene is set
+ * up with a NullGL backend, no window is needed.
+ */
+bool culling_benchmark()
+{
+    NullGL null_gl;
+    init_opengl_backend(&null_gl);
+
+    DBLoader db_loader(config.input());
+
+    if (!db_loader.initialize()) {
+        cerr << "Could not initialize database." << endl;
+        return false;
+    }
+
+    shared_ptr<rtr_format::Scene> scene;
+    db_loader.read(db_loader.startup_scene_id(), scene);
+
+    if (!scene) {
+        cerr << "No startup scene could be loaded." << endl;
+        return false;
+    }
+
+    Viewport viewport(ivec2(config.window_width(), config.window_height()));
+    Runtime runtime(*scene, &db_loader, viewport);
+
+    // Geometries are placed by the first update
+    Timer timer(0.0);
+    runtime.update(timer);
+
+    runtime.benchmark_culling();
+
+    return true;
+}
+
 // A helper macro for printing OpenGL limits.
 #define PRINT_GL_LIMIT(limit_name)                                 \
 {                                                                  \
@@ -496,5 +904,15 @@ bool test_config()
         return false;
     }
 
+    if (config.offline_render_mode_shard_count() < 1 ||
+        config.offline_render_mode_shard() < 0 ||
+        config.offline_render_mode_shard() >= 
+        config.offline_render_mode_shard_count()) {
+        cerr << "Config problem(offline_render_mode_shard = " 
+             << config.offline_render_mode_shard() << "): Shards are numbered"
+             << " from 0 to offline_render_mode_shard_count - 1." << endl;
+        return false;
+    }
+
     return true;
 }
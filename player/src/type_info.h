@@ -54,6 +54,11 @@ template<> struct gltype_info<GLint>
 
     static const GLint components = 1;
 
+    // layout of this type within a uniform block
+    static const GLenum uniform_type = GL_INT;
+    static const GLint columns = 1;
+    static const size_t column_size = sizeof(GLint);
+
     static void set_uniform(GLint location, GLint value)
     {
         glUniform1i(location, value);
@@ -74,6 +79,11 @@ template <> struct gltype_info<GLfloat>
 
     static const GLint components = 1;
 
+    // layout of this type within a uniform block
+    static const GLenum uniform_type = GL_FLOAT;
+    static const GLint columns = 1;
+    static const size_t column_size = sizeof(GLfloat);
+
     static void set_uniform(GLint location, GLfloat value)
     {
         glUniform1f(location, value);
@@ -105,6 +115,11 @@ template <> struct gltype_info<vec2>
 
     static const GLint components = 2;
 
+    // layout of this type within a uniform block
+    static const GLenum uniform_type = GL_FLOAT_VEC2;
+    static const GLint columns = 1;
+    static const size_t column_size = sizeof(vec2);
+
     static void set_uniform(GLint location, const vec2& value)
     {
         glUniform2fv(location, 1, (GLfloat*)&value);
@@ -136,6 +151,11 @@ template <> struct gltype_info<vec3>
 
     static const GLint components = 3;
 
+    // layout of this type within a uniform block
+    static const GLenum uniform_type = GL_FLOAT_VEC3;
+    static const GLint columns = 1;
+    static const size_t column_size = sizeof(vec3);
+
     static void set_uniform(GLint location, const vec3& value)
     {
         glUniform3fv(location, 1, (GLfloat*)&value);
@@ -168,6 +188,11 @@ template <> struct gltype_info<vec4>
 
     static const GLint components = 4;
 
+    // layout of this type within a uniform block
+    static const GLenum uniform_type = GL_FLOAT_VEC4;
+    static const GLint columns = 1;
+    static const size_t column_size = sizeof(vec4);
+
     static void set_uniform(GLint location, const vec4& value)
     {
         glUniform4fv(location, 1, (GLfloat*)&value);
@@ -201,6 +226,11 @@ template <> struct gltype_info<ivec2>
 
     static const GLint components = 2;
 
+    // layout of this type within a uniform block
+    static const GLenum uniform_type = GL_INT_VEC2;
+    static const GLint columns = 1;
+    static const size_t column_size = sizeof(ivec2);
+
     static void set_uniform(GLint location, const ivec2& value)
     {
         glUniform2iv(location, 1, (GLint*)&value);
@@ -221,6 +251,11 @@ template <> struct gltype_info<ivec3>
 
     static const GLint components = 3;
 
+    // layout of this type within a uniform block
+    static const GLenum uniform_type = GL_INT_VEC3;
+    static const GLint columns = 1;
+    static const size_t column_size = sizeof(ivec3);
+
     static void set_uniform(GLint location, const ivec3& value)
     {
         glUniform3iv(location, 1, (GLint*)&value);
@@ -241,6 +276,11 @@ template <> struct gltype_info<ivec4>
 
     static const GLint components = 4;
 
+    // layout of this type within a uniform block
+    static const GLenum uniform_type = GL_INT_VEC4;
+    static const GLint columns = 1;
+    static const size_t column_size = sizeof(ivec4);
+
     static void set_uniform(GLint location, const ivec4& value)
     {
         glUniform4iv(location, 1, (GLint*)&value);
@@ -259,6 +299,11 @@ template <> struct gltype_info<mat2>
 
     static const GLint components = 4;
 
+    // layout of this type within a uniform block
+    static const GLenum uniform_type = GL_FLOAT_MAT2;
+    static const GLint columns = 2;
+    static const size_t column_size = sizeof(vec2);
+
     static void set_uniform(GLint location, const mat2& value)
     {
         glUniformMatrix2fv(location, 1, false, (GLfloat*)&value);
@@ -297,6 +342,11 @@ template <> struct gltype_info<mat3>
 
     static const GLint components = 9;
 
+    // layout of this type within a uniform block
+    static const GLenum uniform_type = GL_FLOAT_MAT3;
+    static const GLint columns = 3;
+    static const size_t column_size = sizeof(vec3);
+
     static void set_uniform(GLint location, const mat3& value)
     {
         glUniformMatrix3fv(location, 1, false, (GLfloat*)&value);
@@ -340,6 +390,11 @@ template <> struct gltype_info<mat4>
 
     static const GLint components = 16;
 
+    // layout of this type within a uniform block
+    static const GLenum uniform_type = GL_FLOAT_MAT4;
+    static const GLint columns = 4;
+    static const size_t column_size = sizeof(vec4);
+
     static void set_uniform(GLint location, const mat4& value)
     {
         glUniformMatrix4fv(location, 1, false, (GLfloat*)&value);
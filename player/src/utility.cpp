@@ -25,10 +25,11 @@
 #include <fstream>
 #include "Shader.h"
 
-void calc_fps(float& fps, float& mspf)
+void calc_fps(float& fps, float& mspf, double update_time)
 {
     static double last = -1.0;
     static int frames = 0;
+    static double update_sum = 0.0;
     static float current_fps = .0f;
     static float current_ms_per_frame = .0f;
 
@@ -39,15 +40,18 @@ void calc_fps(float& fps, float& mspf)
     }
 
     frames += 1;
+    update_sum += update_time;
 
     if (now - last >= 5.0) {
-        printf("%.2f ms/frame (= %d fps)\n", 
+        printf("%.2f ms/frame (= %d fps), %.2f ms/frame updating\n", 
               ((now-last)*1000.0/frames),
-              (int)(frames/(now-last)));
+              (int)(frames/(now-last)),
+              update_sum*1000.0/frames);
         current_fps = float( frames/(now - last) );
         current_ms_per_frame = float( (now-last)*5000.0/frames );
         last = now;
         frames = 0;
+        update_sum = 0.0;
     }
 
     fps = current_fps;
@@ -28,7 +28,12 @@
 
 const char* get_type_enum_name(GLenum type_enum);
 
-void calc_fps(float& fps, float& mspf);
+/**
+ * Counts frames and prints the average frame time every five seconds.
+ * @param update_time Seconds the main thread spent on updating the scene 
+ * this frame, or waiting for the update.
+ */
+void calc_fps(float& fps, float& mspf, double update_time);
 
 /**
  * Test if a file exists on the filesystem.
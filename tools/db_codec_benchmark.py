@@ -0,0 +1,112 @@
+# Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+#                    Thomas Weber <weber (dot) t (at) gmx (dot) at>
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+# Bakes one COLLADA file with every database codec and prints a table of
+# bake time, file size and player load time (record decoding only, see the
+# db_benchmark option of the player).
+#
+# Example:
+#   python db_codec_benchmark.py -b ../build/bin/Release/ColladaBakery.exe \
+#       -p ../build/bin/Release/player.exe \
+#       ../collada_bakery/assets_collada/default_scene.dae
+
+import os
+import os.path
+import re
+import shutil
+import subprocess
+import tempfile
+import time
+from optparse import OptionParser
+
+parser = OptionParser("usage: %prog [options] input.dae")
+parser.add_option("-b", "--bakery", dest="bakery",
+                  help="Path to the ColladaBakery executable. It is run in "
+                       "its own folder, next to its bakery_config.txt.")
+parser.add_option("-p", "--player", dest="player",
+                  help="Path to the player executable. It is run in its own "
+                       "folder, next to its player_config.txt.")
+parser.add_option("-c", "--codecs", dest="codecs",
+                  default="none,lz4,zlib:1,zlib:6,zlib:9",
+                  help="Comma separated list of codecs to compare.")
+parser.add_option("-r", "--runs", dest="runs", type="int", default=5,
+                  help="Number of player load runs per codec, the fastest "
+                       "run is reported.")
+
+(options, args) = parser.parse_args()
+
+if not args or not options.bakery or not options.player:
+    parser.error("Input file, bakery and player are required.")
+
+input_file = os.path.abspath(args[0])
+bakery = os.path.abspath(options.bakery)
+player = os.path.abspath(options.player)
+
+rtr_name = os.path.splitext(os.path.basename(input_file))[0] + ".rtr"
+load_pattern = re.compile(r"in ([0-9.]+) ms\.")
+
+out_root = tempfile.mkdtemp(prefix="db_codec_benchmark")
+
+results = []
+
+try:
+    for codec in options.codecs.split(","):
+
+        out_dir = os.path.join(out_root, codec.replace(":", "_"))
+
+        start = time.time()
+        subprocess.check_output([bakery,
+                                 "--input=" + input_file,
+                                 "--outdir=" + out_dir,
+                                 "--db_codec=" + codec,
+                                 "--db_compression=" + 
+                                    ("false" if codec == "none" else "true"),
+                                 "--bake_textures=false",
+                                 "--save_options=false"],
+                                cwd=os.path.dirname(bakery))
+        bake_time = (time.time() - start) * 1000.0
+
+        rtr_file = os.path.join(out_dir, rtr_name)
+        file_size = os.path.getsize(rtr_file)
+
+        load_times = []
+        for i in range(options.runs):
+            output = subprocess.check_output([player,
+                                              "--input=" + rtr_file,
+                                              "--db_benchmark=true",
+                                              "--save_options=false"],
+                                             cwd=os.path.dirname(player))
+            match = load_pattern.search(output.decode("utf-8", "replace"))
+            if match:
+                load_times.append(float(match.group(1)))
+
+        load_time = min(load_times) if load_times else float("nan")
+
+        results.append((codec, bake_time, file_size, load_time))
+
+finally:
+    shutil.rmtree(out_root, ignore_errors=True)
+
+print("%-8s %12s %12s %12s" % ("codec", "bake [ms]", "size [KB]", 
+                               "load [ms]"))
+for (codec, bake_time, file_size, load_time) in results:
+    print("%-8s %12.1f %12d %12.2f" % (codec, bake_time, file_size / 1024,
+                                       load_time))
@@ -59,6 +59,10 @@ enum extGLenum {
 };
 //------------------------ FUNCTION PROTOTYPES -----------------------------//
 
+// All calls go through the function pointers, so that they can be routed
+// to a backend, see init_opengl_backend(). The loader itself needs the
+// statically linked 1.0 and 1.1 entry points.
+
 #for $category in $categories
 #if $functions.has_key($category) and len($functions[$category]) > 0
 
@@ -68,7 +72,8 @@ enum extGLenum {
 #for $function in $functions[$category]
 GLAPI $(function.returntype) APIENTRY gl$(function.name) ($(', '.join(['%s %s' % (type,name) for name, type in $function.params])));
 #end for
-#else
+
+#end if
 #for $function in $functions[$category]
 typedef $(function.returntype) (APIENTRYP PFNGL$(function.name.upper())PROC)($(', '.join(['%s %s' % (type,name) for name, type in $function.params])));
 #end for
@@ -77,12 +82,28 @@ typedef $(function.returntype) (APIENTRYP PFNGL$(function.name.upper())PROC)($('
 GLAPI PFNGL$(function.name.upper())PROC glpf$function.name;
 #end for
 
+#ifndef EXTGL_SOURCE
 #for $function in $functions[$category]
 #define gl$function.name glpf$function.name
 #end for
+#endif
 #end if
+#end for
+
+//--------------------------------- DISPATCH --------------------------------//
+
+enum extGLfunction {
+#for $category in $categories
+#if $functions.has_key($category)
+#for $function in $functions[$category]
+    EXTGL_FN_$function.name,
+#end for
 #end if
 #end for
+    EXTGL_FUNCTION_COUNT
+};
+
+extern const char* const extGL_function_names[EXTGL_FUNCTION_COUNT];
 
 #for $category in $categories
 #define GL_$category 1
@@ -94,6 +115,36 @@ GLAPI PFNGL$(function.name.upper())PROC glpf$function.name;
 
 int init_opengl();
 
+/**
+ * A parameter of a call passed to an ExtGLBackend.
+ */
+struct extGLarg {
+    const void* value; /* Points to the parameter */
+    unsigned int size; /* sizeof the parameter */
+    int is_pointer;
+};
+
+/**
+ * Receives all GL calls instead of the driver, e.g. to run without a GPU.
+ */
+class ExtGLBackend {
+public:
+    virtual ~ExtGLBackend() {}
+
+    /**
+     * Called for every GL function. The result is cast to the return type
+     * of the function, it is ignored for functions returning void.
+     */
+    virtual GLintptr call(extGLfunction function, 
+                          const extGLarg* args, int arg_count) = 0;
+};
+
+/**
+ * Routes all GL functions to backend. No context is needed, all optional
+ * extensions are reported as unsupported.
+ */
+int init_opengl_backend(ExtGLBackend* backend);
+
 #define EXTGL_MAJOR_VERSION $(version.major)
 #define EXTGL_MINOR_VERSION $(version.minor)
 #define EXTGL_CORE_PROFILE $(1 if $version.core else 0)
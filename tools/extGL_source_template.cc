@@ -1,6 +1,7 @@
 // WARNING: This file was automatically generated
 // Do not edit.
 
+#define EXTGL_SOURCE
 $('#include "%s.%s"' % ($options.outfilename, $options.headerext))
 #raw
 #include "GL/glfw.h"
@@ -68,17 +69,79 @@ void load_opengl_functions()
 {
     // --- Function pointer loading
 #for $category in $categories
-#if $functions.has_key($category) and len($functions[$category]) > 0 and $category not in ['VERSION_1_0', 'VERSION_1_1','VERSION_1_0_DEPRECATED', 'VERSION_1_1_DEPRECATED' ]
+#if $functions.has_key($category) and len($functions[$category]) > 0
 
     // $category
 
+#if $category in ['VERSION_1_0', 'VERSION_1_1','VERSION_1_0_DEPRECATED', 'VERSION_1_1_DEPRECATED' ]
+#for $function in $functions[$category]
+    glpf$function.name = gl$function.name;
+#end for
+#else
 #for $function in $functions[$category]
     glpf$function.name = (PFNGL$(function.name.upper())PROC)glfwGetProcAddress("gl$function.name");
+#end for
+#end if
+#end if
+#end for
+}
+
+// ------------------------------ Backend dispatch -------------------------
+
+static ExtGLBackend* extgl_backend = NULL;
+
+#for $category in $categories
+#if $functions.has_key($category) and len($functions[$category]) > 0
+#for $function in $functions[$category]
+static $(function.returntype) APIENTRY extgl_backend_$(function.name)($(', '.join(['%s %s' % (type,name) for name, type in $function.params])))
+{
+#if len($function.params) > 0
+    extGLarg args[] = { $(', '.join(['{&%s, sizeof(%s), %d}' % (name, name, 1 if type.endswith('*') else 0) for name, type in $function.params])) };
+#set $call = 'extgl_backend->call(EXTGL_FN_%s, args, %d)' % ($function.name, len($function.params))
+#else
+#set $call = 'extgl_backend->call(EXTGL_FN_%s, NULL, 0)' % $function.name
+#end if
+#if $function.returntype == 'void'
+    $call;
+#else
+    return ($(function.returntype))$call;
+#end if
+}
+
 #end for
 #end if
 #end for
+int init_opengl_backend(ExtGLBackend* backend)
+{
+    extgl_backend = backend;
+
+#for $category in $categories
+#if $functions.has_key($category) and len($functions[$category]) > 0
+#for $function in $functions[$category]
+    glpf$function.name = extgl_backend_$(function.name);
+#end for
+#end if
+#end for
+
+#for $extension,$required in $extensions.iteritems()
+#if not $required
+    EXTGL_$extension = GL_FALSE;
+#end if
+#end for
+
+    return GL_TRUE;
 }
 
+const char* const extGL_function_names[EXTGL_FUNCTION_COUNT] = {
+#for $category in $categories
+#if $functions.has_key($category)
+#for $function in $functions[$category]
+    "gl$function.name",
+#end for
+#end if
+#end for
+};
+
 // ----------------------- Extension flag definitions ---------------------- 
 #for $extension,$required in $extensions.iteritems()
 #if not $required
@@ -89,7 +152,7 @@ int EXTGL_$extension = GL_FALSE;
 // ----------------- Function pointer definitions ----------------
 
 #for $category in $categories
-#if $functions.has_key($category) and len($functions[$category]) > 0 and $category not in ['VERSION_1_0', 'VERSION_1_1','VERSION_1_0_DEPRECATED', 'VERSION_1_1_DEPRECATED' ]
+#if $functions.has_key($category) and len($functions[$category]) > 0
 #for $function in $functions[$category]
 PFNGL$(function.name.upper())PROC glpf$(function.name) = NULL;
 #end for
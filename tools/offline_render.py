@@ -0,0 +1,158 @@
+# Copyright (c) 2010 Heinrich Fink <hf (at) hfink (dot) eu>, 
+#                    Thomas Weber <weber (dot) t (at) gmx (dot) at>
+# 
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+# 
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+# 
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+# THE SOFTWARE.
+
+# Renders the offline render mode of the player with several processes.
+# The frames are split into one contiguous shard per process (see the
+# offline_render_mode_shard option of the player), their progress is merged
+# into a single line. Frames that have already been written are skipped by
+# the player, so an interrupted render is resumed by running the same 
+# command again.
+#
+# Additional arguments are passed on to every player process.
+#
+# Example:
+#   python offline_render.py -p ../build/bin/Release/player.exe -j 8 \
+#       --input=assets/default_scene.rtr --offline_render_mode_format=PNG
+
+import os
+import os.path
+import re
+import subprocess
+import sys
+import threading
+import time
+from optparse import OptionParser
+
+parser = OptionParser("usage: %prog [options] [--player_option=value ...]")
+parser.add_option("-p", "--player", dest="player",
+                  help="Path to the player executable. It is run in its own "
+                       "folder, next to its player_config.txt.")
+parser.add_option("-j", "--jobs", dest="jobs", type="int", default=4,
+                  help="Number of player processes.")
+parser.add_option("-f", "--first", dest="first", type="int", default=0,
+                  help="First frame to render.")
+parser.add_option("-l", "--last", dest="last", type="int", default=-1,
+                  help="Last frame to render, -1 renders up to the end.")
+parser.add_option("-w", "--window", dest="window", action="store_true",
+                  default=False,
+                  help="Render into the player windows instead of "
+                       "offscreen.")
+
+def is_player_arg(arg):
+    """Player options are given as --name=value, like long options here."""
+    own_options = ("--player", "--jobs", "--first", "--last")
+    return re.match(r"--\w+=", arg) and arg.split("=")[0] not in own_options
+
+(options, args) = parser.parse_args(
+    [arg for arg in sys.argv[1:] if not is_player_arg(arg)])
+player_args = [arg for arg in sys.argv[1:] if is_player_arg(arg)]
+
+if not options.player or options.jobs < 1:
+    parser.error("The player and at least one job are required.")
+
+player = os.path.abspath(options.player)
+
+range_pattern = re.compile(r"^Rendering (\d+) of (\d+) frames")
+frame_pattern = re.compile(r"^Frame @ [^:]+ : (\d+)/")
+skip_pattern = re.compile(r"^Skipping frame (\d+)")
+timing_pattern = re.compile(r"ms/frame")
+
+lock = threading.Lock()
+shard_frames = [0] * options.jobs
+rendered = [0] * options.jobs
+skipped = [0] * options.jobs
+
+def read_output(shard, process):
+    """Counts the progress of one player, other lines are passed on."""
+    for line in iter(process.stdout.readline, b""):
+        line = line.decode("utf-8", "replace").rstrip()
+
+        with lock:
+            match = range_pattern.match(line)
+            if match:
+                shard_frames[shard] = int(match.group(1))
+            elif frame_pattern.match(line):
+                rendered[shard] += 1
+            elif skip_pattern.match(line):
+                skipped[shard] += 1
+            elif line and not timing_pattern.search(line):
+                sys.stdout.write("\n[shard %d] %s\n" % (shard, line))
+
+processes = []
+readers = []
+
+for shard in range(options.jobs):
+    command = [player,
+               "--offline_render_mode=true",
+               "--offline_render_mode_first_frame=%d" % options.first,
+               "--offline_render_mode_last_frame=%d" % options.last,
+               "--offline_render_mode_shard=%d" % shard,
+               "--offline_render_mode_shard_count=%d" % options.jobs,
+               "--offline_render_mode_offscreen=" + 
+                   ("false" if options.window else "true"),
+               "--save_options=false"] + player_args
+
+    process = subprocess.Popen(command, cwd=os.path.dirname(player),
+                               stdout=subprocess.PIPE, 
+                               stderr=subprocess.STDOUT)
+
+    reader = threading.Thread(target=read_output, args=(shard, process))
+    reader.daemon = True
+    reader.start()
+
+    processes.append(process)
+    readers.append(reader)
+
+start = time.time()
+
+while any(process.poll() is None for process in processes):
+    time.sleep(1.0)
+
+    with lock:
+        total = sum(shard_frames)
+        done = sum(rendered) + sum(skipped)
+        elapsed = time.time() - start
+        rate = sum(rendered) / elapsed
+
+        remaining = ""
+        if rate > 0:
+            remaining = ", %d s remaining" % ((total - done) / rate)
+
+        sys.stdout.write("\r%d/%d frames (%d skipped), %.2f frames/s%s   " %
+                         (done, total, sum(skipped), rate, remaining))
+        sys.stdout.flush()
+
+for reader in readers:
+    reader.join()
+
+elapsed = time.time() - start
+print("\nRendered %d frames in %.1f s (%.2f frames/s), skipped %d." %
+      (sum(rendered), elapsed, sum(rendered) / max(elapsed, 1e-6), 
+       sum(skipped)))
+
+failed = [shard for (shard, process) in enumerate(processes) 
+          if process.returncode != 0 or 
+             rendered[shard] + skipped[shard] < shard_frames[shard]]
+
+if failed:
+    print("Shards %s did not finish, run again to resume." % 
+          ", ".join(str(shard) for shard in failed))
+    sys.exit(1)